@@ -0,0 +1,455 @@
+#include "animation.h"
+#include "gifcodec.h"
+#include "indexed.h"
+#include "profile.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#ifdef DITHER_WITH_PNG
+#include <zlib.h>
+#endif
+
+namespace Dithering {
+
+namespace {
+
+enum class AnimationFormat {
+    GIF,
+    APNG
+};
+
+bool formatFor(const std::string& path, AnimationFormat& format) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return false;
+    std::string ext = path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    if (ext == ".gif") {
+        format = AnimationFormat::GIF;
+        return true;
+    }
+#ifdef DITHER_WITH_PNG
+    if (ext == ".png" || ext == ".apng") {
+        format = AnimationFormat::APNG;
+        return true;
+    }
+#endif
+    return false;
+}
+
+// Smallest rectangle holding every pixel that differs; empty if none do
+cv::Rect changedRect(const cv::Mat& previous, const cv::Mat& current) {
+    int top = -1, bottom = -1, left = current.cols, right = -1;
+    for (int y = 0; y < current.rows; ++y) {
+        const uint8_t* a = previous.ptr<uint8_t>(y);
+        const uint8_t* b = current.ptr<uint8_t>(y);
+        if (std::memcmp(a, b, current.cols) == 0) continue;
+
+        int first = 0;
+        while (a[first] == b[first]) ++first;
+        int last = current.cols - 1;
+        while (a[last] == b[last]) --last;
+
+        if (top < 0) top = y;
+        bottom = y;
+        left = std::min(left, first);
+        right = std::max(right, last);
+    }
+    if (top < 0) return cv::Rect();
+    return cv::Rect(left, top, right - left + 1, bottom - top + 1);
+}
+
+// One output frame: the changed rectangle of a source frame, shown until
+// the next frame that changes anything
+struct Frame {
+    int first = 0;      // Source frame it starts at
+    int count = 1;      // Source frames it lasts
+    cv::Rect rect;
+    cv::Mat pixels;     // Indices inside rect
+    std::vector<uint8_t> data;
+    bool encoded = false;
+};
+
+#ifdef DITHER_WITH_PNG
+
+void appendUint32BE(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void appendUint16BE(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void writeChunk(std::ostream& out, const char* type, const uint8_t* data, size_t size) {
+    std::vector<uint8_t> header;
+    appendUint32BE(header, static_cast<uint32_t>(size));
+    header.insert(header.end(), type, type + 4);
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    if (size > 0) out.write(reinterpret_cast<const char*>(data), size);
+
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(type), 4);
+    if (size > 0) crc = crc32(crc, data, static_cast<uInt>(size));
+    std::vector<uint8_t> trailer;
+    appendUint32BE(trailer, static_cast<uint32_t>(crc));
+    out.write(reinterpret_cast<const char*>(trailer.data()), 4);
+}
+
+void writeChunk(std::ostream& out, const char* type, const std::vector<uint8_t>& data) {
+    writeChunk(out, type, data.data(), data.size());
+}
+
+#endif // DITHER_WITH_PNG
+
+} // namespace
+
+struct AnimationWriter::State {
+    AnimationFormat format = AnimationFormat::GIF;
+    std::ofstream file;
+    int width = 0;
+    int height = 0;
+    int depth = 8;
+    double fps = 30.0;
+    std::vector<cv::Vec3b> palette;
+
+    cv::Mat previous;
+    int framesAdded = 0;
+    int framesWritten = 0;
+    uint32_t sequence = 0;              // APNG fcTL/fdAT sequence number
+    std::streampos frameCountOffset;    // APNG acTL chunk, patched on finish
+    bool failed = false;
+    bool finished = false;
+
+    // Frames not yet written, in order; the last one's duration is open
+    // until the next change arrives
+    std::deque<std::shared_ptr<Frame>> pending;
+    std::deque<std::shared_ptr<Frame>> queue;
+    size_t maxPending = 1;
+    std::vector<std::thread> encoders;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool stopping = false;
+
+    ~State() { stopEncoders(); }
+
+    void startEncoders(int threads) {
+        for (int i = 0; i < threads; ++i) {
+            encoders.emplace_back([this] { encodeLoop(); });
+        }
+    }
+
+    void stopEncoders() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (auto& thread : encoders) thread.join();
+        encoders.clear();
+    }
+
+    void encodeLoop() {
+        setProfileThreadName("animation encoder");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            std::shared_ptr<Frame> frame = queue.front();
+            queue.pop_front();
+            lock.unlock();
+
+            encode(*frame);
+
+            lock.lock();
+            frame->encoded = true;
+            changed.notify_all();
+        }
+    }
+
+    void encode(Frame& frame) {
+        DITHER_PROFILE_PIXELS("animation compress", frame.pixels.total());
+        if (format == AnimationFormat::GIF) {
+            lzwEncode(frame.pixels.ptr<uint8_t>(), frame.pixels.total(), std::max(2, depth), frame.data);
+            return;
+        }
+#ifdef DITHER_WITH_PNG
+        // Unfiltered scanlines packed to the palette's bit depth; the
+        // indices of dithered images gain little from PNG filters
+        const int cols = frame.pixels.cols;
+        const size_t rowBytes = (static_cast<size_t>(cols) * depth + 7) / 8;
+        std::vector<uint8_t> raw((rowBytes + 1) * frame.pixels.rows, 0);
+        const int perByte = 8 / depth;
+        for (int y = 0; y < frame.pixels.rows; ++y) {
+            const uint8_t* src = frame.pixels.ptr<uint8_t>(y);
+            uint8_t* dst = raw.data() + y * (rowBytes + 1) + 1;
+            if (depth == 8) {
+                std::memcpy(dst, src, cols);
+                continue;
+            }
+            for (int x = 0; x < cols; ++x) {
+                dst[x / perByte] |= static_cast<uint8_t>(src[x] << (8 - depth * (x % perByte + 1)));
+            }
+        }
+
+        uLongf size = compressBound(static_cast<uLong>(raw.size()));
+        frame.data.resize(size);
+        if (compress2(frame.data.data(), &size, raw.data(), static_cast<uLong>(raw.size()),
+                      Z_DEFAULT_COMPRESSION) != Z_OK) {
+            size = 0;
+        }
+        frame.data.resize(size);
+#endif
+    }
+
+    // Duration of a frame in 1/units seconds, rounded so that errors do not
+    // accumulate over the animation
+    long duration(const Frame& frame, double units) const {
+        return std::lround((frame.first + frame.count) * units / fps) - std::lround(frame.first * units / fps);
+    }
+
+    bool writeHeader() {
+        const int tableEntries = 1 << depth;
+        if (format == AnimationFormat::GIF) {
+            file.write("GIF89a", 6);
+            writeUint16LE(file, width);
+            writeUint16LE(file, height);
+            file.put(static_cast<char>(0x80 | ((depth - 1) << 4) | (depth - 1)));
+            file.put(0);
+            file.put(0);
+            for (int i = 0; i < tableEntries; ++i) {
+                cv::Vec3b color = i < static_cast<int>(palette.size()) ? palette[i] : cv::Vec3b(0, 0, 0);
+                file.put(static_cast<char>(color[2]));
+                file.put(static_cast<char>(color[1]));
+                file.put(static_cast<char>(color[0]));
+            }
+
+            // NETSCAPE2.0 extension: loop forever
+            const unsigned char loop[19] = {0x21, 0xff, 0x0b, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E',
+                                            '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00};
+            file.write(reinterpret_cast<const char*>(loop), sizeof(loop));
+            return static_cast<bool>(file);
+        }
+#ifdef DITHER_WITH_PNG
+        const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        file.write(reinterpret_cast<const char*>(signature), 8);
+
+        std::vector<uint8_t> header;
+        appendUint32BE(header, width);
+        appendUint32BE(header, height);
+        header.push_back(static_cast<uint8_t>(depth));
+        header.push_back(3);    // Palette color
+        header.push_back(0);    // Deflate
+        header.push_back(0);    // Adaptive filtering
+        header.push_back(0);    // Not interlaced
+        writeChunk(file, "IHDR", header);
+
+        frameCountOffset = file.tellp();
+        writeAnimationControl(0);
+
+        std::vector<uint8_t> colors;
+        for (const cv::Vec3b& color : palette) {
+            colors.push_back(color[2]);
+            colors.push_back(color[1]);
+            colors.push_back(color[0]);
+        }
+        writeChunk(file, "PLTE", colors);
+#endif
+        return static_cast<bool>(file);
+    }
+
+#ifdef DITHER_WITH_PNG
+    void writeAnimationControl(uint32_t frames) {
+        std::vector<uint8_t> control;
+        appendUint32BE(control, frames);
+        appendUint32BE(control, 0);     // Loop forever
+        writeChunk(file, "acTL", control);
+    }
+#endif
+
+    void writeFrame(const Frame& frame) {
+        if (format == AnimationFormat::GIF) {
+            // Graphic control: keep the previous frame underneath
+            long delay = std::min(duration(frame, 100.0), 65535L);
+            file.put(0x21);
+            file.put(static_cast<char>(0xf9));
+            file.put(0x04);
+            file.put(0x04);
+            writeUint16LE(file, static_cast<uint32_t>(delay));
+            file.put(0);
+            file.put(0);
+
+            file.put(0x2c);
+            writeUint16LE(file, frame.rect.x);
+            writeUint16LE(file, frame.rect.y);
+            writeUint16LE(file, frame.rect.width);
+            writeUint16LE(file, frame.rect.height);
+            file.put(0);
+            file.put(static_cast<char>(std::max(2, depth)));
+            writeGifSubBlocks(file, frame.data);
+        }
+#ifdef DITHER_WITH_PNG
+        else {
+            // Milliseconds, or hundredths for frames longer than 65 s
+            long delay = duration(frame, 1000.0);
+            uint32_t denominator = 1000;
+            if (delay > 65535) {
+                delay = std::min(duration(frame, 100.0), 65535L);
+                denominator = 100;
+            }
+
+            std::vector<uint8_t> control;
+            appendUint32BE(control, sequence++);
+            appendUint32BE(control, frame.rect.width);
+            appendUint32BE(control, frame.rect.height);
+            appendUint32BE(control, frame.rect.x);
+            appendUint32BE(control, frame.rect.y);
+            appendUint16BE(control, static_cast<uint32_t>(delay));
+            appendUint16BE(control, denominator);
+            control.push_back(0);   // APNG_DISPOSE_OP_NONE
+            control.push_back(0);   // APNG_BLEND_OP_SOURCE
+            writeChunk(file, "fcTL", control);
+
+            // The first frame doubles as the still image for plain PNG readers
+            if (framesWritten == 0) {
+                writeChunk(file, "IDAT", frame.data);
+            } else {
+                std::vector<uint8_t> data;
+                data.reserve(frame.data.size() + 4);
+                appendUint32BE(data, sequence++);
+                data.insert(data.end(), frame.data.begin(), frame.data.end());
+                writeChunk(file, "fdAT", data);
+            }
+        }
+#endif
+        if (frame.data.empty()) failed = true;
+        ++framesWritten;
+    }
+
+    // Write finished frames from the front; the open last frame only when
+    // flushing everything
+    void writeReady(std::unique_lock<std::mutex>& lock, bool all) {
+        while (!pending.empty() && pending.front()->encoded && (all || pending.size() > 1)) {
+            std::shared_ptr<Frame> frame = pending.front();
+            pending.pop_front();
+            lock.unlock();
+            writeFrame(*frame);
+            lock.lock();
+        }
+    }
+};
+
+AnimationWriter::AnimationWriter() = default;
+
+AnimationWriter::~AnimationWriter() {
+    if (state && !state->finished) finish();
+}
+
+bool AnimationWriter::supports(const std::string& path) {
+    AnimationFormat format;
+    return formatFor(path, format);
+}
+
+bool AnimationWriter::open(const std::string& path, int width, int height, const std::vector<cv::Vec3b>& palette,
+                           double fps, int threads) {
+    if (state && !state->finished) finish();
+
+    auto next = std::make_unique<State>();
+    if (!formatFor(path, next->format)) return false;
+    if (width <= 0 || height <= 0 || palette.empty() || palette.size() > 256) return false;
+    if (next->format == AnimationFormat::GIF && (width > 65535 || height > 65535)) return false;
+
+    next->file.open(path, std::ios::binary);
+    if (!next->file) return false;
+
+    next->width = width;
+    next->height = height;
+    next->depth = paletteBitDepth(palette.size());
+    next->fps = fps > 0.0 ? fps : 30.0;
+    next->palette = palette;
+    if (!next->writeHeader()) return false;
+
+    if (threads <= 0) threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    next->maxPending = static_cast<size_t>(threads) * 2;
+    next->startEncoders(threads);
+    state = std::move(next);
+    return true;
+}
+
+bool AnimationWriter::addFrame(const cv::Mat& indices) {
+    if (!state || state->finished) return false;
+    State& s = *state;
+    if (indices.type() != CV_8U || indices.cols != s.width || indices.rows != s.height) return false;
+
+    cv::Rect rect;
+    {
+        DITHER_PROFILE_PIXELS("animation diff", indices.total());
+        rect = s.framesAdded == 0 ? cv::Rect(0, 0, s.width, s.height) : changedRect(s.previous, indices);
+        indices.copyTo(s.previous);
+    }
+
+    std::unique_lock<std::mutex> lock(s.mutex);
+    if (rect.empty()) {
+        ++s.pending.back()->count;
+    } else {
+        auto frame = std::make_shared<Frame>();
+        frame->first = s.framesAdded;
+        frame->rect = rect;
+        frame->pixels = indices(rect).clone();
+        s.pending.push_back(frame);
+        s.queue.push_back(frame);
+        s.changed.notify_all();
+    }
+    ++s.framesAdded;
+
+    // Keep a bounded number of frames in flight
+    while (true) {
+        s.writeReady(lock, false);
+        if (s.pending.size() <= s.maxPending) break;
+        s.changed.wait(lock);
+    }
+    return !s.failed && static_cast<bool>(s.file);
+}
+
+bool AnimationWriter::finish() {
+    if (!state || state->finished) return false;
+    State& s = *state;
+
+    {
+        std::unique_lock<std::mutex> lock(s.mutex);
+        while (!s.pending.empty()) {
+            s.writeReady(lock, true);
+            if (!s.pending.empty()) s.changed.wait(lock);
+        }
+    }
+    s.stopEncoders();
+    s.finished = true;
+
+    if (s.format == AnimationFormat::GIF) {
+        s.file.put(0x3b);
+    }
+#ifdef DITHER_WITH_PNG
+    else {
+        writeChunk(s.file, "IEND", nullptr, 0);
+        std::streampos end = s.file.tellp();
+        s.file.seekp(s.frameCountOffset);
+        s.writeAnimationControl(static_cast<uint32_t>(s.framesWritten));
+        s.file.seekp(end);
+    }
+#endif
+    s.file.close();
+    return !s.failed && s.framesWritten > 0 && !s.file.fail();
+}
+
+} // namespace Dithering
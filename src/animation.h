@@ -0,0 +1,43 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Dithering {
+
+// Animated GIF or APNG writer for indexed frames sharing one palette.
+// Each frame is cropped to the rectangle that changed since the previous
+// one and drawn over it; identical frames only lengthen the previous
+// frame's duration. Crops are compressed (LZW for GIF, deflate for APNG)
+// on worker threads while later frames arrive, and written in order.
+class AnimationWriter {
+public:
+    AnimationWriter();
+    ~AnimationWriter();  // Finishes the file if finish() was not called
+
+    AnimationWriter(const AnimationWriter&) = delete;
+    AnimationWriter& operator=(const AnimationWriter&) = delete;
+
+    // The format follows the extension: .gif, or .png/.apng (needs libpng's
+    // zlib). palette holds at most 256 BGR entries. threads <= 0 uses all
+    // cores. The animation loops forever.
+    bool open(const std::string& path, int width, int height, const std::vector<cv::Vec3b>& palette,
+              double fps, int threads = 0);
+
+    // Append a width x height CV_8U frame of palette indices
+    bool addFrame(const cv::Mat& indices);
+
+    // Write the remaining frames and close the file
+    bool finish();
+
+    // Whether path names a format open() can write
+    static bool supports(const std::string& path);
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+} // namespace Dithering
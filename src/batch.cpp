@@ -0,0 +1,309 @@
+#include "batch.h"
+#include "profile.h"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+namespace Dithering {
+
+namespace {
+
+thread_local TaskPool* currentPool = nullptr;
+thread_local int currentWorker = -1;
+
+// Whether an image can put more than one core to use: pointwise algorithms
+// split into tiles on the CPU and the threaded kernels take params.threads.
+// The rest, serpentine diffusion included, walk the image serially.
+bool splitsAcrossCores(const Parameters& params) {
+    if (isPointwise(params.algorithm)) return params.backend == Backend::CPU;
+    Parameters threaded = params;
+    threaded.threads = 2;
+    return effectiveThreadCount(threaded, 2) > 1;
+}
+
+} // namespace
+
+TaskPool::TaskPool(int threads) {
+    if (threads <= 0) threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int i = 0; i < threads; ++i) workers.push_back(std::make_unique<Worker>());
+    for (int i = 0; i < threads; ++i) {
+        workers[i]->thread = std::thread([this, i] { loop(i); });
+    }
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker->thread.join();
+}
+
+TaskPool& TaskPool::shared() {
+    // Never destroyed, so tasks still running at exit keep a valid pool
+    static TaskPool* pool = new TaskPool();
+    return *pool;
+}
+
+void TaskPool::submit(Task task) {
+    const int count = threadCount();
+    int target = currentPool == this ? currentWorker : static_cast<int>(nextWorker++ % count);
+    {
+        std::lock_guard<std::mutex> lock(workers[target]->mutex);
+        workers[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        ++queued;
+    }
+    wake.notify_one();
+}
+
+bool TaskPool::runPending() {
+    if (currentPool != this) return false;
+    Task task;
+    if (!take(currentWorker, task)) return false;
+    task();
+    return true;
+}
+
+// Newest task of our own deque, else the oldest of the next busy worker
+bool TaskPool::take(int index, Task& task) {
+    const int count = threadCount();
+    for (int i = 0; i < count; ++i) {
+        Worker& worker = *workers[(index + i) % count];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) continue;
+        if (i == 0) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        } else {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+        --queued;
+        return true;
+    }
+    return false;
+}
+
+void TaskPool::loop(int index) {
+    currentPool = this;
+    currentWorker = index;
+    setProfileThreadName("task worker");
+
+    while (true) {
+        Task task;
+        if (take(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&] { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() <= 0) return;
+    }
+}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+    }
+}
+
+void TaskGroup::run(TaskPool::Task task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++pending;
+    }
+    pool.submit([this, task = std::move(task)] {
+        std::exception_ptr failure;
+        try {
+            task();
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failure && !error) error = failure;
+        if (--pending == 0) done.notify_all();
+    });
+}
+
+void TaskGroup::wait() {
+    const bool worker = currentPool == &pool;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (pending == 0) break;
+            if (!worker) {
+                done.wait(lock, [&] { return pending == 0; });
+                break;
+            }
+        }
+        // A worker keeps running tasks; with none left to take it naps
+        // briefly, since the tasks it waits for may be running elsewhere
+        if (pool.runPending()) continue;
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait_for(lock, std::chrono::milliseconds(1), [&] { return pending == 0; });
+    }
+
+    std::exception_ptr failure;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(failure, error);
+    }
+    if (failure) std::rethrow_exception(failure);
+}
+
+WorkspaceCache::Lease WorkspaceCache::acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spare.empty()) return Lease(*this, std::make_unique<Workspace>());
+    std::unique_ptr<Workspace> workspace = std::move(spare.back());
+    spare.pop_back();
+    return Lease(*this, std::move(workspace));
+}
+
+void WorkspaceCache::release(std::unique_ptr<Workspace> workspace) {
+    std::lock_guard<std::mutex> lock(mutex);
+    spare.push_back(std::move(workspace));
+}
+
+BatchRunner::BatchRunner(const BatchOptions& options, TaskPool& pool) : options(options), pool(pool) {}
+
+int BatchRunner::coresFor(int64_t pixels, const Parameters& params) const {
+    const int cores = options.threads > 0 ? options.threads : pool.threadCount();
+    if (!splitsAcrossCores(params)) return 1;
+    const int64_t perCore = std::max<int64_t>(1, options.pixelsPerCore);
+    return static_cast<int>(std::clamp<int64_t>((pixels + perCore - 1) / perCore, 1, cores));
+}
+
+// The decoded image, a converted or preprocessed copy and the output
+size_t BatchRunner::bytesFor(int64_t pixels) {
+    return static_cast<size_t>(std::max<int64_t>(pixels, 0)) * 9;
+}
+
+int BatchRunner::run(const std::vector<BatchItem>& items, const Parameters& params,
+                     const std::function<void(int done, int total)>& progress) {
+    const int total = static_cast<int>(items.size());
+    const int cores = options.threads > 0 ? options.threads : pool.threadCount();
+    cancelled = false;
+
+    // Largest first, so the big scans are not left running alone at the end
+    std::vector<int64_t> pixels(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        pixels[i] = items[i].size.empty() ? options.pixelsPerCore : items[i].size.area();
+    }
+    std::vector<size_t> order(items.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return pixels[a] > pixels[b]; });
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    int coresFree = cores;
+    size_t bytesInFlight = 0;
+    int running = 0;
+    int finished = 0;
+    int failed = 0;
+    int reported = -1;
+
+    // Called with the lock held; reports without it
+    auto report = [&](std::unique_lock<std::mutex>& lock) {
+        if (!progress || finished == reported) return;
+        reported = finished;
+        int done = finished;
+        lock.unlock();
+        progress(done, total);
+        lock.lock();
+    };
+
+    TaskGroup group(pool);
+    int started = 0;
+    for (size_t index : order) {
+        const int itemCores = coresFor(pixels[index], params);
+        const size_t itemBytes = bytesFor(pixels[index]);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!cancelled.load() && !(coresFree >= itemCores &&
+                                          (running == 0 || bytesInFlight + itemBytes <= options.memoryBudget))) {
+                report(lock);
+                changed.wait_for(lock, std::chrono::milliseconds(100));  // Also notices cancel()
+            }
+            if (cancelled.load()) break;
+            coresFree -= itemCores;
+            bytesInFlight += itemBytes;
+            ++running;
+        }
+        ++started;
+
+        group.run([&, index, itemCores, itemBytes] {
+            bool ok = false;
+            try {
+                ok = process(items[index], params, itemCores);
+            } catch (...) {
+                ok = false;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            coresFree += itemCores;
+            bytesInFlight -= itemBytes;
+            --running;
+            ++finished;
+            if (!ok) ++failed;
+            changed.notify_all();
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running > 0) {
+            report(lock);
+            changed.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        report(lock);
+    }
+    group.wait();
+    return failed + (total - started);
+}
+
+bool BatchRunner::process(const BatchItem& item, const Parameters& params, int cores) {
+    DITHER_PROFILE_SCOPE("batch item");
+    cv::Mat image;
+    if (!item.load || !item.load(image) || image.empty()) return false;
+
+    // In place when the decoded image is already BGR
+    cv::Mat separate;
+    cv::Mat& output = image.type() == CV_8UC3 ? image : separate;
+    Parameters local = params;
+
+    if (cores > 1 && isPointwise(params.algorithm) && params.backend == Backend::CPU) {
+        // Bands of rows as stealable tasks, for the workers this image holds
+        output.create(image.rows, image.cols, CV_8UC3);
+        local.threads = 1;
+        const int rows = std::max(1, options.tileRows);
+        TaskGroup tiles(pool);
+        for (int y = 0; y < image.rows; y += rows) {
+            cv::Rect band(0, y, image.cols, std::min(rows, image.rows - y));
+            tiles.run([&, band] {
+                WorkspaceCache::Lease workspace = workspaces.acquire();
+                ditherRegion(image, output, band, local, *workspace);
+            });
+        }
+        tiles.wait();
+    } else if (cores > 1) {
+        // The kernel's own threads. Wavefront workers wait on each other's
+        // rows, so they cannot be pool tasks; they live in the leased
+        // workspace's WorkerPool and are reused by later images instead of
+        // being started for each one.
+        local.threads = cores;
+        WorkspaceCache::Lease workspace = workspaces.acquire();
+        ditherImage(image, output, local, *workspace);
+    } else {
+        local.threads = 1;
+        WorkspaceCache::Lease workspace = workspaces.acquire();
+        ditherImage(image, output, local, *workspace);
+    }
+
+    return item.save && item.save(output);
+}
+
+} // namespace Dithering
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "dithering.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Dithering {
+
+// Work-stealing thread pool shared by frame-, image- and tile-level tasks.
+// Each worker keeps its own deque: tasks submitted from a worker go to the
+// back of its deque and it runs its newest task first, while idle workers
+// steal the oldest task of another worker. Tasks submitted from outside are
+// dealt round-robin. Tasks must not block on each other except through
+// TaskGroup::wait, which keeps running tasks while it waits.
+class TaskPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit TaskPool(int threads = 0);    // <= 0 uses all cores
+    ~TaskPool();                           // Runs what is queued, then joins
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    void submit(Task task);
+    int threadCount() const { return static_cast<int>(workers.size()); }
+
+    // Run one queued task on the calling worker thread of this pool;
+    // false if nothing could be taken (or the caller is not a worker)
+    bool runPending();
+
+    // Process-wide pool with a thread per core, created on first use
+    static TaskPool& shared();
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    void loop(int index);
+    bool take(int index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<int> queued{0};
+    std::atomic<unsigned> nextWorker{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+// Tasks that are waited on together. wait() called on a pool worker runs
+// queued tasks (its own group's or others') until the group is done, so
+// tasks can split themselves into subtasks without tying up a thread;
+// called from any other thread it just blocks.
+class TaskGroup {
+public:
+    explicit TaskGroup(TaskPool& pool = TaskPool::shared()) : pool(pool) {}
+    ~TaskGroup();   // Waits, dropping any exception
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(TaskPool::Task task);
+
+    // Rethrows the first exception a task threw
+    void wait();
+
+private:
+    TaskPool& pool;
+    int pending = 0;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+// Workspaces lent to concurrent tasks and returned for reuse, so each task
+// gets scratch of its own and steady-state batches do not allocate it again
+class WorkspaceCache {
+public:
+    class Lease {
+    public:
+        Lease(WorkspaceCache& cache, std::unique_ptr<Workspace> workspace)
+            : cache(&cache), workspace(std::move(workspace)) {}
+        Lease(Lease&& other) noexcept = default;
+        ~Lease() { if (workspace) cache->release(std::move(workspace)); }
+
+        Workspace& operator*() const { return *workspace; }
+
+    private:
+        WorkspaceCache* cache;
+        std::unique_ptr<Workspace> workspace;
+    };
+
+    Lease acquire();
+
+private:
+    void release(std::unique_ptr<Workspace> workspace);
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Workspace>> spare;
+};
+
+// One image of a batch. load fills image (any type ditherImage takes) and
+// save receives the dithered CV_8UC3 result; either returning false counts
+// the item as failed. Both run on pool threads, several at once.
+struct BatchItem {
+    std::function<bool(cv::Mat& image)> load;
+    std::function<bool(const cv::Mat& image)> save;
+    cv::Size size;      // Expected size for the memory budget; empty if unknown
+};
+
+struct BatchOptions {
+    int threads = 0;                        // Cores to keep busy; <= 0 uses the pool's threads
+    size_t memoryBudget = size_t(1) << 30;  // Bytes of image buffers in flight
+    int64_t pixelsPerCore = 1 << 20;        // Images get a core per this many pixels
+    int tileRows = 256;                     // Rows per tile task of pointwise algorithms
+};
+
+// Dithers a batch of images on a TaskPool, balancing parallelism across
+// images against parallelism inside them. Each image is given a share of
+// the cores in proportion to its size: thumbnails run one per core, while a
+// large scan gets several, used by the kernel's own threads or, for
+// pointwise algorithms, as tile tasks stolen by the otherwise idle workers.
+// Configurations that run serially (serpentine scans, dot diffusion) hold
+// one core whatever their size.
+// Images start largest first, once their cores are free and their buffers
+// fit in the memory budget (an image larger than the whole budget runs on
+// its own). Items of unknown size are charged as one core's worth of pixels.
+class BatchRunner {
+public:
+    explicit BatchRunner(const BatchOptions& options = {}, TaskPool& pool = TaskPool::shared());
+
+    // Dither every item, blocking the calling thread, which should not be a
+    // worker of the pool. progress, if set, is called on the calling thread
+    // with the number of items finished. Returns how many failed or, after
+    // cancel(), never started.
+    int run(const std::vector<BatchItem>& items, const Parameters& params,
+            const std::function<void(int done, int total)>& progress = nullptr);
+
+    // Stop starting new items; the ones running finish
+    void cancel() { cancelled = true; }
+
+    // Cores and bytes an image of this size is scheduled with
+    int coresFor(int64_t pixels, const Parameters& params) const;
+    static size_t bytesFor(int64_t pixels);
+
+private:
+    bool process(const BatchItem& item, const Parameters& params, int cores);
+
+    BatchOptions options;
+    TaskPool& pool;
+    WorkspaceCache workspaces;
+    std::atomic<bool> cancelled{false};
+};
+
+} // namespace Dithering
@@ -0,0 +1,436 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <opencv2/opencv.hpp>
+#include "dithering.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Benchmark sweep over every algorithm, palette and image size.
+// Results are written as JSON so runs can be diffed between releases.
+
+namespace {
+
+const Dithering::Algorithm allAlgorithms[] = {
+    Dithering::Algorithm::FLOYD_STEINBERG,
+    Dithering::Algorithm::ATKINSON,
+    Dithering::Algorithm::JARVIS_JUDICE_NINKE,
+    Dithering::Algorithm::STUCKI,
+    Dithering::Algorithm::BURKES,
+    Dithering::Algorithm::SIERRA,
+    Dithering::Algorithm::SIERRA_TWO_ROW,
+    Dithering::Algorithm::SIERRA_LITE,
+    Dithering::Algorithm::ORDERED_BAYER_2X2,
+    Dithering::Algorithm::ORDERED_BAYER_4X4,
+    Dithering::Algorithm::ORDERED_BAYER_8X8,
+    Dithering::Algorithm::ORDERED_BAYER_16X16,
+    Dithering::Algorithm::BLUE_NOISE,
+    Dithering::Algorithm::WHITE_NOISE,
+    Dithering::Algorithm::RANDOM_DITHER,
+    Dithering::Algorithm::PATTERN_DITHER,
+    Dithering::Algorithm::DOT_DIFFUSION,
+    Dithering::Algorithm::RIEMERSMA,
+    Dithering::Algorithm::GRADIENT_BASED,
+    Dithering::Algorithm::VARIABLE_ERROR_DIFFUSION,
+    Dithering::Algorithm::OSTROMOUKHOV,
+    Dithering::Algorithm::FAN,
+    Dithering::Algorithm::SHIAU_FAN,
+    Dithering::Algorithm::STEVENPIGEON
+};
+
+// CUSTOM is left out: it needs a user palette
+const Dithering::PaletteMode allPalettes[] = {
+    Dithering::PaletteMode::MONOCHROME,
+    Dithering::PaletteMode::GRAYSCALE_4,
+    Dithering::PaletteMode::GRAYSCALE_8,
+    Dithering::PaletteMode::GRAYSCALE_16,
+    Dithering::PaletteMode::CGA,
+    Dithering::PaletteMode::EGA,
+    Dithering::PaletteMode::VGA,
+    Dithering::PaletteMode::GAMEBOY,
+    Dithering::PaletteMode::PICO8
+};
+
+struct BenchSize {
+    std::string name;
+    int width;
+    int height;
+};
+
+struct BenchOptions {
+    std::vector<BenchSize> sizes = {
+        {"512", 512, 512},
+        {"4k", 3840, 2160},
+        {"24mp", 6000, 4000}
+    };
+    int warmup = 1;
+    int repetitions = 5;
+    int threads = 1;
+    Dithering::Backend backend = Dithering::Backend::CPU;
+    bool reuse = false;             // Dither into a reused output and workspace
+    bool fixedPoint = false;        // Fixed-point error diffusion
+    bool verify = false;            // Check fixed point against the float path
+    std::string algorithmFilter;
+    std::string paletteFilter;
+    std::string outputFile;
+};
+
+// Peak resident set size of the process in bytes
+long long peakRss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return static_cast<long long>(counters.PeakWorkingSetSize);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<long long>(usage.ru_maxrss);
+#else
+    return static_cast<long long>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Deterministic photo-like content: smooth colour gradients, a few hard
+// edges and fine noise, so neither flat nor purely random input dominates
+cv::Mat makeTestImage(int width, int height) {
+    cv::Mat image(height, width, CV_8UC3);
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> noise(-8, 8);
+    for (int y = 0; y < height; ++y) {
+        cv::Vec3b* row = image.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < width; ++x) {
+            float u = static_cast<float>(x) / width;
+            float v = static_cast<float>(y) / height;
+            float edge = ((x / 64 + y / 64) % 2) ? 24.0f : -24.0f;
+            for (int c = 0; c < 3; ++c) {
+                float base = 255.0f * (c == 0 ? u : c == 1 ? v : 1.0f - 0.5f * (u + v));
+                row[x][c] = cv::saturate_cast<uchar>(base + edge + noise(rng));
+            }
+        }
+    }
+    return image;
+}
+
+// Mean absolute difference between block averages of a dithered image and
+// another image, in levels: against the source, how far the output strays
+// from the input tone once the dither pattern is averaged out
+double toneError(const cv::Mat& dithered, const cv::Mat& source, int block = 8) {
+    double total = 0.0;
+    long long blocks = 0;
+    for (int by = 0; by + block <= source.rows; by += block) {
+        for (int bx = 0; bx + block <= source.cols; bx += block) {
+            int sums[2][3] = {};
+            for (int y = by; y < by + block; ++y) {
+                const cv::Vec3b* a = dithered.ptr<cv::Vec3b>(y);
+                const cv::Vec3b* b = source.ptr<cv::Vec3b>(y);
+                for (int x = bx; x < bx + block; ++x) {
+                    for (int c = 0; c < 3; ++c) {
+                        sums[0][c] += a[x][c];
+                        sums[1][c] += b[x][c];
+                    }
+                }
+            }
+            for (int c = 0; c < 3; ++c) total += std::abs(sums[0][c] - sums[1][c]) / double(block * block);
+            blocks += 3;
+        }
+    }
+    return blocks > 0 ? total / blocks : 0.0;
+}
+
+// Largest mean difference, in levels, allowed between 16x16 block averages
+// of the fixed-point and float results. Both dither the same tone, so their
+// patterns differ pixel by pixel but not once averaged: monochrome
+// Floyd-Steinberg sits near 1 level, a broken int16 path far above.
+constexpr double maxFixedPointDifference = 4.0;
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    double rank = p * (values.size() - 1);
+    size_t low = static_cast<size_t>(rank);
+    size_t high = std::min(low + 1, values.size() - 1);
+    return values[low] + (values[high] - values[low]) * (rank - low);
+}
+
+std::string toLower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+    return text;
+}
+
+bool matchesFilter(const std::string& name, const std::string& filter) {
+    return filter.empty() || toLower(name).find(toLower(filter)) != std::string::npos;
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string out;
+    for (char ch : text) {
+        if (ch == '"' || ch == '\\') out += '\\';
+        out += ch;
+    }
+    return out;
+}
+
+bool parseSizes(const std::string& list, std::vector<BenchSize>& sizes) {
+    sizes.clear();
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        std::string key = toLower(item);
+        int width = 0, height = 0;
+        if (key == "4k") {
+            width = 3840; height = 2160;
+        } else if (key == "24mp") {
+            width = 6000; height = 4000;
+        } else if (std::sscanf(key.c_str(), "%dx%d", &width, &height) != 2) {
+            if (std::sscanf(key.c_str(), "%d", &width) != 1) return false;
+            height = width;
+        }
+        if (width <= 0 || height <= 0) return false;
+        sizes.push_back({item, width, height});
+    }
+    return !sizes.empty();
+}
+
+void printUsage(const char* program) {
+    std::cout << "Dither's Boyfriend - Benchmark\n";
+    std::cout << "Usage: " << program << " [options]\n\n";
+    std::cout << "Options:\n";
+    std::cout << "  --sizes <list>        Comma-separated sizes: N, WxH, 4k, 24mp (default: 512,4k,24mp)\n";
+    std::cout << "  --warmup <int>        Untimed runs per case (default: 1)\n";
+    std::cout << "  --reps <int>          Timed runs per case (default: 5)\n";
+    std::cout << "  -t, --threads <int>   Error diffusion threads (0 = all cores, default: 1)\n";
+    std::cout << "  --backend <name>      Compute backend: cpu or opencl (default: cpu)\n";
+    std::cout << "  --reuse               Reuse the output buffer and workspace between runs\n";
+    std::cout << "  --fixed-point         Time fixed-point error diffusion\n";
+    std::cout << "  --verify              Compare fixed-point diffusion with the float path, for the\n";
+    std::cout << "                        cases that use it; fails if their block averages differ\n";
+    std::cout << "  -a, --algorithm <s>   Only algorithms whose name contains <s>\n";
+    std::cout << "  -p, --palette <s>     Only palettes whose name contains <s>\n";
+    std::cout << "  -o, --output <file>   Write JSON to a file instead of stdout\n";
+    std::cout << "  -h, --help            Show this help message\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else if (arg == "--sizes" && hasValue) {
+            if (!parseSizes(argv[++i], options.sizes)) {
+                std::cerr << "Error: Invalid size list\n";
+                return 1;
+            }
+        }
+        else if (arg == "--warmup" && hasValue) {
+            options.warmup = std::max(0, std::stoi(argv[++i]));
+        }
+        else if (arg == "--reps" && hasValue) {
+            options.repetitions = std::max(1, std::stoi(argv[++i]));
+        }
+        else if ((arg == "-t" || arg == "--threads") && hasValue) {
+            options.threads = std::stoi(argv[++i]);
+        }
+        else if (arg == "--backend" && hasValue) {
+            std::string backend = argv[++i];
+            if (backend == "opencl") {
+                options.backend = Dithering::Backend::OPENCL;
+            } else if (backend != "cpu") {
+                std::cerr << "Error: Unknown backend: " << backend << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--reuse") {
+            options.reuse = true;
+        }
+        else if (arg == "--fixed-point") {
+            options.fixedPoint = true;
+        }
+        else if (arg == "--verify") {
+            options.verify = true;
+        }
+        else if ((arg == "-a" || arg == "--algorithm") && hasValue) {
+            options.algorithmFilter = argv[++i];
+        }
+        else if ((arg == "-p" || arg == "--palette") && hasValue) {
+            options.paletteFilter = argv[++i];
+        }
+        else if ((arg == "-o" || arg == "--output") && hasValue) {
+            options.outputFile = argv[++i];
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\n";
+    json << "  \"warmup\": " << options.warmup << ",\n";
+    json << "  \"repetitions\": " << options.repetitions << ",\n";
+    json << "  \"threads\": " << options.threads << ",\n";
+    json << "  \"backend\": \"" << Dithering::getBackendName(options.backend) << "\",\n";
+    json << "  \"reuse\": " << (options.reuse ? "true" : "false") << ",\n";
+    json << "  \"precision\": \"" << (options.fixedPoint ? "fixed" : "float") << "\",\n";
+    json << "  \"results\": [";
+
+    bool first = true;
+    int verifyFailures = 0;
+    int verifiedCases = 0;
+    for (const BenchSize& size : options.sizes) {
+        cv::Mat image = makeTestImage(size.width, size.height);
+        double megapixels = static_cast<double>(size.width) * size.height / 1e6;
+
+        for (Dithering::Algorithm algorithm : allAlgorithms) {
+            std::string algorithmName = Dithering::getAlgorithmName(algorithm);
+            if (!matchesFilter(algorithmName, options.algorithmFilter)) continue;
+
+            for (Dithering::PaletteMode palette : allPalettes) {
+                std::string paletteName = Dithering::getPaletteModeName(palette);
+                if (!matchesFilter(paletteName, options.paletteFilter)) continue;
+
+                Dithering::Parameters params;
+                params.algorithm = algorithm;
+                params.paletteMode = palette;
+                params.threads = options.threads;
+                params.backend = options.backend;
+                if (options.fixedPoint) params.precision = Dithering::DiffusionPrecision::FIXED;
+
+                std::cerr << size.name << " " << algorithmName << " / " << paletteName << "..." << std::flush;
+
+                Dithering::Workspace workspace;
+                cv::Mat reused;
+                auto run = [&] {
+                    if (options.reuse) {
+                        Dithering::ditherImage(image, reused, params, workspace);
+                    } else {
+                        cv::Mat output = Dithering::ditherImage(image, params);
+                    }
+                };
+
+                for (int w = 0; w < options.warmup; ++w) run();
+
+                std::vector<double> timings;
+                for (int r = 0; r < options.repetitions; ++r) {
+                    auto start = std::chrono::high_resolution_clock::now();
+                    run();
+                    auto end = std::chrono::high_resolution_clock::now();
+                    timings.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+                }
+
+                // Record where the case actually ran, since unsupported ones fall back
+                Dithering::Backend backend = Dithering::Backend::CPU;
+                if (Dithering::isBackendAvailable(params.backend) &&
+                    Dithering::backendSupports(params.backend, algorithm)) {
+                    backend = params.backend;
+                }
+
+                double p50 = percentile(timings, 0.50);
+                double p99 = percentile(timings, 0.99);
+                double mean = 0.0;
+                for (double t : timings) mean += t;
+                mean /= timings.size();
+                double throughput = megapixels / (p50 / 1000.0);
+
+                std::cerr << " " << p50 << " ms";
+
+                // Fixed-point output is not bit-identical to float (errors
+                // are rounded to 1/64 level, and a flipped pixel moves the
+                // pattern after it), so the two must agree once 16x16 blocks
+                // are averaged. Only cases that take the int16 path are checked.
+                std::ostringstream verification;
+                Dithering::Parameters fixedParams = params;
+                fixedParams.precision = Dithering::DiffusionPrecision::FIXED;
+                if (options.verify && Dithering::usesFixedPoint(fixedParams)) {
+                    Dithering::Parameters floatParams = params;
+                    floatParams.precision = Dithering::DiffusionPrecision::FLOAT;
+                    cv::Mat reference = Dithering::ditherImage(image, floatParams);
+                    cv::Mat fixed = Dithering::ditherImage(image, fixedParams);
+
+                    long long differing = 0;
+                    for (int y = 0; y < image.rows; ++y) {
+                        const cv::Vec3b* a = reference.ptr<cv::Vec3b>(y);
+                        const cv::Vec3b* b = fixed.ptr<cv::Vec3b>(y);
+                        for (int x = 0; x < image.cols; ++x) differing += a[x] != b[x];
+                    }
+                    double floatTone = toneError(reference, image);
+                    double fixedTone = toneError(fixed, image);
+                    double difference = toneError(fixed, reference, 16);
+                    bool passed = difference <= maxFixedPointDifference;
+                    ++verifiedCases;
+                    if (!passed) ++verifyFailures;
+                    std::cerr << (passed ? " (verified)" : " (FIXED POINT DRIFT)");
+
+                    verification << ", \"pixels_differ\": " << static_cast<double>(differing) / image.total()
+                                 << ", \"tone_error_float\": " << floatTone
+                                 << ", \"tone_error_fixed\": " << fixedTone
+                                 << ", \"fixed_vs_float\": " << difference
+                                 << ", \"verified\": " << (passed ? "true" : "false");
+                } else if (options.verify) {
+                    std::cerr << " (float only, not verified)";
+                }
+                std::cerr << "\n";
+
+                json << (first ? "\n" : ",\n");
+                first = false;
+                json << "    {\"algorithm\": \"" << jsonEscape(algorithmName) << "\""
+                     << ", \"palette\": \"" << jsonEscape(paletteName) << "\""
+                     << ", \"size\": \"" << jsonEscape(size.name) << "\""
+                     << ", \"backend\": \"" << Dithering::getBackendName(backend) << "\""
+                     << ", \"width\": " << size.width
+                     << ", \"height\": " << size.height
+                     << ", \"mpix_per_s\": " << throughput
+                     << ", \"mean_ms\": " << mean
+                     << ", \"p50_ms\": " << p50
+                     << ", \"p99_ms\": " << p99
+                     << ", \"peak_rss_bytes\": " << peakRss() << verification.str() << "}";
+            }
+        }
+    }
+
+    json << "\n  ],\n";
+    json << "  \"peak_rss_bytes\": " << peakRss() << "\n";
+    json << "}\n";
+
+    if (options.outputFile.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream file(options.outputFile);
+        if (!file) {
+            std::cerr << "Error: Could not write " << options.outputFile << "\n";
+            return 1;
+        }
+        file << json.str();
+        std::cerr << "Results written to " << options.outputFile << "\n";
+    }
+
+    if (options.verify) {
+        std::cerr << verifiedCases << " case(s) use fixed point, " << verifyFailures << " failed verification\n";
+    }
+    if (verifyFailures > 0) return 1;
+    return 0;
+}
@@ -0,0 +1,338 @@
+#include "bluenoise.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Dithering {
+
+namespace {
+
+const char maskMagic[4] = {'D', 'B', 'N', 'M'};
+constexpr uint32_t maskVersion = 1;
+constexpr size_t maskHeaderBytes = 16;
+
+// Tournament tree over per-pixel scores; the root holds the index with the
+// lowest score, ties going to the lower index. Excluded pixels score +inf.
+class ArgMinTree {
+public:
+    template <typename Score>
+    void build(int count, Score score) {
+        leaves = 1;
+        while (leaves < count) leaves *= 2;
+        nodes.assign(leaves * 2, -1);
+        scores.assign(leaves, std::numeric_limits<double>::infinity());
+        for (int i = 0; i < count; ++i) {
+            scores[i] = score(i);
+            nodes[leaves + i] = i;
+        }
+        for (int node = leaves - 1; node >= 1; --node) pull(node);
+    }
+
+    void update(int index, double score) {
+        scores[index] = score;
+        for (int node = (leaves + index) / 2; node >= 1; node /= 2) pull(node);
+    }
+
+    int best() const { return nodes[1]; }
+
+private:
+    void pull(int node) {
+        int a = nodes[node * 2];
+        int b = nodes[node * 2 + 1];
+        if (a < 0 || (b >= 0 && scores[b] < scores[a])) a = b;
+        nodes[node] = a;
+    }
+
+    int leaves = 1;
+    std::vector<int> nodes;
+    std::vector<double> scores;
+};
+
+// Binary pattern on a torus with the Gaussian-filtered energy of its set
+// pixels. The tightest cluster is the set pixel with the highest energy,
+// the largest void the unset pixel with the lowest.
+class VoidAndCluster {
+public:
+    VoidAndCluster(int size, float sigma) : size(size), bits(size * size, 0), energy(size * size, 0.0) {
+        radius = std::min(static_cast<int>(std::ceil(4.0f * sigma)), (size - 1) / 2);
+        for (int dy = -radius; dy <= radius; ++dy) {
+            for (int dx = -radius; dx <= radius; ++dx) {
+                kernel.push_back(std::exp(-(dx * dx + dy * dy) / (2.0 * sigma * sigma)));
+            }
+        }
+    }
+
+    void set(int index, bool value) {
+        bits[index] = value ? 1 : 0;
+        const double sign = value ? 1.0 : -1.0;
+        const int px = index % size;
+        const int py = index / size;
+
+        for (int dy = -radius, k = 0; dy <= radius; ++dy) {
+            const int row = ((py + dy + size) % size) * size;
+            for (int dx = -radius; dx <= radius; ++dx, ++k) {
+                const int neighbour = row + (px + dx + size) % size;
+                energy[neighbour] += sign * kernel[k];
+                if (trackClusters) clusters.update(neighbour, clusterScore(neighbour));
+                if (trackVoids) voids.update(neighbour, voidScore(neighbour));
+            }
+        }
+    }
+
+    void track(bool clusterTree, bool voidTree) {
+        trackClusters = clusterTree;
+        trackVoids = voidTree;
+        const int count = size * size;
+        if (trackClusters) clusters.build(count, [this](int i) { return clusterScore(i); });
+        if (trackVoids) voids.build(count, [this](int i) { return voidScore(i); });
+    }
+
+    int tightestCluster() const { return clusters.best(); }
+    int largestVoid() const { return voids.best(); }
+
+    int size;
+    std::vector<uint8_t> bits;
+    std::vector<double> energy;
+
+private:
+    double clusterScore(int i) const {
+        return bits[i] ? -energy[i] : std::numeric_limits<double>::infinity();
+    }
+
+    double voidScore(int i) const {
+        return bits[i] ? std::numeric_limits<double>::infinity() : energy[i];
+    }
+
+    int radius = 0;
+    std::vector<double> kernel;
+    ArgMinTree clusters;
+    ArgMinTree voids;
+    bool trackClusters = false;
+    bool trackVoids = false;
+};
+
+void writeUint32(std::ostream& out, uint32_t value) {
+    unsigned char bytes[4] = {
+        static_cast<unsigned char>(value), static_cast<unsigned char>(value >> 8),
+        static_cast<unsigned char>(value >> 16), static_cast<unsigned char>(value >> 24)
+    };
+    out.write(reinterpret_cast<const char*>(bytes), 4);
+}
+
+uint32_t readUint32(const unsigned char* bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+bool isLittleEndian() {
+    const uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+} // namespace
+
+cv::Mat generateVoidAndClusterMask(int size, unsigned int seed, float sigma,
+                                   const std::function<void(float)>& progress) {
+    const int count = size * size;
+    cv::Mat ranks(size, size, CV_16U);
+    if (count == 0) return ranks;
+
+    VoidAndCluster pattern(size, sigma);
+    std::vector<int> rank(count, 0);
+
+    // Initial binary pattern: about a tenth of the pixels set at random
+    const int initialOnes = std::max(1, count / 10);
+    std::mt19937 rng(seed);
+    std::vector<int> order(count);
+    for (int i = 0; i < count; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    for (int i = 0; i < initialOnes; ++i) pattern.set(order[i], true);
+
+    // Phase 0: move the tightest cluster into the largest void until that
+    // no longer changes anything
+    pattern.track(true, true);
+    for (int iteration = 0; iteration < count; ++iteration) {
+        int cluster = pattern.tightestCluster();
+        pattern.set(cluster, false);
+        int gap = pattern.largestVoid();
+        pattern.set(gap, true);
+        if (gap == cluster) break;
+    }
+    const std::vector<uint8_t> prototypeBits = pattern.bits;
+    const std::vector<double> prototypeEnergy = pattern.energy;
+
+    // Phase 1: strip the prototype's clusters, ranking them downwards
+    pattern.track(true, false);
+    for (int r = initialOnes - 1; r >= 0; --r) {
+        int cluster = pattern.tightestCluster();
+        pattern.set(cluster, false);
+        rank[cluster] = r;
+    }
+    if (progress) progress(static_cast<float>(initialOnes) / count);
+
+    // Phases 2 and 3: fill the prototype's voids, ranking them upwards. The
+    // tightest cluster of unset pixels is the unset pixel with the lowest
+    // energy of set pixels, since the two energies sum to a constant.
+    pattern.bits = prototypeBits;
+    pattern.energy = prototypeEnergy;
+    pattern.track(false, true);
+    const int step = std::max(1, count / 100);
+    for (int r = initialOnes; r < count; ++r) {
+        int gap = pattern.largestVoid();
+        pattern.set(gap, true);
+        rank[gap] = r;
+        if (progress && (r - initialOnes) % step == 0) progress(static_cast<float>(r) / count);
+    }
+
+    // Spread the ranks over the full 16-bit range
+    for (int i = 0; i < count; ++i) {
+        ranks.at<uint16_t>(i / size, i % size) =
+            static_cast<uint16_t>(static_cast<uint64_t>(rank[i]) * 65536 / count);
+    }
+    if (progress) progress(1.0f);
+    return ranks;
+}
+
+bool saveBlueNoiseMask(const std::string& path, const cv::Mat& ranks) {
+    if (ranks.empty() || ranks.type() != CV_16U) return false;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+
+    file.write(maskMagic, 4);
+    writeUint32(file, maskVersion);
+    writeUint32(file, static_cast<uint32_t>(ranks.cols));
+    writeUint32(file, static_cast<uint32_t>(ranks.rows));
+
+    std::vector<unsigned char> row(ranks.cols * 2);
+    for (int y = 0; y < ranks.rows; ++y) {
+        const uint16_t* values = ranks.ptr<uint16_t>(y);
+        for (int x = 0; x < ranks.cols; ++x) {
+            row[x * 2] = static_cast<unsigned char>(values[x]);
+            row[x * 2 + 1] = static_cast<unsigned char>(values[x] >> 8);
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+    return static_cast<bool>(file);
+}
+
+std::shared_ptr<const BlueNoiseMask> BlueNoiseMask::open(const std::string& path) {
+    // The ranks are used in place, so they must already be in host order
+    if (!isLittleEndian()) return nullptr;
+
+    std::shared_ptr<BlueNoiseMask> mask(new BlueNoiseMask());
+    mask->filePath = path;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    mask->fileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) return nullptr;
+    mask->mappedBytes = static_cast<size_t>(fileSize.QuadPart);
+    if (mask->mappedBytes < maskHeaderBytes) return nullptr;
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) return nullptr;
+    mask->mappingHandle = mapping;
+
+    mask->mapping = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mask->mapping) return nullptr;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < maskHeaderBytes) {
+        close(fd);
+        return nullptr;
+    }
+    mask->mappedBytes = static_cast<size_t>(info.st_size);
+
+    void* data = mmap(nullptr, mask->mappedBytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    mask->mapping = data;
+#endif
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(mask->mapping);
+    uint32_t width = readUint32(bytes + 8);
+    uint32_t height = readUint32(bytes + 12);
+    if (std::memcmp(bytes, maskMagic, 4) != 0 || readUint32(bytes + 4) != maskVersion ||
+        width == 0 || height == 0 || width > 65536 || height > 65536 ||
+        mask->mappedBytes != maskHeaderBytes + static_cast<size_t>(width) * height * 2) {
+        return nullptr;
+    }
+
+    // The view never writes; the const_cast only satisfies cv::Mat's constructor
+    mask->view = cv::Mat(static_cast<int>(height), static_cast<int>(width), CV_16U,
+                         const_cast<unsigned char*>(bytes + maskHeaderBytes));
+    return mask;
+}
+
+BlueNoiseMask::~BlueNoiseMask() {
+#ifdef _WIN32
+    if (mapping) UnmapViewOfFile(mapping);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle) CloseHandle(fileHandle);
+#else
+    if (mapping) munmap(mapping, mappedBytes);
+#endif
+}
+
+namespace {
+
+std::mutex activeMaskMutex;
+std::shared_ptr<const BlueNoiseMask> activeMask;
+bool environmentChecked = false;
+
+} // namespace
+
+bool loadBlueNoiseMask(const std::string& path) {
+    auto mask = BlueNoiseMask::open(path);
+    if (!mask) return false;
+
+    std::lock_guard<std::mutex> lock(activeMaskMutex);
+    activeMask = std::move(mask);
+    environmentChecked = true;
+    return true;
+}
+
+void clearBlueNoiseMask() {
+    std::lock_guard<std::mutex> lock(activeMaskMutex);
+    activeMask.reset();
+    environmentChecked = true;
+}
+
+std::shared_ptr<const BlueNoiseMask> getBlueNoiseMask() {
+    std::lock_guard<std::mutex> lock(activeMaskMutex);
+    if (!environmentChecked) {
+        environmentChecked = true;
+        if (const char* path = std::getenv("DITHER_BLUE_NOISE_MASK")) {
+            activeMask = BlueNoiseMask::open(path);
+        }
+    }
+    return activeMask;
+}
+
+} // namespace Dithering
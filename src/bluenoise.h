@@ -0,0 +1,62 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace Dithering {
+
+// Void-and-cluster blue noise masks (Ulichney 1993).
+//
+// A mask file is a 16-byte header followed by width * height little-endian
+// uint16 ranks in row-major order:
+//   char magic[4] = "DBNM", uint32 version = 1, uint32 width, uint32 height
+// Ranks are scaled to the full uint16 range, so rank / 65536 is the pixel's
+// threshold in [0, 1). Masks larger than 256x256 have more pixels than
+// levels and share neighbouring ranks.
+
+// Generate a size x size rank mask (CV_16U) with a Gaussian energy filter of
+// the given sigma. Runs in O(size^2 log size); meant for offline use.
+// progress, if set, is called with the completed fraction.
+cv::Mat generateVoidAndClusterMask(int size, unsigned int seed, float sigma = 1.5f,
+                                   const std::function<void(float)>& progress = nullptr);
+
+// Write a CV_16U rank mask in the format above
+bool saveBlueNoiseMask(const std::string& path, const cv::Mat& ranks);
+
+// Read-only, memory-mapped mask file
+class BlueNoiseMask {
+public:
+    // The mapped mask, or nullptr if the file is missing or malformed
+    static std::shared_ptr<const BlueNoiseMask> open(const std::string& path);
+    ~BlueNoiseMask();
+
+    BlueNoiseMask(const BlueNoiseMask&) = delete;
+    BlueNoiseMask& operator=(const BlueNoiseMask&) = delete;
+
+    // CV_16U view of the mapped ranks; valid for the lifetime of the mask
+    const cv::Mat& ranks() const { return view; }
+    const std::string& path() const { return filePath; }
+
+private:
+    BlueNoiseMask() = default;
+
+    std::string filePath;
+    cv::Mat view;
+    void* mapping = nullptr;
+    size_t mappedBytes = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+// Process-wide mask used by the blue noise algorithm instead of the built-in
+// texture. When none has been loaded, the file named by the
+// DITHER_BLUE_NOISE_MASK environment variable is mapped on first use.
+bool loadBlueNoiseMask(const std::string& path);
+void clearBlueNoiseMask();
+std::shared_ptr<const BlueNoiseMask> getBlueNoiseMask();
+
+} // namespace Dithering
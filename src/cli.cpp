@@ -1,21 +1,74 @@
 #include <iostream>
 #include <string>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <algorithm>
 #include <opencv2/opencv.hpp>
 #include "dithering.h"
+#include "batch.h"
+#include "video.h"
+#include "bluenoise.h"
+#include "stream.h"
+#include "indexed.h"
+#include "profile.h"
+#include "server.h"
+#include "sweep.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace fs = std::filesystem;
 
 void printUsage(const char* program) {
     std::cout << "Dither's Boyfriend - CLI Version\n";
-    std::cout << "Usage: " << program << " [options] input_file output_file\n\n";
+    std::cout << "Usage: " << program << " [options] input_file output_file\n";
+    std::cout << "       " << program << " [options] input.mp4 output.mp4\n";
+    std::cout << "       " << program << " [options] input_dir output_dir\n";
+    std::cout << "       " << program << " [options] --raw WxH - -\n";
+    std::cout << "       " << program << " [options] --serve <socket>\n";
+    std::cout << "       " << program << " [options] --sweep key=v1,v2,... input_file sheet.png|output_dir\n\n";
     std::cout << "Options:\n";
     std::cout << "  -a, --algorithm <name>    Dithering algorithm (default: floyd-steinberg)\n";
     std::cout << "  -p, --palette <name>      Color palette (default: monochrome)\n";
+    std::cout << "  --match <name>            Color matching: rgb, oklab or cielab (default: rgb)\n";
     std::cout << "  -s, --strength <float>    Strength (0.0-2.0, default: 1.0)\n";
     std::cout << "  -g, --gamma <float>       Gamma correction (0.1-3.0, default: 1.0)\n";
     std::cout << "  -c, --contrast <float>    Contrast (0.0-3.0, default: 1.0)\n";
     std::cout << "  -b, --brightness <float>  Brightness (-1.0-1.0, default: 0.0)\n";
     std::cout << "  --saturation <float>      Saturation (0.0-2.0, default: 1.0)\n";
-    std::cout << "  --serpentine              Enable serpentine scanning\n";
+    std::cout << "  --serpentine              Serpentine Floyd-Steinberg and Ostromoukhov scanning (default;\n";
+    std::cout << "                            always serial)\n";
+    std::cout << "  --no-serpentine           Left-to-right rows for those two, which -t can run in parallel\n";
+    std::cout << "  --fixed-point             Integer error diffusion for power-of-two kernels\n";
     std::cout << "  --seed <int>              Random seed (default: 42)\n";
+    std::cout << "  --blue-noise-mask <file>  Blue noise mask made with dither-noise\n";
+    std::cout << "  -t, --threads <int>       Threads for non-serpentine diffusion and Riemersma (0 = all cores,\n";
+    std::cout << "                            default: 1); serpentine scans and other algorithms ignore it\n";
+    std::cout << "  --speedup                 Also time a single-threaded run and report the speedup\n";
+    std::cout << "  --backend <name>          Compute backend: cpu or opencl (default: cpu)\n";
+    std::cout << "  -j, --jobs <int>          Cores for frames/images in parallel (0 = all cores, default: 0)\n";
+    std::cout << "  --temporal                Video: only re-dither tiles that changed since the last frame\n";
+    std::cout << "  --tile-size <int>         Temporal tile size in pixels (default: 16)\n";
+    std::cout << "  --tolerance <int>         Largest per-channel change treated as static (default: 0)\n";
+    std::cout << "  --animate-noise           Video: vary white/random/variable noise with the frame index\n";
+    std::cout << "  --indexed                 Write palettized PNG/BMP/GIF, 1-bit PBM (always for .gif/.pbm)\n";
+    std::cout << "  --stream                  Process the image in strips with bounded memory\n";
+    std::cout << "  --strip-rows <int>        Rows per strip when streaming (default: 64)\n";
+    std::cout << "  --raw <WxH>               Stream raw frames of the given size from stdin to stdout\n";
+    std::cout << "  --pix-fmt <name>          Raw pixel format: bgr24 or rgb24 (default: bgr24)\n";
+    std::cout << "  --serve <socket>          Serve POST /dither over HTTP on a Unix socket (options are defaults)\n";
+    std::cout << "  --sweep <key=v1,v2,...>   Dither every listed value of a parameter; repeat for more axes\n";
+    std::cout << "  --columns <int>           Contact sheet columns (default: near-square grid)\n";
+    std::cout << "  --cell-width <int>        Scale sweep results to this width on the sheet (default: as is)\n";
+    std::cout << "  --profile <file.json>     Write per-stage timings and pixel rates on exit (PROFILE=1 builds)\n";
+    std::cout << "  --trace <file.json>       Write a Chrome trace (chrome://tracing, Perfetto) of every stage\n";
     std::cout << "  -h, --help                Show this help message\n\n";
 
     std::cout << "Algorithms:\n";
@@ -33,53 +86,556 @@ void printUsage(const char* program) {
     std::cout << "  " << program << " input.jpg output.png\n";
     std::cout << "  " << program << " -a atkinson -p gameboy input.jpg output.png\n";
     std::cout << "  " << program << " -a bayer-8x8 -p pico8 -s 1.5 input.jpg output.png\n";
+    std::cout << "  " << program << " -p pico8 --match oklab input.jpg output.png\n";
+    std::cout << "  " << program << " -a atkinson -p gameboy input.mp4 output.mp4\n";
+    std::cout << "  " << program << " -a bayer-8x8 -p gameboy input.mp4 loop.gif\n";
+    std::cout << "  " << program << " --temporal --tolerance 4 -a blue-noise capture.mp4 output.mp4\n";
+    std::cout << "  " << program << " -p cga frames/ dithered/\n";
+    std::cout << "  " << program << " --indexed -p gameboy input.jpg output.png\n";
+    std::cout << "  " << program << " --stream -a stucki scan.tif dithered.tif\n";
+    std::cout << "  " << program << " -j 4 --trace trace.json --profile stages.json input.mp4 output.mp4\n";
+    std::cout << "  " << program << " -p gameboy --serve /tmp/dither.sock\n";
+    std::cout << "  " << program << " --sweep algorithm=atkinson,bayer-8x8 --sweep gamma=0.8,1,1.2 input.jpg sheet.png\n";
+    std::cout << "  ffmpeg -i in.mp4 -f rawvideo -pix_fmt bgr24 - | \\\n";
+    std::cout << "    " << program << " --raw 1280x720 - - | \\\n";
+    std::cout << "    ffmpeg -f rawvideo -pix_fmt bgr24 -s 1280x720 -r 30 -i - out.mp4\n";
+}
+
+bool hasExtension(const std::string& path, std::initializer_list<const char*> extensions) {
+    std::string ext = fs::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    for (const char* candidate : extensions) {
+        if (ext == candidate) return true;
+    }
+    return false;
+}
+
+bool isVideoFile(const std::string& path) {
+    return hasExtension(path, {".mp4", ".avi", ".mov", ".mkv", ".webm", ".m4v"});
+}
+
+bool isImageFile(const std::string& path) {
+    return hasExtension(path, {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".webp"});
+}
+
+// Save a dithered image, as palette indices when asked to or when the
+// format only holds indices
+bool saveImage(const std::string& path, const cv::Mat& image, const Dithering::Parameters& params, bool indexed) {
+    DITHER_PROFILE_PIXELS("save image", image.total());
+    if ((indexed || hasExtension(path, {".gif", ".pbm"})) && Dithering::isIndexedFormat(path)) {
+        Dithering::IndexedImage indexedImage;
+        if (Dithering::indexImage(image, *Dithering::getPaletteMatcher(params), indexedImage)) {
+            return Dithering::writeIndexedImage(path, indexedImage);
+        }
+    }
+    return cv::imwrite(path, image);
+}
+
+// Block until a job finishes, printing progress to stderr
+bool waitForJob(Dithering::VideoJob& job) {
+    while (job.isRunning()) {
+        std::cerr << "\rFrame " << job.framesDone();
+        if (job.totalFrames() > 0) {
+            std::cerr << " / " << job.totalFrames() << " (" << static_cast<int>(job.progress() * 100.0f) << "%)";
+        }
+        std::cerr << std::flush;
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+    job.wait();
+    std::cerr << "\rFrame " << job.framesDone() << "\n";
+
+    if (job.failed()) {
+        std::cerr << "Error: " << job.error() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Strip-by-strip processing for images too large to hold in memory
+int processStream(const std::string& inputFile, const std::string& outputFile,
+                  const Dithering::Parameters& params, int stripRows) {
+    auto source = Dithering::openRowSource(inputFile);
+    if (!source) {
+        std::cerr << "Error: Could not load image: " << inputFile << "\n";
+        return 1;
+    }
+    if (!Dithering::isStreamableFormat(inputFile) || !Dithering::isStreamableFormat(outputFile)) {
+        std::cerr << "Warning: Only PNG and TIFF are streamed; other formats are held in memory\n";
+    }
+    if (!Dithering::StripDitherer::supports(params.algorithm)) {
+        std::cerr << "Warning: " << Dithering::getAlgorithmName(params.algorithm)
+                  << " needs the whole image; it will be held in memory\n";
+    }
+
+    std::cout << "Streaming " << inputFile << " (" << source->width() << "x" << source->height()
+              << ") in strips of " << stripRows << " rows...\n";
+    auto start = std::chrono::high_resolution_clock::now();
+
+    auto sink = Dithering::createRowSink(outputFile);
+    const int height = source->height();
+    int lastPercent = -1;
+    bool ok = Dithering::ditherStream(*source, *sink, params, stripRows, [&](int rows) {
+        int percent = static_cast<int>(100.0 * rows / height);
+        if (percent != lastPercent) {
+            lastPercent = percent;
+            std::cerr << "\rRow " << rows << " / " << height << " (" << percent << "%)" << std::flush;
+        }
+    });
+    std::cerr << "\n";
+
+    if (!ok) {
+        std::cerr << "Error: Streaming " << inputFile << " -> " << outputFile << " failed\n";
+        return 1;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    float elapsed = std::chrono::duration<float, std::milli>(end - start).count();
+    std::cout << "Processing time: " << elapsed << " ms\n";
+    std::cout << "Done!\n";
+    return 0;
+}
+
+int processVideo(const std::string& inputFile, const std::string& outputFile,
+                 const Dithering::Parameters& params, int jobs, const Dithering::TemporalOptions& temporal) {
+    std::cout << "Processing video " << inputFile << " -> " << outputFile << "\n";
+    auto start = std::chrono::high_resolution_clock::now();
+
+    Dithering::VideoJob job;
+    if (!job.start(inputFile, outputFile, params, jobs, temporal)) {
+        std::cerr << "Error: Could not open video: " << inputFile << " or " << outputFile << "\n";
+        return 1;
+    }
+    if (!waitForJob(job)) return 1;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    float seconds = std::chrono::duration<float>(end - start).count();
+    std::cout << "Processed " << job.framesDone() << " frames in " << seconds << " s ("
+              << job.framesDone() / std::max(seconds, 1e-3f) << " fps)\n";
+    if (temporal.enabled) {
+        std::cout << "Re-dithered " << static_cast<int>(job.dirtyRatio() * 100.0f + 0.5f) << "% of tiles\n";
+    }
+    return 0;
+}
+
+// Dither every image in a directory with the batch scheduler; videos are
+// processed one after another with their own pipeline
+int processDirectory(const std::string& inputDir, const std::string& outputDir,
+                     const Dithering::Parameters& params, int jobs, bool indexed,
+                     const Dithering::TemporalOptions& temporal) {
+    std::vector<fs::path> images, videos;
+    for (const auto& entry : fs::directory_iterator(inputDir)) {
+        if (!entry.is_regular_file()) continue;
+        std::string path = entry.path().string();
+        if (isImageFile(path)) images.push_back(entry.path());
+        else if (isVideoFile(path)) videos.push_back(entry.path());
+    }
+    std::sort(images.begin(), images.end());
+    std::sort(videos.begin(), videos.end());
+
+    if (images.empty() && videos.empty()) {
+        std::cerr << "Error: No images or videos found in " << inputDir << "\n";
+        return 1;
+    }
+
+    std::error_code ec;
+    fs::create_directories(outputDir, ec);
+    if (ec) {
+        std::cerr << "Error: Could not create output directory: " << outputDir << "\n";
+        return 1;
+    }
+
+    int status = 0;
+
+    if (!images.empty()) {
+        std::cout << "Processing " << images.size() << " images from " << inputDir << "\n";
+
+        // Header sizes let the scheduler share cores out by image size and
+        // keep the decoded buffers within its memory budget
+        std::vector<Dithering::BatchItem> items;
+        items.reserve(images.size());
+        for (const fs::path& path : images) {
+            fs::path output = fs::path(outputDir) / path.filename();
+            output.replace_extension(".png");
+            Dithering::BatchItem item;
+            item.load = [input = path.string()](cv::Mat& image) {
+                image = cv::imread(input, cv::IMREAD_COLOR);
+                if (image.empty()) std::cerr << "\nWarning: Could not load image: " << input << "\n";
+                return !image.empty();
+            };
+            item.save = [output = output.string(), &params, indexed](const cv::Mat& image) {
+                if (saveImage(output, image, params, indexed)) return true;
+                std::cerr << "\nError: Could not save image: " << output << "\n";
+                return false;
+            };
+            Dithering::readImageSize(path.string(), item.size);
+            items.push_back(std::move(item));
+        }
+
+        Dithering::BatchOptions options;
+        options.threads = jobs;
+        Dithering::BatchRunner runner(options);
+        int failed = runner.run(items, params, [](int done, int total) {
+            std::cerr << "\rImage " << done << " / " << total << std::flush;
+        });
+        std::cerr << "\n";
+        if (failed > 0) status = 1;
+    }
+
+    for (const auto& video : videos) {
+        fs::path output = fs::path(outputDir) / video.filename();
+        if (processVideo(video.string(), output.string(), params, jobs, temporal) != 0) status = 1;
+    }
+
+    std::cout << (status == 0 ? "Done!\n" : "Finished with errors\n");
+    return status;
+}
+
+// Stream fixed-size raw frames from stdin to stdout, e.g. between two ffmpeg
+// processes. All diagnostics go to stderr so stdout carries only pixels.
+int processRawStream(int width, int height, bool rgb,
+                     const Dithering::Parameters& params, int jobs, const Dithering::TemporalOptions& temporal) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    const size_t frameBytes = static_cast<size_t>(width) * height * 3;
+
+    Dithering::FrameSource source = [&](cv::Mat& frame) {
+        frame.create(height, width, CV_8UC3);
+        if (std::fread(frame.data, 1, frameBytes, stdin) != frameBytes) return false;
+        if (rgb) cv::cvtColor(frame, frame, cv::COLOR_RGB2BGR);
+        return true;
+    };
+
+    cv::Mat converted;
+    Dithering::FrameSink sink = [&](const cv::Mat& frame) {
+        const cv::Mat* out = &frame;
+        if (rgb) {
+            cv::cvtColor(frame, converted, cv::COLOR_BGR2RGB);
+            out = &converted;
+        }
+        return std::fwrite(out->data, 1, frameBytes, stdout) == frameBytes;
+    };
+
+    std::cerr << "Streaming " << width << "x" << height << (rgb ? " rgb24" : " bgr24") << " frames\n";
+
+    Dithering::VideoJob job;
+    job.start(source, sink, params, 0, jobs, temporal);
+    bool ok = waitForJob(job);
+    std::fflush(stdout);
+    return ok ? 0 : 1;
+}
+
+const std::pair<const char*, Dithering::Algorithm> ALGORITHM_NAMES[] = {
+    {"floyd-steinberg", Dithering::Algorithm::FLOYD_STEINBERG},
+    {"atkinson", Dithering::Algorithm::ATKINSON},
+    {"jarvis", Dithering::Algorithm::JARVIS_JUDICE_NINKE},
+    {"stucki", Dithering::Algorithm::STUCKI},
+    {"burkes", Dithering::Algorithm::BURKES},
+    {"sierra", Dithering::Algorithm::SIERRA},
+    {"sierra-two", Dithering::Algorithm::SIERRA_TWO_ROW},
+    {"sierra-lite", Dithering::Algorithm::SIERRA_LITE},
+    {"bayer-2x2", Dithering::Algorithm::ORDERED_BAYER_2X2},
+    {"bayer-4x4", Dithering::Algorithm::ORDERED_BAYER_4X4},
+    {"bayer-8x8", Dithering::Algorithm::ORDERED_BAYER_8X8},
+    {"bayer-16x16", Dithering::Algorithm::ORDERED_BAYER_16X16},
+    {"blue-noise", Dithering::Algorithm::BLUE_NOISE},
+    {"white-noise", Dithering::Algorithm::WHITE_NOISE},
+    {"random", Dithering::Algorithm::RANDOM_DITHER},
+    {"pattern", Dithering::Algorithm::PATTERN_DITHER},
+    {"dot-diffusion", Dithering::Algorithm::DOT_DIFFUSION},
+    {"riemersma", Dithering::Algorithm::RIEMERSMA},
+    {"gradient", Dithering::Algorithm::GRADIENT_BASED},
+    {"variable", Dithering::Algorithm::VARIABLE_ERROR_DIFFUSION},
+    {"ostromoukhov", Dithering::Algorithm::OSTROMOUKHOV},
+    {"fan", Dithering::Algorithm::FAN},
+    {"shiau-fan", Dithering::Algorithm::SHIAU_FAN},
+    {"steven-pigeon", Dithering::Algorithm::STEVENPIGEON},
+};
+
+const std::pair<const char*, Dithering::PaletteMode> PALETTE_NAMES[] = {
+    {"monochrome", Dithering::PaletteMode::MONOCHROME},
+    {"gray4", Dithering::PaletteMode::GRAYSCALE_4},
+    {"gray8", Dithering::PaletteMode::GRAYSCALE_8},
+    {"gray16", Dithering::PaletteMode::GRAYSCALE_16},
+    {"cga", Dithering::PaletteMode::CGA},
+    {"ega", Dithering::PaletteMode::EGA},
+    {"vga", Dithering::PaletteMode::VGA},
+    {"gameboy", Dithering::PaletteMode::GAMEBOY},
+    {"pico8", Dithering::PaletteMode::PICO8},
+};
+
+const std::pair<const char*, Dithering::ColorMetric> COLOR_METRIC_NAMES[] = {
+    {"rgb", Dithering::ColorMetric::BGR},
+    {"oklab", Dithering::ColorMetric::OKLAB},
+    {"cielab", Dithering::ColorMetric::CIELAB},
+};
+
+template <typename T, size_t N>
+bool findName(const std::pair<const char*, T> (&names)[N], const std::string& name, T& value) {
+    for (const auto& [candidate, named] : names) {
+        if (name == candidate) {
+            value = named;
+            return true;
+        }
+    }
+    return false;
 }
 
 Dithering::Algorithm parseAlgorithm(const std::string& name) {
-    if (name == "floyd-steinberg") return Dithering::Algorithm::FLOYD_STEINBERG;
-    if (name == "atkinson") return Dithering::Algorithm::ATKINSON;
-    if (name == "jarvis") return Dithering::Algorithm::JARVIS_JUDICE_NINKE;
-    if (name == "stucki") return Dithering::Algorithm::STUCKI;
-    if (name == "burkes") return Dithering::Algorithm::BURKES;
-    if (name == "sierra") return Dithering::Algorithm::SIERRA;
-    if (name == "sierra-two") return Dithering::Algorithm::SIERRA_TWO_ROW;
-    if (name == "sierra-lite") return Dithering::Algorithm::SIERRA_LITE;
-    if (name == "bayer-2x2") return Dithering::Algorithm::ORDERED_BAYER_2X2;
-    if (name == "bayer-4x4") return Dithering::Algorithm::ORDERED_BAYER_4X4;
-    if (name == "bayer-8x8") return Dithering::Algorithm::ORDERED_BAYER_8X8;
-    if (name == "bayer-16x16") return Dithering::Algorithm::ORDERED_BAYER_16X16;
-    if (name == "blue-noise") return Dithering::Algorithm::BLUE_NOISE;
-    if (name == "white-noise") return Dithering::Algorithm::WHITE_NOISE;
-    if (name == "random") return Dithering::Algorithm::RANDOM_DITHER;
-    if (name == "pattern") return Dithering::Algorithm::PATTERN_DITHER;
-    if (name == "dot-diffusion") return Dithering::Algorithm::DOT_DIFFUSION;
-    if (name == "riemersma") return Dithering::Algorithm::RIEMERSMA;
-    if (name == "gradient") return Dithering::Algorithm::GRADIENT_BASED;
-    if (name == "variable") return Dithering::Algorithm::VARIABLE_ERROR_DIFFUSION;
-    if (name == "ostromoukhov") return Dithering::Algorithm::OSTROMOUKHOV;
-    if (name == "fan") return Dithering::Algorithm::FAN;
-    if (name == "shiau-fan") return Dithering::Algorithm::SHIAU_FAN;
-    if (name == "steven-pigeon") return Dithering::Algorithm::STEVENPIGEON;
+    Dithering::Algorithm algorithm;
+    if (findName(ALGORITHM_NAMES, name, algorithm)) return algorithm;
 
     std::cerr << "Unknown algorithm: " << name << ", using floyd-steinberg\n";
     return Dithering::Algorithm::FLOYD_STEINBERG;
 }
 
 Dithering::PaletteMode parsePalette(const std::string& name) {
-    if (name == "monochrome") return Dithering::PaletteMode::MONOCHROME;
-    if (name == "gray4") return Dithering::PaletteMode::GRAYSCALE_4;
-    if (name == "gray8") return Dithering::PaletteMode::GRAYSCALE_8;
-    if (name == "gray16") return Dithering::PaletteMode::GRAYSCALE_16;
-    if (name == "cga") return Dithering::PaletteMode::CGA;
-    if (name == "ega") return Dithering::PaletteMode::EGA;
-    if (name == "vga") return Dithering::PaletteMode::VGA;
-    if (name == "gameboy") return Dithering::PaletteMode::GAMEBOY;
-    if (name == "pico8") return Dithering::PaletteMode::PICO8;
+    Dithering::PaletteMode palette;
+    if (findName(PALETTE_NAMES, name, palette)) return palette;
 
     std::cerr << "Unknown palette: " << name << ", using monochrome\n";
     return Dithering::PaletteMode::MONOCHROME;
 }
 
+Dithering::ColorMetric parseColorMetric(const std::string& name) {
+    Dithering::ColorMetric metric;
+    if (findName(COLOR_METRIC_NAMES, name, metric)) return metric;
+
+    std::cerr << "Unknown color matching: " << name << ", using rgb\n";
+    return Dithering::ColorMetric::BGR;
+}
+
+// One parameter of a server request or sweep axis, named like the long
+// option; unlike the command line, unknown names and values are rejected
+bool setNamedParameter(const std::string& key, const std::string& value, Dithering::Parameters& params,
+                       std::string& error) {
+    auto number = [&](float low, float high, float& out) {
+        try {
+            size_t used = 0;
+            float parsed = std::stof(value, &used);
+            if (used == value.size() && parsed >= low && parsed <= high) {
+                out = parsed;
+                return true;
+            }
+        } catch (const std::exception&) {
+        }
+        error = "Bad value for " + key + ": " + value;
+        return false;
+    };
+    // Whole numbers only, parsed exactly rather than through float
+    auto integer = [&](long long low, long long high, long long& out) {
+        try {
+            size_t used = 0;
+            long long parsed = std::stoll(value, &used);
+            if (used == value.size() && parsed >= low && parsed <= high) {
+                out = parsed;
+                return true;
+            }
+        } catch (const std::exception&) {
+        }
+        error = "Bad value for " + key + " (expects an integer from " + std::to_string(low) + " to " +
+                std::to_string(high) + "): " + value;
+        return false;
+    };
+    auto flag = [&](bool& out) {
+        if (value != "true" && value != "false") {
+            error = key + " takes true or false";
+            return false;
+        }
+        out = value == "true";
+        return true;
+    };
+
+    bool found = true;
+    long long n = 0;
+    bool b = false;
+    if (key == "algorithm") {
+        found = findName(ALGORITHM_NAMES, value, params.algorithm);
+    } else if (key == "palette") {
+        found = findName(PALETTE_NAMES, value, params.paletteMode);
+    } else if (key == "match") {
+        found = findName(COLOR_METRIC_NAMES, value, params.colorMetric);
+    } else if (key == "backend") {
+        found = value == "cpu" || value == "opencl";
+        if (found) params.backend = value == "opencl" ? Dithering::Backend::OPENCL : Dithering::Backend::CPU;
+    } else if (key == "strength") {
+        return number(0.0f, 2.0f, params.strength);
+    } else if (key == "gamma") {
+        return number(0.1f, 3.0f, params.gamma);
+    } else if (key == "contrast") {
+        return number(0.0f, 3.0f, params.contrast);
+    } else if (key == "brightness") {
+        return number(-1.0f, 1.0f, params.brightness);
+    } else if (key == "saturation") {
+        return number(0.0f, 2.0f, params.saturation);
+    } else if (key == "seed") {
+        // Negative seeds wrap, as --seed does
+        if (!integer(INT32_MIN, UINT32_MAX, n)) return false;
+        params.seed = static_cast<unsigned int>(n);
+    } else if (key == "frame") {
+        if (!integer(0, UINT32_MAX, n)) return false;
+        params.frame = static_cast<unsigned int>(n);
+    } else if (key == "threads") {
+        if (!integer(0, 256, n)) return false;
+        params.threads = static_cast<int>(n);
+    } else if (key == "serpentine") {
+        if (!flag(b)) return false;
+        params.serpentine = b ? 1.0f : 0.0f;
+    } else if (key == "fixed-point") {
+        if (!flag(b)) return false;
+        params.precision = b ? Dithering::DiffusionPrecision::FIXED : Dithering::DiffusionPrecision::FLOAT;
+    } else {
+        error = "Unknown parameter: " + key;
+        return false;
+    }
+    if (!found) error = "Unknown " + key + ": " + value;
+    return found;
+}
+
+// A --sweep argument, key=v1,v2,..., as an axis of named values. Every
+// value is checked up front so a typo fails before any work is done.
+bool parseSweepAxis(const std::string& spec, Dithering::SweepAxis& axis, std::string& error) {
+    size_t equals = spec.find('=');
+    if (equals == std::string::npos || equals == 0 || equals + 1 == spec.size()) {
+        error = "--sweep expects key=v1,v2,...";
+        return false;
+    }
+    std::string key = spec.substr(0, equals);
+    std::vector<std::string> values;
+    for (size_t start = equals + 1; start <= spec.size();) {
+        size_t comma = std::min(spec.find(',', start), spec.size());
+        values.push_back(spec.substr(start, comma - start));
+        start = comma + 1;
+    }
+
+    Dithering::Parameters scratch;
+    for (const std::string& value : values) {
+        if (!setNamedParameter(key, value, scratch, error)) return false;
+    }
+
+    axis.count = static_cast<int>(values.size());
+    axis.apply = [key, values](int index, Dithering::Parameters& params) {
+        std::string ignored;
+        setNamedParameter(key, values[index], params, ignored);
+    };
+    return true;
+}
+
+// Dither every combination of the sweep axes, sharing the decode and
+// preprocessing, into one contact sheet or a directory of numbered images
+int processSweep(const std::string& inputFile, const std::string& output, const Dithering::Parameters& params,
+                 const std::vector<Dithering::SweepAxis>& axes, int columns, int cellWidth, bool indexed) {
+    std::cout << "Loading " << inputFile << "...\n";
+    cv::Mat input;
+    {
+        DITHER_PROFILE_SCOPE("load image");
+        input = cv::imread(inputFile, cv::IMREAD_COLOR);
+    }
+    if (input.empty()) {
+        std::cerr << "Error: Could not load image: " << inputFile << "\n";
+        return 1;
+    }
+
+    std::vector<Dithering::Parameters> variants = Dithering::sweepVariants(params, axes);
+    std::cout << "Dithering " << variants.size() << " variants of " << input.cols << "x" << input.rows << "...\n";
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<cv::Mat> results = Dithering::ditherVariants(input, variants);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Processing time: " << std::chrono::duration<float, std::milli>(end - start).count() << " ms\n";
+
+    std::vector<std::string> captions;
+    for (const auto& variant : variants) captions.push_back(Dithering::describeVariant(variant, params));
+
+    if (isImageFile(output)) {
+        cv::Mat sheet = Dithering::contactSheet(results, captions, columns, cellWidth);
+        std::cout << "Saving contact sheet to " << output << "...\n";
+        if (!cv::imwrite(output, sheet)) {
+            std::cerr << "Error: Could not save image: " << output << "\n";
+            return 1;
+        }
+        std::cout << "Done!\n";
+        return 0;
+    }
+
+    std::error_code ec;
+    fs::create_directories(output, ec);
+    if (ec) {
+        std::cerr << "Error: Could not create output directory: " << output << "\n";
+        return 1;
+    }
+
+    int status = 0;
+    const std::string stem = fs::path(inputFile).stem().string();
+    for (size_t i = 0; i < results.size(); ++i) {
+        char suffix[16];
+        std::snprintf(suffix, sizeof(suffix), "-%02zu.png", i + 1);
+        fs::path path = fs::path(output) / (stem + suffix);
+        std::cout << path.filename().string() << ": " << captions[i] << "\n";
+        if (!saveImage(path.string(), results[i], variants[i], indexed)) {
+            std::cerr << "Error: Could not save image: " << path.string() << "\n";
+            status = 1;
+        }
+    }
+    std::cout << (status == 0 ? "Done!\n" : "Finished with errors\n");
+    return status;
+}
+
+Dithering::DitherServer* activeServer = nullptr;
+
+void stopServer(int) {
+    if (activeServer) activeServer->stop();
+}
+
+// Serve dithering requests on a Unix socket until interrupted
+int runServer(const std::string& socketPath, const Dithering::Parameters& params, int jobs) {
+    Dithering::ServerOptions options;
+    options.socketPath = socketPath;
+    options.jobs = jobs;
+    options.defaults = params;
+    options.setParameter = setNamedParameter;
+
+    Dithering::DitherServer server(options);
+    std::string error;
+    if (!server.listen(error)) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+    activeServer = &server;
+    std::signal(SIGINT, stopServer);
+    std::signal(SIGTERM, stopServer);
+
+    std::cerr << "Serving on " << socketPath << " (Ctrl+C to stop)\n";
+    server.run();
+    activeServer = nullptr;
+
+    Dithering::DitherServer::Stats stats = server.stats();
+    std::cerr << "Served " << stats.requests << " requests (" << stats.failed << " failed)\n";
+    return 0;
+}
+
+// Writes the --profile and --trace files when main returns, on every path
+struct ProfileOutput {
+    std::string profileFile;
+    std::string traceFile;
+
+    void start() {
+        if ((!profileFile.empty() || !traceFile.empty()) && !Dithering::profilingCompiledIn()) {
+            std::cerr << "Warning: Built without DITHER_PROFILING (make PROFILE=1); --profile and --trace record nothing\n";
+        }
+        if (!traceFile.empty()) Dithering::startTrace();
+    }
+
+    ~ProfileOutput() {
+        if (!traceFile.empty() && Dithering::isTracing() && !Dithering::stopTrace(traceFile)) {
+            std::cerr << "Error: Could not write trace: " << traceFile << "\n";
+        }
+        if (!profileFile.empty() && !Dithering::writeProfileJson(profileFile)) {
+            std::cerr << "Error: Could not write profile: " << profileFile << "\n";
+        }
+    }
+};
+
 int main(int argc, char** argv) {
     if (argc < 2) {
         printUsage(argv[0]);
@@ -88,6 +644,20 @@ int main(int argc, char** argv) {
 
     Dithering::Parameters params;
     std::string inputFile, outputFile;
+    bool reportSpeedup = false;
+    int jobs = 0;
+    int rawWidth = 0, rawHeight = 0;
+    bool rawRgb = false;
+    std::string blueNoiseMask;
+    bool stream = false;
+    int stripRows = 64;
+    bool indexed = false;
+    Dithering::TemporalOptions temporal;
+    std::string serveSocket;
+    std::vector<Dithering::SweepAxis> sweepAxes;
+    int sweepColumns = 0;
+    int cellWidth = 0;
+    ProfileOutput profile;
 
     // Parse arguments
     for (int i = 1; i < argc; ++i) {
@@ -107,6 +677,11 @@ int main(int argc, char** argv) {
                 params.paletteMode = parsePalette(argv[++i]);
             }
         }
+        else if (arg == "--match") {
+            if (i + 1 < argc) {
+                params.colorMetric = parseColorMetric(argv[++i]);
+            }
+        }
         else if (arg == "-s" || arg == "--strength") {
             if (i + 1 < argc) {
                 params.strength = std::stof(argv[++i]);
@@ -135,11 +710,123 @@ int main(int argc, char** argv) {
         else if (arg == "--serpentine") {
             params.serpentine = 1.0f;
         }
+        else if (arg == "--no-serpentine") {
+            params.serpentine = 0.0f;
+        }
+        else if (arg == "--fixed-point") {
+            params.precision = Dithering::DiffusionPrecision::FIXED;
+        }
         else if (arg == "--seed") {
             if (i + 1 < argc) {
                 params.seed = std::stoi(argv[++i]);
             }
         }
+        else if (arg == "--blue-noise-mask") {
+            if (i + 1 < argc) {
+                blueNoiseMask = argv[++i];
+            }
+        }
+        else if (arg == "-t" || arg == "--threads") {
+            if (i + 1 < argc) {
+                params.threads = std::stoi(argv[++i]);
+            }
+        }
+        else if (arg == "--speedup") {
+            reportSpeedup = true;
+        }
+        else if (arg == "--backend") {
+            if (i + 1 < argc) {
+                std::string backend = argv[++i];
+                if (backend == "opencl") {
+                    params.backend = Dithering::Backend::OPENCL;
+                } else if (backend != "cpu") {
+                    std::cerr << "Unknown backend: " << backend << ", using cpu\n";
+                }
+            }
+        }
+        else if (arg == "--indexed") {
+            indexed = true;
+        }
+        else if (arg == "--stream") {
+            stream = true;
+        }
+        else if (arg == "--strip-rows") {
+            if (i + 1 < argc) {
+                stripRows = std::max(1, std::stoi(argv[++i]));
+            }
+        }
+        else if (arg == "-j" || arg == "--jobs") {
+            if (i + 1 < argc) {
+                jobs = std::stoi(argv[++i]);
+            }
+        }
+        else if (arg == "--temporal") {
+            temporal.enabled = true;
+        }
+        else if (arg == "--animate-noise") {
+            temporal.animateNoise = true;
+        }
+        else if (arg == "--tile-size") {
+            if (i + 1 < argc) {
+                temporal.tileSize = std::max(1, std::stoi(argv[++i]));
+            }
+        }
+        else if (arg == "--tolerance") {
+            if (i + 1 < argc) {
+                temporal.tolerance = std::max(0, std::stoi(argv[++i]));
+            }
+        }
+        else if (arg == "--raw") {
+            if (i + 1 >= argc || std::sscanf(argv[++i], "%dx%d", &rawWidth, &rawHeight) != 2) {
+                std::cerr << "Error: --raw expects a size like 1280x720\n";
+                return 1;
+            }
+        }
+        else if (arg == "--pix-fmt") {
+            std::string format = i + 1 < argc ? argv[++i] : "";
+            if (format != "bgr24" && format != "rgb24") {
+                std::cerr << "Error: --pix-fmt expects bgr24 or rgb24" << (format.empty() ? "" : ", not " + format)
+                          << "\n";
+                return 1;
+            }
+            rawRgb = format == "rgb24";
+        }
+        else if (arg == "--serve") {
+            if (i + 1 < argc) {
+                serveSocket = argv[++i];
+            }
+        }
+        else if (arg == "--sweep") {
+            if (i + 1 < argc) {
+                Dithering::SweepAxis axis;
+                std::string error;
+                if (!parseSweepAxis(argv[++i], axis, error)) {
+                    std::cerr << "Error: " << error << "\n";
+                    return 1;
+                }
+                sweepAxes.push_back(std::move(axis));
+            }
+        }
+        else if (arg == "--columns") {
+            if (i + 1 < argc) {
+                sweepColumns = std::max(0, std::stoi(argv[++i]));
+            }
+        }
+        else if (arg == "--cell-width") {
+            if (i + 1 < argc) {
+                cellWidth = std::max(0, std::stoi(argv[++i]));
+            }
+        }
+        else if (arg == "--profile") {
+            if (i + 1 < argc) {
+                profile.profileFile = argv[++i];
+            }
+        }
+        else if (arg == "--trace") {
+            if (i + 1 < argc) {
+                profile.traceFile = argv[++i];
+            }
+        }
         else if (inputFile.empty()) {
             inputFile = arg;
         }
@@ -148,15 +835,64 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (!serveSocket.empty()) {
+        if (!blueNoiseMask.empty() && !Dithering::loadBlueNoiseMask(blueNoiseMask)) {
+            std::cerr << "Error: Could not load blue noise mask: " << blueNoiseMask << "\n";
+            return 1;
+        }
+        profile.start();
+        return runServer(serveSocket, params, jobs);
+    }
+
     if (inputFile.empty() || outputFile.empty()) {
         std::cerr << "Error: Input and output files are required\n";
         printUsage(argv[0]);
         return 1;
     }
+    profile.start();
+
+    if (!blueNoiseMask.empty() && !Dithering::loadBlueNoiseMask(blueNoiseMask)) {
+        std::cerr << "Error: Could not load blue noise mask: " << blueNoiseMask << "\n";
+        return 1;
+    }
+
+    if (rawWidth > 0 || inputFile == "-" || outputFile == "-") {
+        if (rawWidth <= 0 || rawHeight <= 0 || inputFile != "-" || outputFile != "-") {
+            std::cerr << "Error: Raw streaming needs --raw WxH with '-' as input and output\n";
+            return 1;
+        }
+        return processRawStream(rawWidth, rawHeight, rawRgb, params, jobs, temporal);
+    }
+
+    if (!sweepAxes.empty()) {
+        if (!isImageFile(inputFile)) {
+            std::cerr << "Error: --sweep takes a single image as input\n";
+            return 1;
+        }
+        return processSweep(inputFile, outputFile, params, sweepAxes, sweepColumns, cellWidth, indexed);
+    }
+
+    std::error_code ec;
+    if (fs::is_directory(inputFile, ec)) {
+        return processDirectory(inputFile, outputFile, params, jobs, indexed, temporal);
+    }
+
+    if (isVideoFile(inputFile)) {
+        return processVideo(inputFile, outputFile, params, jobs, temporal);
+    }
+
+    if (stream) {
+        if (indexed) std::cerr << "Warning: --indexed is not supported when streaming; writing full color\n";
+        return processStream(inputFile, outputFile, params, stripRows);
+    }
 
     // Load image
     std::cout << "Loading " << inputFile << "...\n";
-    cv::Mat input = cv::imread(inputFile, cv::IMREAD_COLOR);
+    cv::Mat input;
+    {
+        DITHER_PROFILE_SCOPE("load image");
+        input = cv::imread(inputFile, cv::IMREAD_COLOR);
+    }
     if (input.empty()) {
         std::cerr << "Error: Could not load image: " << inputFile << "\n";
         return 1;
@@ -165,6 +901,20 @@ int main(int argc, char** argv) {
     std::cout << "Image size: " << input.cols << "x" << input.rows << "\n";
     std::cout << "Algorithm: " << Dithering::getAlgorithmName(params.algorithm) << "\n";
     std::cout << "Palette: " << Dithering::getPaletteModeName(params.paletteMode) << "\n";
+    if (params.colorMetric != Dithering::ColorMetric::BGR) {
+        std::cout << "Color matching: " << Dithering::getColorMetricName(params.colorMetric) << "\n";
+    }
+    if (params.backend != Dithering::Backend::CPU) {
+        std::cout << "Backend: " << Dithering::getBackendName(params.backend);
+        if (!Dithering::isBackendAvailable(params.backend)) {
+            std::cout << " (unavailable, using CPU)";
+        } else if (!Dithering::backendSupports(params.backend, params.algorithm)) {
+            std::cout << " (not supported by this algorithm, using CPU)";
+        } else if (params.colorMetric != Dithering::ColorMetric::BGR) {
+            std::cout << " (not supported with perceptual matching, using CPU)";
+        }
+        std::cout << "\n";
+    }
 
     // Process image
     std::cout << "Processing...\n";
@@ -173,11 +923,33 @@ int main(int argc, char** argv) {
     auto end = std::chrono::high_resolution_clock::now();
 
     float elapsed = std::chrono::duration<float, std::milli>(end - start).count();
-    std::cout << "Processing time: " << elapsed << " ms\n";
+    const int threads = Dithering::effectiveThreadCount(params, input.rows);
+    std::cout << "Processing time: " << elapsed << " ms";
+    if (threads > 1) {
+        std::cout << " (" << threads << " threads)";
+    } else if (Dithering::resolveThreadCount(params) > 1) {
+        std::cout << " (serial: this configuration does not use -t)";
+    }
+    std::cout << "\n";
+
+    if (reportSpeedup && threads <= 1) {
+        std::cout << "Speedup: not measured, this configuration runs serially\n";
+    } else if (reportSpeedup) {
+        Dithering::Parameters serialParams = params;
+        serialParams.threads = 1;
+
+        auto serialStart = std::chrono::high_resolution_clock::now();
+        Dithering::ditherImage(input, serialParams);
+        auto serialEnd = std::chrono::high_resolution_clock::now();
+
+        float serialElapsed = std::chrono::duration<float, std::milli>(serialEnd - serialStart).count();
+        std::cout << "Serial time: " << serialElapsed << " ms (speedup "
+                  << serialElapsed / elapsed << "x)\n";
+    }
 
     // Save image
     std::cout << "Saving to " << outputFile << "...\n";
-    if (!cv::imwrite(outputFile, output)) {
+    if (!saveImage(outputFile, output, params, indexed)) {
         std::cerr << "Error: Could not save image: " << outputFile << "\n";
         return 1;
     }
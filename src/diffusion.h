@@ -0,0 +1,733 @@
+#pragma once
+
+#include "dithering.h"
+#include "profile.h"
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Dithering {
+
+// One error-diffusion tap: target offset from the current pixel and its weight
+struct DiffusionTap {
+    int dx;
+    int dy;
+    float weight;
+};
+
+// Compile-time kernel descriptions, taps listed row by row.
+// dy is always >= 0 and dx > 0 when dy == 0 (only unvisited pixels receive error).
+struct FloydSteinbergKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 7.0f/16.0f},
+        {-1, 1, 3.0f/16.0f}, {0, 1, 5.0f/16.0f}, {1, 1, 1.0f/16.0f}
+    };
+};
+
+struct AtkinsonKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 1.0f/8.0f}, {2, 0, 1.0f/8.0f},
+        {-1, 1, 1.0f/8.0f}, {0, 1, 1.0f/8.0f}, {1, 1, 1.0f/8.0f},
+        {0, 2, 1.0f/8.0f}
+    };
+};
+
+struct JarvisJudiceNinkeKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 7.0f/48.0f}, {2, 0, 5.0f/48.0f},
+        {-2, 1, 3.0f/48.0f}, {-1, 1, 5.0f/48.0f}, {0, 1, 7.0f/48.0f}, {1, 1, 5.0f/48.0f}, {2, 1, 3.0f/48.0f},
+        {-2, 2, 1.0f/48.0f}, {-1, 2, 3.0f/48.0f}, {0, 2, 5.0f/48.0f}, {1, 2, 3.0f/48.0f}, {2, 2, 1.0f/48.0f}
+    };
+};
+
+struct StuckiKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 8.0f/42.0f}, {2, 0, 4.0f/42.0f},
+        {-2, 1, 2.0f/42.0f}, {-1, 1, 4.0f/42.0f}, {0, 1, 8.0f/42.0f}, {1, 1, 4.0f/42.0f}, {2, 1, 2.0f/42.0f},
+        {-2, 2, 1.0f/42.0f}, {-1, 2, 2.0f/42.0f}, {0, 2, 4.0f/42.0f}, {1, 2, 2.0f/42.0f}, {2, 2, 1.0f/42.0f}
+    };
+};
+
+struct BurkesKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 8.0f/32.0f}, {2, 0, 4.0f/32.0f},
+        {-2, 1, 2.0f/32.0f}, {-1, 1, 4.0f/32.0f}, {0, 1, 8.0f/32.0f}, {1, 1, 4.0f/32.0f}, {2, 1, 2.0f/32.0f}
+    };
+};
+
+struct SierraKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 5.0f/32.0f}, {2, 0, 3.0f/32.0f},
+        {-2, 1, 2.0f/32.0f}, {-1, 1, 4.0f/32.0f}, {0, 1, 5.0f/32.0f}, {1, 1, 4.0f/32.0f}, {2, 1, 2.0f/32.0f},
+        {-1, 2, 2.0f/32.0f}, {0, 2, 3.0f/32.0f}, {1, 2, 2.0f/32.0f}
+    };
+};
+
+struct SierraTwoRowKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 4.0f/16.0f}, {2, 0, 3.0f/16.0f},
+        {-2, 1, 1.0f/16.0f}, {-1, 1, 2.0f/16.0f}, {0, 1, 3.0f/16.0f}, {1, 1, 2.0f/16.0f}, {2, 1, 1.0f/16.0f}
+    };
+};
+
+struct SierraLiteKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 2.0f/4.0f},
+        {-1, 1, 1.0f/4.0f}, {0, 1, 1.0f/4.0f}
+    };
+};
+
+struct FanKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 7.0f/16.0f},
+        {0, 1, 1.0f/16.0f}, {1, 1, 5.0f/16.0f}, {-1, 1, 3.0f/16.0f}
+    };
+};
+
+struct ShiauFanKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 4.0f/16.0f}, {2, 0, 1.0f/16.0f},
+        {-2, 1, 1.0f/16.0f}, {-1, 1, 1.0f/16.0f}, {0, 1, 2.0f/16.0f}, {1, 1, 4.0f/16.0f}, {2, 1, 2.0f/16.0f}
+    };
+};
+
+struct StevenPigeonKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 2.0f/14.0f}, {2, 0, 1.0f/14.0f},
+        {-2, 1, 1.0f/14.0f}, {-1, 1, 2.0f/14.0f}, {0, 1, 2.0f/14.0f}, {1, 1, 2.0f/14.0f}, {2, 1, 1.0f/14.0f},
+        {-1, 2, 1.0f/14.0f}, {0, 2, 1.0f/14.0f}, {1, 2, 1.0f/14.0f}
+    };
+};
+
+// BT.601 luminance in 14-bit fixed point, as cv::cvtColor with
+// COLOR_BGR2GRAY; gray pixels map to their own value
+inline int luminance(const cv::Vec3b& pixel) {
+    return (pixel[0] * 1868 + pixel[1] * 9617 + pixel[2] * 4899 + 8192) >> 14;
+}
+
+// Source rows around the one being diffused, for adaptive kernels (below).
+// Rows past the image edges are reflected, as cv::Sobel does.
+struct AdaptiveRow {
+    const cv::Vec3b* above;
+    const cv::Vec3b* current;
+    const cv::Vec3b* below;
+    int width;
+    int y;
+    unsigned int seed;
+    unsigned int frame;
+};
+
+// Adaptive kernels keep their taps' positions but choose the weights per
+// pixel: Kernel::weigh(row, x, weights) writes one weight per tap for pixel
+// x of row. They always diffuse in float.
+struct GradientKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 7.0f/16.0f},
+        {-1, 1, 3.0f/16.0f}, {0, 1, 5.0f/16.0f}, {1, 1, 1.0f/16.0f}
+    };
+
+    // Floyd-Steinberg at half strength in flat areas, rising to full
+    // strength on the steepest edge an 8-bit image can have. The Sobel
+    // gradient is taken from the source rows directly, so the error spreads
+    // less where detail would be smeared.
+    static void weigh(const AdaptiveRow& row, int x, float* weights) {
+        const int left = x > 0 ? x - 1 : std::min(1, row.width - 1);
+        const int right = x + 1 < row.width ? x + 1 : std::max(row.width - 2, 0);
+        int gx = luminance(row.above[right]) + 2 * luminance(row.current[right]) + luminance(row.below[right]) -
+                 luminance(row.above[left]) - 2 * luminance(row.current[left]) - luminance(row.below[left]);
+        int gy = luminance(row.below[left]) + 2 * luminance(row.below[x]) + luminance(row.below[right]) -
+                 luminance(row.above[left]) - 2 * luminance(row.above[x]) - luminance(row.above[right]);
+        float gradient = std::min(1.0f, std::sqrt(static_cast<float>(gx * gx + gy * gy)) * (1.0f / 1020.0f));
+        float scale = 0.5f + gradient * 0.5f;
+        for (size_t i = 0; i < std::size(taps); ++i) weights[i] = taps[i].weight * scale;
+    }
+};
+
+// Floyd-Steinberg with all weights scaled by a per-pixel factor in
+// [0.7, 1.3), hashed from the seed, position and frame (see noiseHash)
+struct VariableKernel {
+    static constexpr DiffusionTap taps[] = {
+        {1, 0, 7.0f/16.0f},
+        {-1, 1, 3.0f/16.0f}, {0, 1, 5.0f/16.0f}, {1, 1, 1.0f/16.0f}
+    };
+
+    static void weigh(const AdaptiveRow& row, int x, float* weights) {
+        float scale = 0.7f + 0.6f * noiseUnit(noiseHash(row.seed, x, row.y, row.frame));
+        for (size_t i = 0; i < std::size(taps); ++i) weights[i] = taps[i].weight * scale;
+    }
+};
+
+// Ostromoukhov's variable-coefficient error diffusion ("A Simple and
+// Efficient Error-Diffusion Algorithm", SIGGRAPH 2001): three taps whose
+// weights come from a table indexed by the source pixel's intensity. The
+// published table has 256 rows mirrored about the middle, so only the
+// first 128 are stored; each is {right, down-left, down, sum}.
+struct OstromoukhovKernel {
+    static constexpr DiffusionTap taps[] = {   // Weights from the table
+        {1, 0, 0.0f},
+        {-1, 1, 0.0f}, {0, 1, 0.0f}
+    };
+
+    static const int coefficients[128][4];     // In dithering.cpp
+
+    static void weigh(const AdaptiveRow& row, int x, float* weights) {
+        int level = luminance(row.current[x]);
+        const int* entry = coefficients[level < 128 ? level : 255 - level];
+        const float inverse = 1.0f / static_cast<float>(entry[3]);
+        for (int i = 0; i < 3; ++i) weights[i] = static_cast<float>(entry[i]) * inverse;
+    }
+};
+
+template <typename Kernel, typename = void>
+struct IsAdaptiveKernel : std::false_type {};
+
+template <typename Kernel>
+struct IsAdaptiveKernel<Kernel, std::void_t<decltype(&Kernel::weigh)>> : std::true_type {};
+
+template <typename Kernel>
+constexpr bool isAdaptiveKernel = IsAdaptiveKernel<Kernel>::value;
+
+// Number of error rows a kernel touches (current row included)
+template <typename Kernel>
+constexpr int kernelRows() {
+    int rows = 1;
+    for (const DiffusionTap& tap : Kernel::taps) rows = std::max(rows, tap.dy + 1);
+    return rows;
+}
+
+// Largest horizontal distance a kernel reaches
+template <typename Kernel>
+constexpr int kernelReach() {
+    int reach = 0;
+    for (const DiffusionTap& tap : Kernel::taps) reach = std::max(reach, tap.dx < 0 ? -tap.dx : tap.dx);
+    return reach;
+}
+
+// Shift n of a kernel whose weights are all k / 2^n, or -1 when some weight
+// is not (Jarvis-Judice-Ninke, Stucki, Steven Pigeon) or they vary per pixel
+template <typename Kernel>
+constexpr int kernelShift() {
+    if (isAdaptiveKernel<Kernel>) return -1;
+    for (int n = 0; n <= 8; ++n) {
+        bool exact = true;
+        for (const DiffusionTap& tap : Kernel::taps) {
+            float scaled = tap.weight * static_cast<float>(1 << n);
+            exact = exact && scaled == static_cast<float>(static_cast<int>(scaled));
+        }
+        if (exact) return n;
+    }
+    return -1;
+}
+
+// Whether params select fixed-point errors and Kernel can run with them.
+// Errors of up to 255 * |strength| levels must fit the int16 accumulator.
+// Perceptual metrics diffuse in linear light, which stays float.
+template <typename Kernel>
+bool usesFixedPoint(const Parameters& params) {
+    return params.precision == DiffusionPrecision::FIXED && kernelShift<Kernel>() >= 0 &&
+           std::abs(params.strength) <= 2.0f && params.colorMetric == ColorMetric::BGR;
+}
+
+// sRGB transfer curve on the 0..255 scale, for diffusing error in linear light
+struct LinearLight {
+    float toLinear[256];
+    uchar toSrgb[4096];     // Nearest sRGB level of linear * 4095 / 255
+
+    // linear must be in [0, 255]
+    uchar encode(float linear) const { return toSrgb[static_cast<int>(linear * (4095.0f / 255.0f) + 0.5f)]; }
+};
+
+const LinearLight& linearLight();
+
+namespace detail {
+
+// Fixed-point errors carry 6 fractional bits: 255 levels at strength 2 is
+// 32640, just inside int16
+constexpr int errorFractionBits = 6;
+
+// Taps add error to Channels interleaved values per pixel: 3 for BGR, 1
+// for the luminance plane used with gray palettes
+template <typename Kernel, int Channels, size_t I>
+inline void addTap(float* const* errorRows, int x, int direction, const float* error, float strength) {
+    constexpr DiffusionTap tap = Kernel::taps[I];
+    float* target = errorRows[tap.dy] + (x + tap.dx * direction) * Channels;
+    for (int c = 0; c < Channels; ++c) target[c] += error[c] * tap.weight * strength;
+}
+
+template <typename Kernel, int Channels, size_t... I>
+inline void spreadError(float* const* errorRows, int x, int direction, const float* error,
+                        float strength, std::index_sequence<I...>) {
+    (addTap<Kernel, Channels, I>(errorRows, x, direction, error, strength), ...);
+}
+
+// Adaptive taps: the same positions with this pixel's weights
+template <typename Kernel, int Channels, size_t I>
+inline void addTap(float* const* errorRows, int x, int direction, const float* error, float strength,
+                   const float* weights) {
+    constexpr DiffusionTap tap = Kernel::taps[I];
+    float* target = errorRows[tap.dy] + (x + tap.dx * direction) * Channels;
+    for (int c = 0; c < Channels; ++c) target[c] += error[c] * weights[I] * strength;
+}
+
+template <typename Kernel, int Channels, size_t... I>
+inline void spreadError(float* const* errorRows, int x, int direction, const float* error,
+                        float strength, const float* weights, std::index_sequence<I...>) {
+    (addTap<Kernel, Channels, I>(errorRows, x, direction, error, strength, weights), ...);
+}
+
+// Fixed-point taps: weight k / 2^n becomes a multiply and a rounding shift.
+// error is already scaled by the strength.
+template <typename Kernel, int Channels, size_t I>
+inline void addTap(int16_t* const* errorRows, int x, int direction, const int* error) {
+    constexpr DiffusionTap tap = Kernel::taps[I];
+    constexpr int shift = kernelShift<Kernel>();
+    constexpr int weight = static_cast<int>(tap.weight * static_cast<float>(1 << shift));
+    constexpr int half = shift > 0 ? 1 << (shift - 1) : 0;
+    int16_t* target = errorRows[tap.dy] + (x + tap.dx * direction) * Channels;
+    for (int c = 0; c < Channels; ++c) {
+        target[c] = static_cast<int16_t>(target[c] + ((error[c] * weight + half) >> shift));
+    }
+}
+
+template <typename Kernel, int Channels, size_t... I>
+inline void spreadError(int16_t* const* errorRows, int x, int direction, const int* error,
+                        std::index_sequence<I...>) {
+    (addTap<Kernel, Channels, I>(errorRows, x, direction, error), ...);
+}
+
+// Pixel-level synchronisation hooks for the serial scan (no-ops)
+struct SerialSync {
+    void wait(int) {}
+    void publish(int) {}
+    void finish() {}
+};
+
+// Wavefront synchronisation: a row may process pixel i only once the row
+// above has finished pixels [0, i + lag), where lag = 2 * reach + 1. That
+// guarantees every contribution to pixel i has landed, keeps the two rows'
+// writes to shared error rows disjoint, and preserves the serial order in
+// which error accumulates, so output is bit-identical.
+// Progress is published as row * (width + 1) + done, so a slot reused by a
+// later row can never be mistaken for the row it previously tracked.
+struct alignas(64) RowProgress {
+    std::atomic<int64_t> value{0};
+};
+
+struct WavefrontSync {
+    static constexpr int publishInterval = 32;
+
+    const std::atomic<int64_t>* above;  // nullptr for the first row
+    std::atomic<int64_t>* own;
+    int64_t row;
+    int width;
+    int lag;
+    int available = 0;
+
+    void wait(int i) {
+        if (!above) return;
+        int needed = std::min(width, i + lag);
+        int64_t base = (row - 1) * (width + 1);
+        while (available < needed) {
+            available = static_cast<int>(std::max<int64_t>(above->load(std::memory_order_acquire) - base, 0));
+            if (available < needed) std::this_thread::yield();
+        }
+    }
+
+    void publish(int done) {
+        if (done % publishInterval == 0 && done < width) {
+            own->store(row * (width + 1) + done, std::memory_order_release);
+        }
+    }
+
+    void finish() {
+        own->store(row * (width + 1) + width, std::memory_order_release);
+    }
+};
+
+} // namespace detail
+
+// Error rows and wavefront progress counters. Kept by the caller so repeated
+// images of the same width reuse the memory.
+struct DiffusionScratch {
+    std::vector<float> ring;
+    std::vector<int16_t> fixedRing;     // Fixed-point error rows
+    std::unique_ptr<detail::RowProgress[]> progress;
+    int progressSlots = 0;
+
+    template <typename Error>
+    std::vector<Error>& errors();
+
+    template <typename Error>
+    void prepare(size_t values, int slots) {
+        errors<Error>().assign(values, Error(0));
+        if (slots > progressSlots) {
+            progress.reset(new detail::RowProgress[slots]);
+            progressSlots = slots;
+        }
+        // Counters hold absolute rows, so values left by a previous image
+        // would let rows run ahead
+        for (int i = 0; i < slots; ++i) progress[i].value.store(0, std::memory_order_relaxed);
+    }
+};
+
+template <>
+inline std::vector<float>& DiffusionScratch::errors<float>() { return ring; }
+
+template <>
+inline std::vector<int16_t>& DiffusionScratch::errors<int16_t>() { return fixedRing; }
+
+// Persistent helper threads for repeated parallel runs. run(count, job)
+// calls job(0) .. job(count - 1) concurrently, job(0) on the calling thread,
+// and returns when all are done. Threads are only created when a run needs
+// more than before; a run itself allocates nothing.
+class WorkerPool {
+public:
+    WorkerPool() = default;
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    template <typename Job>
+    void run(int count, Job& job) {
+        if (count <= 1) {
+            if (count == 1) job(0);
+            return;
+        }
+        while (static_cast<int>(threads.size()) < count - 1) {
+            // New threads skip the generation that is already over
+            int index = static_cast<int>(threads.size()) + 1;
+            threads.emplace_back([this, index, seen = generation] { loop(index, seen); });
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = [](void* context, int index) { (*static_cast<Job*>(context))(index); };
+            context = &job;
+            active = count;
+            pending = count - 1;
+            ++generation;
+        }
+        wake.notify_all();
+
+        job(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return pending == 0; });
+    }
+
+private:
+    void loop(int index, uint64_t seen) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            if (index >= active) continue;
+
+            void (*current)(void*, int) = task;
+            void* currentContext = context;
+            lock.unlock();
+            current(currentContext, index);
+            lock.lock();
+            if (--pending == 0) finished.notify_all();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    void (*task)(void*, int) = nullptr;
+    void* context = nullptr;
+    int active = 0;
+    int pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+namespace detail {
+
+// One row of diffusion. With Channels == 1 (gray palettes only) the pixel
+// is reduced to its luminance, quantized through the matcher's sum table
+// and diffused as a single error; on gray input that matches the BGR scan
+// exactly, with a third of the work. With Linear the pixel and its error
+// are in linear light, and only the palette lookup is made in sRGB.
+// Adaptive kernels weigh each pixel from row; fixed ones ignore it.
+template <typename Kernel, int Channels, typename Sync, bool Linear = false>
+void diffuseRow(const cv::Vec3b* src, cv::Vec3b* dst, int width, float* const* errorRows,
+                const PaletteMatcher& matcher, float strength, bool reverse, Sync& sync, const AdaptiveRow& row) {
+    static_assert(!Linear || Channels == 3, "linear light needs BGR errors");
+    constexpr size_t tapCount = std::size(Kernel::taps);
+    const std::vector<cv::Vec3b>& palette = matcher.palette();
+    const LinearLight* light = Linear ? &linearLight() : nullptr;
+
+    int step = reverse ? -1 : 1;
+    for (int i = 0; i < width; ++i) {
+        int x = reverse ? width - 1 - i : i;
+        sync.wait(i);
+
+        const float* pending = errorRows[0] + x * Channels;
+        float value[Channels];
+        int index;
+        if constexpr (Channels == 1) {
+            value[0] = std::clamp(luminance(src[x]) + pending[0], 0.0f, 255.0f);
+            index = matcher.findIndexBySum(3 * static_cast<int>(value[0]));
+        } else if constexpr (Linear) {
+            for (int c = 0; c < 3; ++c) value[c] = std::clamp(light->toLinear[src[x][c]] + pending[c], 0.0f, 255.0f);
+            index = matcher.findIndex(cv::Vec3b(light->encode(value[0]), light->encode(value[1]),
+                                                light->encode(value[2])));
+        } else {
+            for (int c = 0; c < 3; ++c) value[c] = std::clamp(src[x][c] + pending[c], 0.0f, 255.0f);
+            index = matcher.findIndex(cv::Vec3b(
+                static_cast<uchar>(value[0]),
+                static_cast<uchar>(value[1]),
+                static_cast<uchar>(value[2])
+            ));
+        }
+
+        const cv::Vec3b& quantized = palette[index];
+        dst[x] = quantized;
+
+        float error[Channels];
+        for (int c = 0; c < Channels; ++c) {
+            error[c] = value[c] - (Linear ? light->toLinear[quantized[c]] : static_cast<float>(quantized[c]));
+        }
+        if constexpr (isAdaptiveKernel<Kernel>) {
+            float weights[tapCount];
+            Kernel::weigh(row, x, weights);
+            spreadError<Kernel, Channels>(errorRows, x, step, error, strength, weights,
+                                          std::make_index_sequence<tapCount>());
+        } else {
+            spreadError<Kernel, Channels>(errorRows, x, step, error, strength, std::make_index_sequence<tapCount>());
+        }
+
+        sync.publish(i + 1);
+    }
+}
+
+// Same scan on int16 errors in 1/64 levels. Rounding to that resolution is
+// the only difference from the float path: the clamp, the truncation to a
+// pixel and the error left over follow it step by step.
+template <typename Kernel, int Channels, typename Sync>
+void diffuseRow(const cv::Vec3b* src, cv::Vec3b* dst, int width, int16_t* const* errorRows,
+                const PaletteMatcher& matcher, float strength, bool reverse, Sync& sync, const AdaptiveRow&) {
+    static_assert(kernelShift<Kernel>() >= 0, "fixed-point diffusion needs power-of-two weights");
+    constexpr size_t tapCount = std::size(Kernel::taps);
+    constexpr int bits = errorFractionBits;
+    constexpr int maxValue = 255 << bits;
+    const int scale = static_cast<int>(std::lround(strength * 256.0f));
+    const std::vector<cv::Vec3b>& palette = matcher.palette();
+
+    int step = reverse ? -1 : 1;
+    for (int i = 0; i < width; ++i) {
+        int x = reverse ? width - 1 - i : i;
+        sync.wait(i);
+
+        const int16_t* pending = errorRows[0] + x * Channels;
+        int value[Channels];
+        int index;
+        if constexpr (Channels == 1) {
+            value[0] = std::clamp((luminance(src[x]) << bits) + pending[0], 0, maxValue);
+            index = matcher.findIndexBySum(3 * (value[0] >> bits));
+        } else {
+            for (int c = 0; c < 3; ++c) value[c] = std::clamp((src[x][c] << bits) + pending[c], 0, maxValue);
+            index = matcher.findIndex(cv::Vec3b(
+                static_cast<uchar>(value[0] >> bits),
+                static_cast<uchar>(value[1] >> bits),
+                static_cast<uchar>(value[2] >> bits)
+            ));
+        }
+
+        const cv::Vec3b& quantized = palette[index];
+        dst[x] = quantized;
+
+        int error[Channels];
+        for (int c = 0; c < Channels; ++c) error[c] = ((value[c] - (quantized[c] << bits)) * scale + 128) >> 8;
+        spreadError<Kernel, Channels>(errorRows, x, step, error, std::make_index_sequence<tapCount>());
+
+        sync.publish(i + 1);
+    }
+}
+
+} // namespace detail
+
+// Generic error diffusion over a CV_8UC3 image, fed top to bottom in one
+// or more strips of rows.
+// Errors live in a ring of kernelRows() rows padded by kernelReach() pixels on
+// each side, so taps never need bounds checks; padding and rows past the
+// bottom edge simply absorb error that the full-frame version discarded.
+// The ring is all the state that crosses a strip boundary. It lives in a
+// caller-owned DiffusionScratch, and with a WorkerPool no threads are
+// created per call, so repeated images need no allocations.
+//
+// Error is float by default; Error = int16_t keeps it in fixed point (see
+// usesFixedPoint), which halves the ring and replaces the float multiplies
+// with integer ones. Gray palettes keep one luminance error per pixel
+// instead of three, and perceptual matchers diffuse float error in linear
+// light. Adaptive kernels read the source rows above and below the one
+// being diffused, so their input must be the whole image and must not be
+// the result.
+//
+// With more than one worker thread, rows are dealt round-robin to workers
+// that run as a skewed wavefront (see WavefrontSync). Serpentine scans
+// reverse every other row, which leaves nothing to overlap, so they always
+// run serially.
+template <typename Kernel, typename Error = float>
+class ErrorDiffuser {
+public:
+    // matcher defaults to getPaletteMatcher(params); pool to threads
+    // created for each process() call
+    ErrorDiffuser(int width, int height, const Parameters& params, bool serpentine, DiffusionScratch& scratch,
+                  std::shared_ptr<const PaletteMatcher> matcher = nullptr, WorkerPool* pool = nullptr)
+        : matcher(matcher ? std::move(matcher) : getPaletteMatcher(params)), width(width), height(height),
+          strength(params.strength), serpentine(serpentine), seed(params.seed), frame(params.frame),
+          channels(this->matcher->isGray() ? 1 : 3),
+          stride(static_cast<size_t>(width + 2 * reach) * channels), scratch(scratch), pool(pool) {
+        workers = serpentine ? 1 : std::max(1, std::min(resolveThreadCount(params), height));
+
+        // Rows in flight span at most workers + rows - 1 error rows. A row's slot
+        // is cleared before its completion is published, and the next row to
+        // write into that slot cannot start until then.
+        ringRows = workers > 1 ? workers + rows : rows;
+        scratch.prepare<Error>(stride * ringRows, workers > 1 ? ringRows : 0);
+    }
+
+    // Diffuse image rows [firstRow, firstRow + input.rows) from input into
+    // result (same size, preallocated). Strips must arrive in order.
+    void process(const cv::Mat& input, cv::Mat& result, int firstRow) {
+        DITHER_PROFILE_PIXELS("diffuse", input.total());
+        const int lastRow = firstRow + input.rows;
+        Error* ring = scratch.errors<Error>().data();
+        detail::RowProgress* progress = scratch.progress.get();
+
+        if (workers <= 1) {
+            Error* errorRows[rows];
+            detail::SerialSync sync;
+
+            for (int y = firstRow; y < lastRow; ++y) {
+                for (int i = 0; i < rows; ++i) {
+                    errorRows[i] = ring + ((y + i) % ringRows) * stride + reach * channels;
+                }
+
+                bool reverse = serpentine && (y % 2 == 1);
+                diffuseRow(input, y - firstRow, result.ptr<cv::Vec3b>(y - firstRow), errorRows, reverse, y, sync);
+
+                // The current row becomes the furthest-ahead row for the next step
+                std::fill(errorRows[0] - reach * channels, errorRows[0] - reach * channels + stride, Error(0));
+                sync.finish();
+            }
+            return;
+        }
+
+        // Progress is tracked by absolute row, so the first row of a strip
+        // finds the previous strip's last row already complete
+        auto worker = [&](int w) {
+            Error* errorRows[rows];
+            int start = firstRow + ((w - firstRow % workers) + workers) % workers;
+            for (int y = start; y < lastRow; y += workers) {
+                for (int i = 0; i < rows; ++i) {
+                    errorRows[i] = ring + ((y + i) % ringRows) * stride + reach * channels;
+                }
+
+                detail::WavefrontSync sync{y > 0 ? &progress[(y - 1) % ringRows].value : nullptr,
+                                           &progress[y % ringRows].value, y, width, 2 * reach + 1};
+                diffuseRow(input, y - firstRow, result.ptr<cv::Vec3b>(y - firstRow), errorRows, false, y, sync);
+
+                std::fill(errorRows[0] - reach * channels, errorRows[0] - reach * channels + stride, Error(0));
+                sync.finish();
+            }
+        };
+
+        int active = std::min(workers, input.rows);
+        auto job = [&](int k) { worker((firstRow + k) % workers); };
+        if (pool) {
+            pool->run(active, job);
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        threads.reserve(active - 1);
+        for (int k = 1; k < active; ++k) threads.emplace_back(job, k);
+        job(0);
+        for (auto& thread : threads) thread.join();
+    }
+
+private:
+    static constexpr int rows = kernelRows<Kernel>();
+    static constexpr int reach = kernelReach<Kernel>();
+
+    // Row r of input, which is image row y
+    template <typename Sync>
+    void diffuseRow(const cv::Mat& input, int r, cv::Vec3b* dst, Error* const* errorRows, bool reverse, int y,
+                    Sync& sync) {
+        const cv::Vec3b* src = input.ptr<cv::Vec3b>(r);
+        AdaptiveRow row{src, src, src, width, y, seed, frame};
+        if constexpr (isAdaptiveKernel<Kernel>) {
+            const int last = input.rows - 1;
+            row.above = input.ptr<cv::Vec3b>(r > 0 ? r - 1 : std::min(1, last));
+            row.below = input.ptr<cv::Vec3b>(r < last ? r + 1 : std::max(last - 1, 0));
+        }
+
+        if (channels == 1) {
+            detail::diffuseRow<Kernel, 1>(src, dst, width, errorRows, *matcher, strength, reverse, sync, row);
+            return;
+        }
+        if constexpr (std::is_same_v<Error, float>) {
+            if (matcher->linearLight()) {
+                detail::diffuseRow<Kernel, 3, Sync, true>(src, dst, width, errorRows, *matcher, strength, reverse,
+                                                          sync, row);
+                return;
+            }
+        }
+        detail::diffuseRow<Kernel, 3>(src, dst, width, errorRows, *matcher, strength, reverse, sync, row);
+    }
+
+    std::shared_ptr<const PaletteMatcher> matcher;
+    int width;
+    int height;
+    float strength;
+    bool serpentine;
+    unsigned int seed;
+    unsigned int frame;
+    int channels;       // 1 for gray palettes, which diffuse luminance only
+    size_t stride;
+    DiffusionScratch& scratch;
+    WorkerPool* pool;
+    int workers = 1;
+    int ringRows = 1;
+};
+
+template <typename Kernel>
+cv::Mat diffuseErrors(const cv::Mat& input, const Parameters& params, bool serpentine) {
+    cv::Mat result(input.rows, input.cols, CV_8UC3);
+    DiffusionScratch scratch;
+    if constexpr (kernelShift<Kernel>() >= 0) {
+        if (usesFixedPoint<Kernel>(params)) {
+            ErrorDiffuser<Kernel, int16_t>(input.cols, input.rows, params, serpentine, scratch)
+                .process(input, result, 0);
+            return result;
+        }
+    }
+    ErrorDiffuser<Kernel>(input.cols, input.rows, params, serpentine, scratch).process(input, result, 0);
+    return result;
+}
+
+} // namespace Dithering
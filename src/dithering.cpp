@@ -1,597 +1,471 @@
 #include "dithering.h"
+#include "diffusion.h"
+#include "gpu.h"
+#include "bluenoise.h"
+#include "profile.h"
 #include <algorithm>
+#include <array>
 #include <cmath>
-#include <random>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
 
 namespace Dithering {
 
-// Helper function to apply preprocessing (gamma, contrast, brightness, saturation)
-cv::Mat preprocessImage(const cv::Mat& input, const Parameters& params) {
-    cv::Mat processed = input.clone();
-
-    // Convert to float for processing
-    processed.convertTo(processed, CV_32FC3, 1.0/255.0);
-
-    // Brightness and contrast
-    processed = processed * params.contrast + params.brightness;
+// Whether any preprocessing adjustment differs from its neutral value
+bool needsPreprocessing(const Parameters& params) {
+    return params.contrast != 1.0f || params.brightness != 0.0f ||
+           params.gamma != 1.0f || params.saturation != 1.0f;
+}
 
-    // Gamma correction
-    if (params.gamma != 1.0f) {
-        cv::pow(processed, params.gamma, processed);
+// Contrast, brightness and gamma for every 8-bit input level, in [0, 1] units.
+// Like cv::pow, non-integer gamma is applied to the magnitude.
+std::array<float, 256> buildToneCurve(const Parameters& params) {
+    std::array<float, 256> curve;
+    bool integerGamma = params.gamma == std::floor(params.gamma);
+
+    for (int v = 0; v < 256; ++v) {
+        float value = static_cast<float>(v * (1.0 / 255.0)) * params.contrast + params.brightness;
+        if (params.gamma != 1.0f) {
+            value = integerGamma ? std::pow(value, params.gamma)
+                                 : std::pow(std::abs(value), params.gamma);
+        }
+        curve[v] = value;
     }
+    return curve;
+}
 
-    // Saturation
-    if (params.saturation != 1.0f) {
-        cv::Mat hsv;
-        cv::cvtColor(processed, hsv, cv::COLOR_BGR2HSV);
-        std::vector<cv::Mat> channels;
-        cv::split(hsv, channels);
-        channels[1] = channels[1] * params.saturation;
-        cv::merge(channels, hsv);
-        cv::cvtColor(hsv, processed, cv::COLOR_HSV2BGR);
+// Apply preprocessing (gamma, contrast, brightness, saturation) in a single
+// pass into processed, reusing its buffer and lut's when they fit. The tone
+// curve is a per-level table; saturation scales each channel's distance from
+// the brightest channel, which is what scaling S in an HSV round trip does
+// while keeping H and V.
+void preprocessInto(const cv::Mat& input, cv::Mat& processed, const Parameters& params, cv::Mat& lut) {
+    DITHER_PROFILE_PIXELS("preprocess", input.total());
+    std::array<float, 256> curve = buildToneCurve(params);
+    processed.create(input.rows, input.cols, CV_8UC3);
+
+    if (params.saturation == 1.0f) {
+        lut.create(1, 256, CV_8U);
+        for (int v = 0; v < 256; ++v) {
+            lut.at<uchar>(0, v) = cv::saturate_cast<uchar>(std::clamp(curve[v], 0.0f, 1.0f) * 255.0f);
+        }
+        cv::LUT(input, lut, processed);
+        return;
     }
 
-    // Clamp and convert back
-    processed = cv::max(cv::min(processed, 1.0), 0.0);
-    processed.convertTo(processed, CV_8UC3, 255.0);
-
-    return processed;
+    const float saturation = params.saturation;
+    cv::parallel_for_(cv::Range(0, input.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const cv::Vec3b* src = input.ptr<cv::Vec3b>(y);
+            cv::Vec3b* dst = processed.ptr<cv::Vec3b>(y);
+
+            for (int x = 0; x < input.cols; ++x) {
+                float b = curve[src[x][0]];
+                float g = curve[src[x][1]];
+                float r = curve[src[x][2]];
+                float v = std::max(b, std::max(g, r));
+
+                dst[x] = cv::Vec3b(
+                    cv::saturate_cast<uchar>(std::clamp(v + (b - v) * saturation, 0.0f, 1.0f) * 255.0f),
+                    cv::saturate_cast<uchar>(std::clamp(v + (g - v) * saturation, 0.0f, 1.0f) * 255.0f),
+                    cv::saturate_cast<uchar>(std::clamp(v + (r - v) * saturation, 0.0f, 1.0f) * 255.0f)
+                );
+            }
+        }
+    });
 }
 
 // Main dithering function dispatcher
 cv::Mat ditherImage(const cv::Mat& input, const Parameters& params) {
-    cv::Mat preprocessed = preprocessImage(input, params);
-
-    switch (params.algorithm) {
-        case Algorithm::FLOYD_STEINBERG:
-            return floydSteinberg(preprocessed, params);
-        case Algorithm::ATKINSON:
-            return atkinson(preprocessed, params);
-        case Algorithm::JARVIS_JUDICE_NINKE:
-            return jarvisJudiceNinke(preprocessed, params);
-        case Algorithm::STUCKI:
-            return stucki(preprocessed, params);
-        case Algorithm::BURKES:
-            return burkes(preprocessed, params);
-        case Algorithm::SIERRA:
-            return sierra(preprocessed, params);
-        case Algorithm::SIERRA_TWO_ROW:
-            return sierraTwo(preprocessed, params);
-        case Algorithm::SIERRA_LITE:
-            return sierraLite(preprocessed, params);
-        case Algorithm::ORDERED_BAYER_2X2:
-        case Algorithm::ORDERED_BAYER_4X4:
-        case Algorithm::ORDERED_BAYER_8X8:
-        case Algorithm::ORDERED_BAYER_16X16:
-            return orderedDither(preprocessed, params);
-        case Algorithm::BLUE_NOISE:
-            return blueNoiseDither(preprocessed, params);
-        case Algorithm::WHITE_NOISE:
-            return whiteNoiseDither(preprocessed, params);
-        case Algorithm::RANDOM_DITHER:
-            return randomDither(preprocessed, params);
-        case Algorithm::PATTERN_DITHER:
-            return patternDither(preprocessed, params);
-        case Algorithm::DOT_DIFFUSION:
-            return dotDiffusion(preprocessed, params);
-        case Algorithm::RIEMERSMA:
-            return riemersma(preprocessed, params);
-        case Algorithm::GRADIENT_BASED:
-            return gradientBased(preprocessed, params);
-        case Algorithm::VARIABLE_ERROR_DIFFUSION:
-            return variableErrorDiffusion(preprocessed, params);
-        case Algorithm::OSTROMOUKHOV:
-            return ostromoukhov(preprocessed, params);
-        case Algorithm::FAN:
-            return fan(preprocessed, params);
-        case Algorithm::SHIAU_FAN:
-            return shiauFan(preprocessed, params);
-        case Algorithm::STEVENPIGEON:
-            return stevenPigeon(preprocessed, params);
-        default:
-            return floydSteinberg(preprocessed, params);
-    }
+    Workspace workspace;
+    cv::Mat result;
+    ditherImage(input, result, params, workspace);
+    return result;
 }
 
-// Error diffusion helper
-void diffuseError(cv::Mat& errors, int x, int y, const cv::Vec3f& error,
-                  const std::vector<std::pair<int, int>>& offsets,
-                  const std::vector<float>& weights, float strength, bool serpentine) {
-    int direction = (serpentine && (y % 2 == 1)) ? -1 : 1;
-
-    for (size_t i = 0; i < offsets.size(); ++i) {
-        int nx = x + offsets[i].first * direction;
-        int ny = y + offsets[i].second;
+// Device-side dispatcher
+cv::UMat ditherImage(const cv::UMat& input, const Parameters& params) {
+    cv::UMat source = input;
+    if (input.type() == CV_8UC1) {
+        cv::cvtColor(input, source, cv::COLOR_GRAY2BGR);
+    } else if (input.type() == CV_8UC4) {
+        cv::cvtColor(input, source, cv::COLOR_BGRA2BGR);
+    }
 
-        if (nx >= 0 && nx < errors.cols && ny >= 0 && ny < errors.rows) {
-            errors.at<cv::Vec3f>(ny, nx) += error * weights[i] * strength;
+    cv::UMat result;
+    if (params.backend == Backend::OPENCL) {
+        if (openclDither(source, result, params)) return result;
+
+        // Other algorithms still get their preprocessing on the device
+        cv::UMat adjusted;
+        if (needsPreprocessing(params) && openclPreprocess(source, adjusted, params)) {
+            Parameters neutral = params;
+            neutral.gamma = neutral.contrast = neutral.saturation = 1.0f;
+            neutral.brightness = 0.0f;
+
+            cv::Mat dithered;
+            {
+                cv::Mat host = adjusted.getMat(cv::ACCESS_READ);
+                dithered = ditherImage(host, neutral);
+            }
+            dithered.copyTo(result);
+            return result;
         }
     }
+
+    cv::Mat dithered;
+    {
+        cv::Mat host = source.getMat(cv::ACCESS_READ);
+        dithered = ditherImage(host, params);
+    }
+    dithered.copyTo(result);
+    return result;
 }
 
 // Floyd-Steinberg dithering
 cv::Mat floydSteinberg(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-
-    std::vector<std::pair<int, int>> offsets = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
-    std::vector<float> weights = {7.0f/16.0f, 3.0f/16.0f, 5.0f/16.0f, 1.0f/16.0f};
-
-    for (int y = 0; y < input.rows; ++y) {
-        bool reverse = (params.serpentine > 0.5f) && (y % 2 == 1);
-        int start = reverse ? input.cols - 1 : 0;
-        int end = reverse ? -1 : input.cols;
-        int step = reverse ? -1 : 1;
-
-        for (int x = start; x != end; x += step) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
-
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
-
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
-
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
-
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, params.serpentine > 0.5f);
-        }
-    }
-
-    return result;
+    return diffuseErrors<FloydSteinbergKernel>(input, params, params.serpentine > 0.5f);
 }
 
 // Atkinson dithering (used in early Mac systems)
 cv::Mat atkinson(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-
-    std::vector<std::pair<int, int>> offsets = {{1, 0}, {2, 0}, {-1, 1}, {0, 1}, {1, 1}, {0, 2}};
-    std::vector<float> weights(6, 1.0f/8.0f);
-
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
-
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
-
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
-
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
-
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
-        }
-    }
-
-    return result;
+    return diffuseErrors<AtkinsonKernel>(input, params, false);
 }
 
 // Jarvis-Judice-Ninke dithering
 cv::Mat jarvisJudiceNinke(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-
-    std::vector<std::pair<int, int>> offsets = {
-        {1, 0}, {2, 0},
-        {-2, 1}, {-1, 1}, {0, 1}, {1, 1}, {2, 1},
-        {-2, 2}, {-1, 2}, {0, 2}, {1, 2}, {2, 2}
-    };
-    std::vector<float> weights = {
-        7.0f/48.0f, 5.0f/48.0f,
-        3.0f/48.0f, 5.0f/48.0f, 7.0f/48.0f, 5.0f/48.0f, 3.0f/48.0f,
-        1.0f/48.0f, 3.0f/48.0f, 5.0f/48.0f, 3.0f/48.0f, 1.0f/48.0f
-    };
-
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
-
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
-
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
-
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
-
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
-        }
-    }
-
-    return result;
+    return diffuseErrors<JarvisJudiceNinkeKernel>(input, params, false);
 }
 
 // Stucki dithering
 cv::Mat stucki(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-
-    std::vector<std::pair<int, int>> offsets = {
-        {1, 0}, {2, 0},
-        {-2, 1}, {-1, 1}, {0, 1}, {1, 1}, {2, 1},
-        {-2, 2}, {-1, 2}, {0, 2}, {1, 2}, {2, 2}
-    };
-    std::vector<float> weights = {
-        8.0f/42.0f, 4.0f/42.0f,
-        2.0f/42.0f, 4.0f/42.0f, 8.0f/42.0f, 4.0f/42.0f, 2.0f/42.0f,
-        1.0f/42.0f, 2.0f/42.0f, 4.0f/42.0f, 2.0f/42.0f, 1.0f/42.0f
-    };
-
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
-
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
-
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
-
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
-
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
-        }
-    }
-
-    return result;
+    return diffuseErrors<StuckiKernel>(input, params, false);
 }
 
 // Burkes dithering
 cv::Mat burkes(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-
-    std::vector<std::pair<int, int>> offsets = {
-        {1, 0}, {2, 0},
-        {-2, 1}, {-1, 1}, {0, 1}, {1, 1}, {2, 1}
-    };
-    std::vector<float> weights = {
-        8.0f/32.0f, 4.0f/32.0f,
-        2.0f/32.0f, 4.0f/32.0f, 8.0f/32.0f, 4.0f/32.0f, 2.0f/32.0f
-    };
-
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
-
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
-
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
-
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
-
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
-        }
-    }
-
-    return result;
+    return diffuseErrors<BurkesKernel>(input, params, false);
 }
 
 // Sierra dithering
 cv::Mat sierra(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-
-    std::vector<std::pair<int, int>> offsets = {
-        {1, 0}, {2, 0},
-        {-2, 1}, {-1, 1}, {0, 1}, {1, 1}, {2, 1},
-        {-1, 2}, {0, 2}, {1, 2}
-    };
-    std::vector<float> weights = {
-        5.0f/32.0f, 3.0f/32.0f,
-        2.0f/32.0f, 4.0f/32.0f, 5.0f/32.0f, 4.0f/32.0f, 2.0f/32.0f,
-        2.0f/32.0f, 3.0f/32.0f, 2.0f/32.0f
-    };
-
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
-
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
-
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
-
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
-
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
-        }
-    }
-
-    return result;
+    return diffuseErrors<SierraKernel>(input, params, false);
 }
 
 // Sierra Two-Row dithering
 cv::Mat sierraTwo(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-
-    std::vector<std::pair<int, int>> offsets = {
-        {1, 0}, {2, 0},
-        {-2, 1}, {-1, 1}, {0, 1}, {1, 1}, {2, 1}
-    };
-    std::vector<float> weights = {
-        4.0f/16.0f, 3.0f/16.0f,
-        1.0f/16.0f, 2.0f/16.0f, 3.0f/16.0f, 2.0f/16.0f, 1.0f/16.0f
-    };
-
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
-
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
-
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
-
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
-
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
-        }
-    }
-
-    return result;
+    return diffuseErrors<SierraTwoRowKernel>(input, params, false);
 }
 
 // Sierra Lite dithering
 cv::Mat sierraLite(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-
-    std::vector<std::pair<int, int>> offsets = {
-        {1, 0},
-        {-1, 1}, {0, 1}
-    };
-    std::vector<float> weights = {
-        2.0f/4.0f,
-        1.0f/4.0f, 1.0f/4.0f
-    };
+    return diffuseErrors<SierraLiteKernel>(input, params, false);
+}
 
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
+namespace {
 
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
-
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
-
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
+// Rank of (x, y) in a size x size Bayer matrix (size a power of two): each
+// level places the 2x2 pattern {0, 2, 3, 1} over the quadrants of the next
+constexpr int bayerRank(int x, int y, int size) {
+    if (size < 2) return 0;
+    const int half = size / 2;
+    const int base[2][2] = {{0, 2}, {3, 1}};
+    return 4 * bayerRank(x % half, y % half, half) + base[y / half][x / half];
+}
 
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
+template <int Size>
+constexpr std::array<uint8_t, Size * Size> makeBayerTable() {
+    static_assert(Size * Size <= 256, "Bayer ranks must fit in 8 bits");
+    std::array<uint8_t, Size * Size> table{};
+    for (int y = 0; y < Size; ++y) {
+        for (int x = 0; x < Size; ++x) {
+            table[y * Size + x] = static_cast<uint8_t>(bayerRank(x, y, Size));
         }
     }
-
-    return result;
+    return table;
 }
 
-// Generate Bayer matrix
-cv::Mat generateBayerMatrix(int size) {
-    if (size == 2) {
-        cv::Mat bayer = (cv::Mat_<float>(2, 2) << 0, 2, 3, 1);
-        return bayer / 4.0f;
-    }
-
-    int halfSize = size / 2;
-    cv::Mat smaller = generateBayerMatrix(halfSize);
-    cv::Mat bayer = cv::Mat::zeros(size, size, CV_32F);
-
-    for (int y = 0; y < halfSize; ++y) {
-        for (int x = 0; x < halfSize; ++x) {
-            float val = smaller.at<float>(y, x);
-            bayer.at<float>(y, x) = 4 * val + 0;
-            bayer.at<float>(y, x + halfSize) = 4 * val + 2;
-            bayer.at<float>(y + halfSize, x) = 4 * val + 3;
-            bayer.at<float>(y + halfSize, x + halfSize) = 4 * val + 1;
-        }
+// Bayer ranks for the sizes the algorithms use, built at compile time
+constexpr auto bayerTable2 = makeBayerTable<2>();
+constexpr auto bayerTable4 = makeBayerTable<4>();
+constexpr auto bayerTable8 = makeBayerTable<8>();
+constexpr auto bayerTable16 = makeBayerTable<16>();
+
+static_assert(bayerTable2[1] == 2 && bayerTable2[2] == 3 && bayerTable2[3] == 1, "Bayer 2x2 layout");
+static_assert(bayerTable16[255] == 85, "Bayer 16x16 layout");
+
+const uint8_t* bayerTable(int size) {
+    switch (size) {
+        case 2: return bayerTable2.data();
+        case 4: return bayerTable4.data();
+        case 8: return bayerTable8.data();
+        case 16: return bayerTable16.data();
+        default: return nullptr;
     }
-
-    return bayer / (size * size);
 }
 
-// Ordered dithering (Bayer matrix)
-cv::Mat orderedDither(const cv::Mat& input, const Parameters& params) {
-    int size = params.bayerSize;
-    cv::Mat bayerMatrix = generateBayerMatrix(size);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-    cv::Mat result = input.clone();
+} // namespace
 
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            float threshold = bayerMatrix.at<float>(y % size, x % size);
-            cv::Vec3b pixel = input.at<cv::Vec3b>(y, x);
+// Generate Bayer matrix. Sizes that are not a power of two are rounded down.
+cv::Mat generateBayerMatrix(int size) {
+    int levels = 2;
+    while (levels * 2 <= size) levels *= 2;
+    size = levels;
 
-            cv::Vec3f pixelF(pixel[0], pixel[1], pixel[2]);
-            cv::Vec3f adjusted = pixelF + cv::Vec3f(threshold * 255.0f - 127.5f) * params.strength;
+    cv::Mat bayer(size, size, CV_32F);
+    const uint8_t* table = bayerTable(size);
+    const float scale = 1.0f / (size * size);
 
-            adjusted = cv::Vec3f(
-                std::clamp(adjusted[0], 0.0f, 255.0f),
-                std::clamp(adjusted[1], 0.0f, 255.0f),
-                std::clamp(adjusted[2], 0.0f, 255.0f)
-            );
+    for (int y = 0; y < size; ++y) {
+        float* row = bayer.ptr<float>(y);
+        for (int x = 0; x < size; ++x) {
+            int rank = table ? table[y * size + x] : bayerRank(x, y, size);
+            row[x] = rank * scale;
+        }
+    }
 
-            cv::Vec3b adjustedPixel(
-                static_cast<uchar>(adjusted[0]),
-                static_cast<uchar>(adjusted[1]),
-                static_cast<uchar>(adjusted[2])
-            );
+    return bayer;
+}
 
-            result.at<cv::Vec3b>(y, x) = findClosestColor(adjustedPixel, palette);
-        }
+// Threshold-map kernels. Pixels are independent, so rows are spread over
+// OpenCV's thread pool and processed with flat loops the compiler vectorises.
+// Row functions get an AVX2 clone picked at load time where the toolchain
+// supports function multiversioning; elsewhere they are built for the
+// baseline ISA (SSE2 on x86-64, NEON on AArch64).
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define DITHER_ROW_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define DITHER_ROW_KERNEL
+#endif
+
+namespace {
+
+// Add per-channel offsets, clamp and truncate to 8 bits
+DITHER_ROW_KERNEL
+void applyThresholdRow(const uchar* src, const float* offsets, uchar* dst, int count) {
+    for (int i = 0; i < count; ++i) {
+        float value = src[i] + offsets[i];
+        dst[i] = static_cast<uchar>(std::min(std::max(value, 0.0f), 255.0f));
     }
+}
 
-    return result;
+// BT.601 luminance of a BGR row, the same reduction the diffusion kernels
+// apply for gray palettes
+DITHER_ROW_KERNEL
+void luminanceRow(const uchar* src, uchar* dst, int width) {
+    const cv::Vec3b* in = reinterpret_cast<const cv::Vec3b*>(src);
+    for (int x = 0; x < width; ++x) dst[x] = static_cast<uchar>(luminance(in[x]));
 }
 
-// Blue noise dithering
-cv::Mat blueNoiseDither(const cv::Mat& input, const Parameters& params) {
-    cv::Mat blueNoise = generateBlueNoiseTexture(256, params.seed);
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-    cv::Mat result = input.clone();
+// Two-level gray palettes reduce to comparing 3 * level against a split
+DITHER_ROW_KERNEL
+void quantizeBinaryGrayRow(const uchar* levels, uchar* dst, int width, int split, uchar low, uchar high) {
+    for (int x = 0; x < width; ++x) {
+        uchar value = levels[x] * 3 >= split ? high : low;
+        dst[x * 3] = value;
+        dst[x * 3 + 1] = value;
+        dst[x * 3 + 2] = value;
+    }
+}
 
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            float noise = blueNoise.at<float>(y % 256, x % 256);
-            cv::Vec3b pixel = input.at<cv::Vec3b>(y, x);
+// Gray palettes: one level per pixel, expanded to BGR only on output
+void quantizeGrayRow(const uchar* levels, uchar* dst, int width, const PaletteMatcher& matcher) {
+    const std::vector<cv::Vec3b>& palette = matcher.palette();
+    if (matcher.isBinaryGray()) {
+        quantizeBinaryGrayRow(levels, dst, width, matcher.binarySplit(),
+                              palette[matcher.binaryLow()][0], palette[matcher.binaryHigh()][0]);
+        return;
+    }
+    cv::Vec3b* out = reinterpret_cast<cv::Vec3b*>(dst);
+    for (int x = 0; x < width; ++x) out[x] = palette[matcher.findIndexBySum(3 * levels[x])];
+}
 
-            cv::Vec3f pixelF(pixel[0], pixel[1], pixel[2]);
-            cv::Vec3f adjusted = pixelF + cv::Vec3f(noise * 255.0f - 127.5f) * params.strength;
+void quantizeRow(const uchar* src, uchar* dst, int width, const PaletteMatcher& matcher) {
+    const cv::Vec3b* in = reinterpret_cast<const cv::Vec3b*>(src);
+    cv::Vec3b* out = reinterpret_cast<cv::Vec3b*>(dst);
+    for (int x = 0; x < width; ++x) out[x] = matcher.findClosest(in[x]);
+}
 
-            adjusted = cv::Vec3f(
-                std::clamp(adjusted[0], 0.0f, 255.0f),
-                std::clamp(adjusted[1], 0.0f, 255.0f),
-                std::clamp(adjusted[2], 0.0f, 255.0f)
-            );
+// Threshold in [0, 1] of a CV_32F map, or of a CV_16U rank mask
+float thresholdAt(const cv::Mat& thresholdMap, int y, int x) {
+    if (thresholdMap.depth() == CV_16U) {
+        return thresholdMap.at<uint16_t>(y, x) * (1.0f / 65536.0f);
+    }
+    return thresholdMap.at<float>(y, x);
+}
 
-            cv::Vec3b adjustedPixel(
-                static_cast<uchar>(adjusted[0]),
-                static_cast<uchar>(adjusted[1]),
-                static_cast<uchar>(adjusted[2])
-            );
+// Per-row buffers of the threshold and noise passes
+struct RowScratch {
+    std::vector<float> offsets;             // One per pixel
+    std::vector<float> channelOffsets;      // offsets repeated for b, g and r
+    std::vector<uchar> levels;              // Luminance, for gray palettes
+    std::vector<uchar> adjusted;
+
+    void prepare(int width) {
+        offsets.resize(width);
+        channelOffsets.resize(static_cast<size_t>(width) * 3);
+        levels.resize(width);
+        adjusted.resize(static_cast<size_t>(width) * 3);
+    }
+};
+
+// Add rows.offsets to a BGR row and quantize it. Gray palettes offset and
+// match the pixel's luminance alone, a third of the work, so threshold,
+// noise and diffusion kernels all reduce color input to gray the same way.
+void offsetAndQuantizeRow(const uchar* src, uchar* dst, int width, RowScratch& rows, const PaletteMatcher& matcher) {
+    if (matcher.isGray()) {
+        luminanceRow(src, rows.levels.data(), width);
+        applyThresholdRow(rows.levels.data(), rows.offsets.data(), rows.adjusted.data(), width);
+        quantizeGrayRow(rows.adjusted.data(), dst, width, matcher);
+        return;
+    }
+    for (int x = 0; x < width; ++x) {
+        rows.channelOffsets[x * 3] = rows.channelOffsets[x * 3 + 1] = rows.channelOffsets[x * 3 + 2] = rows.offsets[x];
+    }
+    applyThresholdRow(src, rows.channelOffsets.data(), rows.adjusted.data(), width * 3);
+    quantizeRow(rows.adjusted.data(), dst, width, matcher);
+}
 
-            result.at<cv::Vec3b>(y, x) = findClosestColor(adjustedPixel, palette);
+// Buffers of thresholdDither, kept between calls by a Workspace or engine
+struct ThresholdScratch {
+    cv::Mat offsets;
+    std::vector<RowScratch> stripes;
+};
+
+// Dither against a tiled threshold map (see thresholdAt) read from
+// (originX, originY) onwards. result must already be input-sized CV_8UC3
+// and may be input itself.
+void thresholdDither(const cv::Mat& input, cv::Mat& result, const cv::Mat& thresholdMap, const Parameters& params,
+                     const PaletteMatcher& matcher, ThresholdScratch& scratch, int originX = 0, int originY = 0) {
+    DITHER_PROFILE_PIXELS("threshold", input.total());
+    // Only the part of the map the image covers is needed; large masks can
+    // be bigger than the image
+    const int mapRows = std::min(thresholdMap.rows, input.rows);
+    const int mapCols = std::min(thresholdMap.cols, input.cols);
+    cv::Mat& offsets = scratch.offsets;
+    offsets.create(std::max(mapRows, 1), std::max(mapCols, 1), CV_32F);
+    for (int y = 0; y < mapRows; ++y) {
+        int mapY = (y + originY) % thresholdMap.rows;
+        for (int x = 0; x < mapCols; ++x) {
+            float t = thresholdAt(thresholdMap, mapY, (x + originX) % thresholdMap.cols);
+            offsets.at<float>(y, x) = (t * 255.0f - 127.5f) * params.strength;
         }
     }
 
+    // One band of rows per OpenCV thread, each with its own row buffers
+    const int width = input.cols;
+    const int stripes = std::max(1, std::min(input.rows, cv::getNumThreads()));
+    if (static_cast<int>(scratch.stripes.size()) < stripes) scratch.stripes.resize(stripes);
+    for (int i = 0; i < stripes; ++i) scratch.stripes[i].prepare(width);
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range) {
+        for (int stripe = range.start; stripe < range.end; ++stripe) {
+            RowScratch& rows = scratch.stripes[stripe];
+            const int begin = static_cast<int>(static_cast<int64_t>(input.rows) * stripe / stripes);
+            const int end = static_cast<int>(static_cast<int64_t>(input.rows) * (stripe + 1) / stripes);
+
+            for (int y = begin; y < end; ++y) {
+                const float* mapRow = offsets.ptr<float>(y % offsets.rows);
+                for (int x = 0, m = 0; x < width; ++x) {
+                    rows.offsets[x] = mapRow[m];
+                    if (++m == offsets.cols) m = 0;
+                }
+                offsetAndQuantizeRow(input.ptr<uchar>(y), result.ptr<uchar>(y), width, rows, matcher);
+            }
+        }
+    }, stripes);
+}
+
+cv::Mat thresholdDither(const cv::Mat& input, const cv::Mat& thresholdMap, const Parameters& params,
+                        int originX = 0, int originY = 0) {
+    cv::Mat result(input.rows, input.cols, CV_8UC3);
+    ThresholdScratch scratch;
+    thresholdDither(input, result, thresholdMap, params, *getPaletteMatcher(params), scratch, originX, originY);
     return result;
 }
 
-// White noise dithering
-cv::Mat whiteNoiseDither(const cv::Mat& input, const Parameters& params) {
-    std::mt19937 rng(params.seed);
-    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+// Where a loaded blue noise mask is read from, so seeds give different
+// (toroidally shifted) patterns
+void blueNoiseMaskOrigin(const cv::Mat& ranks, unsigned int seed, int& originX, int& originY) {
+    uint32_t h = seed;
+    h ^= h >> 16; h *= 0x7feb352du;
+    h ^= h >> 15; h *= 0x846ca68bu;
+    h ^= h >> 16;
+    originX = static_cast<int>((h & 0xffff) % ranks.cols);
+    originY = static_cast<int>((h >> 16) % ranks.rows);
+}
 
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-    cv::Mat result = input.clone();
+} // namespace
 
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            float noise = dist(rng);
-            cv::Vec3b pixel = input.at<cv::Vec3b>(y, x);
+// Ordered dithering (Bayer matrix)
+cv::Mat orderedDither(const cv::Mat& input, const Parameters& params) {
+    return thresholdDither(input, *getCachedThresholdMap(ThresholdMapType::BAYER, params.bayerSize), params);
+}
 
-            cv::Vec3f pixelF(pixel[0], pixel[1], pixel[2]);
-            cv::Vec3f adjusted = pixelF + cv::Vec3f(noise * 255.0f - 127.5f) * params.strength;
+// Blue noise dithering, from the loaded mask file when there is one
+cv::Mat blueNoiseDither(const cv::Mat& input, const Parameters& params) {
+    if (auto mask = getBlueNoiseMask()) {
+        int originX, originY;
+        blueNoiseMaskOrigin(mask->ranks(), params.seed, originX, originY);
+        return thresholdDither(input, mask->ranks(), params, originX, originY);
+    }
+    return thresholdDither(input, *getCachedThresholdMap(ThresholdMapType::BLUE_NOISE, 64, params.seed), params);
+}
 
-            adjusted = cv::Vec3f(
-                std::clamp(adjusted[0], 0.0f, 255.0f),
-                std::clamp(adjusted[1], 0.0f, 255.0f),
-                std::clamp(adjusted[2], 0.0f, 255.0f)
-            );
+namespace {
 
-            cv::Vec3b adjustedPixel(
-                static_cast<uchar>(adjusted[0]),
-                static_cast<uchar>(adjusted[1]),
-                static_cast<uchar>(adjusted[2])
-            );
+uint32_t hashBits(uint32_t x) {
+    x ^= x >> 16; x *= 0x7feb352du;
+    x ^= x >> 15; x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
 
-            result.at<cv::Vec3b>(y, x) = findClosestColor(adjustedPixel, palette);
+// White noise offsets hashed from each pixel's position in the whole image,
+// which starts (originX, originY) before input. Rows are independent, so
+// they are split across threads like thresholdDither. result must already
+// be input-sized CV_8UC3 and may be input itself.
+void whiteNoiseDither(const cv::Mat& input, cv::Mat& result, const Parameters& params,
+                      const PaletteMatcher& matcher, ThresholdScratch& scratch, int originX = 0, int originY = 0) {
+    DITHER_PROFILE_PIXELS("white noise", input.total());
+    const int width = input.cols;
+    const int stripes = std::max(1, std::min(input.rows, cv::getNumThreads()));
+    if (static_cast<int>(scratch.stripes.size()) < stripes) scratch.stripes.resize(stripes);
+    for (int i = 0; i < stripes; ++i) scratch.stripes[i].prepare(width);
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range) {
+        for (int stripe = range.start; stripe < range.end; ++stripe) {
+            RowScratch& rows = scratch.stripes[stripe];
+            const int begin = static_cast<int>(static_cast<int64_t>(input.rows) * stripe / stripes);
+            const int end = static_cast<int>(static_cast<int64_t>(input.rows) * (stripe + 1) / stripes);
+
+            for (int y = begin; y < end; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    uint32_t bits = noiseHash(params.seed, originX + x, originY + y, params.frame);
+                    rows.offsets[x] = (noiseUnit(bits) * 255.0f - 127.5f) * params.strength;
+                }
+                offsetAndQuantizeRow(input.ptr<uchar>(y), result.ptr<uchar>(y), width, rows, matcher);
+            }
         }
-    }
+    }, stripes);
+}
+
+} // namespace
+
+// The same hash as the OpenCL kernel, so both backends give the same noise.
+// Frames shift the seed by the golden ratio, keeping frame 0 at the plain seed.
+uint32_t noiseHash(unsigned int seed, int x, int y, unsigned int frame) {
+    uint32_t key = seed + frame * 0x9e3779b9u;
+    return hashBits(key ^ hashBits(static_cast<uint32_t>(x) + hashBits(static_cast<uint32_t>(y))));
+}
 
+// White noise dithering
+cv::Mat whiteNoiseDither(const cv::Mat& input, const Parameters& params) {
+    cv::Mat result(input.rows, input.cols, CV_8UC3);
+    ThresholdScratch scratch;
+    whiteNoiseDither(input, result, params, *getPaletteMatcher(params), scratch);
     return result;
 }
 
@@ -600,52 +474,27 @@ cv::Mat randomDither(const cv::Mat& input, const Parameters& params) {
     return whiteNoiseDither(input, params);
 }
 
+// 4x4 pattern for pattern dithering
+cv::Mat generatePatternMatrix() {
+    return (cv::Mat_<float>(4, 4) <<
+        0.0f, 0.5f, 0.125f, 0.625f,
+        0.75f, 0.25f, 0.875f, 0.375f,
+        0.1875f, 0.6875f, 0.0625f, 0.5625f,
+        0.9375f, 0.4375f, 0.8125f, 0.3125f);
+}
+
 // Pattern dithering
 cv::Mat patternDither(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-
-    // Create a 4x4 pattern
-    float pattern[4][4] = {
-        {0.0f, 0.5f, 0.125f, 0.625f},
-        {0.75f, 0.25f, 0.875f, 0.375f},
-        {0.1875f, 0.6875f, 0.0625f, 0.5625f},
-        {0.9375f, 0.4375f, 0.8125f, 0.3125f}
-    };
-
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            float threshold = pattern[y % 4][x % 4];
-            cv::Vec3b pixel = input.at<cv::Vec3b>(y, x);
-
-            cv::Vec3f pixelF(pixel[0], pixel[1], pixel[2]);
-            cv::Vec3f adjusted = pixelF + cv::Vec3f(threshold * 255.0f - 127.5f) * params.strength;
-
-            adjusted = cv::Vec3f(
-                std::clamp(adjusted[0], 0.0f, 255.0f),
-                std::clamp(adjusted[1], 0.0f, 255.0f),
-                std::clamp(adjusted[2], 0.0f, 255.0f)
-            );
-
-            cv::Vec3b adjustedPixel(
-                static_cast<uchar>(adjusted[0]),
-                static_cast<uchar>(adjusted[1]),
-                static_cast<uchar>(adjusted[2])
-            );
-
-            result.at<cv::Vec3b>(y, x) = findClosestColor(adjustedPixel, palette);
-        }
-    }
-
-    return result;
+    return thresholdDither(input, *getCachedThresholdMap(ThresholdMapType::PATTERN, 4), params);
 }
 
 // Dot diffusion dithering
 cv::Mat dotDiffusion(const cv::Mat& input, const Parameters& params) {
+    DITHER_PROFILE_PIXELS("dot diffusion", input.total());
     cv::Mat result = input.clone();
     cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
 
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
+    auto matcher = getPaletteMatcher(params);
 
     // 8x8 class matrix for dot diffusion
     int classMatrix[8][8] = {
@@ -667,8 +516,16 @@ cv::Mat dotDiffusion(const cv::Mat& input, const Parameters& params) {
             cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
             cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
 
+            const float offset = (threshold * 128.0f - 64.0f) * params.strength;
+            if (matcher->isGray()) {
+                // Luminance alone, like every other kernel on gray palettes
+                float level = std::clamp(luminance(oldPixel) + errorVal[0] + offset, 0.0f, 255.0f);
+                result.at<cv::Vec3b>(y, x) = matcher->palette()[matcher->findIndexBySum(3 * static_cast<int>(level))];
+                continue;
+            }
+
             cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF += cv::Vec3f(threshold * 128.0f - 64.0f) * params.strength;
+            newPixelF += cv::Vec3f(offset);
 
             newPixelF = cv::Vec3f(
                 std::clamp(newPixelF[0], 0.0f, 255.0f),
@@ -682,7 +539,7 @@ cv::Mat dotDiffusion(const cv::Mat& input, const Parameters& params) {
                 static_cast<uchar>(newPixelF[2])
             );
 
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
+            cv::Vec3b quantized = matcher->findClosest(newPixel);
             result.at<cv::Vec3b>(y, x) = quantized;
         }
     }
@@ -690,345 +547,801 @@ cv::Mat dotDiffusion(const cv::Mat& input, const Parameters& params) {
     return result;
 }
 
-// Riemersma dithering (space-filling curve)
-cv::Mat riemersma(const cv::Mat& input, const Parameters& params) {
-    // Simplified Riemersma using Hilbert curve approximation
-    cv::Mat result = input.clone();
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
+namespace {
+
+// Riemersma error history: the last riemersmaQueueLength errors, newest
+// weighted 1 and oldest 1/16 on a geometric ramp. The weighted sum is kept
+// incrementally, so a pixel costs the same whatever the queue length. Gray
+// palettes use only the first channel, for luminance.
+constexpr int riemersmaQueueLength = 16;
+
+struct RiemersmaQueue {
+    float errors[riemersmaQueueLength][3] = {};
+    float sum[3] = {};
+    int oldest = 0;
+
+    template <int Channels>
+    void push(const float* error) {
+        static const float decay = std::pow(1.0f / 16.0f, 1.0f / (riemersmaQueueLength - 1));
+        constexpr float oldestWeight = 1.0f / 16.0f;
+        for (int c = 0; c < Channels; ++c) {
+            sum[c] = (sum[c] - errors[oldest][c] * oldestWeight) * decay + error[c];
+            errors[oldest][c] = error[c];
+        }
+        oldest = (oldest + 1) % riemersmaQueueLength;
+    }
+};
+
+// Generalized Hilbert curve over a width x height image (Cervený's
+// "gilbert"): a true Hilbert curve on power-of-two squares, and on other
+// sizes one that still moves to an adjacent pixel every step (diagonally
+// at a few seams when a side is odd). Stored as one byte per step, so a
+// 4K curve is 8 MB, and every segmentLength pixels start a segment whose
+// position is kept. Hilbert order fills aligned blocks before leaving
+// them, so a segment covers a compact patch of about 128 x 128 pixels
+// that stays cache-resident while it is dithered.
+struct HilbertCurve {
+    static constexpr size_t segmentLength = size_t(1) << 14;
+
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> moves;             // Step i, pixel i to i + 1, as (dx + 1) + 3 * (dy + 1)
+    std::vector<cv::Point> segmentStarts;   // Pixel k * segmentLength
+
+    size_t pixels() const { return static_cast<size_t>(width) * height; }
+};
+
+class HilbertBuilder {
+public:
+    explicit HilbertBuilder(HilbertCurve& curve) : curve(curve) {
+        curve.moves.reserve(curve.pixels() - 1);
+        curve.segmentStarts.reserve((curve.pixels() + HilbertCurve::segmentLength - 1) /
+                                    HilbertCurve::segmentLength);
+        if (curve.width >= curve.height) {
+            generate(0, 0, curve.width, 0, 0, curve.height);
+        } else {
+            generate(0, 0, 0, curve.height, curve.width, 0);
+        }
+    }
 
-    // Use a simple serpentine scan as approximation
-    cv::Vec3f error(0, 0, 0);
-    const float decay = 0.8f;
+private:
+    static int sign(int v) { return (v > 0) - (v < 0); }
+    static int halve(int v) { return v >= 0 ? v / 2 : -((1 - v) / 2); }  // Rounds down
 
-    for (int y = 0; y < input.rows; ++y) {
-        bool reverse = (y % 2 == 1);
-        int start = reverse ? input.cols - 1 : 0;
-        int end = reverse ? -1 : input.cols;
-        int step = reverse ? -1 : 1;
-
-        for (int x = start; x != end; x += step) {
-            cv::Vec3b pixel = input.at<cv::Vec3b>(y, x);
-            cv::Vec3f pixelF(pixel[0], pixel[1], pixel[2]);
-            pixelF += error * params.strength;
-
-            pixelF = cv::Vec3f(
-                std::clamp(pixelF[0], 0.0f, 255.0f),
-                std::clamp(pixelF[1], 0.0f, 255.0f),
-                std::clamp(pixelF[2], 0.0f, 255.0f)
-            );
+    void visit(int x, int y) {
+        if (count % HilbertCurve::segmentLength == 0) curve.segmentStarts.emplace_back(x, y);
+        if (count > 0) curve.moves.push_back(static_cast<uint8_t>((x - lastX + 1) + 3 * (y - lastY + 1)));
+        lastX = x;
+        lastY = y;
+        ++count;
+    }
 
-            cv::Vec3b pixelB(
-                static_cast<uchar>(pixelF[0]),
-                static_cast<uchar>(pixelF[1]),
-                static_cast<uchar>(pixelF[2])
-            );
+    // Fill the rectangle at (x, y) spanned by major axis (ax, ay) and minor
+    // axis (bx, by), entering at its corner and leaving along the major axis
+    void generate(int x, int y, int ax, int ay, int bx, int by) {
+        int w = std::abs(ax + ay);
+        int h = std::abs(bx + by);
+        int dax = sign(ax), day = sign(ay);
+        int dbx = sign(bx), dby = sign(by);
+
+        if (h == 1) {
+            for (int i = 0; i < w; ++i, x += dax, y += day) visit(x, y);
+            return;
+        }
+        if (w == 1) {
+            for (int i = 0; i < h; ++i, x += dbx, y += dby) visit(x, y);
+            return;
+        }
 
-            cv::Vec3b quantized = findClosestColor(pixelB, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
+        int ax2 = halve(ax), ay2 = halve(ay);
+        int bx2 = halve(bx), by2 = halve(by);
+        int w2 = std::abs(ax2 + ay2);
+        int h2 = std::abs(bx2 + by2);
 
-            error = (pixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2])) * decay;
+        if (2 * w > 3 * h) {
+            // Long rectangle: split along the major axis only
+            if ((w2 % 2) && w > 2) {
+                ax2 += dax;
+                ay2 += day;
+            }
+            generate(x, y, ax2, ay2, bx, by);
+            generate(x + ax2, y + ay2, ax - ax2, ay - ay2, bx, by);
+        } else {
+            if ((h2 % 2) && h > 2) {
+                bx2 += dbx;
+                by2 += dby;
+            }
+            generate(x, y, bx2, by2, ax2, ay2);
+            generate(x + bx2, y + by2, ax, ay, bx - bx2, by - by2);
+            generate(x + (ax - dax) + (bx2 - dbx), y + (ay - day) + (by2 - dby), -bx2, -by2, -(ax - ax2),
+                     -(ay - ay2));
         }
     }
 
-    return result;
+    HilbertCurve& curve;
+    size_t count = 0;
+    int lastX = 0;
+    int lastY = 0;
+};
+
+// Shared curve for an image size, generated on first use
+std::shared_ptr<const HilbertCurve> getHilbertCurve(int width, int height) {
+    static std::mutex cacheMutex;
+    static std::map<std::pair<int, int>, std::shared_ptr<const HilbertCurve>> cache;
+    constexpr size_t maxCachedCurves = 8;
+
+    auto key = std::make_pair(width, height);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+
+    auto curve = std::make_shared<HilbertCurve>();
+    curve->width = width;
+    curve->height = height;
+    HilbertBuilder builder(*curve);
+
+    if (cache.size() >= maxCachedCurves) cache.clear();
+    cache.emplace(key, curve);
+    return curve;
 }
 
-// Gradient-based dithering
-cv::Mat gradientBased(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    // Calculate gradients
-    cv::Mat gray, gradX, gradY, gradient;
-    cv::cvtColor(input, gray, cv::COLOR_BGR2GRAY);
-    cv::Sobel(gray, gradX, CV_32F, 1, 0);
-    cv::Sobel(gray, gradY, CV_32F, 0, 1);
-    cv::magnitude(gradX, gradY, gradient);
-    cv::normalize(gradient, gradient, 0, 1, cv::NORM_MINMAX);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
+// Walk count pixels of the curve from pixel first at start, carrying queue.
+// Without Write the pixels are only quantized to build up the queue. With
+// Channels == 1 (gray palettes) the luminance is quantized through the
+// matcher's sum table, as in the diffusion kernels.
+template <int Channels, bool Write>
+void riemersmaWalk(const cv::Mat& input, cv::Mat* output, const HilbertCurve& curve, size_t first, size_t count,
+                   cv::Point start, RiemersmaQueue& queue, const PaletteMatcher& matcher, float strength) {
+    ptrdiff_t srcDelta[9];
+    ptrdiff_t dstDelta[9];
+    for (int m = 0; m < 9; ++m) {
+        int dx = m % 3 - 1;
+        int dy = m / 3 - 1;
+        srcDelta[m] = dy * static_cast<ptrdiff_t>(input.step) + dx * 3;
+        dstDelta[m] = Write ? dy * static_cast<ptrdiff_t>(output->step) + dx * 3 : 0;
+    }
 
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            float gradWeight = gradient.at<float>(y, x);
-            float adaptiveStrength = params.strength * (0.5f + gradWeight * 0.5f);
+    const uchar* src = input.ptr<uchar>(start.y) + start.x * 3;
+    uchar* dst = Write ? output->ptr<uchar>(start.y) + start.x * 3 : nullptr;
+    const uint8_t* moves = curve.moves.data() + first;
+    const std::vector<cv::Vec3b>& palette = matcher.palette();
+
+    for (size_t i = 0; i < count; ++i) {
+        const cv::Vec3b& pixel = *reinterpret_cast<const cv::Vec3b*>(src);
+        float value[Channels];
+        int index;
+        if constexpr (Channels == 1) {
+            value[0] = static_cast<float>(luminance(pixel));
+            index = matcher.findIndexBySum(
+                3 * static_cast<int>(std::clamp(value[0] + queue.sum[0] * strength, 0.0f, 255.0f)));
+        } else {
+            cv::Vec3b adjusted;
+            for (int c = 0; c < 3; ++c) {
+                value[c] = pixel[c];
+                adjusted[c] = static_cast<uchar>(std::clamp(value[c] + queue.sum[c] * strength, 0.0f, 255.0f));
+            }
+            index = matcher.findIndex(adjusted);
+        }
+        const cv::Vec3b& quantized = palette[index];
+        if (Write) {
+            for (int c = 0; c < 3; ++c) dst[c] = quantized[c];
+        }
 
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
+        // The queue holds input minus output, so it tracks the tone written
+        // so far rather than compounding its own corrections
+        float error[Channels];
+        for (int c = 0; c < Channels; ++c) error[c] = value[c] - quantized[c];
+        queue.push<Channels>(error);
 
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
+        if (i + 1 < count) {
+            src += srcDelta[moves[i]];
+            if (Write) dst += dstDelta[moves[i]];
+        }
+    }
+}
 
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
+// Riemersma dithering along the cached Hilbert curve into output (created
+// here; must not alias input). Segments are dithered independently, each
+// starting from the queue left by re-quantizing the queue length of pixels
+// before it, so the result does not depend on the thread count.
+void riemersmaInto(const cv::Mat& input, cv::Mat& output, const PaletteMatcher& matcher, float strength,
+                   int threads, WorkerPool& pool, std::vector<RiemersmaQueue>& queues) {
+    DITHER_PROFILE_PIXELS("riemersma", input.total());
+    output.create(input.rows, input.cols, CV_8UC3);
+    if (input.empty()) return;
+
+    auto curve = getHilbertCurve(input.cols, input.rows);
+    const size_t segments = curve->segmentStarts.size();
+    const size_t total = curve->pixels();
+
+    // Warm-up reads input behind each segment before anything is written
+    queues.assign(segments, RiemersmaQueue());
+    for (size_t k = 1; k < segments; ++k) {
+        size_t first = k * HilbertCurve::segmentLength;
+        size_t warmup = std::min<size_t>(riemersmaQueueLength, first);
+        cv::Point start = curve->segmentStarts[k];
+        for (size_t i = 0; i < warmup; ++i) {
+            int m = 8 - curve->moves[first - 1 - i];
+            start.x += m % 3 - 1;
+            start.y += m / 3 - 1;
+        }
+        if (matcher.isGray()) {
+            riemersmaWalk<1, false>(input, nullptr, *curve, first - warmup, warmup, start, queues[k], matcher,
+                                    strength);
+        } else {
+            riemersmaWalk<3, false>(input, nullptr, *curve, first - warmup, warmup, start, queues[k], matcher,
+                                    strength);
+        }
+    }
 
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
+    std::atomic<size_t> next{0};
+    auto job = [&](int) {
+        for (size_t k = next++; k < segments; k = next++) {
+            size_t first = k * HilbertCurve::segmentLength;
+            size_t count = std::min(HilbertCurve::segmentLength, total - first);
+            if (matcher.isGray()) {
+                riemersmaWalk<1, true>(input, &output, *curve, first, count, curve->segmentStarts[k], queues[k],
+                                       matcher, strength);
+            } else {
+                riemersmaWalk<3, true>(input, &output, *curve, first, count, curve->segmentStarts[k], queues[k],
+                                       matcher, strength);
+            }
+        }
+    };
+    pool.run(static_cast<int>(std::min<size_t>(std::max(threads, 1), segments)), job);
+}
 
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
+// Staging for ditherImage's Riemersma path when output is the input
+struct RiemersmaScratch {
+    std::vector<RiemersmaQueue> queues;
+    cv::Mat result;
+};
 
-            // Use Floyd-Steinberg-like diffusion with adaptive strength
-            std::vector<std::pair<int, int>> offsets = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
-            std::vector<float> weights = {7.0f/16.0f, 3.0f/16.0f, 5.0f/16.0f, 1.0f/16.0f};
-            diffuseError(errors, x, y, quantError, offsets, weights, adaptiveStrength, false);
-        }
-    }
+} // namespace
 
+// Riemersma dithering: error diffusion along a Hilbert curve, with a
+// decaying history of the last 16 errors in place of a kernel
+cv::Mat riemersma(const cv::Mat& input, const Parameters& params) {
+    cv::Mat result;
+    WorkerPool pool;
+    std::vector<RiemersmaQueue> queues;
+    riemersmaInto(input, result, *getPaletteMatcher(params), params.strength, resolveThreadCount(params), pool,
+                  queues);
     return result;
 }
 
+// Gradient-based dithering
+cv::Mat gradientBased(const cv::Mat& input, const Parameters& params) {
+    return diffuseErrors<GradientKernel>(input, params, false);
+}
+
 // Variable error diffusion
 cv::Mat variableErrorDiffusion(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
-    std::mt19937 rng(params.seed);
-    std::uniform_real_distribution<float> dist(0.7f, 1.3f);
-
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
+    return diffuseErrors<VariableKernel>(input, params, false);
+}
 
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
+// Ostromoukhov dithering, serpentine as published unless params turn it off
+cv::Mat ostromoukhov(const cv::Mat& input, const Parameters& params) {
+    return diffuseErrors<OstromoukhovKernel>(input, params, params.serpentine > 0.5f);
+}
 
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
+// Fan dithering
+cv::Mat fan(const cv::Mat& input, const Parameters& params) {
+    return diffuseErrors<FanKernel>(input, params, false);
+}
 
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
+// Shiau-Fan dithering
+cv::Mat shiauFan(const cv::Mat& input, const Parameters& params) {
+    return diffuseErrors<ShiauFanKernel>(input, params, false);
+}
 
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
+// Steven Pigeon dithering
+cv::Mat stevenPigeon(const cv::Mat& input, const Parameters& params) {
+    return diffuseErrors<StevenPigeonKernel>(input, params, false);
+}
 
-            // Variable weights
-            float var = dist(rng);
-            std::vector<std::pair<int, int>> offsets = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
-            std::vector<float> weights = {
-                7.0f/16.0f * var,
-                3.0f/16.0f * var,
-                5.0f/16.0f * var,
-                1.0f/16.0f * var
-            };
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
+// Buffers reused across ditherImage calls: converted and preprocessed
+// input, the diffusion ring and threads, threshold and noise rows, and the
+// last palette matcher
+struct Workspace::Impl {
+    cv::Mat converted;
+    cv::Mat preprocessed;
+    cv::Mat toneLut;
+    DiffusionScratch diffusion;
+    WorkerPool pool;
+    ThresholdScratch threshold;
+    RiemersmaScratch riemersma;
+
+    std::shared_ptr<const PaletteMatcher> matcher;
+    PaletteMode matcherMode = PaletteMode::MONOCHROME;
+    ColorMetric matcherMetric = ColorMetric::BGR;
+    std::vector<cv::Vec3b> matcherPalette;
+
+    // Only a palette change goes back to the shared cache
+    const std::shared_ptr<const PaletteMatcher>& matcherFor(const Parameters& params) {
+        bool custom = params.paletteMode == PaletteMode::CUSTOM;
+        if (!matcher || matcherMode != params.paletteMode || matcherMetric != params.colorMetric ||
+            (custom && matcherPalette != params.customPalette)) {
+            matcher = getPaletteMatcher(params);
+            matcherMode = params.paletteMode;
+            matcherMetric = params.colorMetric;
+            if (custom) matcherPalette = params.customPalette;
         }
+        return matcher;
     }
+};
 
-    return result;
-}
-
-// Ostromoukhov dithering
-cv::Mat ostromoukhov(const cv::Mat& input, const Parameters& params) {
-    // Simplified Ostromoukhov (using adaptive weights based on intensity)
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
+Workspace::Workspace() : state(std::make_unique<Impl>()) {}
+Workspace::~Workspace() = default;
 
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
+namespace {
 
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
+template <typename Kernel>
+void diffuseInto(const cv::Mat& input, cv::Mat& output, const Parameters& params, bool serpentine,
+                 Workspace::Impl& workspace) {
+    if constexpr (kernelShift<Kernel>() >= 0) {
+        if (usesFixedPoint<Kernel>(params)) {
+            ErrorDiffuser<Kernel, int16_t>(input.cols, input.rows, params, serpentine, workspace.diffusion,
+                                           workspace.matcherFor(params), &workspace.pool).process(input, output, 0);
+            return;
+        }
+    }
+    ErrorDiffuser<Kernel>(input.cols, input.rows, params, serpentine, workspace.diffusion,
+                          workspace.matcherFor(params), &workspace.pool).process(input, output, 0);
+}
 
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
+// Algorithms without a workspace path still return a new image; keep the
+// caller's buffer when it already has the right shape
+void storeResult(const cv::Mat& result, cv::Mat& output) {
+    if (output.rows == result.rows && output.cols == result.cols && output.type() == result.type()) {
+        result.copyTo(output);
+    } else {
+        output = result;
+    }
+}
 
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
+// Threshold-map algorithms with the map read from (originX, originY), which
+// is where a region at that position of a larger image starts in it
+void thresholdInto(const cv::Mat& input, cv::Mat& output, const Parameters& params, Workspace::Impl& ws,
+                   int originX, int originY) {
+    if (params.algorithm == Algorithm::WHITE_NOISE || params.algorithm == Algorithm::RANDOM_DITHER) {
+        whiteNoiseDither(input, output, params, *ws.matcherFor(params), ws.threshold, originX, originY);
+        return;
+    }
 
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
+    std::shared_ptr<const BlueNoiseMask> mask;
+    std::shared_ptr<const cv::Mat> cached;
+    const cv::Mat* map = nullptr;
 
-            // Adaptive weights based on intensity
-            float intensity = (newPixelF[0] + newPixelF[1] + newPixelF[2]) / (3.0f * 255.0f);
-            float w1 = 7.0f * (1.0f - intensity) + 3.0f * intensity;
-            float w2 = 3.0f * (1.0f - intensity) + 7.0f * intensity;
-            float w3 = 5.0f;
-            float w4 = 1.0f;
-            float sum = w1 + w2 + w3 + w4;
-
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            std::vector<std::pair<int, int>> offsets = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
-            std::vector<float> weights = {w1/sum, w2/sum, w3/sum, w4/sum};
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
-        }
+    switch (params.algorithm) {
+        case Algorithm::BLUE_NOISE:
+            if ((mask = getBlueNoiseMask())) {
+                int maskX, maskY;
+                blueNoiseMaskOrigin(mask->ranks(), params.seed, maskX, maskY);
+                originX += maskX;
+                originY += maskY;
+                map = &mask->ranks();
+            } else {
+                cached = getCachedThresholdMap(ThresholdMapType::BLUE_NOISE, 64, params.seed);
+            }
+            break;
+        case Algorithm::PATTERN_DITHER:
+            cached = getCachedThresholdMap(ThresholdMapType::PATTERN, 4);
+            break;
+        default:
+            cached = getCachedThresholdMap(ThresholdMapType::BAYER, params.bayerSize);
+            break;
     }
+    if (!map) map = cached.get();
 
-    return result;
+    thresholdDither(input, output, *map, params, *ws.matcherFor(params), ws.threshold,
+                    originX % map->cols, originY % map->rows);
 }
 
-// Fan dithering
-cv::Mat fan(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
+} // namespace
+
+void ditherImage(const cv::Mat& input, cv::Mat& output, const Parameters& params, Workspace& workspace) {
+    DITHER_PROFILE_PIXELS("ditherImage", input.total());
+    Workspace::Impl& ws = workspace.impl();
+
+    // Kernels work on 8-bit BGR
+    cv::Mat source = input;
+    if (input.type() == CV_8UC1) {
+        DITHER_PROFILE_SCOPE("convert");
+        cv::cvtColor(input, ws.converted, cv::COLOR_GRAY2BGR);
+        source = ws.converted;
+    } else if (input.type() == CV_8UC4) {
+        DITHER_PROFILE_SCOPE("convert");
+        cv::cvtColor(input, ws.converted, cv::COLOR_BGRA2BGR);
+        source = ws.converted;
+    }
 
-    std::vector<std::pair<int, int>> offsets = {{1, 0}, {0, 1}, {1, 1}, {-1, 1}};
-    std::vector<float> weights = {7.0f/16.0f, 1.0f/16.0f, 5.0f/16.0f, 3.0f/16.0f};
+    if (params.backend == Backend::OPENCL) {
+        DITHER_PROFILE_PIXELS("opencl dither", source.total());
+        if (openclDither(source, output, params)) return;
+    }
 
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
+    // Neutral settings dither the input directly instead of a copy
+    cv::Mat preprocessed = source;
+    if (needsPreprocessing(params)) {
+        preprocessInto(source, ws.preprocessed, params, ws.toneLut);
+        preprocessed = ws.preprocessed;
+    }
 
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
+    // Whole-image algorithms return a new image (see storeResult). Every
+    // other pass reads a row before writing it, so output may be the input.
+    const Algorithm algo = params.algorithm;
+    if (StripDitherer::supports(algo) || algo == Algorithm::GRADIENT_BASED) {
+        output.create(preprocessed.rows, preprocessed.cols, CV_8UC3);
+    }
 
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
+    switch (algo) {
+        case Algorithm::FLOYD_STEINBERG:
+            diffuseInto<FloydSteinbergKernel>(preprocessed, output, params, params.serpentine > 0.5f, ws);
+            break;
+        case Algorithm::ATKINSON:
+            diffuseInto<AtkinsonKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::JARVIS_JUDICE_NINKE:
+            diffuseInto<JarvisJudiceNinkeKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::STUCKI:
+            diffuseInto<StuckiKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::BURKES:
+            diffuseInto<BurkesKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::SIERRA:
+            diffuseInto<SierraKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::SIERRA_TWO_ROW:
+            diffuseInto<SierraTwoRowKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::SIERRA_LITE:
+            diffuseInto<SierraLiteKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::ORDERED_BAYER_2X2:
+        case Algorithm::ORDERED_BAYER_4X4:
+        case Algorithm::ORDERED_BAYER_8X8:
+        case Algorithm::ORDERED_BAYER_16X16:
+        case Algorithm::BLUE_NOISE:
+        case Algorithm::PATTERN_DITHER:
+        case Algorithm::WHITE_NOISE:
+        case Algorithm::RANDOM_DITHER:
+            thresholdInto(preprocessed, output, params, ws, 0, 0);
+            break;
+        case Algorithm::DOT_DIFFUSION:
+            storeResult(dotDiffusion(preprocessed, params), output);
+            break;
+        case Algorithm::RIEMERSMA:
+            if (output.data == preprocessed.data) {
+                riemersmaInto(preprocessed, ws.riemersma.result, *ws.matcherFor(params), params.strength,
+                              resolveThreadCount(params), ws.pool, ws.riemersma.queues);
+                ws.riemersma.result.copyTo(output);
+            } else {
+                riemersmaInto(preprocessed, output, *ws.matcherFor(params), params.strength,
+                              resolveThreadCount(params), ws.pool, ws.riemersma.queues);
+            }
+            break;
+        case Algorithm::GRADIENT_BASED:
+            // Reads the rows around each one, so never diffuses in place
+            if (output.data == preprocessed.data) {
+                preprocessed.copyTo(ws.preprocessed);
+                preprocessed = ws.preprocessed;
+            }
+            diffuseInto<GradientKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::VARIABLE_ERROR_DIFFUSION:
+            diffuseInto<VariableKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::OSTROMOUKHOV:
+            diffuseInto<OstromoukhovKernel>(preprocessed, output, params, params.serpentine > 0.5f, ws);
+            break;
+        case Algorithm::FAN:
+            diffuseInto<FanKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::SHIAU_FAN:
+            diffuseInto<ShiauFanKernel>(preprocessed, output, params, false, ws);
+            break;
+        case Algorithm::STEVENPIGEON:
+            diffuseInto<StevenPigeonKernel>(preprocessed, output, params, false, ws);
+            break;
+        default:
+            diffuseInto<FloydSteinbergKernel>(preprocessed, output, params, params.serpentine > 0.5f, ws);
+            break;
+    }
+}
 
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
+void ditherRegion(const cv::Mat& input, cv::Mat& output, const cv::Rect& region, const Parameters& params,
+                  Workspace& workspace) {
+    if (region.empty()) return;
+    DITHER_PROFILE_PIXELS("ditherRegion", region.area());
+    cv::Mat target = output(region);
+    if (!isPointwise(params.algorithm)) {
+        ditherImage(input(region), target, params, workspace);
+        return;
+    }
 
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
-        }
+    Workspace::Impl& ws = workspace.impl();
+    cv::Mat source = input(region);
+    if (input.type() == CV_8UC1) {
+        cv::cvtColor(source, ws.converted, cv::COLOR_GRAY2BGR);
+        source = ws.converted;
+    } else if (input.type() == CV_8UC4) {
+        cv::cvtColor(source, ws.converted, cv::COLOR_BGRA2BGR);
+        source = ws.converted;
     }
 
-    return result;
+    // Tone curves and saturation are per pixel, so only the region is needed
+    if (needsPreprocessing(params)) {
+        preprocessInto(source, ws.preprocessed, params, ws.toneLut);
+        source = ws.preprocessed;
+    }
+    thresholdInto(source, target, params, ws, region.x, region.y);
 }
 
-// Shiau-Fan dithering
-cv::Mat shiauFan(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
+bool isPointwise(Algorithm algo) {
+    switch (algo) {
+        case Algorithm::ORDERED_BAYER_2X2:
+        case Algorithm::ORDERED_BAYER_4X4:
+        case Algorithm::ORDERED_BAYER_8X8:
+        case Algorithm::ORDERED_BAYER_16X16:
+        case Algorithm::BLUE_NOISE:
+        case Algorithm::PATTERN_DITHER:
+        case Algorithm::WHITE_NOISE:
+        case Algorithm::RANDOM_DITHER:
+            return true;
+        default:
+            return false;
+    }
+}
 
-    std::vector<std::pair<int, int>> offsets = {
-        {1, 0}, {2, 0},
-        {-2, 1}, {-1, 1}, {0, 1}, {1, 1}, {2, 1}
-    };
-    std::vector<float> weights = {
-        4.0f/16.0f, 1.0f/16.0f,
-        1.0f/16.0f, 1.0f/16.0f, 2.0f/16.0f, 4.0f/16.0f, 2.0f/16.0f
-    };
+// Strip engines: one per family of streamable algorithms. The base keeps
+// the per-strip conversion and preprocessing buffers.
+struct StripDitherer::Engine {
+    virtual ~Engine() = default;
+    virtual void process(const cv::Mat& input, cv::Mat& result, int firstRow) = 0;
 
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
+    cv::Mat converted;
+    cv::Mat preprocessed;
+    cv::Mat toneLut;
+};
 
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
+namespace {
 
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
+template <typename Kernel, typename Error>
+struct DiffusionStripEngine : StripDitherer::Engine {
+    DiffusionStripEngine(int width, int height, const Parameters& params, bool serpentine)
+        : diffuser(width, height, params, serpentine, scratch) {}
 
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
+    void process(const cv::Mat& input, cv::Mat& result, int firstRow) override {
+        diffuser.process(input, result, firstRow);
+    }
 
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
+    DiffusionScratch scratch;
+    ErrorDiffuser<Kernel, Error> diffuser;
+};
+
+// Tiled maps only need to know which map row a strip starts on
+struct ThresholdStripEngine : StripDitherer::Engine {
+    ThresholdStripEngine(const Parameters& params) : params(params), matcher(getPaletteMatcher(params)) {
+        if (params.algorithm == Algorithm::BLUE_NOISE && (mask = getBlueNoiseMask())) {
+            map = mask->ranks();
+            blueNoiseMaskOrigin(map, params.seed, originX, originY);
+        } else {
+            map = getThresholdMap(params);
         }
     }
 
-    return result;
-}
-
-// Steven Pigeon dithering
-cv::Mat stevenPigeon(const cv::Mat& input, const Parameters& params) {
-    cv::Mat result = input.clone();
-    cv::Mat errors = cv::Mat::zeros(input.rows, input.cols, CV_32FC3);
-
-    std::vector<cv::Vec3b> palette = getPalette(params.paletteMode);
+    void process(const cv::Mat& input, cv::Mat& result, int firstRow) override {
+        thresholdDither(input, result, map, params, *matcher, scratch, originX, (originY + firstRow) % map.rows);
+    }
 
-    std::vector<std::pair<int, int>> offsets = {
-        {1, 0}, {2, 0},
-        {-2, 1}, {-1, 1}, {0, 1}, {1, 1}, {2, 1},
-        {-1, 2}, {0, 2}, {1, 2}
-    };
-    std::vector<float> weights = {
-        2.0f/14.0f, 1.0f/14.0f,
-        1.0f/14.0f, 2.0f/14.0f, 2.0f/14.0f, 2.0f/14.0f, 1.0f/14.0f,
-        1.0f/14.0f, 1.0f/14.0f, 1.0f/14.0f
-    };
+    Parameters params;
+    std::shared_ptr<const PaletteMatcher> matcher;
+    ThresholdScratch scratch;
+    std::shared_ptr<const BlueNoiseMask> mask;  // Keeps a mapped mask alive
+    cv::Mat map;
+    int originX = 0;
+    int originY = 0;
+};
+
+// Noise is hashed from the position, so a strip only needs its first row
+struct WhiteNoiseStripEngine : StripDitherer::Engine {
+    WhiteNoiseStripEngine(const Parameters& params) : params(params), matcher(getPaletteMatcher(params)) {}
+
+    void process(const cv::Mat& input, cv::Mat& result, int firstRow) override {
+        whiteNoiseDither(input, result, params, *matcher, scratch, 0, firstRow);
+    }
 
-    for (int y = 0; y < input.rows; ++y) {
-        for (int x = 0; x < input.cols; ++x) {
-            cv::Vec3b oldPixel = result.at<cv::Vec3b>(y, x);
-            cv::Vec3f errorVal = errors.at<cv::Vec3f>(y, x);
+    Parameters params;
+    std::shared_ptr<const PaletteMatcher> matcher;
+    ThresholdScratch scratch;
+};
+
+template <typename Kernel>
+std::unique_ptr<StripDitherer::Engine> diffusionEngine(int width, int height, const Parameters& params,
+                                                       bool serpentine = false) {
+    if constexpr (kernelShift<Kernel>() >= 0) {
+        if (usesFixedPoint<Kernel>(params)) {
+            return std::make_unique<DiffusionStripEngine<Kernel, int16_t>>(width, height, params, serpentine);
+        }
+    }
+    return std::make_unique<DiffusionStripEngine<Kernel, float>>(width, height, params, serpentine);
+}
 
-            cv::Vec3f newPixelF = cv::Vec3f(oldPixel[0], oldPixel[1], oldPixel[2]) + errorVal;
-            newPixelF = cv::Vec3f(
-                std::clamp(newPixelF[0], 0.0f, 255.0f),
-                std::clamp(newPixelF[1], 0.0f, 255.0f),
-                std::clamp(newPixelF[2], 0.0f, 255.0f)
-            );
+} // namespace
 
-            cv::Vec3b newPixel(
-                static_cast<uchar>(newPixelF[0]),
-                static_cast<uchar>(newPixelF[1]),
-                static_cast<uchar>(newPixelF[2])
-            );
+StripDitherer::StripDitherer(int width, int height, const Parameters& params) : params(params) {
+    switch (params.algorithm) {
+        case Algorithm::FLOYD_STEINBERG:
+            engine = diffusionEngine<FloydSteinbergKernel>(width, height, params, params.serpentine > 0.5f);
+            break;
+        case Algorithm::ATKINSON:
+            engine = diffusionEngine<AtkinsonKernel>(width, height, params);
+            break;
+        case Algorithm::JARVIS_JUDICE_NINKE:
+            engine = diffusionEngine<JarvisJudiceNinkeKernel>(width, height, params);
+            break;
+        case Algorithm::STUCKI:
+            engine = diffusionEngine<StuckiKernel>(width, height, params);
+            break;
+        case Algorithm::BURKES:
+            engine = diffusionEngine<BurkesKernel>(width, height, params);
+            break;
+        case Algorithm::SIERRA:
+            engine = diffusionEngine<SierraKernel>(width, height, params);
+            break;
+        case Algorithm::SIERRA_TWO_ROW:
+            engine = diffusionEngine<SierraTwoRowKernel>(width, height, params);
+            break;
+        case Algorithm::SIERRA_LITE:
+            engine = diffusionEngine<SierraLiteKernel>(width, height, params);
+            break;
+        case Algorithm::FAN:
+            engine = diffusionEngine<FanKernel>(width, height, params);
+            break;
+        case Algorithm::SHIAU_FAN:
+            engine = diffusionEngine<ShiauFanKernel>(width, height, params);
+            break;
+        case Algorithm::STEVENPIGEON:
+            engine = diffusionEngine<StevenPigeonKernel>(width, height, params);
+            break;
+        case Algorithm::VARIABLE_ERROR_DIFFUSION:
+            engine = diffusionEngine<VariableKernel>(width, height, params);
+            break;
+        case Algorithm::OSTROMOUKHOV:
+            engine = diffusionEngine<OstromoukhovKernel>(width, height, params, params.serpentine > 0.5f);
+            break;
+        case Algorithm::ORDERED_BAYER_2X2:
+        case Algorithm::ORDERED_BAYER_4X4:
+        case Algorithm::ORDERED_BAYER_8X8:
+        case Algorithm::ORDERED_BAYER_16X16:
+        case Algorithm::BLUE_NOISE:
+        case Algorithm::PATTERN_DITHER:
+            engine = std::make_unique<ThresholdStripEngine>(params);
+            break;
+        case Algorithm::WHITE_NOISE:
+        case Algorithm::RANDOM_DITHER:
+            engine = std::make_unique<WhiteNoiseStripEngine>(params);
+            break;
+        default:
+            // Not streamable; like ditherImage, fall back to Floyd-Steinberg
+            engine = diffusionEngine<FloydSteinbergKernel>(width, height, params);
+            break;
+    }
+}
 
-            cv::Vec3b quantized = findClosestColor(newPixel, palette);
-            result.at<cv::Vec3b>(y, x) = quantized;
+StripDitherer::~StripDitherer() = default;
+
+void StripDitherer::process(const cv::Mat& strip, cv::Mat& output) {
+    DITHER_PROFILE_PIXELS("strip", strip.total());
+    cv::Mat source = strip;
+    if (strip.type() == CV_8UC1) {
+        cv::cvtColor(strip, engine->converted, cv::COLOR_GRAY2BGR);
+        source = engine->converted;
+    } else if (strip.type() == CV_8UC4) {
+        cv::cvtColor(strip, engine->converted, cv::COLOR_BGRA2BGR);
+        source = engine->converted;
+    }
 
-            cv::Vec3f quantError = newPixelF - cv::Vec3f(quantized[0], quantized[1], quantized[2]);
-            diffuseError(errors, x, y, quantError, offsets, weights, params.strength, false);
-        }
+    cv::Mat preprocessed = source;
+    if (needsPreprocessing(params)) {
+        preprocessInto(source, engine->preprocessed, params, engine->toneLut);
+        preprocessed = engine->preprocessed;
     }
+    output.create(strip.rows, strip.cols, CV_8UC3);
+    engine->process(preprocessed, output, nextRow);
+    nextRow += strip.rows;
+}
 
-    return result;
+bool StripDitherer::supports(Algorithm algo) {
+    switch (algo) {
+        case Algorithm::DOT_DIFFUSION:
+        case Algorithm::RIEMERSMA:
+        case Algorithm::GRADIENT_BASED:
+            return false;
+        default:
+            return true;
+    }
 }
 
-// Generate blue noise texture
+// Generate a void-and-cluster blue noise texture with thresholds in [0, 1).
+// About 30 ms at 64x64 and a second at 256x256; larger masks belong in a
+// file made offline with dither-noise.
 cv::Mat generateBlueNoiseTexture(int size, unsigned int seed) {
-    // Simplified blue noise generation using void-and-cluster method approximation
-    cv::Mat noise = cv::Mat::zeros(size, size, CV_32F);
-    std::mt19937 rng(seed);
-    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-
-    // Start with white noise
+    cv::Mat ranks = generateVoidAndClusterMask(size, seed);
+    cv::Mat noise(size, size, CV_32F);
     for (int y = 0; y < size; ++y) {
         for (int x = 0; x < size; ++x) {
-            noise.at<float>(y, x) = dist(rng);
+            noise.at<float>(y, x) = thresholdAt(ranks, y, x);
         }
     }
+    return noise;
+}
 
-    // Apply Gaussian blur to create more uniform distribution
-    cv::GaussianBlur(noise, noise, cv::Size(5, 5), 1.0);
-    cv::normalize(noise, noise, 0, 1, cv::NORM_MINMAX);
+// Shared threshold map, generated on first use. Bayer and pattern maps do
+// not depend on the seed, so it is ignored for them.
+std::shared_ptr<const cv::Mat> getCachedThresholdMap(ThresholdMapType type, int size, unsigned int seed) {
+    static std::mutex cacheMutex;
+    static std::map<std::tuple<int, int, unsigned int>, std::shared_ptr<const cv::Mat>> cache;
+    constexpr size_t maxCachedMaps = 32;
 
-    return noise;
+    if (type != ThresholdMapType::BLUE_NOISE) seed = 0;
+    auto key = std::make_tuple(static_cast<int>(type), size, seed);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+
+    cv::Mat map;
+    switch (type) {
+        case ThresholdMapType::BAYER:
+            map = generateBayerMatrix(size);
+            break;
+        case ThresholdMapType::BLUE_NOISE:
+            map = generateBlueNoiseTexture(size, seed);
+            break;
+        case ThresholdMapType::PATTERN:
+            map = generatePatternMatrix();
+            break;
+    }
+
+    if (cache.size() >= maxCachedMaps) cache.clear();
+    auto shared = std::make_shared<const cv::Mat>(std::move(map));
+    cache.emplace(key, shared);
+    return shared;
+}
+
+// Threshold map used by the ordered, blue-noise and pattern algorithms;
+// empty for algorithms that do not tile a map. Shares the cached data.
+cv::Mat getThresholdMap(const Parameters& params) {
+    switch (params.algorithm) {
+        case Algorithm::ORDERED_BAYER_2X2:
+        case Algorithm::ORDERED_BAYER_4X4:
+        case Algorithm::ORDERED_BAYER_8X8:
+        case Algorithm::ORDERED_BAYER_16X16:
+            return *getCachedThresholdMap(ThresholdMapType::BAYER, params.bayerSize);
+        case Algorithm::BLUE_NOISE:
+            if (auto mask = getBlueNoiseMask()) {
+                // Unrolled to the origin blueNoiseDither reads from
+                const cv::Mat& ranks = mask->ranks();
+                int originX, originY;
+                blueNoiseMaskOrigin(ranks, params.seed, originX, originY);
+                cv::Mat map(ranks.rows, ranks.cols, CV_32F);
+                for (int y = 0; y < ranks.rows; ++y) {
+                    for (int x = 0; x < ranks.cols; ++x) {
+                        map.at<float>(y, x) = thresholdAt(ranks, (y + originY) % ranks.rows, (x + originX) % ranks.cols);
+                    }
+                }
+                return map;
+            }
+            return *getCachedThresholdMap(ThresholdMapType::BLUE_NOISE, 64, params.seed);
+        case Algorithm::PATTERN_DITHER:
+            return *getCachedThresholdMap(ThresholdMapType::PATTERN, 4);
+        default:
+            return cv::Mat();
+    }
 }
 
 // Get palette based on mode
@@ -1101,15 +1414,317 @@ std::vector<cv::Vec3b> getPalette(PaletteMode mode) {
     return palette;
 }
 
+// Palette for the given parameters (custom palette when one is supplied)
+std::vector<cv::Vec3b> getPalette(const Parameters& params) {
+    if (params.paletteMode == PaletteMode::CUSTOM && !params.customPalette.empty()) {
+        return params.customPalette;
+    }
+    return getPalette(params.paletteMode);
+}
+
+// Ostromoukhov's coefficients for intensities 0-127; 128-255 mirror them
+const int OstromoukhovKernel::coefficients[128][4] = {
+    {13, 0, 5, 18}, {13, 0, 5, 18}, {21, 0, 10, 31}, {7, 0, 4, 11},                                 // 0-3
+    {8, 0, 5, 13}, {47, 3, 28, 78}, {23, 3, 13, 39}, {15, 3, 8, 26},                                // 4-7
+    {22, 6, 11, 39}, {43, 15, 20, 78}, {7, 3, 3, 13}, {501, 224, 211, 936},                         // 8-11
+    {249, 116, 103, 468}, {165, 80, 67, 312}, {123, 62, 49, 234}, {489, 256, 191, 936},             // 12-15
+    {81, 44, 31, 156}, {483, 272, 181, 936}, {60, 35, 22, 117}, {53, 32, 19, 104},                  // 16-19
+    {237, 148, 83, 468}, {471, 304, 161, 936}, {3, 2, 1, 6}, {481, 314, 185, 980},                  // 20-23
+    {354, 226, 155, 735}, {1389, 866, 685, 2940}, {227, 138, 125, 490}, {267, 158, 163, 588},       // 24-27
+    {327, 188, 220, 735}, {61, 34, 45, 140}, {627, 338, 505, 1470}, {1227, 638, 1075, 2940},        // 28-31
+    {20, 10, 19, 49}, {1937, 1000, 1767, 4704}, {977, 520, 855, 2352}, {657, 360, 551, 1568},       // 32-35
+    {71, 40, 57, 168}, {2005, 1160, 1539, 4704}, {337, 200, 247, 784}, {2039, 1240, 1425, 4704},    // 36-39
+    {257, 160, 171, 588}, {691, 440, 437, 1568}, {1045, 680, 627, 2352}, {301, 200, 171, 672},      // 40-43
+    {177, 120, 95, 392}, {2141, 1480, 1083, 4704}, {1079, 760, 513, 2352}, {725, 520, 323, 1568},   // 44-47
+    {137, 100, 57, 294}, {2209, 1640, 855, 4704}, {53, 40, 19, 112}, {2243, 1720, 741, 4704},       // 48-51
+    {565, 440, 171, 1176}, {759, 600, 209, 1568}, {1147, 920, 285, 2352}, {2311, 1880, 513, 4704},  // 52-55
+    {97, 80, 19, 196}, {335, 280, 57, 672}, {1181, 1000, 171, 2352}, {793, 680, 95, 1568},          // 56-59
+    {599, 520, 57, 1176}, {2413, 2120, 171, 4704}, {405, 360, 19, 784}, {2447, 2200, 57, 4704},     // 60-63
+    {11, 10, 0, 21}, {158, 151, 3, 312}, {178, 179, 7, 364}, {1030, 1091, 63, 2184},                // 64-67
+    {248, 277, 21, 546}, {318, 375, 35, 728}, {458, 571, 63, 1092}, {878, 1159, 147, 2184},         // 68-71
+    {5, 7, 1, 13}, {172, 181, 37, 390}, {97, 76, 22, 195}, {72, 41, 17, 130},                       // 72-75
+    {119, 47, 29, 195}, {4, 1, 1, 6}, {4, 1, 1, 6}, {4, 1, 1, 6},                                   // 76-79
+    {4, 1, 1, 6}, {4, 1, 1, 6}, {4, 1, 1, 6}, {4, 1, 1, 6},                                         // 80-83
+    {4, 1, 1, 6}, {4, 1, 1, 6}, {65, 18, 17, 100}, {95, 29, 26, 150},                               // 84-87
+    {185, 62, 53, 300}, {30, 11, 9, 50}, {35, 14, 11, 60}, {85, 37, 28, 150},                       // 88-91
+    {55, 26, 19, 100}, {80, 41, 29, 150}, {155, 86, 59, 300}, {5, 3, 2, 10},                        // 92-95
+    {5, 3, 2, 10}, {5, 3, 2, 10}, {5, 3, 2, 10}, {5, 3, 2, 10},                                     // 96-99
+    {5, 3, 2, 10}, {5, 3, 2, 10}, {305, 176, 119, 600}, {155, 86, 59, 300},                         // 100-103
+    {105, 56, 39, 200}, {80, 41, 29, 150}, {65, 32, 23, 120}, {55, 26, 19, 100},                    // 104-107
+    {335, 152, 113, 600}, {85, 37, 28, 150}, {115, 48, 37, 200}, {35, 14, 11, 60},                  // 108-111
+    {355, 136, 109, 600}, {30, 11, 9, 50}, {365, 128, 107, 600}, {185, 62, 53, 300},                // 112-115
+    {25, 8, 7, 40}, {95, 29, 26, 150}, {385, 112, 103, 600}, {65, 18, 17, 100},                     // 116-119
+    {395, 104, 101, 600}, {4, 1, 1, 6}, {4, 1, 1, 6}, {395, 104, 101, 600},                         // 120-123
+    {65, 18, 17, 100}, {385, 112, 103, 600}, {95, 29, 26, 150}, {25, 8, 7, 40},                     // 124-127
+};
+
+const LinearLight& linearLight() {
+    static const LinearLight light = [] {
+        LinearLight tables;
+        for (int v = 0; v < 256; ++v) {
+            double c = v / 255.0;
+            double linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+            tables.toLinear[v] = static_cast<float>(linear * 255.0);
+        }
+        for (int i = 0; i < 4096; ++i) {
+            double c = i / 4095.0;
+            double encoded = c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow(c, 1.0 / 2.4) - 0.055;
+            tables.toSrgb[i] = cv::saturate_cast<uchar>(encoded * 255.0);
+        }
+        return tables;
+    }();
+    return light;
+}
+
+namespace {
+
+// A BGR color in OKLab or CIELAB (L, a, b)
+cv::Vec3f toPerceptual(const cv::Vec3b& color, ColorMetric metric) {
+    const LinearLight& light = linearLight();
+    float b = light.toLinear[color[0]] * (1.0f / 255.0f);
+    float g = light.toLinear[color[1]] * (1.0f / 255.0f);
+    float r = light.toLinear[color[2]] * (1.0f / 255.0f);
+
+    if (metric == ColorMetric::OKLAB) {
+        float l = std::cbrt(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+        float m = std::cbrt(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+        float s = std::cbrt(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+        return cv::Vec3f(0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s,
+                         1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s,
+                         0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s);
+    }
+
+    // D65 white, normalized so that Y is XYZ/Yn
+    auto f = [](float t) { return t > 0.008856452f ? std::cbrt(t) : t * 7.787037f + 4.0f / 29.0f; };
+    float fx = f((0.4124564f * r + 0.3575761f * g + 0.1804375f * b) * (1.0f / 0.95047f));
+    float fy = f(0.2126729f * r + 0.7151522f * g + 0.0721750f * b);
+    float fz = f((0.0193339f * r + 0.1191920f * g + 0.9503041f * b) * (1.0f / 1.08883f));
+    return cv::Vec3f(116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz));
+}
+
+float perceptualDistance(const cv::Vec3f& a, const cv::Vec3f& b) {
+    cv::Vec3f d = a - b;
+    return d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+}
+
+// Lowest index among the nearest entries
+int nearestPerceptual(const cv::Vec3f& color, const std::vector<cv::Vec3f>& palette) {
+    int best = 0;
+    float minDist = perceptualDistance(color, palette[0]);
+    for (size_t i = 1; i < palette.size(); ++i) {
+        float dist = perceptualDistance(color, palette[i]);
+        if (dist < minDist) {
+            minDist = dist;
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+// The nearest entry at the lattice points 0, 4, ..., 252, 255 of each axis
+// is shared by the cells meeting there; a cell resolves to its corners'
+// entry when all eight agree and no other palette color lies inside it.
+void PaletteMatcher::buildLattice(ColorMetric metric) {
+    constexpr int cells = 64;
+    constexpr int points = cells + 1;
+    latticeMetric = metric;
+
+    perceptual.resize(colors.size());
+    for (size_t i = 0; i < colors.size(); ++i) perceptual[i] = toPerceptual(colors[i], metric);
+
+    auto level = [](int i) { return static_cast<uchar>(std::min(i * 4, 255)); };
+    std::vector<uint16_t> nearest(points * points * points);
+    cv::parallel_for_(cv::Range(0, points), [&](const cv::Range& range) {
+        for (int p0 = range.start; p0 < range.end; ++p0) {
+            for (int p1 = 0; p1 < points; ++p1) {
+                for (int p2 = 0; p2 < points; ++p2) {
+                    cv::Vec3f color = toPerceptual(cv::Vec3b(level(p0), level(p1), level(p2)), metric);
+                    nearest[(p0 * points + p1) * points + p2] =
+                        static_cast<uint16_t>(nearestPerceptual(color, perceptual));
+                }
+            }
+        }
+    });
+
+    // Palette colors by the cell they fall in
+    auto cellOf = [](const cv::Vec3b& c) { return ((c[0] >> 2) << 12) | ((c[1] >> 2) << 6) | (c[2] >> 2); };
+    std::vector<std::pair<int, uint16_t>> inside;
+    inside.reserve(colors.size());
+    for (size_t i = 0; i < colors.size(); ++i) inside.emplace_back(cellOf(colors[i]), static_cast<uint16_t>(i));
+    std::sort(inside.begin(), inside.end());
+
+    lattice.resize(cells * cells * cells);
+    auto next = inside.begin();
+    std::vector<uint16_t> candidates;
+    for (int c0 = 0; c0 < cells; ++c0) {
+        for (int c1 = 0; c1 < cells; ++c1) {
+            for (int c2 = 0; c2 < cells; ++c2) {
+                int cell = (c0 << 12) | (c1 << 6) | c2;
+                candidates.clear();
+                for (int corner = 0; corner < 8; ++corner) {
+                    int p0 = c0 + (corner >> 2), p1 = c1 + ((corner >> 1) & 1), p2 = c2 + (corner & 1);
+                    candidates.push_back(nearest[(p0 * points + p1) * points + p2]);
+                }
+                for (; next != inside.end() && next->first == cell; ++next) candidates.push_back(next->second);
+
+                std::sort(candidates.begin(), candidates.end());
+                candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+                if (candidates.size() == 1) {
+                    lattice[cell] = candidates[0];
+                    continue;
+                }
+                lattice[cell] = refineFlag | static_cast<uint32_t>(refineLists.size());
+                refineLists.push_back(static_cast<uint16_t>(candidates.size()));
+                refineLists.insert(refineLists.end(), candidates.begin(), candidates.end());
+            }
+        }
+    }
+}
+
+int PaletteMatcher::refineIndex(const cv::Vec3b& color, uint32_t offset) const {
+    cv::Vec3f target = toPerceptual(color, latticeMetric);
+    const uint16_t* list = refineLists.data() + offset;
+    int count = list[0];
+
+    int best = list[1];
+    float minDist = perceptualDistance(target, perceptual[best]);
+    for (int i = 2; i <= count; ++i) {
+        float dist = perceptualDistance(target, perceptual[list[i]]);
+        if (dist < minDist) {
+            minDist = dist;
+            best = list[i];
+        }
+    }
+    return best;
+}
+
+// Build the per-cell candidate lists, or the perceptual lattice
+PaletteMatcher::PaletteMatcher(const std::vector<cv::Vec3b>& palette, ColorMetric metric)
+    : colors(palette.empty() ? std::vector<cv::Vec3b>{cv::Vec3b(0, 0, 0)} : palette) {
+    constexpr int cellsPerAxis = 32;
+    constexpr int cellSize = 256 / cellsPerAxis;
+    constexpr size_t maxPerceptualColors = 1024;
+
+    size_t count = std::min<size_t>(colors.size(), 65536);
+    bool gray = std::all_of(colors.begin(), colors.begin() + count, [](const cv::Vec3b& c) {
+        return c[0] == c[1] && c[1] == c[2];
+    });
+
+    // Gray palettes keep their sum tables; very large ones would take seconds
+    // to sort into the lattice
+    if (metric != ColorMetric::BGR && !gray && colors.size() <= maxPerceptualColors) {
+        buildLattice(metric);
+        return;
+    }
+
+    std::vector<int> minDist(count);
+
+    cellStart.reserve(cellsPerAxis * cellsPerAxis * cellsPerAxis + 1);
+    candidates.reserve(cellsPerAxis * cellsPerAxis * cellsPerAxis);
+
+    for (int c0 = 0; c0 < cellsPerAxis; ++c0) {
+        for (int c1 = 0; c1 < cellsPerAxis; ++c1) {
+            for (int c2 = 0; c2 < cellsPerAxis; ++c2) {
+                int lo[3] = {c0 * cellSize, c1 * cellSize, c2 * cellSize};
+
+                // The nearest color of any point in the cell is no further away
+                // than the smallest worst-case distance over the palette
+                int bound = std::numeric_limits<int>::max();
+                for (size_t i = 0; i < count; ++i) {
+                    int nearDist = 0;
+                    int farDist = 0;
+                    for (int ch = 0; ch < 3; ++ch) {
+                        int v = colors[i][ch];
+                        int hi = lo[ch] + cellSize - 1;
+                        int nearDelta = v < lo[ch] ? lo[ch] - v : (v > hi ? v - hi : 0);
+                        int farDelta = std::max(v - lo[ch], hi - v);
+                        nearDist += nearDelta * nearDelta;
+                        farDist += farDelta * farDelta;
+                    }
+                    minDist[i] = nearDist;
+                    bound = std::min(bound, farDist);
+                }
+
+                cellStart.push_back(static_cast<uint32_t>(candidates.size()));
+                for (size_t i = 0; i < count; ++i) {
+                    if (minDist[i] <= bound) {
+                        candidates.push_back(static_cast<uint16_t>(i));
+                    }
+                }
+            }
+        }
+    }
+    cellStart.push_back(static_cast<uint32_t>(candidates.size()));
+    if (!gray) return;
+
+    // dist((b,g,r), (v,v,v)) = b^2 + g^2 + r^2 - 2 * v * sum + 3 * v^2
+    sumIndex.resize(766);
+    for (int sum = 0; sum <= 765; ++sum) {
+        int best = 0;
+        int bestScore = std::numeric_limits<int>::max();
+        for (size_t i = 0; i < count; ++i) {
+            int v = colors[i][0];
+            int score = 3 * v * v - 2 * v * sum;
+            if (score < bestScore) {
+                bestScore = score;
+                best = static_cast<int>(i);
+            }
+        }
+        sumIndex[sum] = static_cast<uint16_t>(best);
+    }
+
+    int changes = 0;
+    for (int sum = 1; sum <= 765; ++sum) {
+        if (sumIndex[sum] != sumIndex[sum - 1]) {
+            ++changes;
+            binarySplitSum = sum;
+        }
+    }
+    if (changes == 1) {
+        binaryLowIndex = sumIndex[0];
+        binaryHighIndex = sumIndex[765];
+    } else {
+        binarySplitSum = -1;
+    }
+}
+
+// Shared matcher for the parameters' palette, built on first use
+std::shared_ptr<const PaletteMatcher> getPaletteMatcher(const Parameters& params) {
+    static std::mutex cacheMutex;
+    static std::map<std::pair<ColorMetric, std::vector<uint32_t>>, std::shared_ptr<const PaletteMatcher>> cache;
+    constexpr size_t maxCachedPalettes = 16;
+
+    std::vector<cv::Vec3b> palette = getPalette(params);
+    std::pair<ColorMetric, std::vector<uint32_t>> key;
+    key.first = params.colorMetric;
+    key.second.reserve(palette.size());
+    for (const auto& color : palette) {
+        key.second.push_back((color[0] << 16) | (color[1] << 8) | color[2]);
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+
+    if (cache.size() >= maxCachedPalettes) cache.clear();
+    DITHER_PROFILE_SCOPE("palette matcher build");
+    auto matcher = std::make_shared<const PaletteMatcher>(palette, params.colorMetric);
+    cache.emplace(std::move(key), matcher);
+    return matcher;
+}
+
 // Find closest color in palette
 cv::Vec3b findClosestColor(const cv::Vec3b& color, const std::vector<cv::Vec3b>& palette) {
-    float minDist = std::numeric_limits<float>::max();
+    int minDist = std::numeric_limits<int>::max();
     cv::Vec3b closest = palette[0];
 
     for (const auto& paletteColor : palette) {
-        float dist = std::pow(color[0] - paletteColor[0], 2) +
-                     std::pow(color[1] - paletteColor[1], 2) +
-                     std::pow(color[2] - paletteColor[2], 2);
+        int d0 = color[0] - paletteColor[0];
+        int d1 = color[1] - paletteColor[1];
+        int d2 = color[2] - paletteColor[2];
+        int dist = d0 * d0 + d1 * d1 + d2 * d2;
 
         if (dist < minDist) {
             minDist = dist;
@@ -1120,6 +1735,76 @@ cv::Vec3b findClosestColor(const cv::Vec3b& color, const std::vector<cv::Vec3b>&
     return closest;
 }
 
+// Whether a backend can run in this process
+bool isBackendAvailable(Backend backend) {
+    switch (backend) {
+        case Backend::CPU: return true;
+        case Backend::OPENCL: return openclAvailable();
+        default: return false;
+    }
+}
+
+// Whether a backend has its own implementation of an algorithm; unsupported
+// combinations silently use the CPU
+bool backendSupports(Backend backend, Algorithm algo) {
+    if (backend == Backend::CPU) return true;
+
+    switch (algo) {
+        case Algorithm::ORDERED_BAYER_2X2:
+        case Algorithm::ORDERED_BAYER_4X4:
+        case Algorithm::ORDERED_BAYER_8X8:
+        case Algorithm::ORDERED_BAYER_16X16:
+        case Algorithm::BLUE_NOISE:
+        case Algorithm::WHITE_NOISE:
+        case Algorithm::RANDOM_DITHER:
+        case Algorithm::PATTERN_DITHER:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Number of worker threads requested by the parameters
+int resolveThreadCount(const Parameters& params) {
+    if (params.threads > 0) return params.threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Serial passes report one thread, whatever params.threads asks for
+int effectiveThreadCount(const Parameters& params, int rows) {
+    switch (params.algorithm) {
+        case Algorithm::RIEMERSMA:
+            return resolveThreadCount(params);
+        case Algorithm::FLOYD_STEINBERG:
+        case Algorithm::OSTROMOUKHOV:
+            if (params.serpentine > 0.5f) return 1;
+            break;
+        case Algorithm::DOT_DIFFUSION:
+            return 1;
+        default:
+            if (isPointwise(params.algorithm)) return 1;
+            break;
+    }
+    return std::max(1, std::min(resolveThreadCount(params), rows));
+}
+
+bool usesFixedPoint(const Parameters& params) {
+    switch (params.algorithm) {
+        case Algorithm::FLOYD_STEINBERG: return usesFixedPoint<FloydSteinbergKernel>(params);
+        case Algorithm::ATKINSON: return usesFixedPoint<AtkinsonKernel>(params);
+        case Algorithm::JARVIS_JUDICE_NINKE: return usesFixedPoint<JarvisJudiceNinkeKernel>(params);
+        case Algorithm::STUCKI: return usesFixedPoint<StuckiKernel>(params);
+        case Algorithm::BURKES: return usesFixedPoint<BurkesKernel>(params);
+        case Algorithm::SIERRA: return usesFixedPoint<SierraKernel>(params);
+        case Algorithm::SIERRA_TWO_ROW: return usesFixedPoint<SierraTwoRowKernel>(params);
+        case Algorithm::SIERRA_LITE: return usesFixedPoint<SierraLiteKernel>(params);
+        case Algorithm::FAN: return usesFixedPoint<FanKernel>(params);
+        case Algorithm::SHIAU_FAN: return usesFixedPoint<ShiauFanKernel>(params);
+        case Algorithm::STEVENPIGEON: return usesFixedPoint<StevenPigeonKernel>(params);
+        default: return false;   // Adaptive kernels and passes without diffusion rows
+    }
+}
+
 // Get algorithm name
 std::string getAlgorithmName(Algorithm algo) {
     switch (algo) {
@@ -1168,4 +1853,21 @@ std::string getPaletteModeName(PaletteMode mode) {
     }
 }
 
+std::string getBackendName(Backend backend) {
+    switch (backend) {
+        case Backend::CPU: return "CPU";
+        case Backend::OPENCL: return "OpenCL";
+        default: return "Unknown";
+    }
+}
+
+std::string getColorMetricName(ColorMetric metric) {
+    switch (metric) {
+        case ColorMetric::BGR: return "RGB distance";
+        case ColorMetric::OKLAB: return "OKLab";
+        case ColorMetric::CIELAB: return "CIELAB";
+        default: return "Unknown";
+    }
+}
+
 } // namespace Dithering
@@ -5,6 +5,8 @@
 #include <string>
 #include <cmath>
 #include <random>
+#include <memory>
+#include <cstdint>
 
 namespace Dithering {
 
@@ -50,6 +52,32 @@ enum class PaletteMode {
     CUSTOM
 };
 
+// Distance used to pick the nearest palette color
+enum class ColorMetric {
+    BGR,        // Euclidean on 8-bit BGR values
+    OKLAB,      // Perceptual; error diffusion runs in linear light
+    CIELAB      // CIE 1976 L*a*b*, D65; likewise diffuses in linear light
+};
+
+// Generated threshold maps shared through getCachedThresholdMap
+enum class ThresholdMapType {
+    BAYER,
+    BLUE_NOISE,
+    PATTERN
+};
+
+// Compute backends
+enum class Backend {
+    CPU,
+    OPENCL      // OpenCV T-API; threshold-map algorithms and preprocessing only
+};
+
+// Error accumulator of the table-driven diffusion kernels
+enum class DiffusionPrecision {
+    FLOAT,
+    FIXED       // int16 fixed point; kernels without power-of-two weights stay float
+};
+
 // Dithering parameters
 struct Parameters {
     Algorithm algorithm = Algorithm::FLOYD_STEINBERG;
@@ -67,13 +95,182 @@ struct Parameters {
     float saturation = 1.0f;        // Saturation adjustment
     int bayerSize = 8;              // Bayer matrix size
     unsigned int seed = 42;         // Random seed
+    unsigned int frame = 0;         // Frame index mixed into the noise (see noiseHash)
     bool useBlueNoise = true;       // Use blue noise for ordered dithering
     float ditherScale = 1.0f;       // Scale factor for dither pattern
+    int threads = 1;                // Diffusion and Riemersma worker threads (0 = all cores)
+    Backend backend = Backend::CPU; // Falls back to CPU where OpenCL is unsupported
+    DiffusionPrecision precision = DiffusionPrecision::FLOAT;
+    ColorMetric colorMetric = ColorMetric::BGR;  // Gray palettes always match by BGR
+};
+
+// Precomputed nearest-color lookup for a fixed palette.
+// The BGR cube is split into 32x32x32 cells; each cell stores only the palette
+// entries that can be nearest to some color inside it, so a lookup scans a
+// handful of candidates (usually one) instead of the whole palette.
+// Results are identical to findClosestColor, including tie-breaking.
+//
+// With a perceptual metric and a color palette the cube is instead a 64^3
+// lattice of nearest entries in OKLab or CIELAB, so a lookup is one table
+// read. Cells whose corners disagree, or that hold a palette color, keep
+// their corners' entries and are refined per pixel by converting it exactly.
+class PaletteMatcher {
+public:
+    explicit PaletteMatcher(const std::vector<cv::Vec3b>& palette, ColorMetric metric = ColorMetric::BGR);
+
+    int findIndex(const cv::Vec3b& color) const {
+        if (!lattice.empty()) {
+            uint32_t entry = lattice[((color[0] >> 2) << 12) | ((color[1] >> 2) << 6) | (color[2] >> 2)];
+            return entry & refineFlag ? refineIndex(color, entry & ~refineFlag) : static_cast<int>(entry);
+        }
+
+        int cell = ((color[0] >> 3) << 10) | ((color[1] >> 3) << 5) | (color[2] >> 3);
+        uint32_t begin = cellStart[cell];
+        uint32_t end = cellStart[cell + 1];
+        if (end - begin == 1) return candidates[begin];
+
+        int best = candidates[begin];
+        int minDist = distance(color, colors[best]);
+        for (uint32_t i = begin + 1; i < end; ++i) {
+            int dist = distance(color, colors[candidates[i]]);
+            if (dist < minDist) {
+                minDist = dist;
+                best = candidates[i];
+            }
+        }
+        return best;
+    }
+
+    const cv::Vec3b& findClosest(const cv::Vec3b& color) const {
+        return colors[findIndex(color)];
+    }
+
+    const std::vector<cv::Vec3b>& palette() const { return colors; }
+
+    // For palettes made only of grays the nearest entry depends only on
+    // b + g + r, so it can be looked up by that sum (0..765).
+    bool isGray() const { return !sumIndex.empty(); }
+    int findIndexBySum(int sum) const { return sumIndex[sum]; }
+
+    // Two-entry gray palettes: sums >= binarySplit() map to binaryHigh()
+    bool isBinaryGray() const { return binarySplitSum >= 0; }
+    int binarySplit() const { return binarySplitSum; }
+    int binaryLow() const { return binaryLowIndex; }
+    int binaryHigh() const { return binaryHighIndex; }
+
+    // Perceptual matchers diffuse error in linear light
+    bool linearLight() const { return !lattice.empty(); }
+
+private:
+    static constexpr uint32_t refineFlag = 0x80000000u;
+
+    void buildLattice(ColorMetric metric);
+    int refineIndex(const cv::Vec3b& color, uint32_t offset) const;
+
+    static int distance(const cv::Vec3b& a, const cv::Vec3b& b) {
+        int d0 = a[0] - b[0];
+        int d1 = a[1] - b[1];
+        int d2 = a[2] - b[2];
+        return d0 * d0 + d1 * d1 + d2 * d2;
+    }
+
+    std::vector<cv::Vec3b> colors;
+    std::vector<uint32_t> cellStart;    // 32^3 + 1 offsets into candidates
+    std::vector<uint16_t> candidates;   // Palette indices, ascending per cell
+    std::vector<uint16_t> sumIndex;     // Gray palettes only: b + g + r -> index
+    int binarySplitSum = -1;
+    int binaryLowIndex = 0;
+    int binaryHighIndex = 0;
+
+    ColorMetric latticeMetric = ColorMetric::BGR;
+    std::vector<uint32_t> lattice;          // 64^3 entries, or refineFlag | offset into refineLists
+    std::vector<uint16_t> refineLists;      // Per refined cell: count, then palette indices
+    std::vector<cv::Vec3f> perceptual;      // Palette in lattice space
+};
+
+// Scratch memory for repeated ditherImage calls: converted and preprocessed
+// input, error rows, threshold rows, diffusion threads and the palette
+// matcher. Buffers grow to the largest image seen and are then reused, so a
+// stream of same-sized frames dithers without heap allocations (dot
+// diffusion still allocates its result). A workspace must not be used by two threads at once.
+class Workspace {
+public:
+    Workspace();
+    ~Workspace();
+
+    Workspace(const Workspace&) = delete;
+    Workspace& operator=(const Workspace&) = delete;
+
+    struct Impl;
+    Impl& impl() { return *state; }
+
+private:
+    std::unique_ptr<Impl> state;
 };
 
 // Core dithering function
 cv::Mat ditherImage(const cv::Mat& input, const Parameters& params);
 
+// Dither into output (CV_8UC3), reusing its buffer when it already has the
+// input's size, and workspace's buffers for everything else. output may be
+// input itself when input is CV_8UC3.
+void ditherImage(const cv::Mat& input, cv::Mat& output, const Parameters& params, Workspace& workspace);
+
+// Dither one region of input into the same region of output, which must
+// already be an input-sized CV_8UC3 image. For pointwise algorithms the
+// result is exactly that region of the whole image dithered at once; other
+// algorithms dither the region as an image of its own. Always runs on the CPU.
+void ditherRegion(const cv::Mat& input, cv::Mat& output, const cv::Rect& region, const Parameters& params,
+                  Workspace& workspace);
+
+// Whether each output pixel depends only on the input pixel and its
+// position (Bayer, blue noise, pattern, white noise and random dithering)
+bool isPointwise(Algorithm algo);
+
+// Counter-based noise: 32 random bits for pixel (x, y) of the given frame,
+// computed from the coordinates alone rather than drawn from a sequence.
+// White noise, random and variable error diffusion take their noise from
+// it, so any pixel, tile or strip can be dithered on its own, in any order
+// or on any device, and still match the whole image for the same seed.
+uint32_t noiseHash(unsigned int seed, int x, int y, unsigned int frame = 0);
+
+// noiseHash as a float in [0, 1)
+inline float noiseUnit(uint32_t bits) { return static_cast<float>(bits >> 8) * (1.0f / 16777216.0f); }
+
+// Device-side variant: with the OpenCL backend the image never leaves the GPU
+// for supported algorithms; anything else round-trips through the CPU path.
+cv::UMat ditherImage(const cv::UMat& input, const Parameters& params);
+
+// Incremental dithering of an image delivered top to bottom in strips of
+// any height. Only state that crosses strip boundaries is kept: the error
+// rows of diffusion kernels and the map phase of threshold algorithms.
+// Output is identical to ditherImage on the whole image. Always runs on the
+// CPU.
+class StripDitherer {
+public:
+    StripDitherer(int width, int height, const Parameters& params);
+    ~StripDitherer();
+
+    StripDitherer(const StripDitherer&) = delete;
+    StripDitherer& operator=(const StripDitherer&) = delete;
+
+    // Dither the next strip (CV_8UC1/3/4, width columns) into output
+    void process(const cv::Mat& strip, cv::Mat& output);
+
+    int rowsDone() const { return nextRow; }
+
+    // Algorithms that need the whole image at once (dot diffusion,
+    // Riemersma, gradient-based) cannot be streamed
+    static bool supports(Algorithm algo);
+
+    struct Engine;
+
+private:
+    Parameters params;
+    std::unique_ptr<Engine> engine;
+    int nextRow = 0;
+};
+
 // Individual algorithm implementations
 cv::Mat floydSteinberg(const cv::Mat& input, const Parameters& params);
 cv::Mat atkinson(const cv::Mat& input, const Parameters& params);
@@ -99,10 +296,30 @@ cv::Mat stevenPigeon(const cv::Mat& input, const Parameters& params);
 
 // Utility functions
 std::vector<cv::Vec3b> getPalette(PaletteMode mode);
+std::vector<cv::Vec3b> getPalette(const Parameters& params);
+std::shared_ptr<const PaletteMatcher> getPaletteMatcher(const Parameters& params);
 cv::Vec3b findClosestColor(const cv::Vec3b& color, const std::vector<cv::Vec3b>& palette);
 cv::Mat generateBlueNoiseTexture(int size, unsigned int seed);
 cv::Mat generateBayerMatrix(int size);
+cv::Mat getThresholdMap(const Parameters& params);
+std::shared_ptr<const cv::Mat> getCachedThresholdMap(ThresholdMapType type, int size, unsigned int seed = 0);
+bool isBackendAvailable(Backend backend);
+bool backendSupports(Backend backend, Algorithm algo);
+int resolveThreadCount(const Parameters& params);
+
+// Threads ditherImage actually runs for an image of the given height. Only
+// error diffusion and Riemersma take params.threads, and serpentine scans
+// (Floyd-Steinberg and Ostromoukhov unless params.serpentine is off) run
+// serially.
+int effectiveThreadCount(const Parameters& params, int rows);
+
+// Whether ditherImage diffuses error in int16 fixed point for params: FIXED
+// precision with a power-of-two kernel, |strength| <= 2 and RGB matching.
+// Every other case runs in float whatever params.precision asks for.
+bool usesFixedPoint(const Parameters& params);
 std::string getAlgorithmName(Algorithm algo);
 std::string getPaletteModeName(PaletteMode mode);
+std::string getBackendName(Backend backend);
+std::string getColorMetricName(ColorMetric metric);
 
 } // namespace Dithering
@@ -0,0 +1,25 @@
+#pragma once
+
+// GIF building blocks shared by the still and animated writers. Internal to
+// the library.
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace Dithering {
+
+// GIF's LZW variant: codes grow from minCodeSize + 1 to 12 bits and the
+// dictionary starts over once code 4095 is assigned. Appends the packed
+// code stream for count indices to out.
+void lzwEncode(const uint8_t* data, size_t count, int minCodeSize, std::vector<uint8_t>& out);
+
+// Write data as sub-blocks of at most 255 bytes followed by the terminator
+void writeGifSubBlocks(std::ostream& out, const std::vector<uint8_t>& data);
+
+// Little-endian integers as used by GIF and BMP
+void writeUint16LE(std::ostream& out, uint32_t value);
+void writeUint32LE(std::ostream& out, uint32_t value);
+
+} // namespace Dithering
@@ -0,0 +1,215 @@
+#include "gpu.h"
+#include <opencv2/core/ocl.hpp>
+#include <algorithm>
+
+namespace Dithering {
+
+namespace {
+
+// One work item per pixel. Contraction is disabled so the float maths rounds
+// exactly like the CPU path, and white noise hashes coordinates exactly like
+// noiseHash, so both backends give identical output.
+const char* ditherKernelSource = R"CLC(
+#pragma OPENCL FP_CONTRACT OFF
+
+inline uint hashBits(uint x) {
+    x ^= x >> 16; x *= 0x7feb352du;
+    x ^= x >> 15; x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// mode 0: untouched, 1: 8-bit tone LUT, 2: float tone curve + saturation
+inline uchar3 preprocessPixel(uchar3 p, __global const uchar* lut, __global const float* curve,
+                              int mode, float saturation) {
+    if (mode == 1) {
+        return (uchar3)(lut[p.x], lut[p.y], lut[p.z]);
+    }
+    if (mode == 2) {
+        float b = curve[p.x], g = curve[p.y], r = curve[p.z];
+        float v = fmax(b, fmax(g, r));
+        return (uchar3)(convert_uchar_sat_rte(clamp(v + (b - v) * saturation, 0.0f, 1.0f) * 255.0f),
+                        convert_uchar_sat_rte(clamp(v + (g - v) * saturation, 0.0f, 1.0f) * 255.0f),
+                        convert_uchar_sat_rte(clamp(v + (r - v) * saturation, 0.0f, 1.0f) * 255.0f));
+    }
+    return p;
+}
+
+__kernel void preprocess(__global const uchar* src, int src_step, int src_offset,
+                         __global uchar* dst, int dst_step, int dst_offset, int rows, int cols,
+                         __global const uchar* lut, __global const float* curve,
+                         int mode, float saturation) {
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) return;
+
+    uchar3 p = vload3(0, src + src_offset + y * src_step + x * 3);
+    vstore3(preprocessPixel(p, lut, curve, mode, saturation), 0, dst + dst_offset + y * dst_step + x * 3);
+}
+
+// Threshold offsets come from a tiled map, or from the coordinate hash when
+// mapRows is 0 (white noise and random). With gray set (gray palettes) the offset is
+// applied to the pixel's BT.601 luminance alone, as on the CPU.
+__kernel void thresholdDither(__global const uchar* src, int src_step, int src_offset,
+                              __global uchar* dst, int dst_step, int dst_offset, int rows, int cols,
+                              __global const uchar* lut, __global const float* curve,
+                              int mode, float saturation,
+                              __global const float* offsets, int mapRows, int mapCols,
+                              uint seed, uint frame, float strength,
+                              __global const uchar* palette, int paletteSize, int gray) {
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) return;
+
+    uchar3 p = vload3(0, src + src_offset + y * src_step + x * 3);
+    p = preprocessPixel(p, lut, curve, mode, saturation);
+
+    float offset;
+    if (mapRows > 0) {
+        offset = offsets[(y % mapRows) * mapCols + (x % mapCols)];
+    } else {
+        // noiseHash and noiseUnit, as the CPU white noise and random paths use
+        uint h = hashBits((seed + frame * 0x9e3779b9u) ^ hashBits((uint)x + hashBits((uint)y)));
+        offset = ((float)(h >> 8) * (1.0f / 16777216.0f) * 255.0f - 127.5f) * strength;
+    }
+
+    int b, g, r;
+    if (gray) {
+        int level = ((int)p.x * 1868 + (int)p.y * 9617 + (int)p.z * 4899 + 8192) >> 14;
+        b = g = r = convert_int(clamp((float)level + offset, 0.0f, 255.0f));
+    } else {
+        b = convert_int(clamp((float)p.x + offset, 0.0f, 255.0f));
+        g = convert_int(clamp((float)p.y + offset, 0.0f, 255.0f));
+        r = convert_int(clamp((float)p.z + offset, 0.0f, 255.0f));
+    }
+
+    int best = 0;
+    int bestDist = INT_MAX;
+    for (int i = 0; i < paletteSize; ++i) {
+        int d0 = b - palette[i * 3];
+        int d1 = g - palette[i * 3 + 1];
+        int d2 = r - palette[i * 3 + 2];
+        int dist = d0 * d0 + d1 * d1 + d2 * d2;
+        if (dist < bestDist) {
+            bestDist = dist;
+            best = i;
+        }
+    }
+
+    vstore3(vload3(best, palette), 0, dst + dst_offset + y * dst_step + x * 3);
+}
+)CLC";
+
+const cv::ocl::ProgramSource& ditherProgram() {
+    static const cv::ocl::ProgramSource source(ditherKernelSource);
+    return source;
+}
+
+// Tone tables for the kernels, uploaded as small device buffers
+struct ToneTables {
+    cv::UMat lut;
+    cv::UMat curve;
+    int mode = 0;
+};
+
+ToneTables buildToneTables(const Parameters& params) {
+    ToneTables tables;
+    cv::Mat lut = cv::Mat::zeros(1, 256, CV_8U);
+    cv::Mat curve = cv::Mat::zeros(1, 256, CV_32F);
+
+    if (needsPreprocessing(params)) {
+        std::array<float, 256> values = buildToneCurve(params);
+        for (int v = 0; v < 256; ++v) {
+            curve.at<float>(0, v) = values[v];
+            lut.at<uchar>(0, v) = cv::saturate_cast<uchar>(std::clamp(values[v], 0.0f, 1.0f) * 255.0f);
+        }
+        tables.mode = params.saturation == 1.0f ? 1 : 2;
+    }
+
+    lut.copyTo(tables.lut);
+    curve.copyTo(tables.curve);
+    return tables;
+}
+
+} // namespace
+
+bool openclAvailable() {
+    return cv::ocl::haveOpenCL() && cv::ocl::useOpenCL();
+}
+
+bool openclDither(cv::InputArray input, cv::OutputArray output, const Parameters& params) {
+    // The kernel matches colors by BGR distance only
+    if (!backendSupports(Backend::OPENCL, params.algorithm) || params.colorMetric != ColorMetric::BGR ||
+        input.type() != CV_8UC3 || !openclAvailable()) {
+        return false;
+    }
+
+    cv::ocl::Kernel kernel("thresholdDither", ditherProgram());
+    if (kernel.empty()) return false;
+
+    // Same offsets the CPU path precomputes; an empty map means white noise
+    cv::Mat thresholdMap = getThresholdMap(params);
+    cv::Mat offsets = cv::Mat::zeros(1, 1, CV_32F);
+    if (!thresholdMap.empty()) {
+        offsets.create(thresholdMap.rows, thresholdMap.cols, CV_32F);
+        for (int y = 0; y < thresholdMap.rows; ++y) {
+            for (int x = 0; x < thresholdMap.cols; ++x) {
+                offsets.at<float>(y, x) = (thresholdMap.at<float>(y, x) * 255.0f - 127.5f) * params.strength;
+            }
+        }
+    }
+
+    std::vector<cv::Vec3b> palette = getPalette(params);
+    if (palette.empty()) return false;
+
+    ToneTables tables = buildToneTables(params);
+    cv::UMat deviceOffsets, devicePalette;
+    offsets.copyTo(deviceOffsets);
+    cv::Mat paletteRow(1, static_cast<int>(palette.size()), CV_8UC3);
+    for (size_t i = 0; i < palette.size(); ++i) {
+        paletteRow.at<cv::Vec3b>(0, static_cast<int>(i)) = palette[i];
+    }
+    paletteRow.copyTo(devicePalette);
+
+    cv::UMat src = input.getUMat();
+    output.create(src.size(), CV_8UC3);
+    cv::UMat dst = output.getUMat();
+
+    kernel.args(cv::ocl::KernelArg::ReadOnlyNoSize(src),
+                cv::ocl::KernelArg::WriteOnly(dst),
+                cv::ocl::KernelArg::PtrReadOnly(tables.lut),
+                cv::ocl::KernelArg::PtrReadOnly(tables.curve),
+                tables.mode, params.saturation,
+                cv::ocl::KernelArg::PtrReadOnly(deviceOffsets),
+                thresholdMap.empty() ? 0 : thresholdMap.rows,
+                thresholdMap.empty() ? 0 : thresholdMap.cols,
+                static_cast<unsigned int>(params.seed), static_cast<unsigned int>(params.frame), params.strength,
+                cv::ocl::KernelArg::PtrReadOnly(devicePalette),
+                static_cast<int>(palette.size()), getPaletteMatcher(params)->isGray() ? 1 : 0);
+
+    size_t globalSize[2] = {static_cast<size_t>(src.cols), static_cast<size_t>(src.rows)};
+    return kernel.run(2, globalSize, nullptr, false);
+}
+
+bool openclPreprocess(cv::InputArray input, cv::OutputArray output, const Parameters& params) {
+    if (input.type() != CV_8UC3 || !openclAvailable()) return false;
+
+    cv::ocl::Kernel kernel("preprocess", ditherProgram());
+    if (kernel.empty()) return false;
+
+    ToneTables tables = buildToneTables(params);
+    cv::UMat src = input.getUMat();
+    output.create(src.size(), CV_8UC3);
+    cv::UMat dst = output.getUMat();
+
+    kernel.args(cv::ocl::KernelArg::ReadOnlyNoSize(src),
+                cv::ocl::KernelArg::WriteOnly(dst),
+                cv::ocl::KernelArg::PtrReadOnly(tables.lut),
+                cv::ocl::KernelArg::PtrReadOnly(tables.curve),
+                tables.mode, params.saturation);
+
+    size_t globalSize[2] = {static_cast<size_t>(src.cols), static_cast<size_t>(src.rows)};
+    return kernel.run(2, globalSize, nullptr, false);
+}
+
+} // namespace Dithering
@@ -0,0 +1,29 @@
+#pragma once
+
+// OpenCL backend built on OpenCV's transparent API. Internal to the library.
+
+#include "dithering.h"
+#include <array>
+
+namespace Dithering {
+
+// Shared with the CPU preprocessing in dithering.cpp
+bool needsPreprocessing(const Parameters& params);
+std::array<float, 256> buildToneCurve(const Parameters& params);
+
+// CPU preprocessing of a CV_8UC3 image; lut is scratch for the tone table
+void preprocessInto(const cv::Mat& input, cv::Mat& processed, const Parameters& params, cv::Mat& lut);
+
+// Whether OpenCL can be used in this process
+bool openclAvailable();
+
+// Preprocess and dither a CV_8UC3 image with a threshold-map algorithm in a
+// single kernel. input and output may be Mat or UMat; a UMat output stays on
+// the device. Returns false when OpenCL is unavailable, the algorithm has no
+// OpenCL kernel or the kernel could not run; the caller then uses the CPU path.
+bool openclDither(cv::InputArray input, cv::OutputArray output, const Parameters& params);
+
+// Device-side gamma/contrast/brightness/saturation, same maths as the CPU path
+bool openclPreprocess(cv::InputArray input, cv::OutputArray output, const Parameters& params);
+
+} // namespace Dithering
@@ -0,0 +1,378 @@
+#include "indexed.h"
+#include "gifcodec.h"
+#include "profile.h"
+#include <algorithm>
+#include <cctype>
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+
+#ifdef DITHER_WITH_PNG
+#include <png.h>
+#endif
+
+namespace Dithering {
+
+void writeUint16LE(std::ostream& out, uint32_t value) {
+    unsigned char bytes[2] = {static_cast<unsigned char>(value), static_cast<unsigned char>(value >> 8)};
+    out.write(reinterpret_cast<const char*>(bytes), 2);
+}
+
+void writeUint32LE(std::ostream& out, uint32_t value) {
+    writeUint16LE(out, value & 0xffff);
+    writeUint16LE(out, value >> 16);
+}
+
+namespace {
+
+// Packs variable-width codes least significant bit first, as GIF expects
+class CodeWriter {
+public:
+    explicit CodeWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    void put(int code, int width) {
+        buffer |= static_cast<uint32_t>(code) << bits;
+        bits += width;
+        while (bits >= 8) {
+            out.push_back(static_cast<uint8_t>(buffer));
+            buffer >>= 8;
+            bits -= 8;
+        }
+    }
+
+    void flush() {
+        if (bits > 0) out.push_back(static_cast<uint8_t>(buffer));
+        buffer = 0;
+        bits = 0;
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    uint32_t buffer = 0;
+    int bits = 0;
+};
+
+} // namespace
+
+// The dictionary is an open-addressed hash of (prefix code, next index) pairs
+void lzwEncode(const uint8_t* data, size_t count, int minCodeSize, std::vector<uint8_t>& out) {
+    constexpr int maxCode = 4095;
+    constexpr int tableSize = 8191;  // Prime, about twice the dictionary size
+    const int clearCode = 1 << minCodeSize;
+    const int endCode = clearCode + 1;
+
+    std::vector<int32_t> keys(tableSize, -1);
+    std::vector<uint16_t> codes(tableSize);
+    CodeWriter writer(out);
+
+    int codeSize = minCodeSize + 1;
+    int nextCode = clearCode + 2;
+    writer.put(clearCode, codeSize);
+
+    if (count > 0) {
+        int prefix = data[0];
+        for (size_t i = 1; i < count; ++i) {
+            const int symbol = data[i];
+            const int32_t key = (prefix << 8) | symbol;
+            int slot = ((symbol << 5) ^ prefix) % tableSize;
+            while (keys[slot] >= 0 && keys[slot] != key) {
+                if (++slot == tableSize) slot = 0;
+            }
+            if (keys[slot] == key) {
+                prefix = codes[slot];
+                continue;
+            }
+
+            writer.put(prefix, codeSize);
+            const int code = nextCode++;
+            keys[slot] = key;
+            codes[slot] = static_cast<uint16_t>(code);
+            if (code >= (1 << codeSize)) ++codeSize;
+            if (code == maxCode) {
+                writer.put(clearCode, codeSize);
+                std::fill(keys.begin(), keys.end(), -1);
+                codeSize = minCodeSize + 1;
+                nextCode = clearCode + 2;
+            }
+            prefix = symbol;
+        }
+        // The decoder adds an entry for the last code too, and widens its
+        // codes if that fills the current size
+        writer.put(prefix, codeSize);
+        if (nextCode >= (1 << codeSize) && codeSize < 12) ++codeSize;
+    }
+
+    writer.put(endCode, codeSize);
+    writer.flush();
+}
+
+void writeGifSubBlocks(std::ostream& out, const std::vector<uint8_t>& data) {
+    for (size_t offset = 0; offset < data.size(); offset += 255) {
+        size_t block = std::min<size_t>(255, data.size() - offset);
+        out.put(static_cast<char>(block));
+        out.write(reinterpret_cast<const char*>(data.data() + offset), block);
+    }
+    out.put(0);
+}
+
+namespace {
+
+std::string lowerExtension(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return "";
+    std::string ext = path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+bool writeGif(const std::string& path, const IndexedImage& image) {
+    const cv::Mat& indices = image.indices;
+    if (indices.cols > 65535 || indices.rows > 65535) return false;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+
+    // The color table holds a power of two of at least two entries
+    const int depth = image.bitDepth();
+    const int tableEntries = 1 << depth;
+
+    file.write("GIF89a", 6);
+    writeUint16LE(file, indices.cols);
+    writeUint16LE(file, indices.rows);
+    file.put(static_cast<char>(0x80 | ((depth - 1) << 4) | (depth - 1)));  // Global table, depth-bit colors
+    file.put(0);                                                            // Background index
+    file.put(0);                                                            // Square pixels
+    for (int i = 0; i < tableEntries; ++i) {
+        cv::Vec3b color = i < static_cast<int>(image.palette.size()) ? image.palette[i] : cv::Vec3b(0, 0, 0);
+        file.put(static_cast<char>(color[2]));
+        file.put(static_cast<char>(color[1]));
+        file.put(static_cast<char>(color[0]));
+    }
+
+    file.put(0x2c);  // Image descriptor, no local table or interlace
+    writeUint16LE(file, 0);
+    writeUint16LE(file, 0);
+    writeUint16LE(file, indices.cols);
+    writeUint16LE(file, indices.rows);
+    file.put(0);
+
+    cv::Mat continuous = indices.isContinuous() ? indices : indices.clone();
+    const int minCodeSize = std::max(2, depth);
+    std::vector<uint8_t> data;
+    lzwEncode(continuous.ptr<uint8_t>(), continuous.total(), minCodeSize, data);
+
+    file.put(static_cast<char>(minCodeSize));
+    writeGifSubBlocks(file, data);
+    file.put(0x3b);  // Trailer
+    return static_cast<bool>(file);
+}
+
+// Bottom-up BITMAPINFOHEADER file at 1, 4 or 8 bits per pixel
+bool writeBmp(const std::string& path, const IndexedImage& image) {
+    const cv::Mat& indices = image.indices;
+    const int depth = image.bitDepth() == 2 ? 4 : image.bitDepth();
+    const uint32_t stride = ((static_cast<uint32_t>(indices.cols) * depth + 31) / 32) * 4;
+    const uint32_t paletteBytes = static_cast<uint32_t>(image.palette.size()) * 4;
+    const uint32_t dataOffset = 14 + 40 + paletteBytes;
+    const uint64_t fileSize = dataOffset + static_cast<uint64_t>(stride) * indices.rows;
+    if (fileSize > 0xffffffffu) return false;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+
+    file.write("BM", 2);
+    writeUint32LE(file, static_cast<uint32_t>(fileSize));
+    writeUint32LE(file, 0);
+    writeUint32LE(file, dataOffset);
+
+    writeUint32LE(file, 40);
+    writeUint32LE(file, static_cast<uint32_t>(indices.cols));
+    writeUint32LE(file, static_cast<uint32_t>(indices.rows));
+    writeUint16LE(file, 1);                               // Planes
+    writeUint16LE(file, depth);
+    writeUint32LE(file, 0);                               // BI_RGB
+    writeUint32LE(file, static_cast<uint32_t>(stride * indices.rows));
+    writeUint32LE(file, 2835);                            // 72 DPI
+    writeUint32LE(file, 2835);
+    writeUint32LE(file, static_cast<uint32_t>(image.palette.size()));
+    writeUint32LE(file, 0);
+
+    for (const cv::Vec3b& color : image.palette) {
+        const char entry[4] = {static_cast<char>(color[0]), static_cast<char>(color[1]),
+                               static_cast<char>(color[2]), 0};
+        file.write(entry, 4);
+    }
+
+    const int perByte = 8 / depth;
+    std::vector<uint8_t> row(stride);
+    for (int y = indices.rows - 1; y >= 0; --y) {
+        const uint8_t* src = indices.ptr<uint8_t>(y);
+        std::fill(row.begin(), row.end(), 0);
+        for (int x = 0; x < indices.cols; ++x) {
+            int shift = 8 - depth * (x % perByte + 1);
+            row[x / perByte] |= static_cast<uint8_t>(src[x] << shift);
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), stride);
+    }
+    return static_cast<bool>(file);
+}
+
+// Raw PBM (P4): one bit per pixel, most significant first, 1 is black
+bool writePbm(const std::string& path, const IndexedImage& image) {
+    const std::vector<cv::Vec3b>& palette = image.palette;
+    auto brightness = [](const cv::Vec3b& c) { return c[0] + c[1] + c[2]; };
+    uint8_t black[2] = {0, 0};
+    if (palette.size() == 1) {
+        black[0] = brightness(palette[0]) < 383;
+    } else {
+        bool firstDarker = brightness(palette[0]) <= brightness(palette[1]);
+        black[0] = firstDarker;
+        black[1] = !firstDarker;
+    }
+
+    const cv::Mat& indices = image.indices;
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    file << "P4\n" << indices.cols << " " << indices.rows << "\n";
+
+    std::vector<uint8_t> row((indices.cols + 7) / 8);
+    for (int y = 0; y < indices.rows; ++y) {
+        const uint8_t* src = indices.ptr<uint8_t>(y);
+        std::fill(row.begin(), row.end(), 0);
+        for (int x = 0; x < indices.cols; ++x) {
+            row[x >> 3] |= static_cast<uint8_t>(black[src[x]] << (7 - (x & 7)));
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+    return static_cast<bool>(file);
+}
+
+#ifdef DITHER_WITH_PNG
+
+// libpng reports errors by longjmp; see the note in stream.cpp
+class PngIndexedWriter {
+public:
+    ~PngIndexedWriter() {
+        if (png) png_destroy_write_struct(&png, &info);
+        if (file) std::fclose(file);
+    }
+
+    bool write(const std::string& path, const IndexedImage& image) {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) return false;
+
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        if (!png) return false;
+        info = png_create_info_struct(png);
+        if (!info) return false;
+
+        png_color colors[256];
+        const int entries = static_cast<int>(image.palette.size());
+        for (int i = 0; i < entries; ++i) {
+            colors[i].red = image.palette[i][2];
+            colors[i].green = image.palette[i][1];
+            colors[i].blue = image.palette[i][0];
+        }
+
+        if (setjmp(png_jmpbuf(png))) return false;
+        png_init_io(png, file);
+        png_set_IHDR(png, info, image.indices.cols, image.indices.rows, image.bitDepth(),
+                     PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                     PNG_FILTER_TYPE_DEFAULT);
+        png_set_PLTE(png, info, colors, entries);
+        png_write_info(png, info);
+
+        // Rows stay one index per byte; libpng packs them to the bit depth
+        png_set_packing(png);
+        for (int y = 0; y < image.indices.rows; ++y) {
+            png_write_row(png, image.indices.ptr<png_byte>(y));
+        }
+        png_write_end(png, nullptr);
+        png_destroy_write_struct(&png, &info);
+        png = nullptr;
+
+        bool closed = std::fclose(file) == 0;
+        file = nullptr;
+        return closed;
+    }
+
+private:
+    std::FILE* file = nullptr;
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+};
+
+#endif // DITHER_WITH_PNG
+
+} // namespace
+
+int paletteBitDepth(size_t entries) {
+    if (entries <= 2) return 1;
+    if (entries <= 4) return 2;
+    if (entries <= 16) return 4;
+    return 8;
+}
+
+int IndexedImage::bitDepth() const {
+    return paletteBitDepth(palette.size());
+}
+
+bool indexImage(const cv::Mat& dithered, const PaletteMatcher& matcher, IndexedImage& output) {
+    if (matcher.palette().size() > 256 || dithered.type() != CV_8UC3) return false;
+    DITHER_PROFILE_PIXELS("index", dithered.total());
+
+    output.palette = matcher.palette();
+    output.indices.create(dithered.rows, dithered.cols, CV_8U);
+    cv::parallel_for_(cv::Range(0, dithered.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const cv::Vec3b* src = dithered.ptr<cv::Vec3b>(y);
+            uint8_t* dst = output.indices.ptr<uint8_t>(y);
+            for (int x = 0; x < dithered.cols; ++x) {
+                dst[x] = static_cast<uint8_t>(matcher.findIndex(src[x]));
+            }
+        }
+    });
+    return true;
+}
+
+bool ditherIndexed(const cv::Mat& input, const Parameters& params, IndexedImage& output) {
+    return indexImage(ditherImage(input, params), *getPaletteMatcher(params), output);
+}
+
+cv::Mat expandIndexed(const IndexedImage& image) {
+    cv::Mat expanded(image.indices.rows, image.indices.cols, CV_8UC3);
+    for (int y = 0; y < image.indices.rows; ++y) {
+        const uint8_t* src = image.indices.ptr<uint8_t>(y);
+        cv::Vec3b* dst = expanded.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < image.indices.cols; ++x) {
+            dst[x] = image.palette[src[x]];
+        }
+    }
+    return expanded;
+}
+
+bool isIndexedFormat(const std::string& path) {
+    std::string ext = lowerExtension(path);
+#ifdef DITHER_WITH_PNG
+    if (ext == ".png") return true;
+#endif
+    return ext == ".gif" || ext == ".bmp" || ext == ".pbm";
+}
+
+bool writeIndexedImage(const std::string& path, const IndexedImage& image) {
+    if (image.indices.empty() || image.palette.empty() || image.palette.size() > 256) return false;
+    DITHER_PROFILE_PIXELS("write indexed", image.indices.total());
+
+    std::string ext = lowerExtension(path);
+#ifdef DITHER_WITH_PNG
+    if (ext == ".png") return PngIndexedWriter().write(path, image);
+#endif
+    if (ext == ".gif") return writeGif(path, image);
+    if (ext == ".bmp") return writeBmp(path, image);
+    if (ext == ".pbm" && image.palette.size() <= 2) return writePbm(path, image);
+    return cv::imwrite(path, expandIndexed(image));
+}
+
+} // namespace Dithering
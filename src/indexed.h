@@ -0,0 +1,43 @@
+#pragma once
+
+#include "dithering.h"
+#include <string>
+#include <vector>
+
+namespace Dithering {
+
+// Dithered image stored as palette indices rather than BGR pixels. Every
+// algorithm's output is made only of palette colors, so for palettes of up
+// to 256 entries this is lossless and a third of the size before encoding.
+struct IndexedImage {
+    cv::Mat indices;                  // CV_8U, one palette index per pixel
+    std::vector<cv::Vec3b> palette;   // BGR
+
+    // Smallest bit depth (1, 2, 4 or 8) that holds every palette index
+    int bitDepth() const;
+};
+
+// Bit depth for a palette of the given size, as IndexedImage::bitDepth
+int paletteBitDepth(size_t entries);
+
+// Map a dithered CV_8UC3 image to the matcher's palette indices. Returns
+// false if the palette has more than 256 entries.
+bool indexImage(const cv::Mat& dithered, const PaletteMatcher& matcher, IndexedImage& output);
+
+// Dither input and index the result by the parameters' palette
+bool ditherIndexed(const cv::Mat& input, const Parameters& params, IndexedImage& output);
+
+// Back to CV_8UC3
+cv::Mat expandIndexed(const IndexedImage& image);
+
+// Whether path's extension has a palettized writer: .gif, .bmp, .pbm, and
+// .png when built with libpng
+bool isIndexedFormat(const std::string& path);
+
+// Write a palettized PNG, GIF or BMP at the image's bit depth (BMP has no
+// 2-bit mode and uses 4), or a packed 1-bit PBM for two-entry palettes with
+// the darker entry as black. Anything else is expanded and written with
+// cv::imwrite.
+bool writeIndexedImage(const std::string& path, const IndexedImage& image);
+
+} // namespace Dithering
@@ -5,6 +5,10 @@
 #include <atomic>
 #include <chrono>
 #include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <future>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/videoio.hpp>
@@ -15,16 +19,56 @@
 #include <GLFW/glfw3.h>
 #include <GL/gl.h>
 
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_BGR
+#define GL_BGR 0x80E0
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+
 #include "dithering.h"
 #include "platform.h"
+#include "video.h"
+#include "preview.h"
+#include "indexed.h"
+#include "profile.h"
+#include "sweep.h"
+
+// Texture kept alive across updates; reallocated only when the size changes
+struct GLTexture {
+    GLuint id = 0;
+    int width = 0;
+    int height = 0;
+    GLuint buffers[2] = {0, 0};     // Pixel unpack buffers, used alternately
+    int nextBuffer = 0;
+};
+
+constexpr int ALGORITHM_COUNT = static_cast<int>(Dithering::Algorithm::STEVENPIGEON) + 1;
+constexpr int BUILTIN_PALETTE_COUNT = static_cast<int>(Dithering::PaletteMode::CUSTOM);
 
 // Application state
 struct AppState {
-    cv::Mat originalImage;
+    cv::Mat originalImage;          // Until fullResolution, a reduced decode
+    cv::Size imageSize;             // Full resolution of the loaded image
+    bool fullResolution = true;
+    Dithering::ImageLoader loader;
     cv::Mat processedImage;
     cv::Mat displayImage;
-    GLuint originalTexture = 0;
-    GLuint processedTexture = 0;
+    GLTexture originalTexture;
+    GLTexture processedTexture;
+    GLTexture draftTexture;         // Low-res preview passes, kept separately so
+    bool showingDraft = false;      // neither texture changes size while dragging
+    cv::Rect2f originalRegion{0.0f, 0.0f, 1.0f, 1.0f};     // Parts of the image the textures hold
+    cv::Rect2f processedRegion{0.0f, 0.0f, 1.0f, 1.0f};
 
     Dithering::Parameters params;
 
@@ -32,99 +76,381 @@ struct AppState {
     bool imageLoaded = false;
     bool processing = false;
     bool autoUpdate = true;
+    bool processedFinal = false;    // processedImage matches the current params
+    Dithering::PreviewRenderer preview;
 
     // Video state
-    cv::VideoCapture videoCapture;
-    cv::VideoWriter videoWriter;
+    std::string videoPath;
     bool isVideo = false;
-    bool videoProcessing = false;
-    int currentFrame = 0;
-    int totalFrames = 0;
-    float videoProgress = 0.0f;
+    Dithering::VideoJob videoJob;
+    Dithering::TemporalOptions temporal;
+    std::string videoStatus;
 
     // UI state
     int selectedAlgorithm = 0;
     int selectedPalette = 0;
+    int selectedMetric = 0;
+    int selectedBackend = 0;
     float previewScale = 1.0f;
+    float zoom = 1.0f;                          // Relative to fitting the panel
+    cv::Point2f viewCenter{0.5f, 0.5f};         // As fractions of the image
+    Dithering::PreviewView view;                // What the preview panel showed last frame
     bool showOriginal = true;
     bool showProcessed = true;
     bool splitView = true;
+    bool showStageTimings = false;
+
+    // Contact sheet of algorithm/palette variants of the current settings
+    bool showContactSheet = false;
+    bool sheetAlgorithms[ALGORITHM_COUNT] = {};
+    bool sheetPalettes[BUILTIN_PALETTE_COUNT] = {};
+    int sheetCellWidth = 256;
+    std::future<cv::Mat> sheetJob;  // Rendering off the UI thread
+    cv::Mat contactSheet;
+    GLTexture sheetTexture;
 
     // Performance
     float processingTime = 0.0f;
+    std::vector<Dithering::StageProfile> stageTimings;  // Refreshed a few times a second
+    double stageTimingsTime = -1.0;
 };
 
-// Helper function to load texture from cv::Mat
-GLuint loadTextureFromMat(const cv::Mat& mat) {
-    if (mat.empty()) return 0;
+// Pixel buffer object entry points. They are not part of GL 1.1, so they are
+// resolved at runtime; without them uploads go straight from client memory.
+struct PixelBufferApi {
+    typedef void (APIENTRY *GenBuffers)(GLsizei, GLuint*);
+    typedef void (APIENTRY *DeleteBuffers)(GLsizei, const GLuint*);
+    typedef void (APIENTRY *BindBuffer)(GLenum, GLuint);
+    typedef void (APIENTRY *BufferData)(GLenum, std::ptrdiff_t, const void*, GLenum);
+    typedef void* (APIENTRY *MapBuffer)(GLenum, GLenum);
+    typedef GLboolean (APIENTRY *UnmapBuffer)(GLenum);
+
+    GenBuffers genBuffers = nullptr;
+    DeleteBuffers deleteBuffers = nullptr;
+    BindBuffer bindBuffer = nullptr;
+    BufferData bufferData = nullptr;
+    MapBuffer mapBuffer = nullptr;
+    UnmapBuffer unmapBuffer = nullptr;
+
+    bool available() const {
+        return genBuffers && deleteBuffers && bindBuffer && bufferData && mapBuffer && unmapBuffer;
+    }
+};
+
+const PixelBufferApi& pixelBufferApi() {
+    static const PixelBufferApi api = [] {
+        PixelBufferApi loaded;
+        loaded.genBuffers = reinterpret_cast<PixelBufferApi::GenBuffers>(glfwGetProcAddress("glGenBuffers"));
+        loaded.deleteBuffers = reinterpret_cast<PixelBufferApi::DeleteBuffers>(glfwGetProcAddress("glDeleteBuffers"));
+        loaded.bindBuffer = reinterpret_cast<PixelBufferApi::BindBuffer>(glfwGetProcAddress("glBindBuffer"));
+        loaded.bufferData = reinterpret_cast<PixelBufferApi::BufferData>(glfwGetProcAddress("glBufferData"));
+        loaded.mapBuffer = reinterpret_cast<PixelBufferApi::MapBuffer>(glfwGetProcAddress("glMapBuffer"));
+        loaded.unmapBuffer = reinterpret_cast<PixelBufferApi::UnmapBuffer>(glfwGetProcAddress("glUnmapBuffer"));
+        return loaded;
+    }();
+    return api;
+}
+
+// Free a texture and its pixel buffers
+void releaseTexture(GLTexture& texture) {
+    if (texture.id != 0) {
+        glDeleteTextures(1, &texture.id);
+    }
+    if (texture.buffers[0] != 0) {
+        pixelBufferApi().deleteBuffers(2, texture.buffers);
+    }
+    texture = GLTexture();
+}
 
-    cv::Mat rgba;
-    if (mat.channels() == 3) {
-        cv::cvtColor(mat, rgba, cv::COLOR_BGR2RGBA);
+// Upload a BGR image into a persistent texture. The texture storage is only
+// reallocated when the image size changes; otherwise the pixels are streamed
+// through a pixel buffer with glTexSubImage2D, with no RGBA conversion.
+void updateTexture(GLTexture& texture, const cv::Mat& mat) {
+    if (mat.empty()) {
+        releaseTexture(texture);
+        return;
+    }
+    DITHER_PROFILE_PIXELS("texture upload", mat.total());
+
+    cv::Mat bgr = mat;
+    if (mat.channels() == 1) {
+        cv::cvtColor(mat, bgr, cv::COLOR_GRAY2BGR);
     } else if (mat.channels() == 4) {
-        rgba = mat;
+        cv::cvtColor(mat, bgr, cv::COLOR_BGRA2BGR);
+    }
+    if (bgr.step % bgr.elemSize() != 0) {
+        bgr = bgr.clone();
+    }
+
+    if (texture.id == 0 || texture.width != bgr.cols || texture.height != bgr.rows) {
+        if (texture.id == 0) {
+            glGenTextures(1, &texture.id);
+        }
+        glBindTexture(GL_TEXTURE_2D, texture.id);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);   // Keep dither pixels sharp
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, bgr.cols, bgr.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+        texture.width = bgr.cols;
+        texture.height = bgr.rows;
     } else {
-        cv::cvtColor(mat, rgba, cv::COLOR_GRAY2RGBA);
+        glBindTexture(GL_TEXTURE_2D, texture.id);
     }
 
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    // BGR rows are rarely 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    const PixelBufferApi& api = pixelBufferApi();
+    size_t rowBytes = static_cast<size_t>(bgr.cols) * bgr.elemSize();
+    size_t size = rowBytes * bgr.rows;
+    void* mapped = nullptr;
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, rgba.cols, rgba.rows, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data);
+    if (api.available()) {
+        if (texture.buffers[0] == 0) {
+            api.genBuffers(2, texture.buffers);
+        }
+        // Alternate buffers and orphan the storage so the driver never has to
+        // wait for the previous transfer to finish before we write
+        GLuint buffer = texture.buffers[texture.nextBuffer];
+        texture.nextBuffer ^= 1;
+        api.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        api.bufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<std::ptrdiff_t>(size), nullptr, GL_STREAM_DRAW);
+        mapped = api.mapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    }
 
-    return texture;
+    if (mapped) {
+        uchar* dst = static_cast<uchar*>(mapped);
+        if (bgr.isContinuous()) {
+            std::memcpy(dst, bgr.data, size);
+        } else {
+            for (int y = 0; y < bgr.rows; ++y) {
+                std::memcpy(dst + y * rowBytes, bgr.ptr(y), rowBytes);
+            }
+        }
+        api.unmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, bgr.cols, bgr.rows, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+        api.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+        if (api.available()) {
+            api.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, static_cast<GLint>(bgr.step / bgr.elemSize()));
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, bgr.cols, bgr.rows, GL_BGR, GL_UNSIGNED_BYTE, bgr.data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Texture holding the most recent dithered pass
+GLuint processedTextureId(const AppState& state) {
+    return state.showingDraft ? state.draftTexture.id : state.processedTexture.id;
+}
+
+// Show the whole image again, as after loading
+void resetView(AppState& state) {
+    state.zoom = 1.0f;
+    state.viewCenter = cv::Point2f(0.5f, 0.5f);
+    state.originalRegion = cv::Rect2f(0.0f, 0.0f, 1.0f, 1.0f);
+    state.processedRegion = state.originalRegion;
 }
 
-// Update texture with new mat
-void updateTexture(GLuint& texture, const cv::Mat& mat) {
-    if (texture != 0) {
-        glDeleteTextures(1, &texture);
+// The part of the image a panel of this size shows at the current zoom,
+// and the panel pixels it takes. Clamps the zoom and keeps the view inside
+// the image.
+Dithering::PreviewView fitView(AppState& state, ImVec2 panel, ImVec2& drawSize) {
+    // Full-resolution pixels, even while originalImage is a reduced decode
+    const float cols = static_cast<float>(state.imageSize.width);
+    const float rows = static_cast<float>(state.imageSize.height);
+    const float fit = std::max(1e-6f, std::min(panel.x / cols, panel.y / rows));
+    state.zoom = std::clamp(state.zoom, 1.0f, std::max(1.0f, 32.0f / fit));  // Up to 32 screen pixels per pixel
+    const float scale = fit * state.zoom;
+
+    cv::Rect2f region;
+    region.width = std::min(1.0f, panel.x / (cols * scale));
+    region.height = std::min(1.0f, panel.y / (rows * scale));
+    region.x = std::clamp(state.viewCenter.x - region.width * 0.5f, 0.0f, 1.0f - region.width);
+    region.y = std::clamp(state.viewCenter.y - region.height * 0.5f, 0.0f, 1.0f - region.height);
+    state.viewCenter = cv::Point2f(region.x + region.width * 0.5f, region.y + region.height * 0.5f);
+
+    drawSize = ImVec2(region.width * cols * scale, region.height * rows * scale);
+    Dithering::PreviewView view;
+    view.region = region;
+    view.display = cv::Size(std::max(1, static_cast<int>(std::lround(drawSize.x))),
+                            std::max(1, static_cast<int>(std::lround(drawSize.y))));
+    return view;
+}
+
+// Draw the part of a texture covering `covered` that the current view shows,
+// and take zoom and pan input over it: the wheel zooms about the cursor, a
+// left drag pans and a double click fits the image again
+void drawView(AppState& state, const char* id, GLuint texture, const cv::Rect2f& covered, ImVec2 drawSize) {
+    const cv::Rect2f& region = state.view.region;
+    ImVec2 pos = ImGui::GetCursorScreenPos();
+    ImGui::InvisibleButton(id, drawSize);
+
+    ImVec2 uv0((region.x - covered.x) / covered.width, (region.y - covered.y) / covered.height);
+    ImVec2 uv1((region.x + region.width - covered.x) / covered.width,
+               (region.y + region.height - covered.y) / covered.height);
+    ImGui::GetWindowDrawList()->AddImage((void*)(intptr_t)texture, pos,
+                                         ImVec2(pos.x + drawSize.x, pos.y + drawSize.y), uv0, uv1);
+
+    ImGuiIO& io = ImGui::GetIO();
+    if (ImGui::IsItemHovered() && io.MouseWheel != 0.0f) {
+        // Keep the image point under the cursor where it is
+        float px = region.x + (io.MousePos.x - pos.x) / drawSize.x * region.width;
+        float py = region.y + (io.MousePos.y - pos.y) / drawSize.y * region.height;
+        float zoom = std::max(1.0f, state.zoom * std::pow(1.25f, io.MouseWheel));
+        float ratio = state.zoom / zoom;
+        state.viewCenter.x = px + (state.viewCenter.x - px) * ratio;
+        state.viewCenter.y = py + (state.viewCenter.y - py) * ratio;
+        state.zoom = zoom;
+    }
+    if (ImGui::IsItemActive() && ImGui::IsMouseDragging(ImGuiMouseButton_Left)) {
+        state.viewCenter.x -= io.MouseDelta.x / drawSize.x * region.width;
+        state.viewCenter.y -= io.MouseDelta.y / drawSize.y * region.height;
     }
-    texture = loadTextureFromMat(mat);
+    if (ImGui::IsItemHovered() && ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left)) {
+        state.zoom = 1.0f;
+        state.viewCenter = cv::Point2f(0.5f, 0.5f);
+    }
+}
+
+// Follow the panel's view, re-rendering only when it changed
+void updateView(AppState& state, const Dithering::PreviewView& view) {
+    if (view == state.view) return;
+    state.view = view;
+    state.preview.setView(view);
+    state.processing = true;
 }
 
-// Process image with current parameters
+// Process image with current parameters (in the background)
 void processImage(AppState& state) {
     if (!state.imageLoaded || state.originalImage.empty()) return;
 
+    state.preview.request(state.originalImage, state.params, state.view);
+    state.processedFinal = false;
     state.processing = true;
-    auto start = std::chrono::high_resolution_clock::now();
+}
+
+// Pick up finished preview passes; called once per frame
+void updatePreview(AppState& state) {
+    Dithering::PreviewResult result;
+    if (state.preview.poll(result)) {
+        if (!result.source.empty()) {
+            updateTexture(state.originalTexture, result.source);
+            state.originalRegion = result.region;
+        }
+        updateTexture(result.final ? state.processedTexture : state.draftTexture, result.image);
+        state.processedRegion = result.region;
+        state.showingDraft = !result.final;
+        if (result.final) {
+            state.processingTime = result.milliseconds;
+        }
+        if (result.complete) {
+            state.processedImage = result.image;
+            state.processedFinal = true;
+        }
+    }
+    state.processing = state.preview.isBusy();
+}
+
+// Take over the full-resolution decode. Its size is authoritative: the
+// header size guessed at load time may disagree (an Exif rotation the
+// header reader missed), and the view is fitted again if it does.
+void adoptFullResolution(AppState& state, const cv::Mat& full) {
+    state.originalImage = full;
+    state.fullResolution = true;
+    if (full.size() != state.imageSize) {
+        state.imageSize = full.size();
+        resetView(state);
+    }
+}
 
-    state.processedImage = Dithering::ditherImage(state.originalImage, state.params);
-    updateTexture(state.processedTexture, state.processedImage);
+// Swap in the full-resolution decode once the loader has it; called once
+// per frame. Views rendered from it bring the matching original pixels.
+void updateImageLoad(AppState& state) {
+    cv::Mat full;
+    if (!state.loader.poll(full)) return;
+    if (full.empty()) {
+        std::cerr << "Error: Could not decode the full image: " << state.currentFile << std::endl;
+        return;
+    }
+    adoptFullResolution(state, full);
+    processImage(state);
+}
 
-    auto end = std::chrono::high_resolution_clock::now();
-    state.processingTime = std::chrono::duration<float, std::milli>(end - start).count();
-    state.processing = false;
+// Block until the full-resolution image is in, for saving
+bool ensureFullResolution(AppState& state) {
+    if (state.fullResolution) return true;
+    cv::Mat full;
+    if (!state.loader.wait(full)) return false;
+    adoptFullResolution(state, full);
+    state.processedFinal = false;
+    return true;
 }
 
-// Load image file
+// Load image file. Large JPEGs show a reduced decode at once and are
+// switched to full resolution when the background decode finishes.
 bool loadImage(AppState& state, const std::string& filename) {
     std::cout << "Loading image: " << filename << std::endl;
-    cv::Mat img = cv::imread(filename, cv::IMREAD_COLOR);
+    cv::Size size;
+    cv::Mat img = state.loader.open(filename, 1920 * 1080, size);
     if (img.empty()) {
         std::cerr << "Error: Could not load image: " << filename << std::endl;
         return false;
     }
 
     state.originalImage = img;
+    state.imageSize = size;
+    state.fullResolution = !state.loader.isLoading();
     state.currentFile = filename;
     state.imageLoaded = true;
     state.isVideo = false;
+    state.videoPath.clear();
 
+    resetView(state);
     updateTexture(state.originalTexture, state.originalImage);
+    updateTexture(state.processedTexture, cv::Mat());
+    updateTexture(state.draftTexture, cv::Mat());
     processImage(state);
 
-    std::cout << "Image loaded successfully: " << img.cols << "x" << img.rows << std::endl;
+    std::cout << "Image loaded successfully: " << size.width << "x" << size.height;
+    if (!state.fullResolution) std::cout << " (previewing at " << img.cols << "x" << img.rows << ")";
+    std::cout << std::endl;
     return true;
 }
 
+// Load a video; the first frame becomes the preview for tuning parameters
+bool loadVideo(AppState& state, const std::string& filename) {
+    std::cout << "Loading video: " << filename << std::endl;
+    cv::VideoCapture cap(filename);
+    cv::Mat frame;
+    if (!cap.isOpened() || !cap.read(frame)) {
+        std::cerr << "Error: Could not load video: " << filename << std::endl;
+        return false;
+    }
+
+    state.loader.cancel();
+    state.originalImage = frame;
+    state.imageSize = frame.size();
+    state.fullResolution = true;
+    state.currentFile = filename;
+    state.imageLoaded = true;
+    state.isVideo = true;
+    state.videoPath = filename;
+    state.videoStatus.clear();
+
+    resetView(state);
+    updateTexture(state.originalTexture, state.originalImage);
+    updateTexture(state.processedTexture, cv::Mat());
+    updateTexture(state.draftTexture, cv::Mat());
+    processImage(state);
+    return true;
+}
 
 // Drag and drop callback
 void dropCallback(GLFWwindow* window, int count, const char** paths) {
@@ -138,8 +464,7 @@ void dropCallback(GLFWwindow* window, int count, const char** paths) {
         std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
 
         if (ext == "mp4" || ext == "avi" || ext == "mov" || ext == "mkv") {
-            std::cout << "Video file detected. Use CLI for video processing." << std::endl;
-            state->isVideo = true;
+            loadVideo(*state, filepath);
         } else {
             loadImage(*state, filepath);
         }
@@ -148,55 +473,211 @@ void dropCallback(GLFWwindow* window, int count, const char** paths) {
 
 // Save image file
 bool saveImage(AppState& state, const std::string& filename) {
+    if (!ensureFullResolution(state)) return false;
+    if (!state.processedFinal) {
+        // The preview is still refining; render the full image now
+        state.preview.cancel();
+        state.processedImage = Dithering::ditherImage(state.originalImage, state.params);
+        state.processedFinal = true;
+        state.preview.request(state.originalImage, state.params, state.view);   // Redraw the cancelled view
+    }
     if (state.processedImage.empty()) return false;
+    DITHER_PROFILE_PIXELS("save image", state.processedImage.total());
+
+    // Palettized formats store the palette indices, which is lossless and
+    // much smaller; other formats and large custom palettes stay BGR
+    if (Dithering::isIndexedFormat(filename)) {
+        Dithering::IndexedImage indexed;
+        if (Dithering::indexImage(state.processedImage, *Dithering::getPaletteMatcher(state.params), indexed)) {
+            return Dithering::writeIndexedImage(filename, indexed);
+        }
+    }
     return cv::imwrite(filename, state.processedImage);
 }
 
 
-// Process video
-void processVideo(AppState& state, const std::string& inputPath, const std::string& outputPath) {
-    state.videoProcessing = true;
-    state.videoProgress = 0.0f;
+// Export the loaded video in the background; progress is polled by the GUI
+void exportVideo(AppState& state) {
+    if (!state.isVideo || state.videoJob.isRunning()) return;
+
+    std::string outputPath = Platform::saveVideoDialog();
+    if (outputPath.empty()) return;
+
+    if (state.videoJob.start(state.videoPath, outputPath, state.params, 0, state.temporal)) {
+        state.videoStatus.clear();
+    } else {
+        state.videoStatus = "Could not open " + outputPath;
+    }
+}
 
-    cv::VideoCapture cap(inputPath);
-    if (!cap.isOpened()) {
-        state.videoProcessing = false;
+// Floating table of the library's stage timers since the last reset
+void renderStageTimings(AppState& state) {
+    ImGui::SetNextWindowPos(ImVec2(ImGui::GetIO().DisplaySize.x - 620, 40), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(600, 320), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Stage Timings", &state.showStageTimings)) {
+        ImGui::End();
         return;
     }
 
-    int frameWidth = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
-    int frameHeight = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
-    double fps = cap.get(cv::CAP_PROP_FPS);
-    state.totalFrames = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_COUNT));
+    if (!Dithering::profilingCompiledIn()) {
+        ImGui::TextWrapped("Built without DITHER_PROFILING; rebuild with it on to record stage timings.");
+        ImGui::End();
+        return;
+    }
 
-    cv::VideoWriter writer(outputPath, cv::VideoWriter::fourcc('m', 'p', '4', 'v'),
-                          fps, cv::Size(frameWidth, frameHeight));
+    // Updating every frame would make the numbers unreadable
+    double now = ImGui::GetTime();
+    if (state.stageTimingsTime < 0.0 || now - state.stageTimingsTime > 0.5) {
+        state.stageTimings = Dithering::profileSnapshot();
+        state.stageTimingsTime = now;
+    }
 
-    if (!writer.isOpened()) {
-        state.videoProcessing = false;
-        return;
+    if (ImGui::Button("Reset")) {
+        Dithering::resetProfile();
+        state.stageTimings.clear();
+    }
+    ImGui::SameLine();
+    ImGui::TextDisabled("Stages nest; totals include the stages inside them");
+
+    if (ImGui::BeginTable("##StageTimings", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Stage");
+        ImGui::TableSetupColumn("Calls");
+        ImGui::TableSetupColumn("Mean ms");
+        ImGui::TableSetupColumn("Max ms");
+        ImGui::TableSetupColumn("MPix/s");
+        ImGui::TableSetupColumn("Allocs/call");
+        ImGui::TableHeadersRow();
+
+        for (const auto& stage : state.stageTimings) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", stage.name.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", static_cast<unsigned long long>(stage.calls));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", stage.meanMs());
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", stage.maxMs);
+            ImGui::TableNextColumn();
+            if (stage.pixels > 0) {
+                ImGui::Text("%.1f", stage.megapixelsPerSecond());
+            } else {
+                ImGui::TextDisabled("-");
+            }
+            ImGui::TableNextColumn();
+            if (Dithering::allocationCountingCompiledIn()) {
+                ImGui::Text("%.1f", stage.calls ? static_cast<double>(stage.allocations) / stage.calls : 0.0);
+            } else {
+                ImGui::TextDisabled("-");
+            }
+        }
+        ImGui::EndTable();
     }
 
-    cv::Mat frame;
-    state.currentFrame = 0;
+    ImGui::End();
+}
 
-    while (cap.read(frame)) {
-        cv::Mat dithered = Dithering::ditherImage(frame, state.params);
-        writer.write(dithered);
+// Dither the checked algorithms and palettes of the current settings into
+// a contact sheet in the background; unchecked lists keep the current value
+void startContactSheet(AppState& state) {
+    std::vector<Dithering::Algorithm> algorithms;
+    for (int i = 0; i < ALGORITHM_COUNT; ++i) {
+        if (state.sheetAlgorithms[i]) algorithms.push_back(static_cast<Dithering::Algorithm>(i));
+    }
+    std::vector<Dithering::PaletteMode> palettes;
+    for (int i = 0; i < BUILTIN_PALETTE_COUNT; ++i) {
+        if (state.sheetPalettes[i]) palettes.push_back(static_cast<Dithering::PaletteMode>(i));
+    }
 
-        state.currentFrame++;
-        state.videoProgress = static_cast<float>(state.currentFrame) / state.totalFrames;
+    std::vector<Dithering::SweepAxis> axes;
+    if (!algorithms.empty()) {
+        axes.push_back({static_cast<int>(algorithms.size()),
+                        [algorithms](int i, Dithering::Parameters& p) { p.algorithm = algorithms[i]; }});
+    }
+    if (!palettes.empty()) {
+        axes.push_back({static_cast<int>(palettes.size()),
+                        [palettes](int i, Dithering::Parameters& p) { p.paletteMode = palettes[i]; }});
+    }
+
+    cv::Mat image = state.originalImage.clone();
+    Dithering::Parameters base = state.params;
+    int cellWidth = state.sheetCellWidth;
+    state.sheetJob = std::async(std::launch::async, [image, base, axes, cellWidth] {
+        std::vector<Dithering::Parameters> variants = Dithering::sweepVariants(base, axes);
+        std::vector<cv::Mat> results = Dithering::ditherVariants(image, variants);
+        std::vector<std::string> captions;
+        for (const auto& variant : variants) captions.push_back(Dithering::describeVariant(variant, base));
+        return Dithering::contactSheet(results, captions, 0, cellWidth);
+    });
+}
+
+// Floating window for choosing, rendering and saving a contact sheet
+void renderContactSheet(AppState& state) {
+    ImGui::SetNextWindowPos(ImVec2(420, 40), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(760, 560), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Contact Sheet", &state.showContactSheet)) {
+        ImGui::End();
+        return;
+    }
+
+    const bool rendering = state.sheetJob.valid() &&
+        state.sheetJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    if (state.sheetJob.valid() && !rendering) {
+        state.contactSheet = state.sheetJob.get();
+        updateTexture(state.sheetTexture, state.contactSheet);
+    }
+
+    if (ImGui::TreeNode("Algorithms")) {
+        for (int i = 0; i < ALGORITHM_COUNT; ++i) {
+            std::string name = Dithering::getAlgorithmName(static_cast<Dithering::Algorithm>(i));
+            if (i % 3 != 0) ImGui::SameLine(i % 3 * 200.0f);
+            ImGui::Checkbox(name.c_str(), &state.sheetAlgorithms[i]);
+        }
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Palettes")) {
+        for (int i = 0; i < BUILTIN_PALETTE_COUNT; ++i) {
+            std::string name = Dithering::getPaletteModeName(static_cast<Dithering::PaletteMode>(i));
+            if (i % 3 != 0) ImGui::SameLine(i % 3 * 200.0f);
+            ImGui::Checkbox(name.c_str(), &state.sheetPalettes[i]);
+        }
+        ImGui::TreePop();
+    }
+    ImGui::SliderInt("Cell Width", &state.sheetCellWidth, 64, 1024);
+
+    ImGui::BeginDisabled(!state.imageLoaded || rendering);
+    if (ImGui::Button(rendering ? "Rendering..." : "Render")) startContactSheet(state);
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+    ImGui::BeginDisabled(state.contactSheet.empty());
+    if (ImGui::Button("Save Sheet...")) {
+        std::string filepath = Platform::saveFileDialog();
+        if (!filepath.empty() && !cv::imwrite(filepath, state.contactSheet)) {
+            std::cerr << "Failed to save contact sheet" << std::endl;
+        }
+    }
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+    ImGui::TextDisabled("Variants of the current settings; unchecked lists keep the current value");
+
+    if (state.sheetTexture.id != 0) {
+        ImGui::BeginChild("##Sheet", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar);
+        float scale = std::min(1.0f, ImGui::GetContentRegionAvail().x / state.sheetTexture.width);
+        ImGui::Image((void*)(intptr_t)state.sheetTexture.id,
+                     ImVec2(state.sheetTexture.width * scale, state.sheetTexture.height * scale));
+        ImGui::EndChild();
     }
 
-    cap.release();
-    writer.release();
-    state.videoProcessing = false;
+    ImGui::End();
 }
 
 // Main GUI rendering
 void renderGUI(AppState& state) {
     ImGuiIO& io = ImGui::GetIO();
 
+    updateImageLoad(state);
+    updatePreview(state);
+
     // Main menu bar
     if (ImGui::BeginMainMenuBar()) {
         if (ImGui::BeginMenu("File")) {
@@ -207,11 +688,14 @@ void renderGUI(AppState& state) {
                 }
             }
             if (ImGui::MenuItem("Open Video")) {
-                std::cout << "Video processing available via CLI: ./dithers-boyfriend-cli" << std::endl;
+                std::string filepath = Platform::openVideoDialog();
+                if (!filepath.empty()) {
+                    loadVideo(state, filepath);
+                }
             }
             ImGui::Separator();
             if (ImGui::MenuItem("Save As...", "Ctrl+S")) {
-                if (state.imageLoaded && !state.processedImage.empty()) {
+                if (state.imageLoaded) {
                     std::string filepath = Platform::saveFileDialog();
                     if (!filepath.empty()) {
                         if (saveImage(state, filepath)) {
@@ -222,8 +706,8 @@ void renderGUI(AppState& state) {
                     }
                 }
             }
-            if (ImGui::MenuItem("Export Video")) {
-                std::cout << "Video export available via CLI: ./dithers-boyfriend-cli" << std::endl;
+            if (ImGui::MenuItem("Export Video", nullptr, false, state.isVideo && !state.videoJob.isRunning())) {
+                exportVideo(state);
             }
             ImGui::Separator();
             if (ImGui::MenuItem("Exit", "Alt+F4")) {
@@ -236,6 +720,9 @@ void renderGUI(AppState& state) {
             ImGui::MenuItem("Split View", nullptr, &state.splitView);
             ImGui::MenuItem("Show Original", nullptr, &state.showOriginal);
             ImGui::MenuItem("Show Processed", nullptr, &state.showProcessed);
+            ImGui::Separator();
+            ImGui::MenuItem("Stage Timings", nullptr, &state.showStageTimings);
+            ImGui::MenuItem("Contact Sheet", nullptr, &state.showContactSheet);
             ImGui::EndMenu();
         }
 
@@ -289,6 +776,33 @@ void renderGUI(AppState& state) {
         if (state.autoUpdate) processImage(state);
     }
 
+    // Perceptual metrics also diffuse error in linear light
+    const char* metrics[] = { "Match: RGB distance", "Match: OKLab", "Match: CIELAB" };
+    if (ImGui::Combo("##ColorMetric", &state.selectedMetric, metrics, IM_ARRAYSIZE(metrics))) {
+        state.params.colorMetric = static_cast<Dithering::ColorMetric>(state.selectedMetric);
+        if (state.autoUpdate) processImage(state);
+    }
+
+    ImGui::Separator();
+
+    // Compute backend
+    ImGui::Text("Backend");
+    const char* backends[] = { "CPU", "OpenCL (GPU)" };
+
+    if (ImGui::Combo("##Backend", &state.selectedBackend, backends, IM_ARRAYSIZE(backends))) {
+        state.params.backend = static_cast<Dithering::Backend>(state.selectedBackend);
+        if (state.autoUpdate) processImage(state);
+    }
+    if (state.params.backend != Dithering::Backend::CPU) {
+        if (!Dithering::isBackendAvailable(state.params.backend)) {
+            ImGui::TextDisabled("No OpenCL device found, using CPU");
+        } else if (!Dithering::backendSupports(state.params.backend, state.params.algorithm)) {
+            ImGui::TextDisabled("This algorithm runs on the CPU");
+        } else if (state.params.colorMetric != Dithering::ColorMetric::BGR) {
+            ImGui::TextDisabled("Perceptual matching runs on the CPU");
+        }
+    }
+
     ImGui::Separator();
 
     // Parameters
@@ -310,6 +824,12 @@ void renderGUI(AppState& state) {
 
     if (ImGui::SliderInt("Random Seed", reinterpret_cast<int*>(&state.params.seed), 0, 1000)) needsUpdate = true;
 
+    bool fixedPoint = state.params.precision == Dithering::DiffusionPrecision::FIXED;
+    if (ImGui::Checkbox("Fixed-point diffusion", &fixedPoint)) {
+        state.params.precision = fixedPoint ? Dithering::DiffusionPrecision::FIXED : Dithering::DiffusionPrecision::FLOAT;
+        needsUpdate = true;
+    }
+
     if (needsUpdate && state.autoUpdate) {
         processImage(state);
     }
@@ -337,8 +857,12 @@ void renderGUI(AppState& state) {
                 );
             }
         }
+        state.loader.cancel();
+        state.imageSize = state.originalImage.size();
+        state.fullResolution = true;
         state.imageLoaded = true;
         state.currentFile = "test_gradient.png";
+        resetView(state);
         updateTexture(state.originalTexture, state.originalImage);
         processImage(state);
     }
@@ -347,6 +871,8 @@ void renderGUI(AppState& state) {
         state.params = Dithering::Parameters();
         state.selectedAlgorithm = 0;
         state.selectedPalette = 0;
+        state.selectedMetric = 0;
+        state.selectedBackend = 0;
         if (state.autoUpdate) processImage(state);
     }
 
@@ -355,14 +881,52 @@ void renderGUI(AppState& state) {
     // Stats
     ImGui::Text("Statistics");
     if (state.imageLoaded) {
-        ImGui::Text("Image: %dx%d", state.originalImage.cols, state.originalImage.rows);
+        ImGui::Text("Image: %dx%d", state.imageSize.width, state.imageSize.height);
+        if (!state.fullResolution) {
+            ImGui::TextDisabled("Loading full resolution...");
+        }
         ImGui::Text("Processing time: %.2f ms", state.processingTime);
+        if (!state.view.display.empty()) {
+            float shown = state.view.region.width * state.imageSize.width;
+            ImGui::Text("Zoom: %.0f%%", state.view.display.width / shown * 100.0f);
+        }
+        ImGui::TextDisabled("Wheel zooms, drag pans, double-click fits");
+        if (state.processing) {
+            ImGui::TextDisabled("Refining preview...");
+        }
     }
 
-    if (state.videoProcessing) {
-        ImGui::Text("Processing video...");
-        ImGui::ProgressBar(state.videoProgress);
-        ImGui::Text("Frame %d / %d", state.currentFrame, state.totalFrames);
+    if (state.isVideo) {
+        if (state.videoJob.isRunning()) {
+            ImGui::Text("Processing video...");
+            ImGui::ProgressBar(state.videoJob.progress());
+            ImGui::Text("Frame %d / %d", state.videoJob.framesDone(), state.videoJob.totalFrames());
+            if (ImGui::Button("Cancel Export", ImVec2(-1, 30))) {
+                state.videoJob.cancel();
+            }
+        } else {
+            ImGui::Checkbox("Temporal coherence", &state.temporal.enabled);
+            if (state.temporal.enabled) {
+                ImGui::SliderInt("Tile size", &state.temporal.tileSize, 8, 64);
+                ImGui::SliderInt("Tolerance", &state.temporal.tolerance, 0, 32);
+            }
+            ImGui::Checkbox("Animate noise", &state.temporal.animateNoise);
+            if (ImGui::Button("Export Video", ImVec2(-1, 30))) {
+                exportVideo(state);
+            }
+            if (state.videoJob.failed()) {
+                ImGui::TextWrapped("Export failed: %s", state.videoJob.error().c_str());
+            } else if (!state.videoStatus.empty()) {
+                ImGui::TextWrapped("%s", state.videoStatus.c_str());
+            } else if (state.videoJob.wasCancelled()) {
+                ImGui::Text("Export cancelled after %d frames", state.videoJob.framesDone());
+            } else if (state.videoJob.framesDone() > 0) {
+                ImGui::Text("Exported %d frames", state.videoJob.framesDone());
+                if (state.temporal.enabled) {
+                    ImGui::Text("Re-dithered %.0f%% of tiles", state.videoJob.dirtyRatio() * 100.0f);
+                }
+            }
+        }
     }
 
     ImGui::End();
@@ -370,51 +934,49 @@ void renderGUI(AppState& state) {
     // Right panel - Image display
     ImGui::SetNextWindowPos(ImVec2(400, 20));
     ImGui::SetNextWindowSize(ImVec2(io.DisplaySize.x - 400, io.DisplaySize.y - 20));
-    ImGui::Begin("Preview", nullptr, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize);
+    ImGui::Begin("Preview", nullptr,
+                 ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoScrollWithMouse);
 
     if (state.imageLoaded) {
         ImVec2 availSize = ImGui::GetContentRegionAvail();
 
         if (state.splitView) {
-            // Split view - original on left, processed on right
+            // Split view - original on left, processed on right, showing
+            // the same part of the image
             float halfWidth = availSize.x * 0.5f - 10;
+            ImVec2 drawSize;
+            updateView(state, fitView(state, ImVec2(halfWidth - 16, availSize.y - 40), drawSize));
 
-            if (state.showOriginal && state.originalTexture) {
-                ImGui::BeginChild("Original", ImVec2(halfWidth, availSize.y), true);
+            if (state.showOriginal && state.originalTexture.id) {
+                ImGui::BeginChild("Original", ImVec2(halfWidth, availSize.y), true,
+                                  ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
                 ImGui::Text("Original");
-                float scale = std::min(halfWidth / state.originalImage.cols,
-                                     (availSize.y - 30) / state.originalImage.rows);
-                ImVec2 imgSize(state.originalImage.cols * scale, state.originalImage.rows * scale);
-                ImGui::Image((void*)(intptr_t)state.originalTexture, imgSize);
+                drawView(state, "##original", state.originalTexture.id, state.originalRegion, drawSize);
                 ImGui::EndChild();
             }
 
             ImGui::SameLine();
 
-            if (state.showProcessed && state.processedTexture) {
-                ImGui::BeginChild("Processed", ImVec2(halfWidth, availSize.y), true);
+            if (state.showProcessed && processedTextureId(state)) {
+                ImGui::BeginChild("Processed", ImVec2(halfWidth, availSize.y), true,
+                                  ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
                 ImGui::Text("Dithered");
-                float scale = std::min(halfWidth / state.processedImage.cols,
-                                     (availSize.y - 30) / state.processedImage.rows);
-                ImVec2 imgSize(state.processedImage.cols * scale, state.processedImage.rows * scale);
-                ImGui::Image((void*)(intptr_t)state.processedTexture, imgSize);
+                drawView(state, "##processed", processedTextureId(state), state.processedRegion, drawSize);
                 ImGui::EndChild();
             }
         } else {
             // Single view - show processed only
-            if (state.processedTexture) {
-                float scale = std::min(availSize.x / state.processedImage.cols,
-                                     availSize.y / state.processedImage.rows);
-                ImVec2 imgSize(state.processedImage.cols * scale, state.processedImage.rows * scale);
-
+            ImVec2 drawSize;
+            updateView(state, fitView(state, availSize, drawSize));
+            if (processedTextureId(state)) {
                 // Center the image
                 ImVec2 cursorPos = ImGui::GetCursorPos();
                 ImGui::SetCursorPos(ImVec2(
-                    cursorPos.x + (availSize.x - imgSize.x) * 0.5f,
-                    cursorPos.y + (availSize.y - imgSize.y) * 0.5f
+                    cursorPos.x + (availSize.x - drawSize.x) * 0.5f,
+                    cursorPos.y + (availSize.y - drawSize.y) * 0.5f
                 ));
 
-                ImGui::Image((void*)(intptr_t)state.processedTexture, imgSize);
+                drawView(state, "##processed", processedTextureId(state), state.processedRegion, drawSize);
             }
         }
     } else {
@@ -442,6 +1004,9 @@ void renderGUI(AppState& state) {
     }
 
     ImGui::End();
+
+    if (state.showStageTimings) renderStageTimings(state);
+    if (state.showContactSheet) renderContactSheet(state);
 }
 
 // Setup Dear ImGui style (Photoshop-like dark theme)
@@ -619,8 +1184,10 @@ int main(int argc, char** argv) {
     }
 
     // Cleanup
-    if (state.originalTexture) glDeleteTextures(1, &state.originalTexture);
-    if (state.processedTexture) glDeleteTextures(1, &state.processedTexture);
+    releaseTexture(state.originalTexture);
+    releaseTexture(state.processedTexture);
+    releaseTexture(state.draftTexture);
+    releaseTexture(state.sheetTexture);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <opencv2/opencv.hpp>
+#include "bluenoise.h"
+
+// Offline void-and-cluster blue noise mask generator. The masks it writes
+// can be loaded with --blue-noise-mask or DITHER_BLUE_NOISE_MASK.
+
+namespace {
+
+void printUsage(const char* program) {
+    std::cout << "Dither's Boyfriend - Blue Noise Mask Generator\n";
+    std::cout << "Usage: " << program << " [options] output.bin\n\n";
+    std::cout << "Options:\n";
+    std::cout << "  -s, --size <int>      Mask width and height, 64-1024 (default: 256)\n";
+    std::cout << "  --seed <int>          Seed for the initial pattern (default: 42)\n";
+    std::cout << "  --sigma <float>       Energy filter sigma (default: 1.5)\n";
+    std::cout << "  --preview <file>      Also write the mask as an 8-bit image\n";
+    std::cout << "  -h, --help            Show this help message\n\n";
+    std::cout << "Examples:\n";
+    std::cout << "  " << program << " -s 1024 blue_noise_1024.bin\n";
+    std::cout << "  " << program << " -s 128 --preview mask.png blue_noise_128.bin\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int size = 256;
+    unsigned int seed = 42;
+    float sigma = 1.5f;
+    std::string previewFile;
+    std::string outputFile;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else if ((arg == "-s" || arg == "--size") && hasValue) {
+            size = std::stoi(argv[++i]);
+        }
+        else if (arg == "--seed" && hasValue) {
+            seed = static_cast<unsigned int>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--sigma" && hasValue) {
+            sigma = std::stof(argv[++i]);
+        }
+        else if (arg == "--preview" && hasValue) {
+            previewFile = argv[++i];
+        }
+        else if (outputFile.empty() && arg[0] != '-') {
+            outputFile = arg;
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (outputFile.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (size < 64 || size > 1024) {
+        std::cerr << "Error: Size must be between 64 and 1024\n";
+        return 1;
+    }
+    if (sigma <= 0.0f) {
+        std::cerr << "Error: Sigma must be positive\n";
+        return 1;
+    }
+
+    std::cout << "Generating " << size << "x" << size << " void-and-cluster mask..." << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    int lastPercent = -1;
+    cv::Mat ranks = Dithering::generateVoidAndClusterMask(size, seed, sigma, [&](float fraction) {
+        int percent = static_cast<int>(fraction * 100.0f);
+        if (percent != lastPercent) {
+            lastPercent = percent;
+            std::cerr << "\r  " << percent << "%" << std::flush;
+        }
+    });
+    std::cerr << "\n";
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    if (!Dithering::saveBlueNoiseMask(outputFile, ranks)) {
+        std::cerr << "Error: Could not write " << outputFile << "\n";
+        return 1;
+    }
+
+    if (!previewFile.empty()) {
+        cv::Mat preview(ranks.rows, ranks.cols, CV_8U);
+        for (int y = 0; y < ranks.rows; ++y) {
+            for (int x = 0; x < ranks.cols; ++x) {
+                preview.at<uchar>(y, x) = static_cast<uchar>(ranks.at<uint16_t>(y, x) >> 8);
+            }
+        }
+        if (!cv::imwrite(previewFile, preview)) {
+            std::cerr << "Error: Could not write " << previewFile << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << "Wrote " << outputFile << " in " << duration.count() << " ms\n";
+    return 0;
+}
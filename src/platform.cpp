@@ -8,6 +8,25 @@
 
 namespace Platform {
 
+#ifndef _WIN32
+// Run a dialog command and return the first line it prints
+static std::string readCommandOutput(const char* command) {
+    std::string result;
+    FILE* pipe = popen(command, "r");
+    if (pipe) {
+        char buffer[512];
+        if (fgets(buffer, sizeof(buffer), pipe)) {
+            result = buffer;
+            if (!result.empty() && result.back() == '\n') {
+                result.pop_back();
+            }
+        }
+        pclose(pipe);
+    }
+    return result;
+}
+#endif
+
 std::string openFileDialog() {
     std::string filename;
 
@@ -97,7 +116,7 @@ std::string saveFileDialog() {
     ofn.hwndOwner = NULL;
     ofn.lpstrFile = filepath;
     ofn.nMaxFile = sizeof(filepath);
-    ofn.lpstrFilter = "PNG Image\0*.png\0JPEG Image\0*.jpg\0All Files\0*.*\0";
+    ofn.lpstrFilter = "PNG Image\0*.png\0GIF Image\0*.gif\0BMP Image\0*.bmp\0JPEG Image\0*.jpg\0All Files\0*.*\0";
     ofn.nFilterIndex = 1;
     ofn.lpstrDefExt = "png";
     ofn.lpstrFileTitle = NULL;
@@ -112,7 +131,7 @@ std::string saveFileDialog() {
     // Unix-like systems (Linux/macOS)
 
     // Try zenity (GTK-based)
-    FILE* pipe = popen("zenity --file-selection --save --confirm-overwrite --title='Save Image' --file-filter='PNG | *.png' --file-filter='JPEG | *.jpg' 2>/dev/null", "r");
+    FILE* pipe = popen("zenity --file-selection --save --confirm-overwrite --title='Save Image' --file-filter='PNG | *.png' --file-filter='GIF | *.gif' --file-filter='BMP | *.bmp' --file-filter='JPEG | *.jpg' 2>/dev/null", "r");
     if (pipe) {
         char buffer[512];
         if (fgets(buffer, sizeof(buffer), pipe)) {
@@ -126,7 +145,7 @@ std::string saveFileDialog() {
     }
 
     // Try kdialog (KDE)
-    pipe = popen("kdialog --getsavefilename ~ '*.png *.jpg | Image Files' 2>/dev/null", "r");
+    pipe = popen("kdialog --getsavefilename ~ '*.png *.gif *.bmp *.jpg | Image Files' 2>/dev/null", "r");
     if (pipe) {
         char buffer[512];
         if (fgets(buffer, sizeof(buffer), pipe)) {
@@ -162,4 +181,75 @@ std::string saveFileDialog() {
     return filename;
 }
 
+std::string openVideoDialog() {
+    std::string filename;
+
+#ifdef _WIN32
+    char filepath[512] = {0};
+    OPENFILENAMEA ofn;
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.lpstrFile = filepath;
+    ofn.nMaxFile = sizeof(filepath);
+    ofn.lpstrFilter = "Video Files\0*.mp4;*.avi;*.mov;*.mkv\0All Files\0*.*\0";
+    ofn.nFilterIndex = 1;
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_NOCHANGEDIR;
+
+    if (GetOpenFileNameA(&ofn)) {
+        filename = filepath;
+    }
+#else
+    filename = readCommandOutput("zenity --file-selection --title='Select Video' --file-filter='Videos | *.mp4 *.avi *.mov *.mkv' 2>/dev/null");
+    if (!filename.empty()) return filename;
+
+    filename = readCommandOutput("kdialog --getopenfilename ~ 'Videos (*.mp4 *.avi *.mov *.mkv)' 2>/dev/null");
+    if (!filename.empty()) return filename;
+
+    filename = readCommandOutput("osascript -e 'POSIX path of (choose file of type {\"public.movie\"} with prompt \"Select Video\")' 2>/dev/null");
+    if (!filename.empty()) return filename;
+
+    std::cout << "\n=== File Selection ===" << std::endl;
+    std::cout << "Enter video path: ";
+    std::getline(std::cin, filename);
+#endif
+
+    return filename;
+}
+
+std::string saveVideoDialog() {
+    std::string filename;
+
+#ifdef _WIN32
+    char filepath[512] = {0};
+    OPENFILENAMEA ofn;
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.lpstrFile = filepath;
+    ofn.nMaxFile = sizeof(filepath);
+    ofn.lpstrFilter = "MP4 Video\0*.mp4\0AVI Video\0*.avi\0Animated GIF\0*.gif\0Animated PNG\0*.png;*.apng\0All Files\0*.*\0";
+    ofn.nFilterIndex = 1;
+    ofn.lpstrDefExt = "mp4";
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT | OFN_NOCHANGEDIR;
+
+    if (GetSaveFileNameA(&ofn)) {
+        filename = filepath;
+    }
+#else
+    filename = readCommandOutput("zenity --file-selection --save --confirm-overwrite --title='Export Video' --file-filter='MP4 | *.mp4' --file-filter='AVI | *.avi' --file-filter='Animated GIF | *.gif' --file-filter='Animated PNG | *.png *.apng' 2>/dev/null");
+    if (!filename.empty()) return filename;
+
+    filename = readCommandOutput("kdialog --getsavefilename ~ '*.mp4 *.avi *.gif *.png *.apng | Video Files' 2>/dev/null");
+    if (!filename.empty()) return filename;
+
+    filename = readCommandOutput("osascript -e 'POSIX path of (choose file name with prompt \"Export Video As\" default name \"output.mp4\")' 2>/dev/null");
+    if (!filename.empty()) return filename;
+
+    std::cout << "\n=== Save File ===" << std::endl;
+    std::cout << "Enter output path (e.g., output.mp4): ";
+    std::getline(std::cin, filename);
+#endif
+
+    return filename;
+}
+
 } // namespace Platform
@@ -17,4 +17,8 @@ namespace Platform {
 
     // Save file dialog - returns selected filepath or empty string
     std::string saveFileDialog();
+
+    // Video variants of the dialogs above
+    std::string openVideoDialog();
+    std::string saveVideoDialog();
 }
@@ -0,0 +1,344 @@
+#include "preview.h"
+#include "batch.h"
+#include "profile.h"
+#include "stream.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace Dithering {
+
+PreviewRenderer::PreviewRenderer(int previewPixels, int settleMs)
+    : previewPixels(previewPixels), settleMs(settleMs) {
+    worker = std::thread([this] { run(); });
+}
+
+PreviewRenderer::~PreviewRenderer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    worker.join();
+}
+
+uint64_t PreviewRenderer::request(const cv::Mat& image, const Parameters& params, const PreviewView& view) {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingImage = image;
+        pendingParams = params;
+        pendingView = view;
+        ++content;
+        generation = ++requested;
+        busy = true;
+    }
+    changed.notify_all();
+    return generation;
+}
+
+uint64_t PreviewRenderer::setView(const PreviewView& view) {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pendingImage.empty()) return requested;
+        pendingView = view;
+        generation = ++requested;
+        busy = true;
+    }
+    changed.notify_all();
+    return generation;
+}
+
+bool PreviewRenderer::poll(PreviewResult& result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!hasResult) return false;
+    result = std::move(latest);
+    hasResult = false;
+    return true;
+}
+
+void PreviewRenderer::cancel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        rendered = ++requested;
+        pendingImage.release();
+        hasResult = false;
+        busy = false;
+    }
+    changed.notify_all();
+}
+
+void PreviewRenderer::run() {
+    setProfileThreadName("preview");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [&] { return stopping || requested != rendered; });
+        if (stopping) return;
+
+        uint64_t generation = requested;
+        uint64_t version = content;
+        cv::Mat image = pendingImage;
+        Parameters params = pendingParams;
+        PreviewView view = pendingView;
+        lock.unlock();
+
+        auto publish = [&](cv::Mat output, bool final, float ms) {
+            if (!isCurrent(generation)) return false;
+            latest = PreviewResult();
+            latest.image = std::move(output);
+            latest.final = final;
+            latest.milliseconds = ms;
+            latest.generation = generation;
+            hasResult = true;
+            return true;
+        };
+
+        if (image.empty()) {
+            lock.lock();
+            if (isCurrent(generation)) {
+                rendered = generation;
+                busy = false;
+            }
+            continue;
+        }
+
+        if (!view.display.empty()) {
+            PreviewResult result;
+            auto start = std::chrono::high_resolution_clock::now();
+            bool drawn = renderView(image, params, view, version, generation, result);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            lock.lock();
+            if (drawn && publish(std::move(result.image), true, 0.0f)) {
+                latest.source = std::move(result.source);
+                latest.region = result.region;
+                latest.complete = result.complete;
+                latest.milliseconds = std::chrono::duration<float, std::milli>(end - start).count();
+                rendered = generation;
+                busy = false;
+            }
+            continue;
+        }
+
+        // Fast pass at reduced resolution, then wait for the parameters to
+        // settle before paying for the full-resolution pass
+        if (static_cast<double>(image.total()) > previewPixels) {
+            double scale = std::sqrt(static_cast<double>(previewPixels) / image.total());
+            cv::resize(image, reduced, cv::Size(), scale, scale, cv::INTER_AREA);
+
+            // Results are published, so only the scratch is reused
+            auto start = std::chrono::high_resolution_clock::now();
+            cv::Mat output;
+            ditherImage(reduced, output, params, workspace);
+            auto end = std::chrono::high_resolution_clock::now();
+            float ms = std::chrono::duration<float, std::milli>(end - start).count();
+
+            lock.lock();
+            publish(std::move(output), false, ms);
+            bool superseded = changed.wait_for(lock, std::chrono::milliseconds(settleMs),
+                                               [&] { return stopping || requested != generation; });
+            if (superseded) continue;
+            lock.unlock();
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        cv::Mat output;
+        ditherImage(image, output, params, workspace);
+        auto end = std::chrono::high_resolution_clock::now();
+        float ms = std::chrono::duration<float, std::milli>(end - start).count();
+
+        lock.lock();
+        if (publish(std::move(output), true, ms)) {
+            latest.complete = true;
+            rendered = generation;
+            busy = false;
+        }
+    }
+}
+
+namespace {
+
+const int TILE_SIZE = 256;
+const int TILE_CONTEXT = 32;    // Margin dithered around tiles of non-pointwise algorithms
+
+} // namespace
+
+bool PreviewRenderer::renderView(const cv::Mat& image, const Parameters& params, const PreviewView& view,
+                                 uint64_t version, uint64_t generation, PreviewResult& result) {
+    DITHER_PROFILE_SCOPE("preview view");
+    const cv::Rect whole(0, 0, image.cols, image.rows);
+    const int x0 = static_cast<int>(std::floor(view.region.x * image.cols));
+    const int y0 = static_cast<int>(std::floor(view.region.y * image.rows));
+    const int x1 = static_cast<int>(std::ceil((view.region.x + view.region.width) * image.cols));
+    const int y1 = static_cast<int>(std::ceil((view.region.y + view.region.height) * image.rows));
+    cv::Rect pixels = cv::Rect(x0, y0, x1 - x0, y1 - y0) & whole;
+    if (pixels.empty()) pixels = whole;
+
+    result.region = cv::Rect2f(static_cast<float>(pixels.x) / image.cols, static_cast<float>(pixels.y) / image.rows,
+                               static_cast<float>(pixels.width) / image.cols,
+                               static_cast<float>(pixels.height) / image.rows);
+    result.source = image(pixels).clone();
+
+    // Zoomed out: dither the region at the panel's resolution
+    const double scale = std::min(static_cast<double>(view.display.width) / pixels.width,
+                                  static_cast<double>(view.display.height) / pixels.height);
+    if (scale < 1.0) {
+        cv::Size size(std::max(1, static_cast<int>(std::lround(pixels.width * scale))),
+                      std::max(1, static_cast<int>(std::lround(pixels.height * scale))));
+        cv::resize(result.source, result.source, size, 0, 0, cv::INTER_AREA);
+        ditherImage(result.source, result.image, params, workspace);
+        return true;
+    }
+
+    // 1:1 or closer: full-resolution tiles, cached until the content changes
+    const int tilesX = (image.cols + TILE_SIZE - 1) / TILE_SIZE;
+    const int tilesY = (image.rows + TILE_SIZE - 1) / TILE_SIZE;
+    if (canvasContent != version || canvas.size() != image.size()) {
+        canvas.create(image.rows, image.cols, CV_8UC3);
+        tileDone.assign(static_cast<size_t>(tilesX) * tilesY, false);
+        canvasContent = version;
+        canvasExact = true;
+    }
+
+    if (pixels == whole) {
+        // Everything visible: one pass gives the exact result. Cached tiles
+        // can stand in for it only if none was dithered with partial context.
+        bool allDone = std::find(tileDone.begin(), tileDone.end(), false) == tileDone.end();
+        if (!allDone || !canvasExact) {
+            ditherImage(image, canvas, params, workspace);
+            tileDone.assign(tileDone.size(), true);
+            canvasExact = true;
+        }
+        result.complete = true;
+    } else {
+        for (int ty = pixels.y / TILE_SIZE; ty * TILE_SIZE < pixels.y + pixels.height; ++ty) {
+            for (int tx = pixels.x / TILE_SIZE; tx * TILE_SIZE < pixels.x + pixels.width; ++tx) {
+                size_t index = static_cast<size_t>(ty) * tilesX + tx;
+                if (tileDone[index]) continue;
+                {
+                    // Tiles finished so far stay cached for the next request
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!isCurrent(generation)) return false;
+                }
+                renderTile(image, cv::Rect(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE) & whole, params);
+                tileDone[index] = true;
+            }
+        }
+    }
+    result.image = canvas(pixels).clone();
+    return true;
+}
+
+void PreviewRenderer::renderTile(const cv::Mat& image, const cv::Rect& tile, const Parameters& params) {
+    DITHER_PROFILE_PIXELS("preview tile", tile.area());
+    if (isPointwise(params.algorithm)) {
+        ditherRegion(image, canvas, tile, params, workspace);
+        return;
+    }
+
+    // The error reaches the tile already spread as it would be in the whole
+    // image; only the tile itself is kept. It is close to ditherImage, not
+    // equal, so the canvas no longer counts as a finished image.
+    canvasExact = false;
+    const cv::Rect padded = cv::Rect(tile.x - TILE_CONTEXT, tile.y - TILE_CONTEXT, tile.width + 2 * TILE_CONTEXT,
+                                     tile.height + 2 * TILE_CONTEXT) & cv::Rect(0, 0, image.cols, image.rows);
+    ditherImage(image(padded), context, params, workspace);
+    cv::Mat target = canvas(tile);
+    context(cv::Rect(tile.x - padded.x, tile.y - padded.y, tile.width, tile.height)).copyTo(target);
+}
+
+struct ImageLoader::Job {
+    std::mutex mutex;
+    std::condition_variable finished;
+    cv::Mat image;
+    bool done = false;
+};
+
+namespace {
+
+bool isJpegFile(const std::string& path) {
+    unsigned char magic[3] = {};
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+    size_t got = std::fread(magic, 1, sizeof(magic), file);
+    std::fclose(file);
+    return got == sizeof(magic) && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF;
+}
+
+} // namespace
+
+cv::Mat ImageLoader::open(const std::string& path, int previewPixels, cv::Size& size) {
+    cancel();
+
+    // libjpeg scales by 1/2, 1/4 and 1/8 while decoding; OpenCV's reduced
+    // modes decode other formats whole and then resize, which saves nothing
+    int factor = 1;
+    if (readImageSize(path, size) && isJpegFile(path)) {
+        for (int f : {8, 4, 2}) {
+            if (static_cast<double>(size.width / f) * (size.height / f) >= previewPixels) {
+                factor = f;
+                break;
+            }
+        }
+    }
+
+    cv::Mat image;
+    if (factor == 1) {
+        DITHER_PROFILE_SCOPE("load image");
+        image = cv::imread(path, cv::IMREAD_COLOR);
+        size = image.size();
+        return image;
+    }
+
+    {
+        DITHER_PROFILE_SCOPE("load preview");
+        int mode = factor == 8 ? cv::IMREAD_REDUCED_COLOR_8
+                 : factor == 4 ? cv::IMREAD_REDUCED_COLOR_4 : cv::IMREAD_REDUCED_COLOR_2;
+        image = cv::imread(path, mode);
+    }
+    if (image.empty()) return image;
+
+    auto pending = std::make_shared<Job>();
+    job = pending;
+    TaskPool::shared().submit([pending, path] {
+        cv::Mat full;
+        try {
+            DITHER_PROFILE_SCOPE("load image");
+            full = cv::imread(path, cv::IMREAD_COLOR);
+        } catch (...) {
+        }
+        {
+            std::lock_guard<std::mutex> lock(pending->mutex);
+            pending->image = std::move(full);
+            pending->done = true;
+        }
+        pending->finished.notify_all();
+    });
+    return image;
+}
+
+bool ImageLoader::poll(cv::Mat& full) {
+    if (!job) return false;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if (!job->done) return false;
+        full = std::move(job->image);
+    }
+    job.reset();
+    return true;
+}
+
+bool ImageLoader::wait(cv::Mat& full) {
+    if (!job) return false;
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->finished.wait(lock, [&] { return job->done; });
+        full = std::move(job->image);
+    }
+    job.reset();
+    return !full.empty();
+}
+
+} // namespace Dithering
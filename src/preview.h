@@ -0,0 +1,147 @@
+#pragma once
+
+#include "dithering.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Dithering {
+
+// The part of the image a preview panel shows, and the panel pixels it
+// fills. Without a display size the whole image is rendered at full
+// resolution.
+struct PreviewView {
+    cv::Rect2f region{0.0f, 0.0f, 1.0f, 1.0f};    // Fractions of the image's width and height
+    cv::Size display;
+
+    bool operator==(const PreviewView& other) const { return region == other.region && display == other.display; }
+    bool operator!=(const PreviewView& other) const { return !(*this == other); }
+};
+
+// One finished preview pass
+struct PreviewResult {
+    cv::Mat image;
+    cv::Mat source;                 // For views: the input pixels that were dithered
+    cv::Rect2f region{0.0f, 0.0f, 1.0f, 1.0f};    // Part of the image covered, as PreviewView
+    bool final = false;             // Last pass of the request (false = fast low-res pass)
+    bool complete = false;          // The whole image at full resolution, as ditherImage gives
+    float milliseconds = 0.0f;      // Time spent dithering this pass
+    uint64_t generation = 0;        // Request the pass belongs to
+};
+
+// Background preview renderer for interactive parameter changes.
+// request() never blocks: it replaces any pending request, so a burst of
+// slider changes collapses into the most recent one. Large images first get
+// a quick pass at reduced resolution; the full-resolution pass only starts
+// once no new request has arrived for the settle interval. Results of
+// superseded requests are dropped rather than published.
+//
+// With a view, only what the panel shows is dithered. Zoomed out, the
+// visible region is reduced to the panel's pixels first. From 1:1 up, the
+// image is dithered in tiles at full resolution, and tiles are kept until
+// the image or parameters change, so panning only dithers what comes into
+// view. Tiles of pointwise algorithms match the whole image exactly; the
+// others are dithered with a margin of context around them, which hides
+// the seams but is not pixel-identical to ditherImage.
+class PreviewRenderer {
+public:
+    explicit PreviewRenderer(int previewPixels = 512 * 512, int settleMs = 150);
+    ~PreviewRenderer();
+
+    PreviewRenderer(const PreviewRenderer&) = delete;
+    PreviewRenderer& operator=(const PreviewRenderer&) = delete;
+
+    // Queue a render of image with params; returns the request's generation
+    uint64_t request(const cv::Mat& image, const Parameters& params, const PreviewView& view = {});
+
+    // Render the last requested image and params for another view, keeping
+    // the tiles already dithered
+    uint64_t setView(const PreviewView& view);
+
+    // Fetch the newest pass finished since the last call
+    bool poll(PreviewResult& result);
+
+    // Drop any pending or in-flight request
+    void cancel();
+
+    bool isBusy() const { return busy.load(); }
+
+private:
+    void run();
+    bool isCurrent(uint64_t generation) const { return generation == requested && !stopping; }
+    bool renderView(const cv::Mat& image, const Parameters& params, const PreviewView& view, uint64_t content,
+                    uint64_t generation, PreviewResult& result);
+    void renderTile(const cv::Mat& image, const cv::Rect& tile, const Parameters& params);
+
+    int previewPixels;
+    int settleMs;
+
+    std::thread worker;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+
+    cv::Mat pendingImage;
+    Parameters pendingParams;
+    PreviewView pendingView;
+    uint64_t content = 0;           // Bumped for each new image or parameters
+    uint64_t requested = 0;
+    uint64_t rendered = 0;
+    bool stopping = false;
+
+    PreviewResult latest;
+    bool hasResult = false;
+    std::atomic<bool> busy{false};
+
+    // Worker thread only: scratch reused between passes, and the tile cache,
+    // a full-size canvas of which the flagged tiles are dithered
+    Workspace workspace;
+    cv::Mat reduced;
+    cv::Mat canvas;
+    std::vector<bool> tileDone;
+    uint64_t canvasContent = 0;
+    bool canvasExact = true;        // No tile came from renderTile's padded approximation
+    cv::Mat context;
+};
+
+// Opens images for display in two steps. A large JPEG is first decoded with
+// DCT scaling at 1/2, 1/4 or 1/8 size, which takes a fraction of the full
+// decode, and the full-resolution decode then runs as a task on the shared
+// TaskPool for whoever needs it (saving, zooming, the final preview pass).
+// Other formats have no reduced decode and are read in full right away.
+class ImageLoader {
+public:
+    ImageLoader() = default;
+    ~ImageLoader() { cancel(); }
+
+    ImageLoader(const ImageLoader&) = delete;
+    ImageLoader& operator=(const ImageLoader&) = delete;
+
+    // Decode path at the smallest scale still holding previewPixels, and
+    // start the full decode if that was not it. size receives the full
+    // resolution. Returns an empty Mat if the file cannot be read.
+    cv::Mat open(const std::string& path, int previewPixels, cv::Size& size);
+
+    // Whether a full-resolution decode is still to be collected
+    bool isLoading() const { return static_cast<bool>(job); }
+
+    // Once the full decode has finished, hand it over (empty if it failed)
+    // and return true; false while it is still running or if none is pending
+    bool poll(cv::Mat& full);
+
+    // Block until the full decode finishes; false if it failed or none is pending
+    bool wait(cv::Mat& full);
+
+    // Forget the pending decode; it finishes in the background and is dropped
+    void cancel() { job.reset(); }
+
+private:
+    struct Job;
+    std::shared_ptr<Job> job;
+};
+
+} // namespace Dithering
@@ -0,0 +1,275 @@
+#include "profile.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+
+#ifndef DITHER_COUNT_ALLOCATIONS
+#define DITHER_COUNT_ALLOCATIONS 0
+#endif
+
+namespace Dithering {
+
+namespace {
+
+thread_local uint64_t threadAllocations = 0;
+
+// JSON string with the characters stage names can contain escaped
+std::string quoted(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+uint64_t threadAllocationCount() {
+    return threadAllocations;
+}
+
+bool allocationCountingCompiledIn() {
+#if DITHER_PROFILING && DITHER_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if DITHER_PROFILING
+
+namespace {
+
+struct NameLess {
+    bool operator()(const char* a, const char* b) const { return std::strcmp(a, b) < 0; }
+};
+
+struct StageTotals {
+    uint64_t calls = 0;
+    double totalMs = 0.0;
+    double maxMs = 0.0;
+    uint64_t pixels = 0;
+    uint64_t allocations = 0;
+};
+
+struct TraceEvent {
+    const char* name;
+    double startUs;
+    double durationUs;
+    uint32_t thread;
+};
+
+// Stages are keyed by the literal's text, so a stage recorded from several
+// translation units is one entry, and a lookup never allocates
+struct Registry {
+    std::mutex mutex;
+    std::map<const char*, StageTotals, NameLess> stages;
+
+    std::atomic<bool> tracing{false};
+    std::vector<TraceEvent> events;
+    size_t maxEvents = 0;
+    std::map<uint32_t, const char*> threadNames;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+// Never destroyed, so timers in threads outliving main() stay safe
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+std::atomic<uint32_t> nextThreadId{1};
+thread_local uint32_t threadId = 0;
+
+uint32_t currentThreadId() {
+    if (threadId == 0) threadId = nextThreadId++;
+    return threadId;
+}
+
+} // namespace
+
+ScopedTimer::~ScopedTimer() {
+    auto end = std::chrono::steady_clock::now();
+    uint64_t allocations = threadAllocations - allocationsAtStart;
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    StageTotals& totals = r.stages[stage];
+    ++totals.calls;
+    totals.totalMs += ms;
+    totals.maxMs = std::max(totals.maxMs, ms);
+    totals.pixels += pixels;
+    totals.allocations += allocations;
+
+    if (r.tracing.load(std::memory_order_relaxed) && r.events.size() < r.maxEvents) {
+        double startUs = std::chrono::duration<double, std::micro>(start - r.epoch).count();
+        r.events.push_back({stage, startUs, ms * 1000.0, currentThreadId()});
+    }
+}
+
+bool profilingCompiledIn() {
+    return true;
+}
+
+std::vector<StageProfile> profileSnapshot() {
+    Registry& r = registry();
+    std::vector<StageProfile> stages;
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        stages.reserve(r.stages.size());
+        for (const auto& [name, totals] : r.stages) {
+            StageProfile stage;
+            stage.name = name;
+            stage.calls = totals.calls;
+            stage.totalMs = totals.totalMs;
+            stage.maxMs = totals.maxMs;
+            stage.pixels = totals.pixels;
+            stage.allocations = totals.allocations;
+            stages.push_back(std::move(stage));
+        }
+    }
+    std::sort(stages.begin(), stages.end(),
+              [](const StageProfile& a, const StageProfile& b) { return a.totalMs > b.totalMs; });
+    return stages;
+}
+
+void resetProfile() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.stages.clear();
+}
+
+void startTrace(size_t maxEvents) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.events.clear();
+    r.events.reserve(std::min<size_t>(maxEvents, 65536));
+    r.maxEvents = maxEvents;
+    r.tracing = true;
+}
+
+bool stopTrace(const std::string& path) {
+    Registry& r = registry();
+    std::vector<TraceEvent> events;
+    std::map<uint32_t, const char*> names;
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        if (!r.tracing) return false;
+        r.tracing = false;
+        events.swap(r.events);
+        names = r.threadNames;
+    }
+
+    std::ofstream out(path);
+    if (!out) return false;
+
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (const auto& [thread, name] : names) {
+        out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread
+            << ", \"args\": {\"name\": " << quoted(name) << "}}";
+        first = false;
+    }
+    char number[64];
+    for (const auto& event : events) {
+        std::snprintf(number, sizeof(number), "%.3f, \"dur\": %.3f", event.startUs, event.durationUs);
+        out << (first ? "" : ",\n") << "{\"name\": " << quoted(event.name) << ", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+            << event.thread << ", \"ts\": " << number << "}";
+        first = false;
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+bool isTracing() {
+    return registry().tracing.load();
+}
+
+void setProfileThreadName(const char* name) {
+    Registry& r = registry();
+    uint32_t thread = currentThreadId();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.threadNames[thread] = name;
+}
+
+#else
+
+ScopedTimer::~ScopedTimer() {}
+
+bool profilingCompiledIn() { return false; }
+std::vector<StageProfile> profileSnapshot() { return {}; }
+void resetProfile() {}
+void startTrace(size_t) {}
+bool stopTrace(const std::string&) { return false; }
+bool isTracing() { return false; }
+void setProfileThreadName(const char*) {}
+
+#endif
+
+std::string profileToJson(const std::vector<StageProfile>& stages) {
+    std::ostringstream out;
+    out << "{\n  \"profiling\": " << (profilingCompiledIn() ? "true" : "false")
+        << ",\n  \"allocation_counting\": " << (allocationCountingCompiledIn() ? "true" : "false")
+        << ",\n  \"stages\": [";
+    char line[512];
+    for (size_t i = 0; i < stages.size(); ++i) {
+        const StageProfile& s = stages[i];
+        std::snprintf(line, sizeof(line),
+                      "%s\n    {\"name\": %s, \"calls\": %llu, \"total_ms\": %.3f, \"mean_ms\": %.3f, "
+                      "\"max_ms\": %.3f, \"pixels\": %llu, \"mpix_per_s\": %.2f, \"allocations\": %llu}",
+                      i ? "," : "", quoted(s.name).c_str(), static_cast<unsigned long long>(s.calls), s.totalMs, s.meanMs(),
+                      s.maxMs, static_cast<unsigned long long>(s.pixels), s.megapixelsPerSecond(),
+                      static_cast<unsigned long long>(s.allocations));
+        out << line;
+    }
+    out << (stages.empty() ? "]\n}\n" : "\n  ]\n}\n");
+    return out.str();
+}
+
+bool writeProfileJson(const std::string& path) {
+    std::ofstream out(path);
+    out << profileToJson(profileSnapshot());
+    return static_cast<bool>(out);
+}
+
+} // namespace Dithering
+
+#if DITHER_PROFILING && DITHER_COUNT_ALLOCATIONS
+
+// Allocation counting through the replaceable global operator new, per
+// thread so a stage only sees its own thread's allocations. cv::Mat buffers
+// count too: OpenCV news a header for each one. The array forms route
+// through these by default.
+void* operator new(std::size_t size) {
+    ++Dithering::threadAllocations;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    ++Dithering::threadAllocations;
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Stage timers are compiled in only when DITHER_PROFILING is defined to 1;
+// otherwise the macros below expand to nothing and the reporting functions
+// return empty results. Counting allocations replaces the global operator
+// new for the whole process, so it is a separate opt-in on top of that:
+// DITHER_COUNT_ALLOCATIONS, which only profile.cpp reads.
+#ifndef DITHER_PROFILING
+#define DITHER_PROFILING 0
+#endif
+
+namespace Dithering {
+
+// Totals for one instrumented stage since the last resetProfile(). Stages
+// nest, and a stage's time and allocations include the stages inside it.
+struct StageProfile {
+    std::string name;
+    uint64_t calls = 0;
+    double totalMs = 0.0;
+    double maxMs = 0.0;
+    uint64_t pixels = 0;        // Pixels handled, for stages that report them
+    uint64_t allocations = 0;   // operator new calls made on the stage's thread, if counted
+
+    double meanMs() const { return calls ? totalMs / calls : 0.0; }
+    double megapixelsPerSecond() const { return totalMs > 0.0 ? pixels / (totalMs * 1000.0) : 0.0; }
+};
+
+// Whether the library was built with stage timers, and with them the
+// allocation counter
+bool profilingCompiledIn();
+bool allocationCountingCompiledIn();
+
+// Every stage seen so far, slowest total first
+std::vector<StageProfile> profileSnapshot();
+void resetProfile();
+
+// {"profiling": bool, "allocation_counting": bool, "stages": [{"name", "calls", "total_ms", "mean_ms",
+// "max_ms", "pixels", "mpix_per_s", "allocations"}, ...]}
+std::string profileToJson(const std::vector<StageProfile>& stages);
+bool writeProfileJson(const std::string& path);
+
+// Chrome trace recording (chrome://tracing, ui.perfetto.dev): between
+// startTrace() and stopTrace() each timed scope becomes one event on its
+// thread's track. At most maxEvents are kept; later ones are dropped.
+void startTrace(size_t maxEvents = size_t(1) << 20);
+bool stopTrace(const std::string& path);
+bool isTracing();
+
+// Label the calling thread's track in traces; name must outlive the trace
+void setProfileThreadName(const char* name);
+
+// operator new calls made so far on the calling thread; always 0 unless
+// allocation counting is compiled in
+uint64_t threadAllocationCount();
+
+// Times the enclosing scope as the named stage. stage must be a string
+// literal (or otherwise live for the whole run); stages are keyed by name.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* stage, uint64_t pixels = 0)
+        : stage(stage), pixels(pixels), allocationsAtStart(threadAllocationCount()),
+          start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* stage;
+    uint64_t pixels;
+    uint64_t allocationsAtStart;
+    std::chrono::steady_clock::time_point start;
+};
+
+} // namespace Dithering
+
+#define DITHER_PROFILE_CONCAT_(a, b) a##b
+#define DITHER_PROFILE_CONCAT(a, b) DITHER_PROFILE_CONCAT_(a, b)
+
+#if DITHER_PROFILING
+#define DITHER_PROFILE_SCOPE(stage) \
+    ::Dithering::ScopedTimer DITHER_PROFILE_CONCAT(ditherProfileScope, __LINE__)(stage)
+#define DITHER_PROFILE_PIXELS(stage, pixels) \
+    ::Dithering::ScopedTimer DITHER_PROFILE_CONCAT(ditherProfileScope, __LINE__)(stage, static_cast<uint64_t>(pixels))
+#else
+#define DITHER_PROFILE_SCOPE(stage) ((void)0)
+#define DITHER_PROFILE_PIXELS(stage, pixels) ((void)0)
+#endif
@@ -0,0 +1,569 @@
+#include "server.h"
+#include "profile.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace Dithering {
+
+namespace {
+
+const size_t MAX_HEADER_BYTES = 64 * 1024;
+
+void skipSpace(const std::string& text, size_t& pos) {
+    while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+}
+
+void appendUtf8(std::string& out, unsigned code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+// A JSON string starting at the opening quote
+bool parseString(const std::string& text, size_t& pos, std::string& out) {
+    if (pos >= text.size() || text[pos] != '"') return false;
+    ++pos;
+    out.clear();
+    while (pos < text.size()) {
+        char c = text[pos++];
+        if (c == '"') return true;
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (pos >= text.size()) return false;
+        char escape = text[pos++];
+        switch (escape) {
+            case '"': case '\\': case '/': out += escape; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                if (pos + 4 > text.size()) return false;
+                unsigned code = 0;
+                for (int i = 0; i < 4; ++i) {
+                    char h = text[pos++];
+                    if (!std::isxdigit(static_cast<unsigned char>(h))) return false;
+                    int digit = std::isdigit(static_cast<unsigned char>(h)) ? h - '0' : std::tolower(h) - 'a' + 10;
+                    code = code * 16 + static_cast<unsigned>(digit);
+                }
+                appendUtf8(out, code);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+std::string lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+}
+
+std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t");
+    if (begin == std::string::npos) return "";
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+// A Content-Length value: digits only. Values too large for size_t
+// saturate, so they are refused as too large rather than as malformed.
+bool parseContentLength(const std::string& text, size_t& length) {
+    if (text.empty()) return false;
+    length = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') return false;
+        const size_t digit = static_cast<size_t>(c - '0');
+        length = length > (SIZE_MAX - digit) / 10 ? SIZE_MAX : length * 10 + digit;
+    }
+    return true;
+}
+
+const char* reasonPhrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+const char* contentTypeFor(const std::string& format) {
+    if (format == "png") return "image/png";
+    if (format == "bmp") return "image/bmp";
+    if (format == "jpg" || format == "jpeg") return "image/jpeg";
+    if (format == "webp") return "image/webp";
+    if (format == "tif" || format == "tiff") return "image/tiff";
+    if (format == "pbm" || format == "pgm" || format == "ppm") return "image/x-portable-anymap";
+    return "application/octet-stream";
+}
+
+} // namespace
+
+bool parseFlatJson(const std::string& text, std::map<std::string, std::string>& values) {
+    values.clear();
+    size_t pos = 0;
+    skipSpace(text, pos);
+    if (pos >= text.size() || text[pos++] != '{') return false;
+    skipSpace(text, pos);
+    if (pos < text.size() && text[pos] == '}') {
+        ++pos;
+    } else {
+        while (true) {
+            std::string key, value;
+            skipSpace(text, pos);
+            if (!parseString(text, pos, key)) return false;
+            skipSpace(text, pos);
+            if (pos >= text.size() || text[pos++] != ':') return false;
+            skipSpace(text, pos);
+            if (pos >= text.size()) return false;
+            if (text[pos] == '"') {
+                if (!parseString(text, pos, value)) return false;
+            } else {
+                // Numbers and literals are kept as written
+                size_t end = pos;
+                while (end < text.size() && (std::isalnum(static_cast<unsigned char>(text[end])) ||
+                                             text[end] == '-' || text[end] == '+' || text[end] == '.')) {
+                    ++end;
+                }
+                if (end == pos) return false;
+                value = text.substr(pos, end - pos);
+                pos = end;
+            }
+            values[key] = value;
+            skipSpace(text, pos);
+            if (pos >= text.size()) return false;
+            if (text[pos] == ',') {
+                ++pos;
+                continue;
+            }
+            if (text[pos++] != '}') return false;
+            break;
+        }
+    }
+    skipSpace(text, pos);
+    return pos == text.size();
+}
+
+struct DitherServer::Response {
+    int status = 200;
+    std::string contentType = "application/json";
+    std::vector<uchar> body;
+
+    static Response json(int status, const std::string& text) {
+        Response response;
+        response.status = status;
+        response.body.assign(text.begin(), text.end());
+        return response;
+    }
+
+    static Response error(int status, const std::string& message) {
+        return json(status, "{\"error\": \"" + jsonEscape(message) + "\"}\n");
+    }
+};
+
+DitherServer::DitherServer(ServerOptions options)
+    : options(std::move(options)), pool(this->options.jobs), openCvThreads(cv::getNumThreads()) {
+    // The pool is the only parallelism: cv::parallel_for_ in the threshold
+    // and noise kernels runs inline on the request's own thread
+    cv::setNumThreads(1);
+}
+
+DitherServer::~DitherServer() {
+    cv::setNumThreads(openCvThreads);
+#ifndef _WIN32
+    if (listenFd >= 0) {
+        ::close(listenFd);
+        ::unlink(options.socketPath.c_str());
+    }
+#endif
+}
+
+DitherServer::Stats DitherServer::stats() const {
+    Stats stats;
+    stats.requests = requests.load();
+    stats.failed = failures.load();
+    stats.active = connections.load();
+    return stats;
+}
+
+DitherServer::Response DitherServer::handle(const std::string& method, const std::string& target,
+                                            const std::map<std::string, std::string>& headers,
+                                            const std::string& body) {
+    const std::string path = target.substr(0, target.find('?'));
+    if (path == "/dither") {
+        if (method != "POST") return Response::error(405, "Use POST for /dither");
+        return dither(headers, body);
+    }
+    if (path == "/health") {
+        if (method != "GET") return Response::error(405, "Use GET for /health");
+        Stats s = stats();
+        char text[160];
+        std::snprintf(text, sizeof(text), "{\"status\": \"ok\", \"requests\": %lld, \"failed\": %lld, \"active\": %d}\n",
+                      s.requests, s.failed, s.active);
+        return Response::json(200, text);
+    }
+    if (path == "/profile") {
+        if (method != "GET") return Response::error(405, "Use GET for /profile");
+        return Response::json(200, profileToJson(profileSnapshot()));
+    }
+    return Response::error(404, "No such endpoint: " + path);
+}
+
+bool DitherServer::requestParameters(const std::string& header, Parameters& params, std::string& format,
+                                     std::string& error) const {
+    params = options.defaults;
+    format = "png";
+    if (!header.empty()) {
+        std::map<std::string, std::string> values;
+        if (!parseFlatJson(header, values)) {
+            error = "Dither-Parameters must be a flat JSON object";
+            return false;
+        }
+        for (const auto& [key, value] : values) {
+            if (key == "format") {
+                format = lower(value);
+                if (format.empty() || format.find_first_of("./\\") != std::string::npos ||
+                    !cv::haveImageWriter("." + format)) {
+                    error = "Unsupported format: " + value;
+                    return false;
+                }
+            } else if (!options.setParameter) {
+                error = "Unknown parameter: " + key;
+                return false;
+            } else if (!options.setParameter(key, value, params, error)) {
+                if (error.empty()) error = "Bad parameter: " + key;
+                return false;
+            }
+        }
+    }
+
+    // Each request is one pool task; its own diffusion threads would put it
+    // beyond `jobs` whatever the client asked for
+    params.threads = 1;
+    return true;
+}
+
+DitherServer::Response DitherServer::dither(const std::map<std::string, std::string>& headers,
+                                            const std::string& body) {
+    Parameters params;
+    std::string format, error;
+    auto header = headers.find("dither-parameters");
+    if (!requestParameters(header != headers.end() ? header->second : std::string(), params, format, error)) {
+        return Response::error(400, error);
+    }
+    if (body.empty()) return Response::error(400, "Empty body; send the encoded image");
+
+    // Decoding and encoding run on the pool too, and requests dither on one
+    // thread (OpenCV's loops included), so `jobs` bounds the whole request's
+    // CPU use rather than just the dithering
+    Response response;
+    TaskGroup group(pool);
+    group.run([&] {
+        DITHER_PROFILE_SCOPE("server request");
+        cv::Mat input;
+        {
+            DITHER_PROFILE_SCOPE("server decode");
+            const cv::Mat bytes(1, static_cast<int>(body.size()), CV_8U, const_cast<char*>(body.data()));
+            input = cv::imdecode(bytes, cv::IMREAD_COLOR);
+        }
+        if (input.empty()) {
+            response = Response::error(400, "Could not decode the image");
+            return;
+        }
+
+        cv::Mat output;
+        {
+            WorkspaceCache::Lease workspace = workspaces.acquire();
+            ditherImage(input, output, params, *workspace);
+        }
+
+        DITHER_PROFILE_SCOPE("server encode");
+        response.contentType = contentTypeFor(format);
+        if (!cv::imencode("." + format, output, response.body)) {
+            response = Response::error(400, "Could not encode as " + format);
+        }
+    });
+    try {
+        group.wait();
+    } catch (const std::exception& e) {
+        return Response::error(500, e.what());
+    }
+    return response;
+}
+
+#ifdef _WIN32
+
+bool DitherServer::listen(std::string& error) {
+    error = "Server mode needs Unix domain sockets, which this build does not have";
+    return false;
+}
+
+void DitherServer::run() {}
+void DitherServer::serveConnection(int) {}
+
+#else
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+bool sendAll(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t sent = ::send(fd, bytes, size, SEND_FLAGS);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// Append whatever arrives within the idle timeout. Between requests a stop
+// request ends the wait early; mid-request the client gets to finish.
+bool receive(int fd, std::string& buffer, const std::atomic<bool>& stopping, bool betweenRequests,
+             int idleSeconds) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(std::max(1, idleSeconds));
+    char chunk[64 * 1024];
+    while (true) {
+        if (betweenRequests && stopping.load()) return false;
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        pollfd entry{fd, POLLIN, 0};
+        int ready = ::poll(&entry, 1, 250);
+        if (ready < 0 && errno != EINTR) return false;
+        if (ready <= 0) continue;
+        ssize_t got = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        buffer.append(chunk, static_cast<size_t>(got));
+        return true;
+    }
+}
+
+bool sendResponse(int fd, int status, const std::string& contentType,
+                  const std::vector<uchar>& body, bool keepAlive) {
+    char head[256];
+    int length = std::snprintf(head, sizeof(head),
+                               "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+                               status, reasonPhrase(status), contentType.c_str(), body.size(),
+                               keepAlive ? "keep-alive" : "close");
+    return sendAll(fd, head, static_cast<size_t>(length)) && (body.empty() || sendAll(fd, body.data(), body.size()));
+}
+
+} // namespace
+
+bool DitherServer::listen(std::string& error) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (options.socketPath.empty() || options.socketPath.size() >= sizeof(address.sun_path)) {
+        error = "Socket path is empty or too long: " + options.socketPath;
+        return false;
+    }
+    std::memcpy(address.sun_path, options.socketPath.c_str(), options.socketPath.size() + 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error = std::string("Could not create socket: ") + std::strerror(errno);
+        return false;
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // A socket file nobody answers on is left over from a crash
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        ::close(fd);
+        error = "Another server is already listening on " + options.socketPath;
+        return false;
+    }
+    ::close(fd);
+    ::unlink(options.socketPath.c_str());
+
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(fd, 64) != 0) {
+        error = "Could not listen on " + options.socketPath + ": " + std::strerror(errno);
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    listenFd = fd;
+    return true;
+}
+
+void DitherServer::run() {
+    while (listenFd >= 0 && !stopping.load()) {
+        pollfd entry{listenFd, POLLIN, 0};
+        if (::poll(&entry, 1, 250) <= 0) continue;
+        int fd = ::accept(listenFd, nullptr, nullptr);
+        if (fd < 0) continue;
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+        if (connections.load() >= std::max(1, options.maxConnections)) {
+            Response busy = Response::error(503, "Too many connections");
+            sendResponse(fd, busy.status, busy.contentType, busy.body, false);
+            ::close(fd);
+            continue;
+        }
+
+        // A thread per connection for the socket I/O; the work itself is
+        // queued on the pool, so slow clients do not hold up dithering
+        ++connections;
+        std::thread([this, fd] {
+            serveConnection(fd);
+            --connections;
+        }).detach();
+    }
+
+    if (listenFd >= 0) {
+        ::close(listenFd);
+        ::unlink(options.socketPath.c_str());
+        listenFd = -1;
+    }
+    while (connections.load() > 0) std::this_thread::sleep_for(std::chrono::milliseconds(20));
+}
+
+void DitherServer::serveConnection(int fd) {
+    setProfileThreadName("server connection");
+    std::string buffer;
+    bool keepAlive = true;
+
+    while (keepAlive) {
+        size_t headerEnd;
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (buffer.size() > MAX_HEADER_BYTES) {
+                Response tooLarge = Response::error(431, "Request headers too large");
+                sendResponse(fd, tooLarge.status, tooLarge.contentType, tooLarge.body, false);
+                ::close(fd);
+                return;
+            }
+            if (!receive(fd, buffer, stopping, buffer.empty(), options.idleSeconds)) {
+                ::close(fd);
+                return;
+            }
+        }
+
+        // Request line and headers, names lowercased
+        std::string method, target, version;
+        std::map<std::string, std::string> headers;
+        size_t lineEnd = buffer.find("\r\n");
+        {
+            std::string requestLine = buffer.substr(0, lineEnd);
+            size_t a = requestLine.find(' ');
+            size_t b = a == std::string::npos ? a : requestLine.find(' ', a + 1);
+            if (b != std::string::npos) {
+                method = requestLine.substr(0, a);
+                target = requestLine.substr(a + 1, b - a - 1);
+                version = requestLine.substr(b + 1);
+            }
+        }
+        for (size_t pos = lineEnd + 2; pos < headerEnd;) {
+            size_t end = buffer.find("\r\n", pos);
+            std::string line = buffer.substr(pos, end - pos);
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) headers[lower(trim(line.substr(0, colon)))] = trim(line.substr(colon + 1));
+            pos = end + 2;
+        }
+        keepAlive = version == "HTTP/1.1" ? lower(headers["connection"]) != "close"
+                                          : lower(headers["connection"]) == "keep-alive";
+
+        Response response;
+        size_t length = 0;
+        auto contentLength = headers.find("content-length");
+        if (method.empty() || version.compare(0, 5, "HTTP/") != 0) {
+            response = Response::error(400, "Malformed request line");
+            keepAlive = false;
+        } else if (headers.count("transfer-encoding")) {
+            response = Response::error(411, "Chunked bodies are not supported; send Content-Length");
+            keepAlive = false;
+        } else if (contentLength != headers.end() && !parseContentLength(contentLength->second, length)) {
+            response = Response::error(400, "Malformed Content-Length: " + contentLength->second);
+            keepAlive = false;
+        } else if (length > options.maxRequestBytes) {
+            response = Response::error(413, "Body larger than the server accepts");
+            keepAlive = false;
+        }
+        if (response.status != 200) {
+            ++requests;
+            ++failures;
+            sendResponse(fd, response.status, response.contentType, response.body, false);
+            ::close(fd);
+            return;
+        }
+
+        const size_t bodyStart = headerEnd + 4;
+        while (buffer.size() < bodyStart + length) {
+            if (!receive(fd, buffer, stopping, false, options.idleSeconds)) {
+                ::close(fd);
+                return;
+            }
+        }
+        std::string body = buffer.substr(bodyStart, length);
+        buffer.erase(0, bodyStart + length);
+
+        response = handle(method, target, headers, body);
+        ++requests;
+        if (response.status != 200) ++failures;
+        if (stopping.load()) keepAlive = false;
+        if (!sendResponse(fd, response.status, response.contentType, response.body, keepAlive)) break;
+    }
+    ::close(fd);
+}
+
+#endif
+
+} // namespace Dithering
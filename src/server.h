@@ -0,0 +1,104 @@
+#pragma once
+
+#include "batch.h"
+#include "dithering.h"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace Dithering {
+
+// Sets one request parameter from its JSON value (strings unquoted, numbers
+// and booleans as written). Returns false with error set for an unknown key
+// or a bad value.
+using ParameterSetter =
+    std::function<bool(const std::string& key, const std::string& value, Parameters& params, std::string& error)>;
+
+struct ServerOptions {
+    std::string socketPath;                         // Unix domain socket to listen on
+    int jobs = 0;                                   // Images dithered at once; <= 0 uses all cores
+    int maxConnections = 64;                        // Further clients get 503
+    size_t maxRequestBytes = size_t(256) << 20;     // Larger bodies get 413
+    int idleSeconds = 30;                           // Keep-alive connections idle this long are closed
+    Parameters defaults;                            // What each request's parameters start from
+    ParameterSetter setParameter;
+};
+
+// Long-running dithering service speaking HTTP/1.1 over a Unix socket, so a
+// stream of small jobs pays process start-up, OpenCV initialisation and
+// thread creation once. Everything built lazily stays warm between jobs:
+// palette matchers and threshold maps in their process-wide caches, noise
+// masks, the task pool and a Workspace per concurrent job.
+//
+//   POST /dither     Body: encoded image (anything cv::imdecode reads).
+//                    Header Dither-Parameters: a flat JSON object of the
+//                    CLI's long option names, e.g.
+//                    {"algorithm": "atkinson", "palette": "gameboy"}, plus
+//                    "format" for the reply's encoding (png, bmp, jpg, ...;
+//                    default png). Replies with the encoded result.
+//   GET  /health     {"status": "ok", "requests": n, "failed": n, "active": n}
+//   GET  /profile    Stage timings as profileToJson
+//
+// Errors are replied as {"error": "..."} with a 4xx/5xx status. Requests are
+// handled concurrently, decoding and encoding included, on a TaskPool of
+// `jobs` threads, each request on one of them: the "threads" parameter is
+// accepted but overridden, and OpenCV's own threading is switched off while
+// the server exists. Nothing touches the filesystem but the socket.
+class DitherServer {
+public:
+    explicit DitherServer(ServerOptions options);
+    ~DitherServer();
+
+    DitherServer(const DitherServer&) = delete;
+    DitherServer& operator=(const DitherServer&) = delete;
+
+    // Bind and listen, replacing a stale socket file. False with error set
+    // if the socket cannot be created (or on platforms without them).
+    bool listen(std::string& error);
+
+    // Serve until stop(), then wait for open connections to finish
+    void run();
+
+    // Safe from any thread and from a signal handler
+    void stop() { stopping = true; }
+
+    // The parameters a /dither request runs with: options.defaults with the
+    // Dither-Parameters JSON (header, may be empty) applied and threads
+    // pinned to one, so `jobs` alone bounds CPU use. False with error set
+    // for a malformed header, unknown key, bad value or unwritable format.
+    bool requestParameters(const std::string& header, Parameters& params, std::string& format,
+                           std::string& error) const;
+
+    struct Stats {
+        long long requests = 0;
+        long long failed = 0;
+        int active = 0;         // Connections open
+    };
+    Stats stats() const;
+
+private:
+    struct Response;
+
+    void serveConnection(int fd);
+    Response handle(const std::string& method, const std::string& target,
+                    const std::map<std::string, std::string>& headers, const std::string& body);
+    Response dither(const std::map<std::string, std::string>& headers, const std::string& body);
+
+    ServerOptions options;
+    TaskPool pool;
+    WorkspaceCache workspaces;
+    int openCvThreads;          // cv::getNumThreads() before the server, restored after
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+    std::atomic<long long> requests{0};
+    std::atomic<long long> failures{0};
+    std::atomic<int> connections{0};
+};
+
+// Parse a flat JSON object ({"key": "text" | number | true | false | null})
+// into key/value text. False for anything else, including nested values.
+bool parseFlatJson(const std::string& text, std::map<std::string, std::string>& values);
+
+} // namespace Dithering
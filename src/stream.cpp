@@ -0,0 +1,561 @@
+#include "stream.h"
+#include <algorithm>
+#include <cctype>
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef DITHER_WITH_PNG
+#include <png.h>
+#endif
+
+#ifdef DITHER_WITH_TIFF
+#include <tiffio.h>
+#endif
+
+namespace Dithering {
+
+namespace {
+
+std::string lowerExtension(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return "";
+    std::string ext = path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+bool isPng(const std::string& path) {
+    return lowerExtension(path) == ".png";
+}
+
+bool isTiff(const std::string& path) {
+    std::string ext = lowerExtension(path);
+    return ext == ".tif" || ext == ".tiff";
+}
+
+// Whole-image fallback for formats without a strip writer
+class ImageRowSink : public MatRowSink {
+public:
+    explicit ImageRowSink(std::string path) : path(std::move(path)) {}
+
+    bool finish() override {
+        return MatRowSink::finish() && cv::imwrite(path, result());
+    }
+
+private:
+    std::string path;
+};
+
+#ifdef DITHER_WITH_PNG
+
+// libpng reports errors by longjmp, so every function that calls into it
+// sets the jump point first and keeps no objects with destructors in between
+class PngRowSource : public RowSource {
+public:
+    ~PngRowSource() override {
+        if (png) png_destroy_read_struct(&png, &info, nullptr);
+        if (file) std::fclose(file);
+    }
+
+    bool open(const std::string& path) {
+        file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+
+        png_byte signature[8];
+        if (std::fread(signature, 1, 8, file) != 8 || png_sig_cmp(signature, 0, 8) != 0) return false;
+
+        png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        if (!png) return false;
+        info = png_create_info_struct(png);
+        if (!info) return false;
+        if (setjmp(png_jmpbuf(png))) return false;
+
+        png_init_io(png, file);
+        png_set_sig_bytes(png, 8);
+        png_read_info(png, info);
+
+        // Interlaced rows are only complete after the last pass
+        if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) return false;
+
+        // Normalise everything to 8-bit BGR, dropping alpha like cv::IMREAD_COLOR
+        int colorType = png_get_color_type(png, info);
+        int bitDepth = png_get_bit_depth(png, info);
+        if (bitDepth == 16) png_set_strip_16(png);
+        if (colorType == PNG_COLOR_TYPE_PALETTE) png_set_palette_to_rgb(png);
+        if (colorType == PNG_COLOR_TYPE_GRAY && bitDepth < 8) png_set_expand_gray_1_2_4_to_8(png);
+        if (colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA) png_set_gray_to_rgb(png);
+        if (colorType & PNG_COLOR_MASK_ALPHA) png_set_strip_alpha(png);
+        png_set_bgr(png);
+        png_read_update_info(png, info);
+
+        cols = static_cast<int>(png_get_image_width(png, info));
+        rows = static_cast<int>(png_get_image_height(png, info));
+        return png_get_rowbytes(png, info) == static_cast<size_t>(cols) * 3;
+    }
+
+    int width() const override { return cols; }
+    int height() const override { return rows; }
+
+    bool read(cv::Mat& strip) override {
+        if (setjmp(png_jmpbuf(png))) return false;
+        for (int y = 0; y < strip.rows; ++y) {
+            png_read_row(png, strip.ptr<png_byte>(y), nullptr);
+        }
+        return true;
+    }
+
+private:
+    std::FILE* file = nullptr;
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+    int cols = 0;
+    int rows = 0;
+};
+
+class PngRowSink : public RowSink {
+public:
+    explicit PngRowSink(std::string path) : path(std::move(path)) {}
+
+    ~PngRowSink() override {
+        if (png) png_destroy_write_struct(&png, &info);
+        if (file) std::fclose(file);
+    }
+
+    bool begin(int width, int height) override {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) return false;
+
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        if (!png) return false;
+        info = png_create_info_struct(png);
+        if (!info) return false;
+        if (setjmp(png_jmpbuf(png))) return false;
+
+        png_init_io(png, file);
+        png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png, info);
+        png_set_bgr(png);
+        return true;
+    }
+
+    bool write(const cv::Mat& strip) override {
+        if (setjmp(png_jmpbuf(png))) return false;
+        for (int y = 0; y < strip.rows; ++y) {
+            png_write_row(png, strip.ptr<png_byte>(y));
+        }
+        return true;
+    }
+
+    bool finish() override {
+        if (setjmp(png_jmpbuf(png))) return false;
+        png_write_end(png, nullptr);
+        png_destroy_write_struct(&png, &info);
+        png = nullptr;
+
+        bool closed = std::fclose(file) == 0;
+        file = nullptr;
+        return closed;
+    }
+
+private:
+    std::string path;
+    std::FILE* file = nullptr;
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+};
+
+#endif // DITHER_WITH_PNG
+
+#ifdef DITHER_WITH_TIFF
+
+// 8-bit contiguous gray or RGB TIFFs, read scanline by scanline or, for
+// tiled files, one band of tiles at a time
+class TiffRowSource : public RowSource {
+public:
+    ~TiffRowSource() override {
+        if (tif) TIFFClose(tif);
+    }
+
+    bool open(const std::string& path) {
+        tif = TIFFOpen(path.c_str(), "r");
+        if (!tif) return false;
+
+        uint32_t w = 0, h = 0;
+        uint16_t bitsPerSample = 1, planar = PLANARCONFIG_CONTIG, photometric = 0;
+        TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+        TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+        TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+        TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+        TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+        if (!TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric)) return false;
+        if (bitsPerSample != 8 || planar != PLANARCONFIG_CONTIG) return false;
+
+        bool gray = (photometric == PHOTOMETRIC_MINISBLACK || photometric == PHOTOMETRIC_MINISWHITE) && samples >= 1;
+        bool rgb = photometric == PHOTOMETRIC_RGB && samples >= 3;
+        if (!gray && !rgb) return false;
+        isGray = gray;
+        invert = photometric == PHOTOMETRIC_MINISWHITE;
+
+        cols = static_cast<int>(w);
+        rows = static_cast<int>(h);
+
+        if (TIFFIsTiled(tif)) {
+            TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tileWidth);
+            TIFFGetField(tif, TIFFTAG_TILELENGTH, &tileHeight);
+            if (tileWidth == 0 || tileHeight == 0) return false;
+            tile.resize(TIFFTileSize(tif));
+            band.resize(static_cast<size_t>(tileHeight) * cols * samples);
+        } else {
+            scanline.resize(TIFFScanlineSize(tif));
+        }
+        return true;
+    }
+
+    int width() const override { return cols; }
+    int height() const override { return rows; }
+
+    bool read(cv::Mat& strip) override {
+        for (int y = 0; y < strip.rows; ++y, ++nextRow) {
+            const uint8_t* source = nullptr;
+            if (tileHeight > 0) {
+                if (nextRow % tileHeight == 0 && !loadBand(nextRow)) return false;
+                source = band.data() + static_cast<size_t>(nextRow % tileHeight) * cols * samples;
+            } else {
+                if (TIFFReadScanline(tif, scanline.data(), nextRow, 0) < 0) return false;
+                source = scanline.data();
+            }
+            convertRow(source, strip.ptr<cv::Vec3b>(y));
+        }
+        return true;
+    }
+
+private:
+    bool loadBand(int firstRow) {
+        const size_t tileRowBytes = static_cast<size_t>(tileWidth) * samples;
+        for (int x = 0; x < cols; x += tileWidth) {
+            if (TIFFReadTile(tif, tile.data(), x, firstRow, 0, 0) < 0) return false;
+
+            const size_t copyBytes = static_cast<size_t>(std::min<int>(tileWidth, cols - x)) * samples;
+            const int bandRows = std::min<int>(tileHeight, rows - firstRow);
+            for (int r = 0; r < bandRows; ++r) {
+                std::copy_n(tile.data() + r * tileRowBytes, copyBytes,
+                            band.data() + (static_cast<size_t>(r) * cols + x) * samples);
+            }
+        }
+        return true;
+    }
+
+    void convertRow(const uint8_t* source, cv::Vec3b* dst) const {
+        for (int x = 0; x < cols; ++x, source += samples) {
+            if (isGray) {
+                uint8_t v = invert ? 255 - source[0] : source[0];
+                dst[x] = cv::Vec3b(v, v, v);
+            } else {
+                dst[x] = cv::Vec3b(source[2], source[1], source[0]);
+            }
+        }
+    }
+
+    TIFF* tif = nullptr;
+    uint16_t samples = 1;
+    bool isGray = false;
+    bool invert = false;
+    int cols = 0;
+    int rows = 0;
+    int nextRow = 0;
+    uint32_t tileWidth = 0;
+    uint32_t tileHeight = 0;
+    std::vector<uint8_t> scanline;
+    std::vector<uint8_t> tile;
+    std::vector<uint8_t> band;
+};
+
+class TiffRowSink : public RowSink {
+public:
+    explicit TiffRowSink(std::string path) : path(std::move(path)) {}
+
+    ~TiffRowSink() override {
+        if (tif) TIFFClose(tif);
+    }
+
+    bool begin(int width, int height) override {
+        // Classic TIFF offsets are 32-bit; switch to BigTIFF well before that
+        bool big = static_cast<uint64_t>(width) * height * 3 > (1ull << 31);
+        tif = TIFFOpen(path.c_str(), big ? "w8" : "w");
+        if (!tif) return false;
+
+        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, static_cast<uint32_t>(width));
+        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, static_cast<uint32_t>(height));
+        TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 3);
+        TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+        TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+        TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+        TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
+
+        rows = height;
+        row.resize(static_cast<size_t>(width) * 3);
+        return true;
+    }
+
+    bool write(const cv::Mat& strip) override {
+        for (int y = 0; y < strip.rows; ++y, ++nextRow) {
+            const cv::Vec3b* src = strip.ptr<cv::Vec3b>(y);
+            for (int x = 0; x < strip.cols; ++x) {
+                row[x * 3] = src[x][2];
+                row[x * 3 + 1] = src[x][1];
+                row[x * 3 + 2] = src[x][0];
+            }
+            if (TIFFWriteScanline(tif, row.data(), nextRow, 0) < 0) return false;
+        }
+        return true;
+    }
+
+    bool finish() override {
+        TIFFClose(tif);
+        tif = nullptr;
+        return nextRow == rows;
+    }
+
+private:
+    std::string path;
+    TIFF* tif = nullptr;
+    int rows = 0;
+    int nextRow = 0;
+    std::vector<uint8_t> row;
+};
+
+#endif // DITHER_WITH_TIFF
+
+} // namespace
+
+bool MatRowSource::read(cv::Mat& strip) {
+    if (nextRow + strip.rows > image.rows) return false;
+
+    cv::Mat rows = image.rowRange(nextRow, nextRow + strip.rows);
+    if (rows.type() == CV_8UC1) {
+        cv::cvtColor(rows, strip, cv::COLOR_GRAY2BGR);
+    } else if (rows.type() == CV_8UC4) {
+        cv::cvtColor(rows, strip, cv::COLOR_BGRA2BGR);
+    } else {
+        rows.copyTo(strip);
+    }
+    nextRow += strip.rows;
+    return true;
+}
+
+bool MatRowSink::begin(int width, int height) {
+    image.create(height, width, CV_8UC3);
+    nextRow = 0;
+    return true;
+}
+
+bool MatRowSink::write(const cv::Mat& strip) {
+    if (nextRow + strip.rows > image.rows) return false;
+    cv::Mat target = image.rowRange(nextRow, nextRow + strip.rows);
+    strip.copyTo(target);
+    nextRow += strip.rows;
+    return true;
+}
+
+std::unique_ptr<RowSource> openRowSource(const std::string& path) {
+#ifdef DITHER_WITH_PNG
+    if (isPng(path)) {
+        auto source = std::make_unique<PngRowSource>();
+        if (source->open(path)) return source;
+    }
+#endif
+#ifdef DITHER_WITH_TIFF
+    if (isTiff(path)) {
+        auto source = std::make_unique<TiffRowSource>();
+        if (source->open(path)) return source;
+    }
+#endif
+
+    // Unsupported layouts of PNG and TIFF end up here too
+    cv::Mat image = cv::imread(path, cv::IMREAD_COLOR);
+    if (image.empty()) return nullptr;
+    return std::make_unique<MatRowSource>(image);
+}
+
+std::unique_ptr<RowSink> createRowSink(const std::string& path) {
+#ifdef DITHER_WITH_PNG
+    if (isPng(path)) return std::make_unique<PngRowSink>(path);
+#endif
+#ifdef DITHER_WITH_TIFF
+    if (isTiff(path)) return std::make_unique<TiffRowSink>(path);
+#endif
+    return std::make_unique<ImageRowSink>(path);
+}
+
+bool isStreamableFormat(const std::string& path) {
+#ifdef DITHER_WITH_PNG
+    if (isPng(path)) return true;
+#endif
+#ifdef DITHER_WITH_TIFF
+    if (isTiff(path)) return true;
+#endif
+    (void)path;
+    return false;
+}
+
+namespace {
+
+uint32_t bigEndian(const unsigned char* p, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; ++i) value = (value << 8) | p[i];
+    return value;
+}
+
+uint32_t littleEndian(const unsigned char* p, int bytes) {
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i) value = (value << 8) | p[i];
+    return value;
+}
+
+// Orientation tag (1-8) of an APP1 Exif payload, or 1 if it has none
+int exifOrientation(const std::vector<unsigned char>& app1) {
+    const size_t base = 6;     // After "Exif\0\0"
+    if (app1.size() < base + 8 || std::memcmp(app1.data(), "Exif\0\0", 6) != 0) return 1;
+    const unsigned char* tiff = app1.data() + base;
+    const size_t size = app1.size() - base;
+    const bool little = tiff[0] == 'I' && tiff[1] == 'I';
+    if (!little && !(tiff[0] == 'M' && tiff[1] == 'M')) return 1;
+    auto read = [&](size_t offset, int bytes) {
+        return little ? littleEndian(tiff + offset, bytes) : bigEndian(tiff + offset, bytes);
+    };
+
+    const size_t ifd = read(4, 4);
+    if (ifd > size - 2) return 1;
+    const size_t entries = read(ifd, 2);
+    for (size_t i = 0; i < entries && ifd + 2 + (i + 1) * 12 <= size; ++i) {
+        const size_t entry = ifd + 2 + i * 12;
+        if (read(entry, 2) == 0x0112 && read(entry + 2, 2) == 3) {   // Orientation, SHORT
+            const int orientation = static_cast<int>(read(entry + 8, 2));
+            return orientation >= 1 && orientation <= 8 ? orientation : 1;
+        }
+    }
+    return 1;
+}
+
+// Walk the JPEG markers up to the first start-of-frame segment. An Exif
+// orientation of 5-8 swaps the size, as decoders (OpenCV included) rotate
+// the image on load.
+bool readJpegSize(std::FILE* file, cv::Size& size) {
+    unsigned char segment[7];
+    int orientation = 1;
+    while (true) {
+        int c = std::fgetc(file);
+        if (c == EOF) return false;
+        if (c != 0xFF) continue;
+        int marker;
+        do {
+            marker = std::fgetc(file);
+        } while (marker == 0xFF);
+        if (marker == EOF || marker == 0xD9 || marker == 0xDA) return false;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;  // No length
+
+        if (std::fread(segment, 1, 2, file) != 2) return false;
+        const long length = static_cast<long>(bigEndian(segment, 2));
+        if (length < 2) return false;
+        const bool frame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (marker == 0xE1 && orientation == 1) {
+            std::vector<unsigned char> app1(static_cast<size_t>(length - 2));
+            if (std::fread(app1.data(), 1, app1.size(), file) != app1.size()) return false;
+            orientation = exifOrientation(app1);
+            continue;
+        }
+        if (!frame) {
+            if (std::fseek(file, length - 2, SEEK_CUR) != 0) return false;
+            continue;
+        }
+        if (length < 7 || std::fread(segment, 1, 5, file) != 5) return false;
+        size = cv::Size(static_cast<int>(bigEndian(segment + 3, 2)), static_cast<int>(bigEndian(segment + 1, 2)));
+        if (orientation >= 5) std::swap(size.width, size.height);
+        return true;
+    }
+}
+
+} // namespace
+
+bool readImageSize(const std::string& path, cv::Size& size) {
+#ifdef DITHER_WITH_TIFF
+    if (isTiff(path)) {
+        if (TIFF* tif = TIFFOpen(path.c_str(), "r")) {
+            uint32_t w = 0, h = 0;
+            TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+            TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+            TIFFClose(tif);
+            size = cv::Size(static_cast<int>(w), static_cast<int>(h));
+            return w > 0 && h > 0 && w <= INT32_MAX && h <= INT32_MAX;
+        }
+        return false;
+    }
+#endif
+
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+    unsigned char header[26] = {};
+    const size_t got = std::fread(header, 1, sizeof(header), file);
+
+    bool ok = false;
+    if (got >= 24 && std::memcmp(header, "\x89PNG\r\n\x1a\n", 8) == 0 && std::memcmp(header + 12, "IHDR", 4) == 0) {
+        size = cv::Size(static_cast<int>(bigEndian(header + 16, 4)), static_cast<int>(bigEndian(header + 20, 4)));
+        ok = true;
+    } else if (got >= 10 && std::memcmp(header, "GIF8", 4) == 0) {
+        size = cv::Size(static_cast<int>(littleEndian(header + 6, 2)), static_cast<int>(littleEndian(header + 8, 2)));
+        ok = true;
+    } else if (got >= 26 && header[0] == 'B' && header[1] == 'M') {
+        // Bottom-up bitmaps store a negative height
+        const int32_t w = static_cast<int32_t>(littleEndian(header + 18, 4));
+        const int32_t h = static_cast<int32_t>(littleEndian(header + 22, 4));
+        size = cv::Size(w, h == INT32_MIN ? 0 : std::abs(h));
+        ok = true;
+    } else if (got >= 2 && header[0] == 0xFF && header[1] == 0xD8) {
+        ok = std::fseek(file, 2, SEEK_SET) == 0 && readJpegSize(file, size);
+    }
+    std::fclose(file);
+    return ok && size.width > 0 && size.height > 0;
+}
+
+bool ditherStream(RowSource& source, RowSink& sink, const Parameters& params, int stripRows,
+                  const std::function<void(int)>& progress) {
+    const int width = source.width();
+    const int height = source.height();
+    if (width <= 0 || height <= 0 || !sink.begin(width, height)) return false;
+    stripRows = std::max(1, stripRows);
+
+    if (!StripDitherer::supports(params.algorithm)) {
+        cv::Mat image(height, width, CV_8UC3);
+        if (!source.read(image)) return false;
+        cv::Mat result = ditherImage(image, params);
+
+        for (int y = 0; y < height; y += stripRows) {
+            if (!sink.write(result.rowRange(y, std::min(height, y + stripRows)))) return false;
+            if (progress) progress(std::min(height, y + stripRows));
+        }
+        return sink.finish();
+    }
+
+    StripDitherer ditherer(width, height, params);
+    cv::Mat strip, output;
+    for (int y = 0; y < height; y += stripRows) {
+        int rows = std::min(stripRows, height - y);
+        strip.create(rows, width, CV_8UC3);
+        if (!source.read(strip)) return false;
+
+        ditherer.process(strip, output);
+        if (!sink.write(output)) return false;
+        if (progress) progress(y + rows);
+    }
+    return sink.finish();
+}
+
+} // namespace Dithering
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "dithering.h"
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace Dithering {
+
+// Supplies an image top to bottom, a strip of rows at a time
+class RowSource {
+public:
+    virtual ~RowSource() = default;
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+
+    // Fill strip with the next rows; strip is CV_8UC3 with width() columns
+    // and as many rows as should be read. Returns false on a read error.
+    virtual bool read(cv::Mat& strip) = 0;
+};
+
+// Receives an image top to bottom, a strip of rows at a time
+class RowSink {
+public:
+    virtual ~RowSink() = default;
+
+    // Called once before the first strip
+    virtual bool begin(int width, int height) = 0;
+    virtual bool write(const cv::Mat& strip) = 0;
+    // Called once after the last strip; flushes and closes the output
+    virtual bool finish() = 0;
+};
+
+// In-memory source and sink, mostly for tests and callers that already
+// hold the image
+class MatRowSource : public RowSource {
+public:
+    explicit MatRowSource(cv::Mat image) : image(std::move(image)) {}
+
+    int width() const override { return image.cols; }
+    int height() const override { return image.rows; }
+    bool read(cv::Mat& strip) override;
+
+private:
+    cv::Mat image;
+    int nextRow = 0;
+};
+
+class MatRowSink : public RowSink {
+public:
+    bool begin(int width, int height) override;
+    bool write(const cv::Mat& strip) override;
+    bool finish() override { return nextRow == image.rows; }
+
+    const cv::Mat& result() const { return image; }
+
+private:
+    cv::Mat image;
+    int nextRow = 0;
+};
+
+// Open a file for strip reading. PNG (non-interlaced) and TIFF (8-bit,
+// stripped or tiled) are decoded incrementally when the library was built
+// with libpng/libtiff; anything else is decoded whole with cv::imread.
+// Returns nullptr if the file cannot be read.
+std::unique_ptr<RowSource> openRowSource(const std::string& path);
+
+// Create a strip writer for a file, chosen by extension like openRowSource.
+// Formats without a strip writer are collected in memory and written with
+// cv::imwrite on finish().
+std::unique_ptr<RowSink> createRowSink(const std::string& path);
+
+// Whether path would be read or written strip by strip
+bool isStreamableFormat(const std::string& path);
+
+// Image dimensions from the file header alone (PNG, JPEG, GIF, BMP, and
+// TIFF when built with libtiff), without decoding any pixels. JPEG sizes
+// follow the Exif orientation, matching what cv::imread returns. Returns
+// false if the format is not recognised or the header is damaged.
+bool readImageSize(const std::string& path, cv::Size& size);
+
+// Dither source into sink stripRows rows at a time, in memory bounded by a
+// few strips plus the kernel's error rows (see StripDitherer). Algorithms
+// StripDitherer cannot stream are run on the whole image instead.
+// progress, if set, is called with the rows finished so far.
+bool ditherStream(RowSource& source, RowSink& sink, const Parameters& params, int stripRows = 64,
+                  const std::function<void(int)>& progress = nullptr);
+
+} // namespace Dithering
@@ -0,0 +1,204 @@
+#include "sweep.h"
+#include "gpu.h"
+#include "profile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+
+namespace Dithering {
+
+namespace {
+
+// Whether two parameter sets preprocess an image identically
+bool sameTone(const Parameters& a, const Parameters& b) {
+    return a.gamma == b.gamma && a.contrast == b.contrast &&
+           a.brightness == b.brightness && a.saturation == b.saturation;
+}
+
+std::string formatNumber(float value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%g", value);
+    return text;
+}
+
+} // namespace
+
+std::vector<cv::Mat> ditherVariants(const cv::Mat& image, const std::vector<Parameters>& variants, TaskPool& pool) {
+    DITHER_PROFILE_PIXELS("ditherVariants", image.total() * variants.size());
+    std::vector<cv::Mat> results(variants.size());
+    if (variants.empty() || image.empty()) return results;
+
+    // Kernels work on 8-bit BGR; convert once rather than per variant
+    cv::Mat source = image;
+    if (image.type() == CV_8UC1) {
+        cv::cvtColor(image, source, cv::COLOR_GRAY2BGR);
+    } else if (image.type() == CV_8UC4) {
+        cv::cvtColor(image, source, cv::COLOR_BGRA2BGR);
+    }
+
+    // One preprocessed image per distinct tone setting; neutral settings
+    // dither the source itself
+    std::vector<int> toneOf(variants.size(), -1);
+    std::vector<const Parameters*> tones;
+    for (size_t i = 0; i < variants.size(); ++i) {
+        if (!needsPreprocessing(variants[i])) continue;
+        auto same = std::find_if(tones.begin(), tones.end(),
+                                 [&](const Parameters* tone) { return sameTone(*tone, variants[i]); });
+        toneOf[i] = static_cast<int>(same - tones.begin());
+        if (same == tones.end()) tones.push_back(&variants[i]);
+    }
+
+    std::vector<cv::Mat> preprocessed(tones.size());
+    {
+        TaskGroup group(pool);
+        for (size_t t = 0; t < tones.size(); ++t) {
+            group.run([&, t] {
+                cv::Mat lut;
+                preprocessInto(source, preprocessed[t], *tones[t], lut);
+            });
+        }
+        group.wait();
+    }
+
+    // Build each palette's matcher before the variants race for it, and
+    // hold it so the cache cannot drop it midway
+    std::vector<std::shared_ptr<const PaletteMatcher>> matchers;
+    matchers.reserve(variants.size());
+    for (const Parameters& variant : variants) matchers.push_back(getPaletteMatcher(variant));
+
+    // Variants split the pool's threads between them
+    const int share = std::max(1, pool.threadCount() / static_cast<int>(variants.size()));
+    WorkspaceCache workspaces;
+    TaskGroup group(pool);
+    for (size_t i = 0; i < variants.size(); ++i) {
+        group.run([&, i] {
+            DITHER_PROFILE_SCOPE("variant");
+            Parameters local = variants[i];
+            local.threads = std::max(1, std::min(resolveThreadCount(local), share));
+            local.gamma = 1.0f;
+            local.contrast = 1.0f;
+            local.brightness = 0.0f;
+            local.saturation = 1.0f;
+
+            const cv::Mat& input = toneOf[i] < 0 ? source : preprocessed[toneOf[i]];
+            WorkspaceCache::Lease workspace = workspaces.acquire();
+            ditherImage(input, results[i], local, *workspace);
+        });
+    }
+    group.wait();
+    return results;
+}
+
+std::vector<Parameters> sweepVariants(const Parameters& base, const std::vector<SweepAxis>& axes) {
+    std::vector<Parameters> variants{base};
+    for (const SweepAxis& axis : axes) {
+        if (axis.count <= 0 || !axis.apply) continue;
+        std::vector<Parameters> next;
+        next.reserve(variants.size() * axis.count);
+        for (const Parameters& variant : variants) {
+            for (int i = 0; i < axis.count; ++i) {
+                next.push_back(variant);
+                axis.apply(i, next.back());
+            }
+        }
+        variants = std::move(next);
+    }
+    return variants;
+}
+
+std::string describeVariant(const Parameters& variant, const Parameters& base) {
+    std::vector<std::string> parts;
+    if (variant.algorithm != base.algorithm) parts.push_back(getAlgorithmName(variant.algorithm));
+    if (variant.paletteMode != base.paletteMode) parts.push_back(getPaletteModeName(variant.paletteMode));
+    if (variant.colorMetric != base.colorMetric) parts.push_back(getColorMetricName(variant.colorMetric));
+    if (variant.strength != base.strength) parts.push_back("strength " + formatNumber(variant.strength));
+    if (variant.gamma != base.gamma) parts.push_back("gamma " + formatNumber(variant.gamma));
+    if (variant.contrast != base.contrast) parts.push_back("contrast " + formatNumber(variant.contrast));
+    if (variant.brightness != base.brightness) parts.push_back("brightness " + formatNumber(variant.brightness));
+    if (variant.saturation != base.saturation) parts.push_back("saturation " + formatNumber(variant.saturation));
+    if ((variant.serpentine > 0.5f) != (base.serpentine > 0.5f)) {
+        parts.push_back(variant.serpentine > 0.5f ? "serpentine" : "no serpentine");
+    }
+    if (variant.precision != base.precision) {
+        parts.push_back(variant.precision == DiffusionPrecision::FIXED ? "fixed point" : "float");
+    }
+    if (variant.seed != base.seed) parts.push_back("seed " + std::to_string(variant.seed));
+    if (variant.frame != base.frame) parts.push_back("frame " + std::to_string(variant.frame));
+    if (variant.threads != base.threads) {
+        parts.push_back(variant.threads > 0 ? "threads " + std::to_string(variant.threads) : "all threads");
+    }
+    if (variant.backend != base.backend) parts.push_back(getBackendName(variant.backend));
+
+    if (parts.empty()) {
+        parts.push_back(getAlgorithmName(variant.algorithm));
+        parts.push_back(getPaletteModeName(variant.paletteMode));
+    }
+
+    std::string caption = parts[0];
+    for (size_t i = 1; i < parts.size(); ++i) caption += ", " + parts[i];
+    return caption;
+}
+
+cv::Mat contactSheet(const std::vector<cv::Mat>& images, const std::vector<std::string>& captions,
+                     int columns, int cellWidth) {
+    if (images.empty()) return cv::Mat();
+    const int count = static_cast<int>(images.size());
+    if (columns <= 0) columns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+    columns = std::min(columns, count);
+    const int rows = (count + columns - 1) / columns;
+
+    const int gap = 8;
+    const int font = cv::FONT_HERSHEY_SIMPLEX;
+    const double fontScale = 0.5;
+    int baseline = 0;
+    const int captionHeight = cv::getTextSize("Ag", font, fontScale, 1, &baseline).height + baseline + gap;
+
+    // Cells scaled to the requested width, keeping their aspect
+    std::vector<cv::Mat> cells(count);
+    for (int i = 0; i < count; ++i) {
+        const cv::Mat& image = images[i];
+        if (cellWidth > 0 && !image.empty() && image.cols != cellWidth) {
+            int height = std::max(1, static_cast<int>(std::lround(image.rows * double(cellWidth) / image.cols)));
+            cv::resize(image, cells[i], cv::Size(cellWidth, height), 0, 0, cv::INTER_NEAREST);
+        } else {
+            cells[i] = image;
+        }
+        if (cells[i].type() == CV_8UC1) {
+            cv::cvtColor(cells[i], cells[i], cv::COLOR_GRAY2BGR);
+        } else if (cells[i].type() == CV_8UC4) {
+            cv::cvtColor(cells[i], cells[i], cv::COLOR_BGRA2BGR);
+        }
+    }
+
+    // Columns as wide as their widest cell, rows as tall as their tallest
+    std::vector<int> columnWidth(columns, 0), rowHeight(rows, 0);
+    for (int i = 0; i < count; ++i) {
+        columnWidth[i % columns] = std::max(columnWidth[i % columns], cells[i].cols);
+        rowHeight[i / columns] = std::max(rowHeight[i / columns], cells[i].rows + captionHeight);
+    }
+
+    int width = gap, height = gap;
+    for (int w : columnWidth) width += w + gap;
+    for (int h : rowHeight) height += h + gap;
+    cv::Mat sheet(height, width, CV_8UC3, cv::Scalar(255, 255, 255));
+
+    int y = gap;
+    for (int row = 0; row < rows; ++row) {
+        int x = gap;
+        for (int column = 0; column < columns; ++column) {
+            const int i = row * columns + column;
+            if (i >= count) break;
+            if (!cells[i].empty()) cells[i].copyTo(sheet(cv::Rect(x, y, cells[i].cols, cells[i].rows)));
+            if (i < static_cast<int>(captions.size()) && !captions[i].empty()) {
+                cv::putText(sheet, captions[i], cv::Point(x, y + cells[i].rows + captionHeight - baseline - gap / 2),
+                            font, fontScale, cv::Scalar(0, 0, 0), 1, cv::LINE_AA);
+            }
+            x += columnWidth[column] + gap;
+        }
+        y += rowHeight[row] + gap;
+    }
+    return sheet;
+}
+
+} // namespace Dithering
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "batch.h"
+#include "dithering.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Dithering {
+
+// Many parameter variants of one image, for comparing settings side by
+// side. The input is converted to BGR once; variants with the same tone
+// settings (gamma, contrast, brightness, saturation) share one
+// preprocessing pass, and palette matchers are built once per palette.
+// Variants then run concurrently on the pool, each with a workspace of its
+// own and a share of the pool's threads for the kernels that take them.
+// Each result equals ditherImage(image, variant).
+std::vector<cv::Mat> ditherVariants(const cv::Mat& image, const std::vector<Parameters>& variants,
+                                    TaskPool& pool = TaskPool::shared());
+
+// Every combination of the values given per axis, applied to base in
+// order, so the last axis varies fastest. Axes are functions that set one
+// value (by index) on a copy of the parameters.
+struct SweepAxis {
+    int count = 0;
+    std::function<void(int index, Parameters& params)> apply;
+};
+std::vector<Parameters> sweepVariants(const Parameters& base, const std::vector<SweepAxis>& axes);
+
+// Short caption naming what a variant changes relative to base: any of
+// the settings a sweep axis can name (algorithm, palette, color matching,
+// strength, tone, serpentine, precision, seed, frame, threads, backend).
+// A variant equal to base is captioned with its algorithm and palette.
+std::string describeVariant(const Parameters& variant, const Parameters& base);
+
+// Images laid out in a grid, left to right and top to bottom, each in a
+// cell with its caption underneath. columns <= 0 picks a near-square grid.
+// cellWidth > 0 scales each image to that width (nearest neighbour, so
+// palette colors stay exact); 0 keeps every image at its own size.
+cv::Mat contactSheet(const std::vector<cv::Mat>& images, const std::vector<std::string>& captions,
+                     int columns = 0, int cellWidth = 0);
+
+} // namespace Dithering
@@ -0,0 +1,545 @@
+#include "video.h"
+#include "animation.h"
+#include "batch.h"
+#include "indexed.h"
+#include "profile.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+
+namespace Dithering {
+
+namespace {
+
+struct IndexedFrame {
+    int index = 0;
+    cv::Mat frame;
+    std::vector<uint8_t> dirty;     // Temporal mode: one flag per tile
+    int dirtyTiles = 0;
+};
+
+// Tile (tx, ty) of a frame; the last row and column may be partial
+cv::Rect tileRect(int tileSize, int tx, int ty, cv::Size size) {
+    return cv::Rect(tx * tileSize, ty * tileSize, std::min(tileSize, size.width - tx * tileSize),
+                    std::min(tileSize, size.height - ty * tileSize));
+}
+
+// Which tiles of a frame changed since they were last dithered. The
+// reference holds, tile by tile, the source each tile's output came from,
+// so slow drift below the tolerance still adds up to a change.
+class TileTracker {
+public:
+    TileTracker(int tileSize, int tolerance) : tileSize(std::max(1, tileSize)), tolerance(std::max(0, tolerance)) {}
+
+    // Flag the tiles to dither again (all of them for the first frame or a
+    // new size or type) and return how many there are
+    int update(const cv::Mat& frame, std::vector<uint8_t>& dirty) {
+        DITHER_PROFILE_PIXELS("tile tracking", frame.total());
+        const int columns = (frame.cols + tileSize - 1) / tileSize;
+        const int rows = (frame.rows + tileSize - 1) / tileSize;
+        dirty.resize(static_cast<size_t>(columns) * rows);
+
+        if (reference.size() != frame.size() || reference.type() != frame.type()) {
+            frame.copyTo(reference);
+            std::fill(dirty.begin(), dirty.end(), 1);
+            return static_cast<int>(dirty.size());
+        }
+
+        std::atomic<int> count{0};
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range) {
+            for (int ty = range.start; ty < range.end; ++ty) {
+                for (int tx = 0; tx < columns; ++tx) {
+                    cv::Rect tile = tileRect(tileSize, tx, ty, frame.size());
+                    bool changed = differs(frame, tile);
+                    dirty[ty * columns + tx] = changed;
+                    if (!changed) continue;
+                    cv::Mat target = reference(tile);
+                    frame(tile).copyTo(target);
+                    ++count;
+                }
+            }
+        });
+        return count.load();
+    }
+
+    void reset() { reference.release(); }
+
+    int size() const { return tileSize; }
+
+private:
+    bool differs(const cv::Mat& frame, const cv::Rect& tile) const {
+        const size_t offset = tile.x * frame.elemSize();
+        const size_t bytes = tile.width * frame.elemSize();
+        for (int y = tile.y; y < tile.y + tile.height; ++y) {
+            const uint8_t* a = frame.ptr<uint8_t>(y) + offset;
+            const uint8_t* b = reference.ptr<uint8_t>(y) + offset;
+            if (tolerance == 0) {
+                if (std::memcmp(a, b, bytes) != 0) return true;
+                continue;
+            }
+            for (size_t i = 0; i < bytes; ++i) {
+                if (std::abs(a[i] - b[i]) > tolerance) return true;
+            }
+        }
+        return false;
+    }
+
+    int tileSize;
+    int tolerance;
+    cv::Mat reference;
+};
+
+// Call f for each horizontal run of tiles whose flag equals wanted
+template <typename F>
+void forEachTileRun(cv::Size size, int tileSize, const std::vector<uint8_t>& dirty, bool wanted, F&& f) {
+    const int columns = (size.width + tileSize - 1) / tileSize;
+    const int rows = (size.height + tileSize - 1) / tileSize;
+    for (int ty = 0; ty < rows; ++ty) {
+        for (int tx = 0; tx < columns;) {
+            if (static_cast<bool>(dirty[ty * columns + tx]) != wanted) {
+                ++tx;
+                continue;
+            }
+            int end = tx + 1;
+            while (end < columns && static_cast<bool>(dirty[ty * columns + end]) == wanted) ++end;
+            cv::Rect first = tileRect(tileSize, tx, ty, size);
+            cv::Rect last = tileRect(tileSize, end - 1, ty, size);
+            f(cv::Rect(first.x, first.y, last.x + last.width - first.x, first.height));
+            tx = end;
+        }
+    }
+}
+
+// Dither the dirty tiles of frame into output. Pointwise algorithms redo
+// only those tiles when output already holds a frame of the right shape;
+// anything else dithers the whole frame if any tile changed.
+void ditherDirtyTiles(const cv::Mat& frame, cv::Mat& output, const std::vector<uint8_t>& dirty, int dirtyTiles,
+                      int tileSize, const Parameters& params, Workspace& workspace) {
+    if (dirtyTiles == 0) return;
+    bool partial = dirtyTiles < static_cast<int>(dirty.size()) && isPointwise(params.algorithm) &&
+                   output.type() == CV_8UC3 && output.size() == frame.size();
+    if (!partial) {
+        ditherImage(frame, output, params, workspace);
+        return;
+    }
+    forEachTileRun(frame.size(), tileSize, dirty, true, [&](const cv::Rect& run) {
+        ditherRegion(frame, output, run, params, workspace);
+    });
+}
+
+// Copy the clean tiles of the previous output into output
+void restoreCleanTiles(cv::Mat& output, const cv::Mat& previous, const std::vector<uint8_t>& dirty, int tileSize) {
+    forEachTileRun(output.size(), tileSize, dirty, false, [&](const cv::Rect& run) {
+        cv::Mat target = output(run);
+        previous(run).copyTo(target);
+    });
+}
+
+// Tiles of pointwise algorithms are dithered on the CPU; keep whole frames
+// there too so both match
+Parameters temporalParameters(const Parameters& params) {
+    Parameters adjusted = params;
+    if (isPointwise(params.algorithm)) adjusted.backend = Backend::CPU;
+    return adjusted;
+}
+
+// Collects out-of-order worker results and releases them in sequence.
+// Workers block while they are more than `window` frames ahead of the writer,
+// which bounds the number of finished frames held in memory.
+class ReorderBuffer {
+public:
+    explicit ReorderBuffer(int window) : window(window) {}
+
+    bool put(IndexedFrame item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return aborted || item.index < next + window; });
+        if (aborted) return false;
+        int index = item.index;
+        frames.emplace(index, std::move(item));
+        changed.notify_all();
+        return true;
+    }
+
+    // Returns false when every frame has been taken or the job was aborted
+    bool take(IndexedFrame& frame) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return aborted || finished || frames.count(next) > 0; });
+        auto it = frames.find(next);
+        if (aborted || it == frames.end()) return false;
+        frame = std::move(it->second);
+        frames.erase(it);
+        ++next;
+        changed.notify_all();
+        return true;
+    }
+
+    // No more frames will be put
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        changed.notify_all();
+    }
+
+    void abort() {
+        std::lock_guard<std::mutex> lock(mutex);
+        aborted = true;
+        changed.notify_all();
+    }
+
+private:
+    int window;
+    int next = 0;
+    bool finished = false;
+    bool aborted = false;
+    std::map<int, IndexedFrame> frames;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+// Frame buffers (and tile flags) handed back by the writer for the decoder
+// to fill again. Frames in flight are bounded by the reorder window, so once
+// that many exist no more are allocated.
+class FramePool {
+public:
+    explicit FramePool(size_t capacity) { frames.reserve(capacity); }
+
+    IndexedFrame take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (frames.empty()) return IndexedFrame();
+        IndexedFrame frame = std::move(frames.back());
+        frames.pop_back();
+        return frame;
+    }
+
+    void give(IndexedFrame frame) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (frames.size() < frames.capacity()) frames.push_back(std::move(frame));
+    }
+
+private:
+    std::vector<IndexedFrame> frames;
+    std::mutex mutex;
+};
+
+} // namespace
+
+// Frames are dithered as tasks on the shared TaskPool. The decoder only
+// reads a frame once fewer than `workers` are being dithered and fewer than
+// `window` are waiting to be written, so the reorder buffer never makes a
+// task wait and a pool thread is never held by the job.
+struct VideoJob::Pipeline {
+    Pipeline(int window, int workers)
+        : encoded(window), spare(static_cast<size_t>(window) + 1), window(window), workers(workers) {}
+
+    ReorderBuffer encoded;
+    FramePool spare;
+    WorkspaceCache workspaces;
+    std::atomic<int> liveThreads{0};
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    const int window;
+    const int workers;
+    int unwritten = 0;
+    int dithering = 0;
+    bool aborted = false;
+
+    // Wait until another frame may be decoded; false once aborted
+    bool admit() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return aborted || (unwritten < window && dithering < workers); });
+        if (aborted) return false;
+        ++unwritten;
+        ++dithering;
+        return true;
+    }
+
+    void dithered() { update(0, -1); }
+    void written() { update(-1, 0); }
+
+    // A frame admitted but never decoded
+    void unadmit() { update(-1, -1); }
+
+    void update(int writes, int dithers) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            unwritten += writes;
+            dithering += dithers;
+        }
+        changed.notify_all();
+    }
+
+    void abort() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            aborted = true;
+        }
+        changed.notify_all();
+        encoded.abort();
+    }
+};
+
+struct TemporalDitherer::State {
+    State(const Parameters& params, const TemporalOptions& options)
+        : params(temporalParameters(params)), tracker(options.tileSize, options.tolerance),
+          firstFrame(params.frame), animateNoise(options.animateNoise) {}
+
+    Parameters params;
+    TileTracker tracker;
+    Workspace workspace;
+    std::vector<uint8_t> dirty;
+    cv::Mat result;     // Output of the previous frame
+    cv::Mat fresh;
+    unsigned int firstFrame;
+    unsigned int frames = 0;    // Frames processed, for animated noise
+    bool animateNoise;
+};
+
+TemporalDitherer::TemporalDitherer(const Parameters& params, const TemporalOptions& options)
+    : state(std::make_unique<State>(params, options)) {}
+
+TemporalDitherer::~TemporalDitherer() = default;
+
+void TemporalDitherer::process(const cv::Mat& frame, cv::Mat& output) {
+    State& s = *state;
+    if (s.animateNoise) s.params.frame = s.firstFrame + s.frames;
+    ++s.frames;
+    dirty = s.tracker.update(frame, s.dirty);
+    tiles = static_cast<int>(s.dirty.size());
+    const int tileSize = s.tracker.size();
+
+    if (dirty == tiles) {
+        ditherImage(frame, s.result, s.params, s.workspace);
+    } else if (isPointwise(s.params.algorithm)) {
+        ditherDirtyTiles(frame, s.result, s.dirty, dirty, tileSize, s.params, s.workspace);
+    } else if (dirty > 0) {
+        ditherImage(frame, s.fresh, s.params, s.workspace);
+        restoreCleanTiles(s.fresh, s.result, s.dirty, tileSize);
+        std::swap(s.fresh, s.result);
+    }
+    s.result.copyTo(output);
+}
+
+void TemporalDitherer::reset() {
+    state->tracker.reset();
+}
+
+VideoJob::~VideoJob() {
+    cancel();
+    wait();
+}
+
+bool VideoJob::start(const std::string& inputPath, const std::string& outputPath,
+                     const Parameters& params, int workers, const TemporalOptions& temporal) {
+    auto capture = std::make_shared<cv::VideoCapture>(inputPath);
+    if (!capture->isOpened()) return false;
+
+    int frameWidth = static_cast<int>(capture->get(cv::CAP_PROP_FRAME_WIDTH));
+    int frameHeight = static_cast<int>(capture->get(cv::CAP_PROP_FRAME_HEIGHT));
+    int frameCount = static_cast<int>(capture->get(cv::CAP_PROP_FRAME_COUNT));
+    double fps = capture->get(cv::CAP_PROP_FPS);
+    if (fps <= 0.0) fps = 30.0;
+
+    FrameSource source = [capture](cv::Mat& frame) { return capture->read(frame); };
+    FrameSink sink;
+
+    if (AnimationWriter::supports(outputPath)) {
+        // Animated GIF/APNG: index each frame by the palette and let the
+        // writer crop it to what changed. The writer finishes the file when
+        // the pipeline releases the sink.
+        auto matcher = getPaletteMatcher(params);
+        auto animation = std::make_shared<AnimationWriter>();
+        if (!animation->open(outputPath, frameWidth, frameHeight, matcher->palette(), fps, workers)) {
+            return false;
+        }
+        auto indexed = std::make_shared<IndexedImage>();
+        sink = [animation, matcher, indexed](const cv::Mat& frame) {
+            return indexImage(frame, *matcher, *indexed) && animation->addFrame(indexed->indices);
+        };
+    } else {
+        auto writer = std::make_shared<cv::VideoWriter>(
+            outputPath, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps, cv::Size(frameWidth, frameHeight));
+        if (!writer->isOpened()) return false;
+
+        sink = [writer](const cv::Mat& frame) {
+            writer->write(frame);
+            return true;
+        };
+    }
+
+    return start(std::move(source), std::move(sink), params, std::max(frameCount, 0), workers, temporal);
+}
+
+bool VideoJob::start(FrameSource source, FrameSink sink, const Parameters& params,
+                     int totalFrames, int workers, const TemporalOptions& temporal) {
+    if (running.load()) return false;
+    wait();
+
+    if (workers <= 0) workers = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    cancelled = false;
+    done = 0;
+    total = totalFrames;
+    tilesDirty = 0;
+    tilesSeen = 0;
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        errorMessage.clear();
+    }
+
+    auto stages = std::make_shared<Pipeline>(workers * 4, workers);
+    stages->liveThreads = 2;
+    pipeline = stages;
+    running = true;
+
+    // The last thread out marks the job as finished
+    auto exitThread = [this, stages] {
+        if (--stages->liveThreads == 0) running = false;
+    };
+
+    Parameters frameParams = temporal.enabled ? temporalParameters(params) : params;
+    const int tileSize = std::max(1, temporal.tileSize);
+
+    threads.emplace_back([this, stages, source, frameParams, temporal, tileSize, exitThread]() mutable {
+        setProfileThreadName("video decoder");
+        TaskGroup frames(TaskPool::shared());
+        try {
+            // Frames are read in order, so this is where changes are found
+            TileTracker tracker(tileSize, temporal.tolerance);
+            for (int index = 0; !cancelled.load() && stages->admit(); ++index) {
+                IndexedFrame item = stages->spare.take();
+                bool read;
+                {
+                    DITHER_PROFILE_SCOPE("video decode");
+                    read = source(item.frame);
+                }
+                if (!read || item.frame.empty()) {
+                    stages->unadmit();
+                    break;
+                }
+                item.index = index;
+                if (temporal.enabled) {
+                    item.dirtyTiles = tracker.update(item.frame, item.dirty);
+                    tilesDirty += item.dirtyTiles;
+                    tilesSeen += static_cast<long long>(item.dirty.size());
+                }
+
+                // Dithered in place with scratch lent by the pipeline, so
+                // steady-state transcoding allocates nothing per frame
+                frames.run([this, stages, frameParams, temporal, tileSize, item = std::move(item)]() mutable {
+                    try {
+                        if (!cancelled.load()) {
+                            DITHER_PROFILE_PIXELS("video dither", item.frame.total());
+                            WorkspaceCache::Lease workspace = stages->workspaces.acquire();
+                            if (temporal.animateNoise) frameParams.frame += static_cast<unsigned int>(item.index);
+                            if (temporal.enabled) {
+                                ditherDirtyTiles(item.frame, item.frame, item.dirty, item.dirtyTiles, tileSize,
+                                                 frameParams, *workspace);
+                            } else {
+                                ditherImage(item.frame, item.frame, frameParams, *workspace);
+                            }
+                        }
+                    } catch (const std::exception& e) {
+                        fail(std::string("Dithering failed: ") + e.what());
+                        stages->abort();
+                    }
+                    stages->dithered();
+                    stages->encoded.put(std::move(item));
+                });
+            }
+        } catch (const std::exception& e) {
+            fail(std::string("Decoding failed: ") + e.what());
+            stages->abort();
+        }
+        frames.wait();
+        stages->encoded.finish();
+        source = nullptr;
+        exitThread();
+    });
+
+    threads.emplace_back([this, stages, sink, temporal, tileSize, exitThread]() mutable {
+        setProfileThreadName("video writer");
+        try {
+            // Clean tiles were left undithered; they come from the output
+            // before, which only this thread sees in order
+            cv::Mat previous;
+            IndexedFrame item;
+            while (stages->encoded.take(item)) {
+                if (temporal.enabled) {
+                    if (item.dirtyTiles < static_cast<int>(item.dirty.size())) {
+                        restoreCleanTiles(item.frame, previous, item.dirty, tileSize);
+                    }
+                    item.frame.copyTo(previous);
+                }
+                bool written;
+                {
+                    DITHER_PROFILE_SCOPE("video encode");
+                    written = sink(item.frame);
+                }
+                if (!written) {
+                    fail("Output rejected frame " + std::to_string(done.load()));
+                    break;
+                }
+                ++done;
+                stages->spare.give(std::move(item));
+                stages->written();
+            }
+        } catch (const std::exception& e) {
+            fail(std::string("Encoding failed: ") + e.what());
+        }
+        // Unblock the decoder and frame tasks if the writer stopped early, and
+        // release the sink so file outputs are finalised before we report done
+        stages->abort();
+        sink = nullptr;
+        exitThread();
+    });
+
+    return true;
+}
+
+void VideoJob::cancel() {
+    cancelled = true;
+    if (pipeline) pipeline->abort();
+}
+
+void VideoJob::wait() {
+    for (auto& thread : threads) {
+        if (thread.joinable()) thread.join();
+    }
+    threads.clear();
+    pipeline.reset();
+}
+
+bool VideoJob::failed() const {
+    std::lock_guard<std::mutex> lock(errorMutex);
+    return !errorMessage.empty();
+}
+
+std::string VideoJob::error() const {
+    std::lock_guard<std::mutex> lock(errorMutex);
+    return errorMessage;
+}
+
+float VideoJob::progress() const {
+    int frames = total.load();
+    if (frames <= 0) return 0.0f;
+    return std::min(1.0f, static_cast<float>(done.load()) / frames);
+}
+
+float VideoJob::dirtyRatio() const {
+    long long seen = tilesSeen.load();
+    if (seen <= 0) return 1.0f;
+    return static_cast<float>(tilesDirty.load()) / seen;
+}
+
+void VideoJob::fail(const std::string& message) {
+    std::lock_guard<std::mutex> lock(errorMutex);
+    if (errorMessage.empty()) errorMessage = message;
+}
+
+} // namespace Dithering
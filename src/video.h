@@ -0,0 +1,130 @@
+#pragma once
+
+#include "dithering.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Dithering {
+
+// Produces the next frame; returns false at end of stream. frame may hold
+// the pixels of an earlier frame, so sources that fill it in place (such as
+// cv::VideoCapture::read) reuse its buffer.
+using FrameSource = std::function<bool(cv::Mat& frame)>;
+
+// Consumes dithered frames in presentation order; returns false to abort.
+// The frame's buffer is recycled once the sink returns; clone it to keep it.
+using FrameSink = std::function<bool(const cv::Mat& frame)>;
+
+// Temporal coherence for video: frames are split into square tiles, and a
+// tile is only dithered again once its source differs by more than
+// tolerance (per channel) from the source it was last dithered from.
+// Everything else keeps its previous output, so static regions stop
+// shimmering. Pointwise algorithms (see isPointwise) re-dither just the
+// changed tiles and match a full dither exactly when tolerance is 0; other
+// algorithms dither the whole frame whenever any tile changed.
+//
+// animateNoise works with or without coherence: each frame's noise uses
+// Parameters::frame plus the frame's index, so white noise, random and
+// variable diffusion change from frame to frame, reproducibly per seed.
+// Otherwise every frame uses the same noise.
+struct TemporalOptions {
+    bool enabled = false;
+    int tileSize = 16;
+    int tolerance = 0;      // Raise for compressed sources, whose static areas are noisy
+    bool animateNoise = false;
+};
+
+// Frame-by-frame temporal dithering for callers with their own loop. Feed
+// frames in order; reset() before an unrelated frame (cuts, seeks or a
+// parameter change).
+class TemporalDitherer {
+public:
+    TemporalDitherer(const Parameters& params, const TemporalOptions& options);
+    ~TemporalDitherer();
+
+    TemporalDitherer(const TemporalDitherer&) = delete;
+    TemporalDitherer& operator=(const TemporalDitherer&) = delete;
+
+    // Dither frame into output (CV_8UC3); output may be frame itself when
+    // frame is CV_8UC3
+    void process(const cv::Mat& frame, cv::Mat& output);
+    void reset();
+
+    // Tiles dithered for the last frame, out of the total
+    int dirtyTiles() const { return dirty; }
+    int totalTiles() const { return tiles; }
+
+    struct State;
+
+private:
+    std::unique_ptr<State> state;
+    int dirty = 0;
+    int tiles = 0;
+};
+
+// Asynchronous video transcoding pipeline.
+// A decoder thread feeds a bounded queue, N workers dither frames in
+// parallel, and a writer thread hands results to the sink strictly in
+// order. Everything runs off the calling thread; progress and cancellation
+// can be polled or requested from any thread without blocking. With
+// temporal options enabled, the decoder tracks which tiles changed, workers
+// dither only those and the writer fills in the rest from the frame before.
+class VideoJob {
+public:
+    VideoJob() = default;
+    ~VideoJob();
+
+    VideoJob(const VideoJob&) = delete;
+    VideoJob& operator=(const VideoJob&) = delete;
+
+    // Start transcoding a video file with OpenCV's default codec for the
+    // output container, or as an animated GIF/APNG when the output path
+    // ends in .gif/.png/.apng (palettes of up to 256 colors). Returns false
+    // if either file cannot be opened.
+    bool start(const std::string& inputPath, const std::string& outputPath,
+               const Parameters& params, int workers = 0, const TemporalOptions& temporal = {});
+
+    // Start with a caller-provided source and sink. totalFrames may be 0
+    // when the length is unknown.
+    bool start(FrameSource source, FrameSink sink, const Parameters& params,
+               int totalFrames = 0, int workers = 0, const TemporalOptions& temporal = {});
+
+    void cancel();
+    void wait();
+
+    bool isRunning() const { return running.load(); }
+    bool wasCancelled() const { return cancelled.load(); }
+    bool failed() const;
+    std::string error() const;
+
+    int framesDone() const { return done.load(); }
+    int totalFrames() const { return total.load(); }
+    float progress() const;
+
+    // Share of tiles re-dithered so far in temporal mode (1 otherwise)
+    float dirtyRatio() const;
+
+private:
+    struct Pipeline;
+
+    void fail(const std::string& message);
+
+    std::shared_ptr<Pipeline> pipeline;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running{false};
+    std::atomic<bool> cancelled{false};
+    std::atomic<int> done{0};
+    std::atomic<int> total{0};
+    std::atomic<long long> tilesDirty{0};
+    std::atomic<long long> tilesSeen{0};
+
+    mutable std::mutex errorMutex;
+    std::string errorMessage;
+};
+
+} // namespace Dithering
@@ -0,0 +1,28 @@
+#pragma once
+
+// Minimal checks shared by the test executables. A failed CHECK prints its
+// location and is counted; main returns testResult() for ctest.
+
+#include <iostream>
+
+namespace Test {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline int testResult() {
+    if (failures() > 0) std::cerr << failures() << " check(s) failed\n";
+    return failures() > 0 ? 1 : 0;
+}
+
+} // namespace Test
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+            ++Test::failures();                                                             \
+        }                                                                                   \
+    } while (0)
@@ -0,0 +1,32 @@
+#pragma once
+
+// Deterministic inputs shared by the image tests
+
+#include <opencv2/opencv.hpp>
+#include <random>
+
+namespace Test {
+
+// Smooth color ramps under fine noise, so flat areas, edges and busy
+// texture all reach the dithering kernels
+inline cv::Mat testImage(int width, int height, unsigned seed = 7) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> noise(-24, 24);
+    cv::Mat image(height, width, CV_8UC3);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int ramp[3] = {x * 255 / std::max(1, width - 1), y * 255 / std::max(1, height - 1),
+                           (x + y) * 255 / std::max(1, width + height - 2)};
+            for (int c = 0; c < 3; ++c) {
+                image.at<cv::Vec3b>(y, x)[c] = cv::saturate_cast<uchar>(ramp[c] + noise(rng));
+            }
+        }
+    }
+    return image;
+}
+
+inline bool identical(const cv::Mat& a, const cv::Mat& b) {
+    return a.size() == b.size() && a.type() == b.type() && cv::norm(a, b, cv::NORM_INF) == 0;
+}
+
+} // namespace Test
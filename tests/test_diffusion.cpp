@@ -0,0 +1,121 @@
+// Fixed-point against float error diffusion, and threaded against serial
+
+#include "check.h"
+#include "images.h"
+#include "dithering.h"
+#include <cstdlib>
+
+using namespace Dithering;
+
+namespace {
+
+const Algorithm kernels[] = {
+    Algorithm::FLOYD_STEINBERG, Algorithm::ATKINSON, Algorithm::JARVIS_JUDICE_NINKE, Algorithm::STUCKI,
+    Algorithm::BURKES, Algorithm::SIERRA, Algorithm::SIERRA_TWO_ROW, Algorithm::SIERRA_LITE,
+    Algorithm::FAN, Algorithm::SHIAU_FAN, Algorithm::STEVENPIGEON};
+
+const PaletteMode palettes[] = {PaletteMode::MONOCHROME, PaletteMode::GRAYSCALE_4, PaletteMode::CGA,
+                                PaletteMode::PICO8};
+
+// Mean absolute difference of the 16x16 block averages of two images, in
+// levels; the bound dither-bench --verify applies
+double blockDifference(const cv::Mat& a, const cv::Mat& b) {
+    const int block = 16;
+    double total = 0.0;
+    long long blocks = 0;
+    for (int by = 0; by + block <= a.rows; by += block) {
+        for (int bx = 0; bx + block <= a.cols; bx += block) {
+            int sums[2][3] = {};
+            for (int y = by; y < by + block; ++y) {
+                for (int x = bx; x < bx + block; ++x) {
+                    for (int c = 0; c < 3; ++c) {
+                        sums[0][c] += a.at<cv::Vec3b>(y, x)[c];
+                        sums[1][c] += b.at<cv::Vec3b>(y, x)[c];
+                    }
+                }
+            }
+            for (int c = 0; c < 3; ++c) total += std::abs(sums[0][c] - sums[1][c]) / double(block * block);
+            blocks += 3;
+        }
+    }
+    return blocks > 0 ? total / blocks : 0.0;
+}
+
+cv::Mat dither(const cv::Mat& image, Parameters params, DiffusionPrecision precision) {
+    params.precision = precision;
+    return ditherImage(image, params);
+}
+
+} // namespace
+
+int main() {
+    const cv::Mat image = Test::testImage(256, 192);
+
+    for (Algorithm algorithm : kernels) {
+        for (PaletteMode palette : palettes) {
+            Parameters params;
+            params.algorithm = algorithm;
+            params.paletteMode = palette;
+            params.precision = DiffusionPrecision::FIXED;
+
+            const cv::Mat reference = dither(image, params, DiffusionPrecision::FLOAT);
+            const cv::Mat fixed = dither(image, params, DiffusionPrecision::FIXED);
+            if (usesFixedPoint(params)) {
+                // Pixels move, the tone does not
+                CHECK(blockDifference(fixed, reference) <= 4.0);
+            } else {
+                // Kernels without power-of-two weights ignore the request
+                CHECK(Test::identical(fixed, reference));
+            }
+
+            // Out-of-range strength and perceptual matching fall back to float
+            Parameters strong = params;
+            strong.strength = 2.5f;
+            CHECK(!usesFixedPoint(strong));
+            CHECK(Test::identical(dither(image, strong, DiffusionPrecision::FIXED),
+                                  dither(image, strong, DiffusionPrecision::FLOAT)));
+            if (palette == PaletteMode::CGA) {
+                Parameters perceptual = params;
+                perceptual.colorMetric = ColorMetric::OKLAB;
+                CHECK(!usesFixedPoint(perceptual));
+                CHECK(Test::identical(dither(image, perceptual, DiffusionPrecision::FIXED),
+                                      dither(image, perceptual, DiffusionPrecision::FLOAT)));
+            }
+        }
+    }
+
+    // The power-of-two kernels must actually take the int16 path
+    for (Algorithm algorithm : {Algorithm::FLOYD_STEINBERG, Algorithm::ATKINSON, Algorithm::SIERRA_LITE}) {
+        Parameters params;
+        params.algorithm = algorithm;
+        params.precision = DiffusionPrecision::FIXED;
+        CHECK(usesFixedPoint(params));
+    }
+
+    // The row wavefront matches a serial scan exactly, in both precisions
+    for (Algorithm algorithm : kernels) {
+        for (DiffusionPrecision precision : {DiffusionPrecision::FLOAT, DiffusionPrecision::FIXED}) {
+            Parameters params;
+            params.algorithm = algorithm;
+            params.paletteMode = PaletteMode::CGA;
+            params.serpentine = 0.0f;
+            params.threads = 1;
+            const cv::Mat serial = dither(image, params, precision);
+            params.threads = 4;
+            CHECK(Test::identical(dither(image, params, precision), serial));
+        }
+    }
+
+    // Ostromoukhov scans serpentine unless told not to, and then threads
+    Parameters ostromoukhov;
+    ostromoukhov.algorithm = Algorithm::OSTROMOUKHOV;
+    const cv::Mat serpentine = ditherImage(image, ostromoukhov);
+    ostromoukhov.serpentine = 0.0f;
+    const cv::Mat raster = ditherImage(image, ostromoukhov);
+    CHECK(!Test::identical(raster, serpentine));
+    ostromoukhov.threads = 4;
+    CHECK(effectiveThreadCount(ostromoukhov, image.rows) == 4);
+    CHECK(Test::identical(ditherImage(image, ostromoukhov), raster));
+
+    return Test::testResult();
+}
@@ -0,0 +1,102 @@
+// Round trips of the GIF LZW encoder through a strict decoder
+
+#include "check.h"
+#include "gifcodec.h"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace {
+
+// Decodes like giflib: codes widen as soon as the table fills the current
+// size, and anything after the end code other than the final byte's padding,
+// a code beyond the table or a missing end code is an error
+bool lzwDecode(const std::vector<uint8_t>& stream, int minCodeSize, std::vector<uint8_t>& out) {
+    const int clearCode = 1 << minCodeSize;
+    const int endCode = clearCode + 1;
+    std::vector<std::vector<uint8_t>> table;
+    auto reset = [&] {
+        table.assign(clearCode + 2, {});
+        for (int i = 0; i < clearCode; ++i) table[i] = {static_cast<uint8_t>(i)};
+    };
+    reset();
+
+    int codeSize = minCodeSize + 1;
+    int previous = -1;
+    size_t bitPosition = 0;
+    const size_t totalBits = stream.size() * 8;
+
+    while (bitPosition + codeSize <= totalBits) {
+        int code = 0;
+        for (int bit = 0; bit < codeSize; ++bit, ++bitPosition) {
+            code |= ((stream[bitPosition / 8] >> (bitPosition % 8)) & 1) << bit;
+        }
+
+        if (code == clearCode) {
+            reset();
+            codeSize = minCodeSize + 1;
+            previous = -1;
+            continue;
+        }
+        if (code == endCode) {
+            // Only padding may follow, within the last byte
+            return stream.size() * 8 - bitPosition < 8;
+        }
+
+        const int nextCode = static_cast<int>(table.size());
+        std::vector<uint8_t> entry;
+        if (code < nextCode && (code >= clearCode + 2 || code < clearCode)) {
+            entry = table[code];
+        } else if (code == nextCode && previous >= 0) {
+            entry = table[previous];
+            entry.push_back(table[previous][0]);
+        } else {
+            return false;
+        }
+        out.insert(out.end(), entry.begin(), entry.end());
+
+        if (previous >= 0 && nextCode < 4096) {
+            std::vector<uint8_t> added = table[previous];
+            added.push_back(entry[0]);
+            table.push_back(std::move(added));
+            if (static_cast<int>(table.size()) == (1 << codeSize) && codeSize < 12) ++codeSize;
+        }
+        previous = code;
+    }
+    return false;   // No end code
+}
+
+bool roundTrips(const std::vector<uint8_t>& pixels, int minCodeSize) {
+    std::vector<uint8_t> stream;
+    Dithering::lzwEncode(pixels.data(), pixels.size(), minCodeSize, stream);
+    std::vector<uint8_t> decoded;
+    return lzwDecode(stream, minCodeSize, decoded) && decoded == pixels;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 rng(1234);
+
+    // Every small size, which puts the last code at each point of the table
+    for (int bits : {1, 2, 4, 8}) {
+        const int minCodeSize = std::max(2, bits);
+        std::uniform_int_distribution<int> index(0, (1 << bits) - 1);
+        for (size_t count = 0; count < 400; ++count) {
+            std::vector<uint8_t> pixels(count);
+            for (auto& pixel : pixels) pixel = static_cast<uint8_t>(index(rng));
+            CHECK(roundTrips(pixels, minCodeSize));
+        }
+    }
+
+    // Long inputs that fill the dictionary and start it over, random and flat
+    for (size_t count : {size_t(4093), size_t(20011), size_t(100003)}) {
+        std::uniform_int_distribution<int> index(0, 255);
+        std::vector<uint8_t> pixels(count);
+        for (auto& pixel : pixels) pixel = static_cast<uint8_t>(index(rng));
+        CHECK(roundTrips(pixels, 8));
+        CHECK(roundTrips(std::vector<uint8_t>(count, 3), 2));
+    }
+
+    return Test::testResult();
+}
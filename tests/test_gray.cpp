@@ -0,0 +1,60 @@
+// Gray palettes: every kernel reduces color input to the same luminance
+
+#include "check.h"
+#include "images.h"
+#include "dithering.h"
+#include <cmath>
+
+using namespace Dithering;
+
+namespace {
+
+// BT.601 luminance as the kernels compute it, repeated in all three channels
+cv::Mat luminanceImage(const cv::Mat& image) {
+    cv::Mat gray(image.size(), CV_8UC3);
+    for (int y = 0; y < image.rows; ++y) {
+        for (int x = 0; x < image.cols; ++x) {
+            const cv::Vec3b& p = image.at<cv::Vec3b>(y, x);
+            const uchar level = static_cast<uchar>((p[0] * 1868 + p[1] * 9617 + p[2] * 4899 + 8192) >> 14);
+            gray.at<cv::Vec3b>(y, x) = cv::Vec3b(level, level, level);
+        }
+    }
+    return gray;
+}
+
+} // namespace
+
+int main() {
+    // A color and its luminance dither identically under every algorithm
+    const cv::Mat image = Test::testImage(120, 90);
+    const cv::Mat gray = luminanceImage(image);
+    for (int a = 0; a <= static_cast<int>(Algorithm::STEVENPIGEON); ++a) {
+        for (PaletteMode palette : {PaletteMode::MONOCHROME, PaletteMode::GRAYSCALE_4}) {
+            Parameters params;
+            params.algorithm = static_cast<Algorithm>(a);
+            params.paletteMode = palette;
+            const bool same = Test::identical(ditherImage(image, params), ditherImage(gray, params));
+            if (!same) std::cerr << getAlgorithmName(params.algorithm) << ": ";
+            CHECK(same);
+        }
+    }
+
+    // On a flat color patch, Bayer and Floyd-Steinberg settle on the same
+    // tone: the patch's luminance (green-heavy, far from the channel mean)
+    const cv::Vec3b color(40, 200, 90);
+    const double level = (color[0] * 1868 + color[1] * 9617 + color[2] * 4899 + 8192) >> 14;
+    const cv::Mat patch(64, 64, CV_8UC3, cv::Scalar(color[0], color[1], color[2]));
+    double tones[2];
+    int i = 0;
+    for (Algorithm algorithm : {Algorithm::ORDERED_BAYER_8X8, Algorithm::FLOYD_STEINBERG}) {
+        Parameters params;
+        params.algorithm = algorithm;
+        params.paletteMode = PaletteMode::MONOCHROME;
+        tones[i++] = cv::mean(ditherImage(patch, params))[0];
+    }
+    CHECK(std::abs(tones[0] - level) < 4.0);
+    CHECK(std::abs(tones[1] - level) < 4.0);
+    CHECK(std::abs(tones[0] - tones[1]) < 4.0);
+
+    return Test::testResult();
+}
@@ -0,0 +1,78 @@
+// Counter-based noise: fixed values, independence from traversal order
+
+#include "check.h"
+#include "images.h"
+#include "dithering.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace Dithering;
+
+int main() {
+    // Pinned outputs: a changed hash changes every noise dither for a given
+    // seed, and must stay in step with the OpenCL kernel
+    CHECK(noiseHash(42, 0, 0) == 0x172733c2u);
+    CHECK(noiseHash(42, 17, 5) == 0xd9564adcu);
+    CHECK(noiseHash(42, 17, 5, 3) == 0xa41c35b7u);
+    CHECK(noiseHash(7, -3, 1000) == 0x7a7dfc4bu);
+
+    // Uniform in [0, 1), and different per seed and frame
+    double sum = 0.0;
+    int sameSeed = 0, sameFrame = 0;
+    for (int y = 0; y < 256; ++y) {
+        for (int x = 0; x < 256; ++x) {
+            const uint32_t bits = noiseHash(42, x, y);
+            const float unit = noiseUnit(bits);
+            CHECK(unit >= 0.0f && unit < 1.0f);
+            sum += unit;
+            sameSeed += bits == noiseHash(43, x, y);
+            sameFrame += bits == noiseHash(42, x, y, 1);
+        }
+    }
+    CHECK(std::abs(sum / 65536.0 - 0.5) < 0.01);
+    CHECK(sameSeed < 4);
+    CHECK(sameFrame < 4);
+
+    const cv::Mat image = Test::testImage(203, 151);
+    Workspace workspace;
+
+    // Pointwise noise: uneven tiles, dithered in any order, rebuild the whole image
+    for (Algorithm algorithm : {Algorithm::WHITE_NOISE, Algorithm::RANDOM_DITHER}) {
+        for (PaletteMode palette : {PaletteMode::MONOCHROME, PaletteMode::EGA}) {
+            Parameters params;
+            params.algorithm = algorithm;
+            params.paletteMode = palette;
+            params.frame = 5;
+            const cv::Mat whole = ditherImage(image, params);
+
+            cv::Mat tiled(image.rows, image.cols, CV_8UC3, cv::Scalar::all(0));
+            for (int y = image.rows; y > 0; y -= 23) {
+                for (int x = 0; x < image.cols; x += 37) {
+                    const int top = std::max(0, y - 23);
+                    ditherRegion(image, tiled, cv::Rect(x, top, std::min(37, image.cols - x), y - top), params,
+                                 workspace);
+                }
+            }
+            CHECK(Test::identical(tiled, whole));
+
+            params.threads = 4;
+            CHECK(Test::identical(ditherImage(image, params), whole));
+            params.frame = 6;
+            CHECK(!Test::identical(ditherImage(image, params), whole));
+        }
+    }
+
+    // Variable error diffusion: repeatable, threaded equals serial, frames differ
+    Parameters params;
+    params.algorithm = Algorithm::VARIABLE_ERROR_DIFFUSION;
+    params.paletteMode = PaletteMode::CGA;
+    params.serpentine = 0.0f;
+    const cv::Mat serial = ditherImage(image, params);
+    CHECK(Test::identical(ditherImage(image, params), serial));
+    params.threads = 4;
+    CHECK(Test::identical(ditherImage(image, params), serial));
+    params.frame = 1;
+    CHECK(!Test::identical(ditherImage(image, params), serial));
+
+    return Test::testResult();
+}
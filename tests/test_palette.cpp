@@ -0,0 +1,62 @@
+// PaletteMatcher against the brute-force findClosestColor
+
+#include "check.h"
+#include "dithering.h"
+#include <random>
+#include <vector>
+
+using namespace Dithering;
+
+namespace {
+
+// Count of sampled colors where the matcher and the linear scan disagree
+int mismatches(const std::vector<cv::Vec3b>& palette, std::mt19937& rng) {
+    PaletteMatcher matcher(palette);
+    int count = 0;
+    auto compare = [&](const cv::Vec3b& color) {
+        if (matcher.findClosest(color) != findClosestColor(color, palette)) ++count;
+    };
+
+    // A lattice through every 32-cube cell, including both edges of each
+    for (int b = 0; b < 256; b += 5) {
+        for (int g = 0; g < 256; g += 5) {
+            for (int r = 0; r < 256; r += 5) compare(cv::Vec3b(b, g, r));
+        }
+    }
+    std::uniform_int_distribution<int> channel(0, 255);
+    for (int i = 0; i < 50000; ++i) compare(cv::Vec3b(channel(rng), channel(rng), channel(rng)));
+
+    // Palette colors themselves and their neighbours, where ties are likely
+    for (const cv::Vec3b& entry : palette) {
+        for (int d = -2; d <= 2; ++d) {
+            compare(cv::Vec3b(cv::saturate_cast<uchar>(entry[0] + d), cv::saturate_cast<uchar>(entry[1] - d),
+                              cv::saturate_cast<uchar>(entry[2] + d)));
+        }
+    }
+    return count;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 rng(99);
+
+    for (int mode = 0; mode < static_cast<int>(PaletteMode::CUSTOM); ++mode) {
+        const std::vector<cv::Vec3b> palette = getPalette(static_cast<PaletteMode>(mode));
+        const int failed = mismatches(palette, rng);
+        if (failed) std::cerr << getPaletteModeName(static_cast<PaletteMode>(mode)) << ": ";
+        CHECK(failed == 0);
+    }
+
+    // Random custom palettes, including duplicate entries that must tie-break
+    // to the first one
+    std::uniform_int_distribution<int> channel(0, 255);
+    for (size_t size : {size_t(1), size_t(3), size_t(17), size_t(256)}) {
+        std::vector<cv::Vec3b> palette(size);
+        for (auto& entry : palette) entry = cv::Vec3b(channel(rng), channel(rng), channel(rng));
+        if (size > 2) palette[size - 1] = palette[0];
+        CHECK(mismatches(palette, rng) == 0);
+    }
+
+    return Test::testResult();
+}
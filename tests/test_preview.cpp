@@ -0,0 +1,49 @@
+// Preview views: only exact canvases are reported complete
+
+#include "check.h"
+#include "images.h"
+#include "preview.h"
+#include <chrono>
+#include <thread>
+
+using namespace Dithering;
+
+namespace {
+
+// Wait for the final pass of request generation
+bool waitFor(PreviewRenderer& renderer, uint64_t generation, PreviewResult& result) {
+    for (int i = 0; i < 2000; ++i) {
+        if (renderer.poll(result) && result.generation == generation && result.final) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+} // namespace
+
+int main() {
+    const cv::Mat image = Test::testImage(600, 520);
+    const PreviewView zoomed{cv::Rect2f(0.1f, 0.1f, 0.6f, 0.6f), cv::Size(1000, 1000)};
+    const PreviewView whole{cv::Rect2f(0.0f, 0.0f, 1.0f, 1.0f), cv::Size(1000, 1000)};
+
+    for (Algorithm algorithm : {Algorithm::FLOYD_STEINBERG, Algorithm::ORDERED_BAYER_8X8}) {
+        Parameters params;
+        params.algorithm = algorithm;
+        params.paletteMode = PaletteMode::CGA;
+        const cv::Mat expected = ditherImage(image, params);
+
+        // Tiles over most of the image, then the rest by panning, then all of it
+        PreviewRenderer renderer(512 * 512, 0);
+        PreviewResult result;
+        CHECK(waitFor(renderer, renderer.request(image, params, zoomed), result));
+        CHECK(!result.complete);
+        CHECK(waitFor(renderer, renderer.setView({cv::Rect2f(0.4f, 0.4f, 0.6f, 0.6f), zoomed.display}), result));
+        CHECK(waitFor(renderer, renderer.setView({cv::Rect2f(0.0f, 0.4f, 0.6f, 0.6f), zoomed.display}), result));
+        CHECK(waitFor(renderer, renderer.setView({cv::Rect2f(0.4f, 0.0f, 0.6f, 0.6f), zoomed.display}), result));
+        CHECK(waitFor(renderer, renderer.setView(whole), result));
+        CHECK(result.complete);
+        CHECK(Test::identical(result.image, expected));
+    }
+
+    return Test::testResult();
+}
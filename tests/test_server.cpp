@@ -0,0 +1,48 @@
+// Server requests stay within the pool whatever they ask for
+
+#include "check.h"
+#include "server.h"
+#include <string>
+
+using namespace Dithering;
+
+int main() {
+    ServerOptions options;
+    options.jobs = 2;
+    options.defaults.threads = 8;
+    options.defaults.serpentine = 0.0f;     // So diffusion could split across threads
+    options.setParameter = [](const std::string& key, const std::string& value, Parameters& params,
+                              std::string& error) {
+        if (key == "threads") {
+            params.threads = std::stoi(value);
+            return true;
+        }
+        error = "Unknown parameter: " + key;
+        return false;
+    };
+
+    const int openCvThreads = cv::getNumThreads();
+    {
+        DitherServer server(options);
+        CHECK(cv::getNumThreads() == 1);
+
+        Parameters params;
+        std::string format, error;
+        for (const char* header : {"{\"threads\": 0}", "{\"threads\": 256}", ""}) {
+            CHECK(server.requestParameters(header, params, format, error));
+            CHECK(params.threads == 1);
+            CHECK(effectiveThreadCount(params, 4096) == 1);
+            CHECK(format == "png");
+        }
+
+        CHECK(server.requestParameters("{\"threads\": 0, \"format\": \"BMP\"}", params, format, error));
+        CHECK(format == "bmp");
+        CHECK(!server.requestParameters("{\"strength\": 2}", params, format, error));
+        CHECK(error == "Unknown parameter: strength");
+        CHECK(!server.requestParameters("[1]", params, format, error));
+        CHECK(!server.requestParameters("{\"format\": \"../x\"}", params, format, error));
+    }
+    CHECK(cv::getNumThreads() == openCvThreads);
+
+    return Test::testResult();
+}
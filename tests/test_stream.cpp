@@ -0,0 +1,92 @@
+// Strip streaming against dithering the whole image at once
+
+#include "check.h"
+#include "images.h"
+#include "dithering.h"
+#include "stream.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+using namespace Dithering;
+
+namespace {
+
+// Feeds image to a StripDitherer in strips of stripRows and joins the output
+cv::Mat ditherInStrips(const cv::Mat& image, const Parameters& params, int stripRows) {
+    StripDitherer ditherer(image.cols, image.rows, params);
+    cv::Mat result(image.rows, image.cols, CV_8UC3);
+    cv::Mat output;
+    for (int row = 0; row < image.rows; row += stripRows) {
+        const int rows = std::min(stripRows, image.rows - row);
+        ditherer.process(image.rowRange(row, row + rows), output);
+        output.copyTo(result.rowRange(row, row + rows));
+    }
+    return result;
+}
+
+} // namespace
+
+int main() {
+    const cv::Mat image = Test::testImage(97, 131);
+    cv::Mat gray;
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+
+    for (int a = 0; a <= static_cast<int>(Algorithm::STEVENPIGEON); ++a) {
+        const Algorithm algorithm = static_cast<Algorithm>(a);
+        for (PaletteMode palette : {PaletteMode::MONOCHROME, PaletteMode::CGA}) {
+            Parameters params;
+            params.algorithm = algorithm;
+            params.paletteMode = palette;
+            params.frame = 2;
+            if (palette == PaletteMode::CGA) params.contrast = 1.2f;   // Strips preprocess too
+            const cv::Mat whole = ditherImage(image, params);
+
+            if (StripDitherer::supports(algorithm)) {
+                for (int stripRows : {1, 7, 64, image.rows}) {
+                    const bool same = Test::identical(ditherInStrips(image, params, stripRows), whole);
+                    if (!same) std::cerr << getAlgorithmName(algorithm) << ", " << stripRows << " rows: ";
+                    CHECK(same);
+                }
+                CHECK(Test::identical(ditherInStrips(gray, params, 10), ditherImage(gray, params)));
+            }
+
+            // Through the row source and sink, which fall back to the whole
+            // image for what StripDitherer cannot stream
+            MatRowSource source(image);
+            MatRowSink sink;
+            CHECK(ditherStream(source, sink, params, 13));
+            const bool same = Test::identical(sink.result(), whole);
+            if (!same) std::cerr << getAlgorithmName(algorithm) << " via ditherStream: ";
+            CHECK(same);
+        }
+    }
+
+    // A file written strip by strip reads back unchanged
+    Parameters params;
+    params.paletteMode = PaletteMode::PICO8;
+    const cv::Mat expected = ditherImage(image, params);
+    for (const char* extension : {".png", ".tif"}) {
+        const std::string path =
+            (std::filesystem::temp_directory_path() / ("dither_test_stream" + std::string(extension))).string();
+        {
+            MatRowSource source(image);
+            std::unique_ptr<RowSink> sink = createRowSink(path);
+            CHECK(sink && ditherStream(source, *sink, params, 16));
+        }
+        std::unique_ptr<RowSource> reader = openRowSource(path);
+        CHECK(reader && reader->width() == image.cols && reader->height() == image.rows);
+        if (reader) {
+            cv::Mat readBack(image.rows, image.cols, CV_8UC3);
+            for (int row = 0; row < image.rows; row += 16) {
+                cv::Mat strip(std::min(16, image.rows - row), image.cols, CV_8UC3);
+                CHECK(reader->read(strip));
+                strip.copyTo(readBack.rowRange(row, row + strip.rows));
+            }
+            CHECK(Test::identical(readBack, expected));
+        }
+        std::remove(path.c_str());
+    }
+
+    return Test::testResult();
+}
@@ -0,0 +1,74 @@
+// Sweep captions tell every swept value apart
+
+#include "check.h"
+#include "sweep.h"
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace Dithering;
+
+int main() {
+    // One setter per key --sweep accepts (setNamedParameter in cli.cpp),
+    // each taking three values
+    struct Key {
+        const char* name;
+        std::function<void(int, Parameters&)> apply;
+    };
+    const std::vector<Key> keys = {
+        {"algorithm", [](int i, Parameters& p) {
+             const Algorithm values[] = {Algorithm::FLOYD_STEINBERG, Algorithm::ATKINSON, Algorithm::RIEMERSMA};
+             p.algorithm = values[i];
+         }},
+        {"palette", [](int i, Parameters& p) {
+             const PaletteMode values[] = {PaletteMode::MONOCHROME, PaletteMode::CGA, PaletteMode::PICO8};
+             p.paletteMode = values[i];
+         }},
+        {"match", [](int i, Parameters& p) {
+             const ColorMetric values[] = {ColorMetric::BGR, ColorMetric::OKLAB, ColorMetric::CIELAB};
+             p.colorMetric = values[i];
+         }},
+        {"backend", [](int i, Parameters& p) { p.backend = i == 1 ? Backend::OPENCL : Backend::CPU; }},
+        {"strength", [](int i, Parameters& p) { p.strength = 0.5f + 0.25f * i; }},
+        {"gamma", [](int i, Parameters& p) { p.gamma = 0.8f + 0.2f * i; }},
+        {"contrast", [](int i, Parameters& p) { p.contrast = 0.8f + 0.2f * i; }},
+        {"brightness", [](int i, Parameters& p) { p.brightness = -0.1f + 0.1f * i; }},
+        {"saturation", [](int i, Parameters& p) { p.saturation = 0.5f + 0.5f * i; }},
+        {"seed", [](int i, Parameters& p) { p.seed = 41 + i; }},
+        {"frame", [](int i, Parameters& p) { p.frame = i; }},
+        {"threads", [](int i, Parameters& p) { p.threads = i; }},
+        {"serpentine", [](int i, Parameters& p) { p.serpentine = i == 1 ? 0.0f : 1.0f; }},
+        {"fixed-point", [](int i, Parameters& p) {
+             p.precision = i == 1 ? DiffusionPrecision::FIXED : DiffusionPrecision::FLOAT;
+         }},
+    };
+
+    const Parameters base;
+    for (const Key& key : keys) {
+        // Two-valued keys sweep both values; the rest sweep three. Either way
+        // one value may equal the base and fall back to the default caption.
+        const int count = (key.name == std::string("backend") || key.name == std::string("serpentine") ||
+                           key.name == std::string("fixed-point")) ? 2 : 3;
+        SweepAxis axis;
+        axis.count = count;
+        axis.apply = key.apply;
+
+        std::set<std::string> captions;
+        for (const Parameters& variant : sweepVariants(base, {axis})) captions.insert(describeVariant(variant, base));
+        const bool distinct = static_cast<int>(captions.size()) == count;
+        if (!distinct) std::cerr << key.name << ": ";
+        CHECK(distinct);
+    }
+
+    // Two axes at once: every cell still has a caption of its own
+    SweepAxis seeds{3, [](int i, Parameters& p) { p.seed = 100 + i; }};
+    SweepAxis serpentine{2, [](int i, Parameters& p) { p.serpentine = i ? 1.0f : 0.0f; }};
+    std::set<std::string> captions;
+    for (const Parameters& variant : sweepVariants(base, {seeds, serpentine})) {
+        captions.insert(describeVariant(variant, base));
+    }
+    CHECK(captions.size() == 6);
+
+    return Test::testResult();
+}